@@ -0,0 +1,63 @@
+#include "pch.h"
+#include "Terrain.h"
+
+// Bakes the visible sets of the terrain in a setup file, ../Data/setup.txt unless another is named.  Tracing every pair
+// of cells takes far longer than a start should, so the engine only maps sets that were baked ahead of time.  The build
+// runs this after linking it, and sets that already match the terrain are kept so only a changed terrain is baked again.
+int main(int argc, char* argv[]) {
+	char defaultFilename[] = "../Data/setup.txt";
+	char* setupFilename = (argc > 1) ? argv[1] : defaultFilename;
+
+	// The bake only traces the heights, the device just holds the cells the terrain builds as it loads.
+	Microsoft::WRL::ComPtr<ID3D11Device> device;
+	D3D_FEATURE_LEVEL featureLevel = D3D_FEATURE_LEVEL_11_0;
+
+	HRESULT result = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_WARP, nullptr, 0, &featureLevel, 1, D3D11_SDK_VERSION,
+		device.GetAddressOf(), nullptr, nullptr);
+	if (FAILED(result)) {
+		std::printf("Could not create a device\n");
+		return 1;
+	}
+
+	Terrain* terrain = new Terrain;
+	if (!terrain->Initialize(device.Get(), setupFilename)) {
+		std::printf("Could not load the terrain in %s\n", setupFilename);
+		delete terrain;
+		return 1;
+	}
+
+	// A setup without a visibility file, or an editable or paged terrain, has nothing to bake.
+	if (!terrain->GetVisibilityFilename()) {
+		std::printf("The terrain in %s doesn't use visible sets\n", setupFilename);
+		delete terrain;
+		return 0;
+	}
+
+	if (terrain->HasVisibleSets()) {
+		std::printf("The visible sets in %s are up to date\n", terrain->GetVisibilityFilename());
+		delete terrain;
+		return 0;
+	}
+
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER startTime;
+	LARGE_INTEGER endTime;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&startTime);
+
+	bool baked = terrain->BakeVisibleSets();
+
+	QueryPerformanceCounter(&endTime);
+	double bakeTime = static_cast<double>(endTime.QuadPart - startTime.QuadPart) / static_cast<double>(frequency.QuadPart);
+
+	if (baked) {
+		std::printf("Baked the visible sets of %d cells into %s in %.1f s\n", terrain->GetCellCount(), terrain->GetVisibilityFilename(), bakeTime);
+	}
+	else {
+		std::printf("Could not write the visible sets to %s\n", terrain->GetVisibilityFilename());
+	}
+
+	delete terrain;
+
+	return baked ? 0 : 1;
+}
@@ -0,0 +1,552 @@
+#include "pch.h"
+#include "Tests.h"
+#include "TestDevice.h"
+#include "TestFlythrough.h"
+#include "TestTerrain.h"
+#include "Terrain.h"
+#include "TerrainCache.h"
+#include "TerrainSurface.h"
+
+#include <psapi.h>
+#include <thread>
+
+#pragma comment(lib, "psapi.lib")
+
+namespace {
+	// Loads the terrain on a scheduler limited to the given number of threads and returns how long it took, or a
+	// negative time if it failed.
+	double BuildTerrain(TestDevice& device, TestTerrain& testTerrain, unsigned int threadCount) {
+		concurrency::SchedulerPolicy policy(2, concurrency::MinConcurrency, 1, concurrency::MaxConcurrency, threadCount);
+		concurrency::CurrentScheduler::Create(policy);
+
+		double startTime = TestHarness::GetTime();
+
+		Terrain* terrain = new Terrain;
+		bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+
+		double time = TestHarness::GetTime() - startTime;
+
+		delete terrain;
+		concurrency::CurrentScheduler::Detach();
+
+		return result ? time : -1.0;
+	}
+
+	bool ReadWholeFile(const char* filename, std::string& contents) {
+		std::ifstream fin(filename, std::ios::binary);
+		if (fin.fail()) {
+			return false;
+		}
+
+		contents.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+
+		return true;
+	}
+
+	bool WriteWholeFile(const char* filename, const std::string& contents) {
+		std::ofstream fout(filename, std::ios::binary);
+		if (fout.fail()) {
+			return false;
+		}
+
+		fout.write(contents.data(), contents.size());
+		fout.close();
+
+		return !fout.fail();
+	}
+
+	// Small deterministic generator so every load is sampled at the same points.
+	float GetRandom(unsigned int& state) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+
+		return static_cast<float>(state >> 8) / 16777216.0f;
+	}
+
+	// Loads the terrain and keeps everything the cache stands in for as bytes, so two loads can be compared exactly:
+	// the bounds, decode and level of detail errors of every cell and the heights at a spread of points.
+	bool LoadTerrain(TestDevice& device, TestTerrain& testTerrain, std::string& contents) {
+		Terrain* terrain = new Terrain;
+		if (!terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename())) {
+			delete terrain;
+			return false;
+		}
+
+		contents.clear();
+
+		for (int cellId = 0; cellId < terrain->GetCellCount(); cellId++) {
+			float bounds[6];
+			terrain->GetCellBounds(cellId, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+
+			contents.append(reinterpret_cast<const char*>(bounds), sizeof(bounds));
+			contents.append(reinterpret_cast<const char*>(&terrain->GetCellDecode(cellId)), sizeof(TerrainMesh::DecodeType));
+			contents.append(reinterpret_cast<const char*>(terrain->GetCellLodErrors(cellId)), terrain->GetLodLevelCount() * sizeof(float));
+		}
+
+		const TestTerrain::SetupType& setup = testTerrain.GetSetup();
+		unsigned int state = 97531;
+
+		for (int k = 0; k < 5000; k++) {
+			float x = GetRandom(state) * static_cast<float>(setup.terrainWidth - 1);
+			float z = GetRandom(state) * static_cast<float>(setup.terrainHeight - 1);
+			float height = 0.0f;
+			bool found = terrain->GetHeightAtPosition(x, z, height);
+
+			contents.append(reinterpret_cast<const char*>(&found), sizeof(found));
+			contents.append(reinterpret_cast<const char*>(&height), sizeof(height));
+		}
+
+		delete terrain;
+
+		return true;
+	}
+
+	size_t GetPeakWorkingSet() {
+		PROCESS_MEMORY_COUNTERS counters = {};
+		counters.cb = sizeof(counters);
+
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+			return 0;
+		}
+
+		return counters.PeakWorkingSetSize;
+	}
+
+	unsigned int GetThreadCount() {
+		return std::max(std::thread::hardware_concurrency(), 2u);
+	}
+}
+
+void TestPeakMemory(TestHarness& harness) {
+	// The peak only ever grows, so this has to run before anything else loads a terrain.  The device and the source
+	// files come first so that what WARP itself takes isn't counted against the terrain.
+	const size_t budgetBytes = 64 * 1024 * 1024;
+
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("peak-memory", TestTerrain::GetShippedSetup()));
+
+	size_t startBytes = GetPeakWorkingSet();
+
+	// Load the shipped terrain from its source files, which is when the most is resident at once.  What it keeps, the
+	// height field, the vertex buffers and surface copies of the cells and the height pyramid, comes to about 53 MB.
+	// Building the cells straight from the height field adds little on top, where the expanded terrain model took
+	// half a gigabyte.
+	Terrain* terrain = new Terrain;
+	TEST_CHECK(harness, terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename()));
+
+	size_t peakBytes = GetPeakWorkingSet() - startBytes;
+	harness.Report("peak working set grew by %.1f MB while loading", static_cast<double>(peakBytes) / (1024.0 * 1024.0));
+
+	TEST_CHECK(harness, startBytes != 0);
+	TEST_CHECK(harness, peakBytes < budgetBytes);
+
+	delete terrain;
+}
+
+void TestParallelBuild(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	// The cache holds every cell's vertices and bounds and the level of detail errors, so a build on one thread and a
+	// build on many have to write the same bytes.  The second size isn't a whole number of cells or bands.
+	TestTerrain::SetupType setups[2] = { TestTerrain::GetSyntheticSetup(257, 33), TestTerrain::GetSyntheticSetup(301, 17) };
+	setups[1].terrainHeight = 203;
+
+	for (const TestTerrain::SetupType& setup : setups) {
+		TestTerrain::SetupType cachedSetup = setup;
+		cachedSetup.cache = true;
+
+		TestTerrain testTerrain;
+		TEST_CHECK(harness, testTerrain.Initialize("parallel-build", cachedSetup));
+
+		TEST_CHECK(harness, BuildTerrain(device, testTerrain, 1) >= 0.0);
+
+		std::string serial;
+		TEST_CHECK(harness, ReadWholeFile(testTerrain.GetCacheFilename(), serial));
+		std::remove(testTerrain.GetCacheFilename());
+
+		TEST_CHECK(harness, BuildTerrain(device, testTerrain, GetThreadCount()) >= 0.0);
+
+		std::string parallel;
+		TEST_CHECK(harness, ReadWholeFile(testTerrain.GetCacheFilename(), parallel));
+
+		TEST_CHECK(harness, !serial.empty());
+		TEST_CHECK(harness, serial == parallel);
+	}
+}
+
+void BenchmarkParallelBuild(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("build-benchmark", TestTerrain::GetShippedSetup()));
+
+	// Time the whole load of the shipped terrain without a cache, best of three at each thread count.
+	const int runCount = 3;
+	double serialTime = 0.0;
+
+	// Double the threads each step and finish on every hardware thread.
+	unsigned int maxThreadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+	for (unsigned int threadCount = 1; threadCount <= maxThreadCount; threadCount = (threadCount < maxThreadCount) ? std::min(threadCount * 2, maxThreadCount) : threadCount + 1) {
+		double bestTime = DBL_MAX;
+
+		for (int run = 0; run < runCount; run++) {
+			double time = BuildTerrain(device, testTerrain, threadCount);
+			TEST_CHECK(harness, time >= 0.0);
+
+			bestTime = std::min(bestTime, time);
+		}
+
+		if (threadCount == 1) {
+			serialTime = bestTime;
+		}
+
+		harness.Report("%2u threads: %7.1f ms, %.2fx", threadCount, bestTime * 1000.0, serialTime / bestTime);
+	}
+}
+
+void TestTerrainCache(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	TestTerrain::SetupType setup = TestTerrain::GetSyntheticSetup(257, 33);
+	setup.terrainHeight = 203;
+	setup.cache = true;
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("terrain-cache", setup));
+
+	// The first load builds the cells from the source files and bakes them, the second maps the cache and has to come
+	// out the same in every detail.
+	std::string built;
+	TEST_CHECK(harness, LoadTerrain(device, testTerrain, built));
+
+	std::string baked;
+	TEST_CHECK(harness, ReadWholeFile(testTerrain.GetCacheFilename(), baked));
+	TEST_CHECK(harness, baked.size() > sizeof(TerrainCache::HeaderType));
+	if (baked.size() <= sizeof(TerrainCache::HeaderType)) {
+		return;
+	}
+
+	std::string cached;
+	TEST_CHECK(harness, LoadTerrain(device, testTerrain, cached));
+	TEST_CHECK(harness, cached == built);
+
+	// Mark the bounds of the first cell in the cache to be sure the load really took them from there.
+	std::string marked = baked;
+	float firstBounds[6];
+	memcpy(firstBounds, &marked[sizeof(TerrainCache::HeaderType)], sizeof(firstBounds));
+	firstBounds[1] += 1000.0f;
+	memcpy(&marked[sizeof(TerrainCache::HeaderType)], firstBounds, sizeof(firstBounds));
+	TEST_CHECK(harness, WriteWholeFile(testTerrain.GetCacheFilename(), marked));
+
+	Terrain* terrain = new Terrain;
+	TEST_CHECK(harness, terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename()));
+
+	float bounds[6];
+	terrain->GetCellBounds(0, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+	TEST_CHECK(harness, bounds[1] == firstBounds[1]);
+
+	delete terrain;
+
+	// A cache cut off part way through the vertices is turned down, and the cells are built and baked again.
+	int cellCount = (((setup.terrainWidth - 2) / (setup.cellWidth - 1)) + 1) * (((setup.terrainHeight - 2) / (setup.cellHeight - 1)) + 1);
+	size_t vertexBytes = static_cast<size_t>(cellCount) * TerrainMesh::GetVertexCount(setup.cellWidth, setup.cellHeight) * sizeof(TerrainMesh::VertexType);
+	TEST_CHECK(harness, WriteWholeFile(testTerrain.GetCacheFilename(), baked.substr(0, baked.size() - (vertexBytes / 2))));
+
+	std::string truncated;
+	TEST_CHECK(harness, LoadTerrain(device, testTerrain, truncated));
+	TEST_CHECK(harness, truncated == built);
+
+	std::string rebaked;
+	TEST_CHECK(harness, ReadWholeFile(testTerrain.GetCacheFilename(), rebaked));
+	TEST_CHECK(harness, rebaked == baked);
+
+	// One byte changed in the height map makes the cache stale.  The terrain has to carry the new height and bake it,
+	// and putting the byte back bakes the first cache again.
+	std::string heightMap;
+	TEST_CHECK(harness, ReadWholeFile(testTerrain.GetHeightMapFilename(), heightMap));
+
+	int changedColumn = 100;
+	int changedRow = 90;
+	size_t changedOffset = ((static_cast<size_t>(changedRow) * setup.terrainWidth) + changedColumn) * sizeof(unsigned short);
+	std::string changedHeightMap = heightMap;
+	changedHeightMap[changedOffset + 1] = static_cast<char>(changedHeightMap[changedOffset + 1] ^ 0x40);
+	TEST_CHECK(harness, WriteWholeFile(testTerrain.GetHeightMapFilename(), changedHeightMap));
+
+	std::string changed;
+	TEST_CHECK(harness, LoadTerrain(device, testTerrain, changed));
+	TEST_CHECK(harness, changed != built);
+
+	std::string changedCache;
+	TEST_CHECK(harness, ReadWholeFile(testTerrain.GetCacheFilename(), changedCache));
+	TEST_CHECK(harness, (changedCache.size() == baked.size()) && (changedCache != baked));
+
+	terrain = new Terrain;
+	TEST_CHECK(harness, terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename()));
+
+	float changedX = static_cast<float>(changedColumn);
+	float changedZ = static_cast<float>(setup.terrainHeight - 1 - changedRow);
+	float changedHeight = 0.0f;
+	bool changedFound = false;
+	terrain->GetHeightsAtPositions(&changedX, &changedZ, 1, &changedHeight, &changedFound);
+
+	float expectedHeight = static_cast<float>(*reinterpret_cast<const unsigned short*>(&changedHeightMap[changedOffset])) / setup.heightScale;
+	TEST_CHECK(harness, changedFound && (fabsf(changedHeight - expectedHeight) < 0.01f));
+
+	delete terrain;
+
+	TEST_CHECK(harness, WriteWholeFile(testTerrain.GetHeightMapFilename(), heightMap));
+
+	std::string restored;
+	TEST_CHECK(harness, LoadTerrain(device, testTerrain, restored));
+	TEST_CHECK(harness, restored == built);
+	TEST_CHECK(harness, ReadWholeFile(testTerrain.GetCacheFilename(), rebaked));
+	TEST_CHECK(harness, rebaked == baked);
+
+	// So does a new height scale over the same source files.
+	setup.heightScale = 250.0f;
+	TEST_CHECK(harness, testTerrain.Initialize("terrain-cache", setup));
+	TEST_CHECK(harness, WriteWholeFile(testTerrain.GetCacheFilename(), baked));
+
+	std::string rescaled;
+	TEST_CHECK(harness, LoadTerrain(device, testTerrain, rescaled));
+	TEST_CHECK(harness, rescaled != built);
+	TEST_CHECK(harness, ReadWholeFile(testTerrain.GetCacheFilename(), rebaked));
+	TEST_CHECK(harness, (rebaked.size() == baked.size()) && (rebaked != baked));
+
+	std::string rescaledCached;
+	TEST_CHECK(harness, LoadTerrain(device, testTerrain, rescaledCached));
+	TEST_CHECK(harness, rescaledCached == rescaled);
+}
+
+void BenchmarkTerrainCache(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	// The shipped terrain loaded from its source files without a cache, then from a cache baked by an earlier load.
+	TestTerrain::SetupType setup = TestTerrain::GetShippedSetup();
+	TestTerrain sourceTerrain;
+	TEST_CHECK(harness, sourceTerrain.Initialize("cache-benchmark-source", setup));
+
+	setup.cache = true;
+	TestTerrain cachedTerrain;
+	TEST_CHECK(harness, cachedTerrain.Initialize("cache-benchmark", setup));
+
+	Terrain* terrain = new Terrain;
+	TEST_CHECK(harness, terrain->Initialize(device.GetDevice(), cachedTerrain.GetSetupFilename()));
+	delete terrain;
+
+	// Best of three of each.
+	const int runCount = 3;
+	double sourceTime = DBL_MAX;
+	double cacheTime = DBL_MAX;
+
+	for (int run = 0; run < runCount; run++) {
+		double startTime = TestHarness::GetTime();
+		terrain = new Terrain;
+		TEST_CHECK(harness, terrain->Initialize(device.GetDevice(), sourceTerrain.GetSetupFilename()));
+		sourceTime = std::min(sourceTime, TestHarness::GetTime() - startTime);
+		delete terrain;
+
+		startTime = TestHarness::GetTime();
+		terrain = new Terrain;
+		TEST_CHECK(harness, terrain->Initialize(device.GetDevice(), cachedTerrain.GetSetupFilename()));
+		cacheTime = std::min(cacheTime, TestHarness::GetTime() - startTime);
+		delete terrain;
+	}
+
+	harness.Report("source load %.1f ms, cache load %.1f ms, %.1fx faster", sourceTime * 1000.0, cacheTime * 1000.0, sourceTime / cacheTime);
+}
+
+void TestPaging(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	// The same terrain loaded whole and paged with a budget too small for the ring around the camera.
+	TestTerrain::SetupType setup = TestTerrain::GetSyntheticSetup(513, 33);
+	TestTerrain::SetupType pagedSetup = setup;
+	pagedSetup.pageRadius = 160.0f;
+	pagedSetup.pageBudget = 1;
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("paging", setup));
+
+	TestTerrain pagedTestTerrain;
+	TEST_CHECK(harness, pagedTestTerrain.Initialize("paging-paged", pagedSetup));
+
+	Terrain* terrain = new Terrain;
+	bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+	TEST_CHECK(harness, result);
+
+	Terrain* pagedTerrain = new Terrain;
+	bool pagedResult = pagedTerrain->Initialize(device.GetDevice(), pagedTestTerrain.GetSetupFilename());
+	TEST_CHECK(harness, pagedResult);
+
+	if (!result || !pagedResult) {
+		delete pagedTerrain;
+		delete terrain;
+		return;
+	}
+
+	// The slots are as many cells as the budget holds, counting the vertex buffer and the surface copy of each.
+	int cellCount = terrain->GetCellCount();
+	int cellCountX = ((setup.terrainWidth - 2) / (setup.cellWidth - 1)) + 1;
+	int slotCount = pagedTerrain->GetSlotCount();
+	unsigned long long cellBytes = static_cast<unsigned long long>(setup.cellWidth * setup.cellHeight) * (sizeof(TerrainMesh::VertexType) + TerrainSurface::VERTEX_SIZE);
+
+	TEST_CHECK(harness, pagedTerrain->GetCellCount() == cellCount);
+	TEST_CHECK(harness, slotCount == static_cast<int>(std::min((1024ull * 1024ull) / cellBytes, static_cast<unsigned long long>(cellCount))));
+	TEST_CHECK(harness, slotCount < cellCount);
+
+	// Fly round the loop and half way round again, so the cells at the start are evicted and then built again.
+	const int frameCount = 240;
+	TestFlythrough flythrough;
+	flythrough.Initialize(terrain, setup.terrainWidth, setup.terrainHeight, frameCount);
+
+	int* cellSlots = new int[cellCount];
+	int* buildCounts = new int[cellCount];
+	int* visibleCells = new int[cellCount];
+	const int quadCount = (setup.cellWidth - 1) * (setup.cellHeight - 1);
+	float* pointX = new float[quadCount * 2];
+	float* pointZ = new float[quadCount * 2];
+	float* heights = new float[quadCount * 2];
+	float* pagedHeights = new float[quadCount * 2];
+	bool* found = new bool[quadCount * 2];
+	bool* pagedFound = new bool[quadCount * 2];
+
+	for (int i = 0; i < cellCount; i++) {
+		cellSlots[i] = -1;
+		buildCounts[i] = 0;
+	}
+
+	int maxResidentCount = 0;
+	int maxBuildCount = 0;
+	int rebuiltCount = 0;
+	bool slotsMatch = true;
+	bool cullMatches = true;
+	bool heightsMatch = true;
+
+	for (int frame = 0; frame < (frameCount * 3) / 2; frame++) {
+		TEST_CHECK(harness, pagedTerrain->PageCells(device.GetDevice(), flythrough.GetPosition(frame)));
+
+		// The cells and the slots have to point at each other, and a cell that was resident in the last frame either
+		// kept its slot or was evicted.
+		int residentCount = 0;
+		int buildCount = 0;
+
+		for (int slot = 0; slot < slotCount; slot++) {
+			int cellId = pagedTerrain->GetSlotCell(slot);
+			slotsMatch = slotsMatch && ((cellId < 0) || (pagedTerrain->GetCellSlot(cellId) == slot));
+		}
+
+		for (int cellId = 0; cellId < cellCount; cellId++) {
+			int slot = pagedTerrain->GetCellSlot(cellId);
+			if (slot < 0) {
+				cellSlots[cellId] = -1;
+				continue;
+			}
+
+			slotsMatch = slotsMatch && (slot < slotCount) && (pagedTerrain->GetSlotCell(slot) == cellId);
+			residentCount++;
+
+			if (cellSlots[cellId] == slot) {
+				continue;
+			}
+
+			slotsMatch = slotsMatch && (cellSlots[cellId] < 0);
+			cellSlots[cellId] = slot;
+			buildCount++;
+
+			if (++buildCounts[cellId] < 2) {
+				continue;
+			}
+
+			// A cell built again after it was evicted has to give the same heights as the terrain loaded whole.  The
+			// points are well inside the two triangles of every quad so they can't land in a neighbour.
+			rebuiltCount++;
+
+			int startColumn = (cellId % cellCountX) * (setup.cellWidth - 1);
+			int startRow = (cellId / cellCountX) * (setup.cellHeight - 1);
+			int pointCount = 0;
+
+			for (int row = startRow; row < std::min(startRow + setup.cellHeight - 1, setup.terrainHeight - 1); row++) {
+				for (int column = startColumn; column < std::min(startColumn + setup.cellWidth - 1, setup.terrainWidth - 1); column++) {
+					for (float fraction : { 0.25f, 0.75f }) {
+						pointX[pointCount] = static_cast<float>(column) + fraction;
+						pointZ[pointCount] = static_cast<float>(setup.terrainHeight - 1 - row) - fraction;
+						pointCount++;
+					}
+				}
+			}
+
+			terrain->GetHeightsAtPositions(pointX, pointZ, pointCount, heights, found);
+			pagedTerrain->GetHeightsAtPositions(pointX, pointZ, pointCount, pagedHeights, pagedFound);
+
+			for (int k = 0; k < pointCount; k++) {
+				heightsMatch = heightsMatch && found[k] && pagedFound[k] && (memcmp(&heights[k], &pagedHeights[k], sizeof(float)) == 0);
+			}
+		}
+
+		maxResidentCount = std::max(maxResidentCount, residentCount);
+		maxBuildCount = std::max(maxBuildCount, buildCount);
+
+		// Culling only hands back the resident cells, in the order the whole terrain has them.
+		Frustum frustum;
+		flythrough.ConstructFrustum(frame, frustum);
+		terrain->CullCells(&frustum);
+		pagedTerrain->CullCells(&frustum);
+
+		int visibleCount = 0;
+		for (int i = 0; i < terrain->GetVisibleCellCount(); i++) {
+			int cellId = terrain->GetVisibleCell(i);
+			if (pagedTerrain->GetCellSlot(cellId) >= 0) {
+				visibleCells[visibleCount++] = cellId;
+			}
+		}
+
+		cullMatches = cullMatches && (pagedTerrain->GetVisibleCellCount() == visibleCount);
+		for (int i = 0; cullMatches && (i < visibleCount); i++) {
+			cullMatches = pagedTerrain->GetVisibleCell(i) == visibleCells[i];
+		}
+	}
+
+	harness.Report("%d slots for %d cells, at most %d resident and %d built in a frame, %d cells built again", slotCount, cellCount, maxResidentCount, maxBuildCount, rebuiltCount);
+
+	TEST_CHECK(harness, slotsMatch);
+	TEST_CHECK(harness, maxResidentCount <= slotCount);
+	TEST_CHECK(harness, maxResidentCount == slotCount);
+	TEST_CHECK(harness, maxBuildCount <= Terrain::MAX_PAGE_BUILDS);
+	TEST_CHECK(harness, rebuiltCount > 0);
+	TEST_CHECK(harness, heightsMatch);
+	TEST_CHECK(harness, cullMatches);
+
+	delete[] pagedFound;
+	delete[] found;
+	delete[] pagedHeights;
+	delete[] heights;
+	delete[] pointZ;
+	delete[] pointX;
+	delete[] visibleCells;
+	delete[] buildCounts;
+	delete[] cellSlots;
+	delete pagedTerrain;
+	delete terrain;
+
+	// A budget bigger than the whole terrain only needs a slot for every cell.
+	pagedSetup.pageBudget = 256;
+	TestTerrain largeTestTerrain;
+	TEST_CHECK(harness, largeTestTerrain.Initialize("paging-large", pagedSetup));
+
+	Terrain* largeTerrain = new Terrain;
+	TEST_CHECK(harness, largeTerrain->Initialize(device.GetDevice(), largeTestTerrain.GetSetupFilename()));
+	TEST_CHECK(harness, largeTerrain->GetSlotCount() == cellCount);
+
+	delete largeTerrain;
+}
@@ -0,0 +1,1282 @@
+#include "pch.h"
+#include "Tests.h"
+#include "TestDevice.h"
+#include "TestFlythrough.h"
+#include "TestTerrain.h"
+#include "Terrain.h"
+#include "TerrainKernels.h"
+#include "TerrainQuadTree.h"
+#include "TerrainVisibility.h"
+
+namespace {
+	// Small deterministic generator so every run tests the same boxes.
+	float GetRandom(unsigned int& state) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+
+		return static_cast<float>(state >> 8) / 16777216.0f;
+	}
+
+	// Boxes scattered over a 1024 square terrain from flat slivers up to a cell across, some squashed to a plane or a
+	// point, so plenty of them straddle the planes of a view from the flythrough.
+	struct BoxesType {
+		float* maxWidths;
+		float* maxHeights;
+		float* maxDepths;
+		float* minWidths;
+		float* minHeights;
+		float* minDepths;
+		int* ids;
+	};
+
+	BoxesType CreateBoxes(int count, unsigned int seed) {
+		BoxesType boxes;
+		boxes.maxWidths = new float[count];
+		boxes.maxHeights = new float[count];
+		boxes.maxDepths = new float[count];
+		boxes.minWidths = new float[count];
+		boxes.minHeights = new float[count];
+		boxes.minDepths = new float[count];
+		boxes.ids = new int[count];
+
+		unsigned int state = seed;
+		for (int k = 0; k < count; k++) {
+			float sizeX = (GetRandom(state) < 0.1f) ? 0.0f : GetRandom(state) * 64.0f;
+			float sizeY = (GetRandom(state) < 0.1f) ? 0.0f : GetRandom(state) * 40.0f;
+			float sizeZ = (GetRandom(state) < 0.1f) ? 0.0f : GetRandom(state) * 64.0f;
+
+			boxes.minWidths[k] = GetRandom(state) * 1024.0f;
+			boxes.minHeights[k] = (GetRandom(state) * 80.0f) - 20.0f;
+			boxes.minDepths[k] = GetRandom(state) * 1024.0f;
+			boxes.maxWidths[k] = boxes.minWidths[k] + sizeX;
+			boxes.maxHeights[k] = boxes.minHeights[k] + sizeY;
+			boxes.maxDepths[k] = boxes.minDepths[k] + sizeZ;
+			boxes.ids[k] = k;
+		}
+
+		return boxes;
+	}
+
+	void DeleteBoxes(BoxesType& boxes) {
+		delete[] boxes.ids;
+		delete[] boxes.minDepths;
+		delete[] boxes.minHeights;
+		delete[] boxes.minWidths;
+		delete[] boxes.maxDepths;
+		delete[] boxes.maxHeights;
+		delete[] boxes.maxWidths;
+	}
+
+	// Pixels a unit high object covers at a distance of one on a 1080 line screen, as the scene works it out.
+	float GetProjectionScale() {
+		return 540.0f / tanf(TestFlythrough::FIELD_OF_VIEW * 0.5f);
+	}
+
+	// A view from high up off one side of the terrain looking down across the middle, so the whole terrain is in the
+	// frustum and spread over a wide range of depths.  The views step round the terrain.
+	void ConstructOverview(int terrainSize, int index, int viewCount, Matrix& viewMatrix, Frustum& frustum) {
+		float size = static_cast<float>(terrainSize - 1);
+		float angle = (static_cast<float>(index) * 2.0f * 3.14159265f) / static_cast<float>(viewCount);
+		DirectX::XMVECTOR eye = DirectX::XMVectorSet((0.5f + cosf(angle)) * size, 0.8f * size, (0.5f + sinf(angle)) * size, 1.0f);
+		DirectX::XMVECTOR target = DirectX::XMVectorSet(0.5f * size, 0.0f, 0.5f * size, 1.0f);
+		DirectX::XMMATRIX view = DirectX::XMMatrixLookAtLH(eye, target, DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		DirectX::XMMATRIX projection = DirectX::XMMatrixPerspectiveFovLH(3.14159265f / 2.0f, 1.0f, 1.0f, 4.0f * size);
+
+		viewMatrix = view;
+		frustum.Initialize(4.0f * size);
+		frustum.ConstructFrustum(projection, view);
+	}
+
+	// View space depth of the middle of the box of a cell, worked out the same way the sort does.
+	float GetCellDepth(const Terrain* terrain, int cellId, const Matrix& viewMatrix) {
+		float bounds[6];
+		terrain->GetCellBounds(cellId, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+
+		float centerX = (bounds[0] + bounds[3]) * 0.5f;
+		float centerY = (bounds[1] + bounds[4]) * 0.5f;
+		float centerZ = (bounds[2] + bounds[5]) * 0.5f;
+
+		return (centerX * viewMatrix._13) + (centerY * viewMatrix._23) + (centerZ * viewMatrix._33) + viewMatrix._43;
+	}
+}
+
+void BenchmarkCellSizes(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	// Smaller cells cull closer to the frustum and coarsen sooner, larger cells take fewer draws and less per cell
+	// overhead.  Load the shipped terrain at each size and fly the same path over it.
+	const int cellSizes[] = { 17, 33, 65, 129 };
+	const int frameCount = 200;
+	const int cullRepeats = 20;
+
+	for (int cellSize : cellSizes) {
+		TestTerrain::SetupType setup = TestTerrain::GetShippedSetup();
+		setup.cellWidth = cellSize;
+		setup.cellHeight = cellSize;
+
+		TestTerrain testTerrain;
+		TEST_CHECK(harness, testTerrain.Initialize("cell-sizes", setup));
+
+		double startTime = TestHarness::GetTime();
+
+		Terrain* terrain = new Terrain;
+		bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+		TEST_CHECK(harness, result);
+
+		double loadTime = TestHarness::GetTime() - startTime;
+
+		if (!result) {
+			delete terrain;
+			continue;
+		}
+
+		// The vertex buffers of every cell and the index buffer of the levels that they all share.
+		int cellCount = terrain->GetCellCount();
+		int levelCount = TerrainMesh::GetLevelCount(cellSize, cellSize);
+		double bufferBytes = (static_cast<double>(cellCount) * TerrainMesh::GetVertexCount(cellSize, cellSize) * sizeof(TerrainMesh::VertexType)) +
+			(static_cast<double>(TerrainMesh::GetIndexStart(cellSize, cellSize, levelCount)) * sizeof(unsigned short));
+
+		terrain->SetLodErrorBudget(8.0f, GetProjectionScale());
+
+		TestFlythrough flythrough;
+		flythrough.Initialize(terrain, setup.terrainWidth, setup.terrainHeight, frameCount);
+
+		double cullTime = 0.0;
+		long long drawCount = 0;
+		long long triangleCount = 0;
+
+		for (int frame = 0; frame < frameCount; frame++) {
+			Frustum frustum;
+			flythrough.ConstructFrustum(frame, frustum);
+
+			// Cull the frame a number of times and keep the fastest, the walk is only microseconds long.
+			double frameTime = DBL_MAX;
+			for (int repeat = 0; repeat < cullRepeats; repeat++) {
+				startTime = TestHarness::GetTime();
+				terrain->CullCells(&frustum);
+				frameTime = std::min(frameTime, TestHarness::GetTime() - startTime);
+			}
+
+			cullTime += frameTime;
+
+			terrain->SelectLod(flythrough.GetPosition(frame));
+
+			for (int k = 0; k < terrain->GetVisibleCellCount(); k++) {
+				triangleCount += terrain->GetCellIndexCount(terrain->GetVisibleCell(k)) / 3;
+			}
+
+			drawCount += terrain->GetVisibleCellCount();
+		}
+
+		harness.Report("%3dx%-3d %5d cells: load %6.1f ms, cull %6.1f us, %6.1f draws, %8.0f triangles, buffers %5.1f MB",
+			cellSize, cellSize, cellCount, loadTime * 1000.0, (cullTime / frameCount) * 1.0e6, static_cast<double>(drawCount) / frameCount,
+			static_cast<double>(triangleCount) / frameCount, bufferBytes / (1024.0 * 1024.0));
+
+		TEST_CHECK(harness, drawCount > 0);
+
+		delete terrain;
+	}
+}
+
+void TestRectangleKernel(TestHarness& harness) {
+	const int boxCount = 4096;
+	const int frameCount = 64;
+	BoxesType boxes = CreateBoxes(boxCount, 2024);
+	int* visible = new int[boxCount];
+
+	// Views round a loop over the terrain, without a terrain under them the eye stays at a fixed height.
+	TestFlythrough flythrough;
+	flythrough.Initialize(nullptr, 1025, 1025, frameCount);
+
+	int testCount = 0;
+	int visibleTotal = 0;
+	int mismatchCount = 0;
+	unsigned int state = 99;
+
+	for (int frame = 0; frame < frameCount; frame++) {
+		Frustum frustum;
+		flythrough.ConstructFrustum(frame, frustum);
+
+		// Runs of every length up to a couple of registers from every alignment, then the whole set, so the vector
+		// loops and the scalar tail after them both see every kind of box.
+		for (int run = 0; run < 64; run++) {
+			int count = (run < 63) ? (run % 21) : boxCount;
+			int first = (run < 63) ? static_cast<int>(GetRandom(state) * static_cast<float>(boxCount - count)) : 0;
+
+			// With every plane the kernel has to keep exactly the boxes CheckRectangle2 keeps.  With fewer it has to
+			// agree with ClassifyRectangle limited to the same planes.
+			int planeMask = ((run & 1) == 0) ? Frustum::ALL_PLANES : static_cast<int>(GetRandom(state) * 64.0f);
+
+			// The plane tried first can't change which boxes are kept.
+			int lastPlane = static_cast<int>(GetRandom(state) * 6.0f);
+			int visibleCount = frustum.CheckRectangles(boxes.maxWidths + first, boxes.maxHeights + first, boxes.maxDepths + first,
+				boxes.minWidths + first, boxes.minHeights + first, boxes.minDepths + first, boxes.ids + first, count, planeMask, lastPlane, visible);
+
+			int referenceCount = 0;
+			bool match = true;
+
+			for (int k = first; k < first + count; k++) {
+				bool inside;
+				if (planeMask == Frustum::ALL_PLANES) {
+					inside = frustum.CheckRectangle2(boxes.maxWidths[k], boxes.maxHeights[k], boxes.maxDepths[k], boxes.minWidths[k], boxes.minHeights[k], boxes.minDepths[k]);
+				}
+				else {
+					int rectangleMask = planeMask;
+					int lastPlane = 0;
+					inside = frustum.ClassifyRectangle(boxes.maxWidths[k], boxes.maxHeights[k], boxes.maxDepths[k], boxes.minWidths[k], boxes.minHeights[k], boxes.minDepths[k],
+						rectangleMask, lastPlane) != Frustum::OUTSIDE;
+				}
+
+				if (inside) {
+					match = match && (referenceCount < visibleCount) && (visible[referenceCount] == k);
+					referenceCount++;
+				}
+			}
+
+			match = match && (referenceCount == visibleCount) && (lastPlane >= 0) && (lastPlane < 6);
+			if (!match && (mismatchCount < 4)) {
+				harness.Report("frame %d: %d boxes from %d with planes %02x kept %d against %d", frame, count, first, planeMask, visibleCount, referenceCount);
+			}
+
+			mismatchCount += match ? 0 : 1;
+			visibleTotal += visibleCount;
+			testCount++;
+		}
+	}
+
+	harness.Report("%s kernel: %d runs, %d boxes kept, %d differ", TerrainKernels::SupportsAvx2() ? "AVX" : "SSE2", testCount, visibleTotal, mismatchCount);
+
+	TEST_CHECK(harness, visibleTotal > 0);
+	TEST_CHECK(harness, mismatchCount == 0);
+
+	// The kernel for several views has to keep, for each view in its mask, exactly the boxes the kernel for one view
+	// keeps with the same planes, add them after what the list already holds, and set the bit of the view in the mask
+	// of each of them.  Views outside the mask are left alone.
+	const int viewCount = 8;
+	Frustum frustums[viewCount];
+	const Frustum* frustumList[viewCount];
+	int* viewVisible[viewCount];
+	unsigned int* masks = new unsigned int[boxCount];
+	int viewRuns = 0;
+	int viewMismatches = 0;
+
+	for (int view = 0; view < viewCount; view++) {
+		flythrough.ConstructFrustum((view * frameCount) / viewCount, frustums[view]);
+		frustumList[view] = &frustums[view];
+		viewVisible[view] = new int[boxCount + 8];
+	}
+
+	for (int run = 0; run < 256; run++) {
+		int count = (run < 255) ? (run % 21) : boxCount;
+		int first = (run < 255) ? static_cast<int>(GetRandom(state) * static_cast<float>(boxCount - count)) : 0;
+		unsigned int viewMask = static_cast<unsigned int>(GetRandom(state) * 256.0f);
+		int planeMasks[viewCount];
+		int lastPlanes[viewCount];
+		int visibleCounts[viewCount];
+
+		for (int view = 0; view < viewCount; view++) {
+			planeMasks[view] = ((run & 1) == 0) ? Frustum::ALL_PLANES : static_cast<int>(GetRandom(state) * 64.0f);
+			lastPlanes[view] = static_cast<int>(GetRandom(state) * 6.0f);
+			visibleCounts[view] = run % 3;
+			viewVisible[view][0] = -1;
+			viewVisible[view][1] = -1;
+		}
+
+		memset(masks, 0, boxCount * sizeof(unsigned int));
+		Frustum::CheckRectanglesInViews(frustumList, viewMask, boxes.maxWidths + first, boxes.maxHeights + first, boxes.maxDepths + first,
+			boxes.minWidths + first, boxes.minHeights + first, boxes.minDepths + first, boxes.ids + first, count, planeMasks, lastPlanes, viewVisible, visibleCounts, masks);
+
+		bool match = true;
+
+		for (int view = 0; view < viewCount; view++) {
+			int start = run % 3;
+
+			if ((viewMask & (1u << view)) == 0) {
+				match = match && (visibleCounts[view] == start);
+				continue;
+			}
+
+			int lastPlane = 0;
+			int referenceCount = frustums[view].CheckRectangles(boxes.maxWidths + first, boxes.maxHeights + first, boxes.maxDepths + first,
+				boxes.minWidths + first, boxes.minHeights + first, boxes.minDepths + first, boxes.ids + first, count, planeMasks[view], lastPlane, visible);
+
+			match = match && (visibleCounts[view] == start + referenceCount) && (lastPlanes[view] >= 0) && (lastPlanes[view] < 6);
+
+			for (int k = 0; match && (k < start); k++) {
+				match = viewVisible[view][k] == -1;
+			}
+
+			for (int k = 0; match && (k < referenceCount); k++) {
+				match = viewVisible[view][start + k] == visible[k];
+			}
+		}
+
+		for (int k = first; match && (k < first + count); k++) {
+			unsigned int mask = 0;
+
+			for (int view = 0; view < viewCount; view++) {
+				int rectangleMask = planeMasks[view];
+				int lastPlane = 0;
+
+				if (((viewMask & (1u << view)) != 0) && (frustums[view].ClassifyRectangle(boxes.maxWidths[k], boxes.maxHeights[k], boxes.maxDepths[k],
+					boxes.minWidths[k], boxes.minHeights[k], boxes.minDepths[k], rectangleMask, lastPlane) != Frustum::OUTSIDE)) {
+					mask |= 1u << view;
+				}
+			}
+
+			match = masks[k] == mask;
+		}
+
+		if (!match && (viewMismatches < 4)) {
+			harness.Report("%d boxes from %d for views %02x differ from one view at a time", count, first, viewMask);
+		}
+
+		viewMismatches += match ? 0 : 1;
+		viewRuns++;
+	}
+
+	harness.Report("%d runs over several views, %d differ", viewRuns, viewMismatches);
+
+	TEST_CHECK(harness, viewMismatches == 0);
+
+	for (int view = 0; view < viewCount; view++) {
+		delete[] viewVisible[view];
+	}
+
+	delete[] masks;
+	delete[] visible;
+	DeleteBoxes(boxes);
+}
+
+void BenchmarkPlaneCache(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("plane-cache", TestTerrain::GetShippedSetup()));
+
+	Terrain* terrain = new Terrain;
+	bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+	TEST_CHECK(harness, result);
+	if (!result) {
+		delete terrain;
+		return;
+	}
+
+	// The cached planes only pay off when each frame looks much like the one before.  Fly the path in order, then
+	// visit the same frames in a shuffled order so every cached plane is from an unrelated view.  Both passes do the
+	// same frames, so the difference is what the cache saves.
+	const int frameCount = 400;
+	const int passCount = 50;
+	const TestTerrain::SetupType& setup = testTerrain.GetSetup();
+
+	TestFlythrough flythrough;
+	flythrough.Initialize(terrain, setup.terrainWidth, setup.terrainHeight, frameCount);
+
+	Frustum* frustums = new Frustum[frameCount];
+	int* orders[2] = { new int[frameCount], new int[frameCount] };
+	int* visibleCounts[2] = { new int[frameCount], new int[frameCount] };
+	unsigned int state = 31337;
+
+	for (int frame = 0; frame < frameCount; frame++) {
+		flythrough.ConstructFrustum(frame, frustums[frame]);
+		orders[0][frame] = frame;
+		orders[1][frame] = frame;
+	}
+
+	for (int frame = frameCount - 1; frame > 0; frame--) {
+		std::swap(orders[1][frame], orders[1][static_cast<int>(GetRandom(state) * static_cast<float>(frame + 1))]);
+	}
+
+	double passTimes[2] = { DBL_MAX, DBL_MAX };
+
+	for (int pass = 0; pass < passCount; pass++) {
+		for (int order = 0; order < 2; order++) {
+			double startTime = TestHarness::GetTime();
+
+			for (int k = 0; k < frameCount; k++) {
+				int frame = orders[order][k];
+
+				terrain->CullCells(&frustums[frame]);
+				visibleCounts[order][frame] = terrain->GetVisibleCellCount();
+			}
+
+			passTimes[order] = std::min(passTimes[order], TestHarness::GetTime() - startTime);
+		}
+	}
+
+	bool countsMatch = true;
+	for (int frame = 0; frame < frameCount; frame++) {
+		countsMatch = countsMatch && (visibleCounts[0][frame] == visibleCounts[1][frame]);
+	}
+
+	harness.Report("in order %.2f us, shuffled %.2f us a frame, the cached planes save %.0f%%", (passTimes[0] / frameCount) * 1.0e6,
+		(passTimes[1] / frameCount) * 1.0e6, (1.0 - (passTimes[0] / passTimes[1])) * 100.0);
+
+	TEST_CHECK(harness, countsMatch);
+
+	delete[] visibleCounts[1];
+	delete[] visibleCounts[0];
+	delete[] orders[1];
+	delete[] orders[0];
+	delete[] frustums;
+	delete terrain;
+}
+
+void TestRectangleClassification(TestHarness& harness) {
+	const int boxCount = 4096;
+	const int frameCount = 64;
+	BoxesType boxes = CreateBoxes(boxCount, 4048);
+	Frustum::Classification* classifications = new Frustum::Classification[boxCount];
+	int* planeMasks = new int[boxCount];
+
+	TestFlythrough flythrough;
+	flythrough.Initialize(nullptr, 1025, 1025, frameCount);
+
+	// The batched classification has to give every box the same classification and straddled planes as classifying
+	// it on its own does, whatever planes are left to test and whichever is tried first.
+	int counts[3] = { 0, 0, 0 };
+	int mismatchCount = 0;
+	unsigned int state = 7;
+
+	for (int frame = 0; frame < frameCount; frame++) {
+		Frustum frustum;
+		flythrough.ConstructFrustum(frame, frustum);
+
+		for (int run = 0; run < 64; run++) {
+			int count = (run < 63) ? (run % 21) : boxCount;
+			int first = (run < 63) ? static_cast<int>(GetRandom(state) * static_cast<float>(boxCount - count)) : 0;
+			int planeMask = ((run & 1) == 0) ? Frustum::ALL_PLANES : static_cast<int>(GetRandom(state) * 64.0f);
+			int lastPlane = static_cast<int>(GetRandom(state) * 6.0f);
+
+			frustum.ClassifyRectangles(boxes.maxWidths + first, boxes.maxHeights + first, boxes.maxDepths + first, boxes.minWidths + first, boxes.minHeights + first, boxes.minDepths + first,
+				count, planeMask, lastPlane, classifications, planeMasks);
+
+			for (int k = 0; k < count; k++) {
+				int box = first + k;
+				int rectangleMask = planeMask;
+				int rectanglePlane = 0;
+				Frustum::Classification classification = frustum.ClassifyRectangle(boxes.maxWidths[box], boxes.maxHeights[box], boxes.maxDepths[box],
+					boxes.minWidths[box], boxes.minHeights[box], boxes.minDepths[box], rectangleMask, rectanglePlane);
+
+				if (classification == Frustum::OUTSIDE) {
+					rectangleMask = 0;
+				}
+
+				if ((classifications[k] != classification) || (planeMasks[k] != rectangleMask)) {
+					if (mismatchCount < 4) {
+						harness.Report("frame %d box %d with planes %02x: %d %02x against %d %02x", frame, box, planeMask, classifications[k], planeMasks[k], classification, rectangleMask);
+					}
+
+					mismatchCount++;
+				}
+
+				counts[classification]++;
+			}
+
+			TEST_CHECK(harness, (lastPlane >= 0) && (lastPlane < 6));
+		}
+	}
+
+	harness.Report("%d outside, %d intersecting, %d inside, %d differ", counts[Frustum::OUTSIDE], counts[Frustum::INTERSECTING], counts[Frustum::INSIDE], mismatchCount);
+
+	TEST_CHECK(harness, (counts[Frustum::OUTSIDE] > 0) && (counts[Frustum::INTERSECTING] > 0) && (counts[Frustum::INSIDE] > 0));
+	TEST_CHECK(harness, mismatchCount == 0);
+
+	// Spheres around the camera have to come out outside exactly when the visibility test rejects them, and turn up
+	// as all three.
+	int sphereCounts[3] = { 0, 0, 0 };
+	bool spheresMatch = true;
+	bool tangentsMatch = true;
+	int tangentCount = 0;
+
+	for (int frame = 0; frame < frameCount; frame++) {
+		Frustum frustum;
+		flythrough.ConstructFrustum(frame, frustum);
+		Vector3 position = flythrough.GetPosition(frame);
+
+		for (int sphere = 0; sphere < 256; sphere++) {
+			float x = position.x + ((GetRandom(state) - 0.5f) * 400.0f);
+			float y = position.y + ((GetRandom(state) - 0.5f) * 100.0f);
+			float z = position.z + ((GetRandom(state) - 0.5f) * 400.0f);
+			float radius = GetRandom(state) * GetRandom(state) * 60.0f;
+
+			Frustum::Classification classification = frustum.ClassifySphere(x, y, z, radius);
+			spheresMatch = spheresMatch && ((classification == Frustum::OUTSIDE) == !frustum.CheckSphere(x, y, z, radius));
+			sphereCounts[classification]++;
+
+			// A center outside the frustum with the radius that just reaches the nearest plane it is behind.  The
+			// visibility test rejects radii up to that one, so bisect the bits of the radius for where it stops.  A
+			// sphere touching the plane from behind is outside, one a step bigger reaches through it.
+			if (frustum.CheckSphere(x, y, z, 0.0f)) {
+				continue;
+			}
+
+			unsigned int rejected = 0;
+			unsigned int accepted = 0x7f000000u;
+			while (accepted - rejected > 1) {
+				unsigned int middle = rejected + ((accepted - rejected) / 2);
+				float middleRadius;
+				memcpy(&middleRadius, &middle, sizeof(float));
+
+				if (frustum.CheckSphere(x, y, z, middleRadius)) {
+					accepted = middle;
+				}
+				else {
+					rejected = middle;
+				}
+			}
+
+			float tangentRadius;
+			float throughRadius;
+			memcpy(&tangentRadius, &rejected, sizeof(float));
+			memcpy(&throughRadius, &accepted, sizeof(float));
+
+			tangentsMatch = tangentsMatch && (frustum.ClassifySphere(x, y, z, tangentRadius) == Frustum::OUTSIDE) && (frustum.ClassifySphere(x, y, z, throughRadius) == Frustum::INTERSECTING);
+			tangentCount++;
+		}
+	}
+
+	// A small sphere well ahead of the camera is inside, one that takes in the camera straddles the near plane and
+	// one behind the camera is outside.
+	Frustum frustum;
+	flythrough.ConstructFrustum(0, frustum);
+	Vector3 eye = flythrough.GetPosition(0);
+	Vector3 ahead = flythrough.GetPosition(1);
+	float directionX = ahead.x - eye.x;
+	float directionZ = ahead.z - eye.z;
+	float length = sqrtf((directionX * directionX) + (directionZ * directionZ));
+	directionX /= length;
+	directionZ /= length;
+
+	TEST_CHECK(harness, frustum.ClassifySphere(eye.x + (directionX * 50.0f), eye.y, eye.z + (directionZ * 50.0f), 1.0f) == Frustum::INSIDE);
+	TEST_CHECK(harness, frustum.ClassifySphere(eye.x, eye.y, eye.z, 5.0f) == Frustum::INTERSECTING);
+	TEST_CHECK(harness, frustum.ClassifySphere(eye.x - (directionX * 50.0f), eye.y, eye.z - (directionZ * 50.0f), 1.0f) == Frustum::OUTSIDE);
+
+	harness.Report("spheres: %d outside, %d intersecting, %d inside, %d tangent", sphereCounts[Frustum::OUTSIDE], sphereCounts[Frustum::INTERSECTING], sphereCounts[Frustum::INSIDE], tangentCount);
+
+	TEST_CHECK(harness, (sphereCounts[Frustum::OUTSIDE] > 0) && (sphereCounts[Frustum::INTERSECTING] > 0) && (sphereCounts[Frustum::INSIDE] > 0));
+	TEST_CHECK(harness, tangentCount > 1000);
+	TEST_CHECK(harness, spheresMatch);
+	TEST_CHECK(harness, tangentsMatch);
+
+	// The quadtree classifies the children of each node together, it still has to find exactly the cells a test of
+	// every cell on its own finds.  Two grids, one that splits evenly and one that doesn't, with hills on them.
+	const int gridSizes[2][2] = { { 32, 32 }, { 45, 23 } };
+
+	for (const int* gridSize : gridSizes) {
+		int cellCount = gridSize[0] * gridSize[1];
+		TerrainQuadTree quadTree;
+		TEST_CHECK(harness, quadTree.Initialize(gridSize[0], gridSize[1]));
+
+		for (int y = 0; y < gridSize[1]; y++) {
+			for (int x = 0; x < gridSize[0]; x++) {
+				float minHeight = GetRandom(state) * 40.0f;
+				quadTree.SetCellBounds((y * gridSize[0]) + x, static_cast<float>((x + 1) * 32), minHeight + (GetRandom(state) * 60.0f), static_cast<float>((y + 1) * 32),
+					static_cast<float>(x * 32), minHeight, static_cast<float>(y * 32));
+			}
+		}
+
+		quadTree.UpdateBounds();
+
+		int* visibleCells = new int[cellCount];
+		bool* visible = new bool[cellCount];
+		int visibleTotal = 0;
+		bool cellsMatch = true;
+
+		for (int frame = 0; frame < frameCount; frame++) {
+			Frustum frustum;
+			flythrough.ConstructFrustum(frame, frustum);
+
+			int visibleCount = quadTree.Cull(&frustum, visibleCells);
+			memset(visible, 0, cellCount * sizeof(bool));
+
+			for (int k = 0; k < visibleCount; k++) {
+				cellsMatch = cellsMatch && !visible[visibleCells[k]];
+				visible[visibleCells[k]] = true;
+			}
+
+			for (int cellId = 0; cellId < cellCount; cellId++) {
+				float bounds[6];
+				quadTree.GetCellBounds(cellId, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+				cellsMatch = cellsMatch && (visible[cellId] == frustum.CheckRectangle2(bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]));
+			}
+
+			visibleTotal += visibleCount;
+		}
+
+		harness.Report("%dx%d cells: %.1f visible a frame", gridSize[0], gridSize[1], static_cast<double>(visibleTotal) / frameCount);
+
+		TEST_CHECK(harness, visibleTotal > 0);
+		TEST_CHECK(harness, cellsMatch);
+
+		delete[] visible;
+		delete[] visibleCells;
+	}
+
+	delete[] planeMasks;
+	delete[] classifications;
+	DeleteBoxes(boxes);
+}
+
+void TestOcclusion(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("occlusion", TestTerrain::GetShippedSetup()));
+
+	Terrain* terrain = new Terrain;
+	bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+	TEST_CHECK(harness, result);
+	if (!result) {
+		delete terrain;
+		return;
+	}
+
+	// Fly the path the way the scene draws a frame, without a window: cull against the frustum, sort front to back,
+	// then occlude.  Every cell the occlusion drops is checked by casting rays from the eye to points just above its
+	// surface, none of them that are in the frustum may be in plain sight.
+	const int frameCount = 200;
+	const int sampleStep = 4;
+	const TestTerrain::SetupType& setup = testTerrain.GetSetup();
+	int cellSizeX = setup.cellWidth - 1;
+	int cellSizeY = setup.cellHeight - 1;
+	int cellCountX = ((setup.terrainWidth - 2) / cellSizeX) + 1;
+	int cellCount = terrain->GetCellCount();
+	float backZ = static_cast<float>(setup.terrainHeight - 1);
+
+	TestFlythrough flythrough;
+	flythrough.Initialize(terrain, setup.terrainWidth, setup.terrainHeight, frameCount);
+
+	int* frustumCells = new int[cellCount];
+	bool* kept = new bool[cellCount];
+	int maxSamples = ((cellSizeX / sampleStep) + 1) * ((cellSizeY / sampleStep) + 1);
+	Vector3* starts = new Vector3[maxSamples];
+	Vector3* ends = new Vector3[maxSamples];
+	bool* visible = new bool[maxSamples];
+
+	long long frustumTotal = 0;
+	long long rejectedTotal = 0;
+	long long sampleTotal = 0;
+	int seenRejections = 0;
+	double occludeTime = 0.0;
+	double cullTime = 0.0;
+	int worstRejected = 0;
+
+	for (int frame = 0; frame < frameCount; frame++) {
+		Frustum frustum;
+		flythrough.ConstructFrustum(frame, frustum);
+		Matrix viewMatrix = flythrough.GetViewMatrix(frame);
+		Vector3 eye = flythrough.GetPosition(frame);
+
+		terrain->CullCells(&frustum);
+		terrain->SortVisibleCells(viewMatrix);
+
+		int frustumCount = terrain->GetVisibleCellCount();
+		for (int k = 0; k < frustumCount; k++) {
+			frustumCells[k] = terrain->GetVisibleCell(k);
+		}
+
+		double startTime = TestHarness::GetTime();
+		terrain->OccludeCells(DirectX::XMMatrixMultiply(flythrough.GetViewMatrix(frame), flythrough.GetProjectionMatrix()));
+		occludeTime += TestHarness::GetTime() - startTime;
+		cullTime += terrain->GetOcclusionTime() / 1000.0;
+
+		memset(kept, 0, cellCount * sizeof(bool));
+		for (int k = 0; k < terrain->GetVisibleCellCount(); k++) {
+			kept[terrain->GetVisibleCell(k)] = true;
+		}
+
+		int rejected = frustumCount - terrain->GetVisibleCellCount();
+		TEST_CHECK(harness, rejected == terrain->GetCellsOccluded());
+
+		frustumTotal += frustumCount;
+		rejectedTotal += rejected;
+		worstRejected = std::max(worstRejected, rejected);
+
+		for (int k = 0; k < frustumCount; k++) {
+			int cellId = frustumCells[k];
+			if (kept[cellId]) {
+				continue;
+			}
+
+			int firstColumn = (cellId % cellCountX) * cellSizeX;
+			int firstRow = (cellId / cellCountX) * cellSizeY;
+			int sampleCount = 0;
+
+			for (int j = firstRow; j <= std::min(firstRow + cellSizeY, setup.terrainHeight - 1); j += sampleStep) {
+				for (int i = firstColumn; i <= std::min(firstColumn + cellSizeX, setup.terrainWidth - 1); i += sampleStep) {
+					float x = static_cast<float>(i);
+					float z = backZ - static_cast<float>(j);
+					float height = 0.0f;
+					terrain->GetHeightsAtPositions(&x, &z, 1, &height, visible);
+
+					if (!visible[0] || !frustum.CheckPoint(x, height + 0.05f, z)) {
+						continue;
+					}
+
+					starts[sampleCount] = eye;
+					ends[sampleCount] = Vector3(x, height + 0.05f, z);
+					sampleCount++;
+				}
+			}
+
+			terrain->CheckLineOfSight(starts, ends, sampleCount, visible);
+
+			bool seen = false;
+			for (int n = 0; n < sampleCount; n++) {
+				seen = seen || visible[n];
+			}
+
+			if (seen && (seenRejections < 4)) {
+				harness.Report("frame %d: cell %d was occluded but can be seen", frame, cellId);
+			}
+
+			seenRejections += seen ? 1 : 0;
+			sampleTotal += sampleCount;
+		}
+	}
+
+	harness.Report("%.1f cells in the frustum, %.1f occluded (%.0f%%, at most %d), occlusion %.3f ms (%.3f ms in the culler) a frame",
+		static_cast<double>(frustumTotal) / frameCount, static_cast<double>(rejectedTotal) / frameCount, (frustumTotal > 0) ? (100.0 * rejectedTotal) / frustumTotal : 0.0,
+		worstRejected, (occludeTime / frameCount) * 1000.0, (cullTime / frameCount) * 1000.0);
+	harness.Report("%lld samples of occluded cells checked, %d occluded cells in sight", sampleTotal, seenRejections);
+
+	TEST_CHECK(harness, rejectedTotal > 0);
+	TEST_CHECK(harness, seenRejections == 0);
+
+	delete[] visible;
+	delete[] ends;
+	delete[] starts;
+	delete[] kept;
+	delete[] frustumCells;
+	delete terrain;
+}
+
+void TestVisibility(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	// Rolling hills seen from low down so plenty of cells hide behind the ones in front.
+	TestTerrain::SetupType setup = TestTerrain::GetSyntheticSetup(257, 17);
+	setup.visibility = true;
+	setup.visibilityHeight = 4.0f;
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("visibility", setup));
+
+	Terrain* terrain = new Terrain;
+	bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+	TEST_CHECK(harness, result);
+	if (!result) {
+		delete terrain;
+		return;
+	}
+
+	// Starting the terrain only maps sets that were baked ahead of time.
+	FILE* file = std::fopen(testTerrain.GetVisibilityFilename(), "rb");
+	TEST_CHECK(harness, file == nullptr);
+	if (file) {
+		std::fclose(file);
+	}
+
+	TEST_CHECK(harness, terrain->GetVisibilityFilename() != nullptr);
+	TEST_CHECK(harness, !terrain->HasVisibleSets());
+
+	double startTime = TestHarness::GetTime();
+	result = terrain->BakeVisibleSets();
+	double bakeTime = TestHarness::GetTime() - startTime;
+	TEST_CHECK(harness, result);
+
+	TerrainVisibility::HeaderType header = {};
+	file = std::fopen(testTerrain.GetVisibilityFilename(), "rb");
+	TEST_CHECK(harness, file != nullptr);
+	if (file) {
+		TEST_CHECK(harness, std::fread(&header, sizeof(header), 1, file) == 1);
+		std::fclose(file);
+	}
+
+	TerrainVisibility visibility;
+	result = visibility.Open(testTerrain.GetVisibilityFilename(), header);
+	TEST_CHECK(harness, result);
+	if (!result) {
+		delete terrain;
+		return;
+	}
+
+	// Every cell a set leaves out has to be out of sight of every eye the set is used for.  Cast rays from eyes spread
+	// over the ground the set covers, from the top of the range down to just above the ground, to points just above
+	// the surface of the hidden cell.
+	const int sampleStep = 4;
+	const int eyeCount = 12;
+	int cellSizeX = setup.cellWidth - 1;
+	int cellSizeY = setup.cellHeight - 1;
+	int cellCountX = header.cellCountX;
+	int cellCount = terrain->GetCellCount();
+	float backZ = static_cast<float>(setup.terrainHeight - 1);
+	int targetsPerCell = ((cellSizeX / sampleStep) + 1) * ((cellSizeY / sampleStep) + 1);
+	int maxSegments = cellCount * eyeCount * targetsPerCell;
+
+	unsigned int* bits = new unsigned int[TerrainVisibility::GetWordCount(cellCount)];
+	Vector3* eyes = new Vector3[eyeCount];
+	Vector3* targets = new Vector3[targetsPerCell];
+	Vector3* starts = new Vector3[maxSegments];
+	Vector3* ends = new Vector3[maxSegments];
+	bool* visible = new bool[maxSegments];
+	unsigned int state = 23;
+	long long hiddenTotal = 0;
+	long long segmentTotal = 0;
+	int seenPairs = 0;
+
+	for (int viewerCell = 0; viewerCell < cellCount; viewerCell++) {
+		visibility.GetVisibleSet(viewerCell, bits);
+
+		TEST_CHECK(harness, TerrainVisibility::IsVisible(bits, viewerCell));
+
+		// The range of eyes reaches the view height above the highest vertex of the cell.
+		int firstColumn = (viewerCell % cellCountX) * cellSizeX;
+		int firstRow = (viewerCell / cellCountX) * cellSizeY;
+		float top = -FLT_MAX;
+
+		for (int j = firstRow; j <= std::min(firstRow + cellSizeY, setup.terrainHeight - 1); j++) {
+			for (int i = firstColumn; i <= std::min(firstColumn + cellSizeX, setup.terrainWidth - 1); i++) {
+				float x = static_cast<float>(i);
+				float z = backZ - static_cast<float>(j);
+				float height = 0.0f;
+				bool found = false;
+				terrain->GetHeightsAtPositions(&x, &z, 1, &height, &found);
+
+				if (found) {
+					top = std::max(top, height);
+				}
+			}
+		}
+
+		top += setup.visibilityHeight;
+
+		// The corners of the ground the set covers at the top of the range, then random eyes anywhere below it.
+		for (int k = 0; k < eyeCount; k++) {
+			float u = (k < 4) ? static_cast<float>(k & 1) : GetRandom(state);
+			float v = (k < 4) ? static_cast<float>(k >> 1) : GetRandom(state);
+			float x = std::min(static_cast<float>(firstColumn) + (u * cellSizeX), static_cast<float>(setup.terrainWidth - 1));
+			float z = std::max(backZ - static_cast<float>(firstRow) - (v * cellSizeY), 0.0f);
+			float ground = top;
+			bool found = false;
+			terrain->GetHeightsAtPositions(&x, &z, 1, &ground, &found);
+
+			eyes[k] = Vector3(x, (k < 4) ? top : ground + 0.05f + ((top - ground - 0.05f) * GetRandom(state)), z);
+		}
+
+		int segmentCount = 0;
+		int* pairStarts = new int[cellCount + 1];
+
+		for (int targetCell = 0; targetCell < cellCount; targetCell++) {
+			pairStarts[targetCell] = segmentCount;
+
+			if (TerrainVisibility::IsVisible(bits, targetCell)) {
+				continue;
+			}
+
+			int firstColumn = (targetCell % cellCountX) * cellSizeX;
+			int firstRow = (targetCell / cellCountX) * cellSizeY;
+			int targetCount = 0;
+
+			for (int j = firstRow; j <= std::min(firstRow + cellSizeY, setup.terrainHeight - 1); j += sampleStep) {
+				for (int i = firstColumn; i <= std::min(firstColumn + cellSizeX, setup.terrainWidth - 1); i += sampleStep) {
+					float x = static_cast<float>(i);
+					float z = backZ - static_cast<float>(j);
+					float height = 0.0f;
+					bool found = false;
+					terrain->GetHeightsAtPositions(&x, &z, 1, &height, &found);
+
+					if (found) {
+						targets[targetCount++] = Vector3(x, height + 0.05f, z);
+					}
+				}
+			}
+
+			for (int k = 0; k < eyeCount; k++) {
+				for (int n = 0; n < targetCount; n++) {
+					starts[segmentCount] = eyes[k];
+					ends[segmentCount] = targets[n];
+					segmentCount++;
+				}
+			}
+
+			hiddenTotal++;
+		}
+
+		pairStarts[cellCount] = segmentCount;
+		terrain->CheckLineOfSight(starts, ends, segmentCount, visible);
+
+		for (int targetCell = 0; targetCell < cellCount; targetCell++) {
+			bool seen = false;
+			for (int n = pairStarts[targetCell]; n < pairStarts[targetCell + 1]; n++) {
+				seen = seen || visible[n];
+			}
+
+			if (seen && (seenPairs < 4)) {
+				harness.Report("cell %d is hidden from cell %d but can be seen", targetCell, viewerCell);
+			}
+
+			seenPairs += seen ? 1 : 0;
+		}
+
+		segmentTotal += segmentCount;
+		delete[] pairStarts;
+	}
+
+	long long pairCount = static_cast<long long>(cellCount) * cellCount;
+	harness.Report("bake %.0f ms for %d cells, %lld of %lld pairs hidden (%.1f%%)", bakeTime * 1000.0, cellCount, hiddenTotal, pairCount, (100.0 * hiddenTotal) / pairCount);
+	harness.Report("%lld segments to hidden cells checked, %d hidden pairs in sight", segmentTotal, seenPairs);
+
+	TEST_CHECK(harness, hiddenTotal > 0);
+	TEST_CHECK(harness, seenPairs == 0);
+
+	// The next start maps the sets, which is how the bake tool tells they are up to date.
+	Terrain* reloaded = new Terrain;
+	TEST_CHECK(harness, reloaded->Initialize(device.GetDevice(), testTerrain.GetSetupFilename()));
+	TEST_CHECK(harness, reloaded->HasVisibleSets());
+	delete reloaded;
+
+	// An offset past the runs or one that goes backwards is refused instead of being read outside the mapping.
+	long fileSize = 0;
+	unsigned char* contents = nullptr;
+	file = std::fopen(testTerrain.GetVisibilityFilename(), "rb");
+	if (file) {
+		std::fseek(file, 0, SEEK_END);
+		fileSize = std::ftell(file);
+		std::fseek(file, 0, SEEK_SET);
+		contents = new unsigned char[fileSize];
+		TEST_CHECK(harness, std::fread(contents, 1, fileSize, file) == static_cast<size_t>(fileSize));
+		std::fclose(file);
+	}
+
+	const char* damagedFilename = "test-visibility-damaged.pvs";
+	bool refused = contents && (static_cast<size_t>(fileSize) > sizeof(header) + (3 * sizeof(unsigned int)));
+
+	for (int damage = 0; refused && (damage < 2); damage++) {
+		unsigned char* damaged = new unsigned char[fileSize];
+		memcpy(damaged, contents, fileSize);
+
+		unsigned int* offsets = reinterpret_cast<unsigned int*>(damaged + sizeof(header));
+		offsets[1] = (damage == 0) ? header.dataSize + 1 : offsets[2] + 1;
+
+		file = std::fopen(damagedFilename, "wb");
+		if (file) {
+			std::fwrite(damaged, 1, fileSize, file);
+			std::fclose(file);
+		}
+
+		TerrainVisibility damagedVisibility;
+		refused = !damagedVisibility.Open(damagedFilename, header);
+
+		delete[] damaged;
+	}
+
+	std::remove(damagedFilename);
+	TEST_CHECK(harness, refused);
+
+	delete[] contents;
+
+	delete[] visible;
+	delete[] ends;
+	delete[] starts;
+	delete[] targets;
+	delete[] eyes;
+	delete[] bits;
+	delete terrain;
+}
+
+void TestVisibleCellSort(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	// Small cells so the overviews put over ten thousand cells in the frustum.
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("sort", TestTerrain::GetSyntheticSetup(1025, 9)));
+
+	Terrain* terrain = new Terrain;
+	bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+	TEST_CHECK(harness, result);
+	if (!result) {
+		delete terrain;
+		return;
+	}
+
+	// The sort has to hand back the same cells, front to back.  Depths closer together than one step of the 16 bit
+	// keys can come out either way round.
+	const int overviewCount = 8;
+	const int frameCount = 64;
+	int cellCount = terrain->GetCellCount();
+	int* unsorted = new int[cellCount];
+	int* seen = new int[cellCount];
+	int largestCount = 0;
+	int wrongCells = 0;
+	int wrongOrders = 0;
+
+	TestFlythrough flythrough;
+	flythrough.Initialize(terrain, 1025, 1025, frameCount);
+
+	for (int view = 0; view < overviewCount + frameCount; view++) {
+		Matrix viewMatrix;
+		Frustum frustum;
+
+		if (view < overviewCount) {
+			ConstructOverview(1025, view, overviewCount, viewMatrix, frustum);
+		}
+		else {
+			viewMatrix = flythrough.GetViewMatrix(view - overviewCount);
+			flythrough.ConstructFrustum(view - overviewCount, frustum);
+		}
+
+		terrain->CullCells(&frustum);
+
+		int visibleCount = terrain->GetVisibleCellCount();
+		for (int k = 0; k < visibleCount; k++) {
+			unsorted[k] = terrain->GetVisibleCell(k);
+		}
+
+		terrain->SortVisibleCells(viewMatrix);
+
+		TEST_CHECK(harness, terrain->GetVisibleCellCount() == visibleCount);
+		largestCount = std::max(largestCount, visibleCount);
+
+		// Every cell comes back exactly once.
+		memset(seen, 0, cellCount * sizeof(int));
+		for (int k = 0; k < visibleCount; k++) {
+			seen[unsorted[k]]++;
+		}
+
+		for (int k = 0; k < visibleCount; k++) {
+			wrongCells += (--seen[terrain->GetVisibleCell(k)] < 0) ? 1 : 0;
+		}
+
+		float nearest = FLT_MAX;
+		float farthest = -FLT_MAX;
+		for (int k = 0; k < visibleCount; k++) {
+			float depth = GetCellDepth(terrain, unsorted[k], viewMatrix);
+			nearest = std::min(nearest, depth);
+			farthest = std::max(farthest, depth);
+		}
+
+		float tolerance = ((farthest - nearest) / 65535.0f) * 1.001f;
+		for (int k = 1; k < visibleCount; k++) {
+			float depth = GetCellDepth(terrain, terrain->GetVisibleCell(k), viewMatrix);
+			float previous = GetCellDepth(terrain, terrain->GetVisibleCell(k - 1), viewMatrix);
+
+			if ((depth < previous - tolerance) && (wrongOrders++ < 4)) {
+				harness.Report("view %d: cell %d at %.3f is after cell %d at %.3f", view, terrain->GetVisibleCell(k), depth, terrain->GetVisibleCell(k - 1), previous);
+			}
+		}
+	}
+
+	harness.Report("%d cells, up to %d sorted in one view, %d cells lost, %d out of order", cellCount, largestCount, wrongCells, wrongOrders);
+
+	TEST_CHECK(harness, largestCount >= 10000);
+	TEST_CHECK(harness, wrongCells == 0);
+	TEST_CHECK(harness, wrongOrders == 0);
+
+	delete[] seen;
+	delete[] unsorted;
+	delete terrain;
+}
+
+void BenchmarkVisibleCellSort(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("sort", TestTerrain::GetSyntheticSetup(1025, 9)));
+
+	Terrain* terrain = new Terrain;
+	bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+	TEST_CHECK(harness, result);
+	if (!result) {
+		delete terrain;
+		return;
+	}
+
+	// Sort every cell of the terrain from views round it, and sort the same cells by their float depths with
+	// std::sort to compare.  The radix sort is timed on freshly culled lists since it costs the same whatever the order.
+	const int viewCount = 16;
+	const int repeats = 50;
+	int cellCount = terrain->GetCellCount();
+	std::pair<float, int>* pairs = new std::pair<float, int>[cellCount];
+	long long sortedTotal = 0;
+	double radixTime = 0.0;
+	double referenceTime = 0.0;
+
+	for (int view = 0; view < viewCount; view++) {
+		Matrix viewMatrix;
+		Frustum frustum;
+		ConstructOverview(1025, view, viewCount, viewMatrix, frustum);
+
+		for (int repeat = 0; repeat < repeats; repeat++) {
+			terrain->CullCells(&frustum);
+
+			int visibleCount = terrain->GetVisibleCellCount();
+			for (int k = 0; k < visibleCount; k++) {
+				pairs[k] = std::make_pair(GetCellDepth(terrain, terrain->GetVisibleCell(k), viewMatrix), terrain->GetVisibleCell(k));
+			}
+
+			double startTime = TestHarness::GetTime();
+			terrain->SortVisibleCells(viewMatrix);
+			radixTime += TestHarness::GetTime() - startTime;
+
+			startTime = TestHarness::GetTime();
+			std::sort(pairs, pairs + visibleCount);
+			referenceTime += TestHarness::GetTime() - startTime;
+
+			sortedTotal += visibleCount;
+		}
+	}
+
+	int passCount = viewCount * repeats;
+	harness.Report("%.0f cells a sort: radix %.1f us (%.1f ns a cell), std::sort %.1f us (%.1f ns a cell)",
+		static_cast<double>(sortedTotal) / passCount, (radixTime / passCount) * 1.0e6, (radixTime / sortedTotal) * 1.0e9,
+		(referenceTime / passCount) * 1.0e6, (referenceTime / sortedTotal) * 1.0e9);
+
+	TEST_CHECK(harness, sortedTotal >= 10000LL * passCount);
+
+	delete[] pairs;
+	delete terrain;
+}
+
+void TestCullViews(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("views", TestTerrain::GetSyntheticSetup(1025, 33)));
+
+	Terrain* terrain = new Terrain;
+	bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+	TEST_CHECK(harness, result);
+	if (!result) {
+		delete terrain;
+		return;
+	}
+
+	// Cull spread out frames of the flythrough together, as the camera would be with its shadow cascades, and check
+	// every view finds the same cells in the same order as culling it on its own, and exactly the cells a test of each
+	// box on its own finds.  The mask of each cell has to have the bit of exactly the views that found it.
+	const int viewCount = TerrainQuadTree::MAX_VIEWS;
+	const int frameCount = 240;
+	const int cullRepeats = 20;
+	int cellCount = terrain->GetCellCount();
+	int* visibleCells[viewCount + 1];
+	int visibleCounts[viewCount + 1];
+	unsigned int* cellMasks = new unsigned int[cellCount];
+	int* expected = new int[cellCount];
+	long long visibleTotal = 0;
+	int mismatchCount = 0;
+	double togetherTime = 0.0;
+	double separateTime = 0.0;
+
+	for (int view = 0; view <= viewCount; view++) {
+		visibleCells[view] = new int[cellCount];
+	}
+
+	TestFlythrough flythrough;
+	flythrough.Initialize(terrain, 1025, 1025, frameCount);
+
+	for (int frame = 0; frame < frameCount; frame += 8) {
+		Frustum frustums[viewCount + 1];
+		const Frustum* frustumList[viewCount + 1];
+
+		for (int view = 0; view <= viewCount; view++) {
+			flythrough.ConstructFrustum((frame + (view * 29)) % frameCount, frustums[view]);
+			frustumList[view] = &frustums[view];
+		}
+
+		// Time the views together and one at a time, keeping the fastest of a few runs of each.
+		double frameTime = DBL_MAX;
+		for (int repeat = 0; repeat < cullRepeats; repeat++) {
+			double startTime = TestHarness::GetTime();
+			result = terrain->CullViews(frustumList, viewCount, visibleCells, visibleCounts, cellMasks);
+			frameTime = std::min(frameTime, TestHarness::GetTime() - startTime);
+		}
+
+		togetherTime += frameTime;
+		TEST_CHECK(harness, result);
+
+		frameTime = DBL_MAX;
+		for (int repeat = 0; repeat < cullRepeats; repeat++) {
+			double startTime = TestHarness::GetTime();
+			for (int view = 0; view < viewCount; view++) {
+				terrain->CullCells(frustumList[view]);
+			}
+			frameTime = std::min(frameTime, TestHarness::GetTime() - startTime);
+		}
+
+		separateTime += frameTime;
+
+		bool match = true;
+		for (int view = 0; view < viewCount; view++) {
+			terrain->CullCells(frustumList[view]);
+
+			match = match && (terrain->GetVisibleCellCount() == visibleCounts[view]);
+			for (int k = 0; match && (k < visibleCounts[view]); k++) {
+				match = terrain->GetVisibleCell(k) == visibleCells[view][k];
+			}
+
+			visibleTotal += visibleCounts[view];
+		}
+
+		memset(expected, 0, cellCount * sizeof(int));
+		for (int view = 0; view < viewCount; view++) {
+			for (int k = 0; k < visibleCounts[view]; k++) {
+				expected[visibleCells[view][k]] |= 1 << view;
+			}
+		}
+
+		for (int cellId = 0; cellId < cellCount; cellId++) {
+			float bounds[6];
+			terrain->GetCellBounds(cellId, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+
+			unsigned int reference = 0;
+			for (int view = 0; view < viewCount; view++) {
+				reference |= frustums[view].CheckRectangle2(bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]) ? 1u << view : 0u;
+			}
+
+			match = match && (cellMasks[cellId] == static_cast<unsigned int>(expected[cellId])) && (cellMasks[cellId] == reference);
+		}
+
+		if (!match && (mismatchCount < 4)) {
+			harness.Report("frame %d: the views culled together differ from culling them one at a time", frame);
+		}
+
+		mismatchCount += match ? 0 : 1;
+
+		// One view more than the masks have bits for is refused and leaves every list empty.
+		for (int view = 0; view <= viewCount; view++) {
+			visibleCounts[view] = -1;
+		}
+
+		result = terrain->CullViews(frustumList, viewCount + 1, visibleCells, visibleCounts, cellMasks);
+		TEST_CHECK(harness, !result);
+
+		for (int view = 0; view <= viewCount; view++) {
+			TEST_CHECK(harness, visibleCounts[view] == 0);
+		}
+	}
+
+	int passCount = (frameCount + 7) / 8;
+	harness.Report("%d views: %.1f cells a view, culled together %.1f us, one at a time %.1f us, %d differ", viewCount,
+		static_cast<double>(visibleTotal) / (passCount * viewCount), (togetherTime / passCount) * 1.0e6, (separateTime / passCount) * 1.0e6, mismatchCount);
+
+	TEST_CHECK(harness, visibleTotal > 0);
+	TEST_CHECK(harness, mismatchCount == 0);
+
+	for (int view = 0; view <= viewCount; view++) {
+		delete[] visibleCells[view];
+	}
+
+	delete[] expected;
+	delete[] cellMasks;
+	delete terrain;
+}
@@ -0,0 +1,364 @@
+#include "pch.h"
+#include "Tests.h"
+#include "TestDevice.h"
+#include "TestTerrain.h"
+#include "Terrain.h"
+#include "TerrainKernels.h"
+#include "TerrainLod.h"
+#include "TerrainMesh.h"
+#include "TerrainQuadTree.h"
+
+using namespace DirectX;
+
+namespace {
+	// Small deterministic generator so every run makes the same edits.
+	float GetRandom(unsigned int& state) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+
+		return static_cast<float>(state >> 8) / 16777216.0f;
+	}
+
+	// Applies one edit of a random kind, size and place, which can hang over the edges of the terrain.
+	bool ApplyRandomEdit(Terrain* terrain, ID3D11DeviceContext* deviceContext, const TestTerrain::SetupType& setup, unsigned int& state) {
+		float radius = 2.0f + (GetRandom(state) * 18.0f);
+		float positionX = (GetRandom(state) * (static_cast<float>(setup.terrainWidth - 1) + (2.0f * radius))) - radius;
+		float positionZ = (GetRandom(state) * (static_cast<float>(setup.terrainHeight - 1) + (2.0f * radius))) - radius;
+		float amount = 1.0f + (GetRandom(state) * 40.0f);
+		float strength = GetRandom(state);
+
+		switch (static_cast<int>(GetRandom(state) * 4.0f)) {
+		case 0:
+			return terrain->RaiseTerrain(deviceContext, positionX, positionZ, radius, amount);
+		case 1:
+			return terrain->LowerTerrain(deviceContext, positionX, positionZ, radius, amount);
+		case 2:
+			return terrain->FlattenTerrain(deviceContext, positionX, positionZ, radius, amount * 5.0f, strength);
+		default:
+			return terrain->SmoothTerrain(deviceContext, positionX, positionZ, radius, strength);
+		}
+	}
+
+	// A camera somewhere over or beside the terrain looking at a random point of it.
+	void ConstructRandomFrustum(const TestTerrain::SetupType& setup, unsigned int& state, Frustum& frustum) {
+		float sizeX = static_cast<float>(setup.terrainWidth - 1);
+		float sizeZ = static_cast<float>(setup.terrainHeight - 1);
+		XMVECTOR eye = XMVectorSet((GetRandom(state) * sizeX * 1.5f) - (sizeX * 0.25f), 20.0f + (GetRandom(state) * 200.0f), (GetRandom(state) * sizeZ * 1.5f) - (sizeZ * 0.25f), 1.0f);
+		XMVECTOR target = XMVectorSet(GetRandom(state) * sizeX, 0.0f, GetRandom(state) * sizeZ, 1.0f);
+
+		frustum.Initialize(150.0f);
+		frustum.ConstructFrustum(XMMatrixPerspectiveFovLH(3.14159265f / 4.0f, 16.0f / 9.0f, 0.1f, 150.0f), XMMatrixLookAtLH(eye, target, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)));
+	}
+
+	// Builds everything a load makes from the heights the edits left behind and compares it with what the edits made
+	// of the terrain: the padding and normals of the height field, the vertices, decode and bounds of every cell, the
+	// quadtree, the level of detail errors and the height pyramid.
+	void CheckEditedTerrain(TestHarness& harness, Terrain* terrain, ID3D11DeviceContext* deviceContext, const TestTerrain::SetupType& setup, unsigned int& state) {
+		const HeightField* edited = terrain->GetHeightField();
+		int width = edited->GetWidth();
+		int height = edited->GetHeight();
+		int cellCountX = (width - 1) / (setup.cellWidth - 1);
+		int cellCountY = (height - 1) / (setup.cellHeight - 1);
+		int cellCount = cellCountX * cellCountY;
+
+		// Only the heights of the terrain itself are taken, the padding has to come out of the edits the same as here.
+		HeightField* heightField = new HeightField;
+		TEST_CHECK(harness, heightField->Initialize(width, height, setup.terrainWidth, setup.terrainHeight));
+
+		for (int j = 0; j < setup.terrainHeight; j++) {
+			memcpy(heightField->GetHeightRow(j), edited->GetHeightRow(j), sizeof(float) * setup.terrainWidth);
+		}
+
+		for (int j = 0; j < height; j++) {
+			const unsigned int* colors = edited->GetColorRow(j);
+
+			for (int i = 0; i < width; i++) {
+				heightField->SetColor(i, j, static_cast<unsigned char>(colors[i]), static_cast<unsigned char>(colors[i] >> 8), static_cast<unsigned char>(colors[i] >> 16));
+			}
+		}
+
+		heightField->ExtendHeights();
+		TerrainKernels::CalculateNormals(heightField, 0, height);
+
+		bool heightsMatch = true;
+		bool normalsMatch = true;
+
+		for (int j = 0; j < height; j++) {
+			heightsMatch = heightsMatch && (memcmp(heightField->GetHeightRow(j), edited->GetHeightRow(j), sizeof(float) * width) == 0);
+			normalsMatch = normalsMatch && (memcmp(heightField->GetNormalRow(j), edited->GetNormalRow(j), sizeof(unsigned int) * width) == 0);
+		}
+
+		// Every cell as a load would build it.
+		int vertexCount = TerrainMesh::GetVertexCount(setup.cellWidth, setup.cellHeight);
+		TerrainMesh::VertexType* vertices = new TerrainMesh::VertexType[cellCount * vertexCount];
+		TerrainMesh::VertexType* cellVertices = new TerrainMesh::VertexType[vertexCount];
+		TerrainMesh::DecodeType* decodes = new TerrainMesh::DecodeType[cellCount];
+
+		TerrainQuadTree quadTree;
+		TEST_CHECK(harness, quadTree.Initialize(cellCountX, cellCountY));
+
+		bool boundsMatch = true;
+		bool decodesMatch = true;
+		bool verticesMatch = true;
+
+		for (int cellId = 0; cellId < cellCount; cellId++) {
+			int nodeIndexX = cellId % cellCountX;
+			int nodeIndexY = cellId / cellCountX;
+
+			float bounds[6];
+			float cellBounds[6];
+			TerrainMesh::CalculateBounds(heightField, nodeIndexX, nodeIndexY, setup.cellWidth, setup.cellHeight, bounds);
+			terrain->GetCellBounds(cellId, cellBounds[0], cellBounds[1], cellBounds[2], cellBounds[3], cellBounds[4], cellBounds[5]);
+			boundsMatch = boundsMatch && (memcmp(bounds, cellBounds, sizeof(bounds)) == 0);
+
+			quadTree.SetCellBounds(cellId, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+
+			decodes[cellId] = TerrainMesh::GetDecode(bounds, setup.cellWidth, setup.cellHeight);
+			decodesMatch = decodesMatch && (memcmp(&decodes[cellId], &terrain->GetCellDecode(cellId), sizeof(TerrainMesh::DecodeType)) == 0);
+
+			TerrainMesh::VertexType* expected = vertices + (cellId * vertexCount);
+			TerrainMesh::BuildVertices(expected, decodes[cellId], heightField, nodeIndexX, nodeIndexY, setup.cellWidth, setup.cellHeight);
+			verticesMatch = verticesMatch && terrain->GetCellVertices(deviceContext, cellId, cellVertices) &&
+				(memcmp(expected, cellVertices, sizeof(TerrainMesh::VertexType) * vertexCount) == 0);
+		}
+
+		quadTree.UpdateBounds();
+
+		// The refitted quadtree has to cull the same cells in the same order as one built from the new bounds.
+		int* visibleCells = new int[cellCount];
+		int* expectedCells = new int[cellCount];
+		bool cullsMatch = true;
+
+		for (int view = 0; view < 16; view++) {
+			Frustum frustum;
+			ConstructRandomFrustum(setup, state, frustum);
+			const Frustum* frustumList[1] = { &frustum };
+
+			int visibleCount = 0;
+			int expectedCount = 0;
+			int* visibleList[1] = { visibleCells };
+			int* expectedList[1] = { expectedCells };
+			cullsMatch = cullsMatch && terrain->CullViews(frustumList, 1, visibleList, &visibleCount, nullptr);
+			cullsMatch = cullsMatch && quadTree.CullViews(frustumList, 1, expectedList, &expectedCount, nullptr);
+			cullsMatch = cullsMatch && (visibleCount == expectedCount) && (memcmp(visibleCells, expectedCells, sizeof(int) * expectedCount) == 0);
+		}
+
+		// The level of detail errors measured whole.
+		TerrainLod lod;
+		TEST_CHECK(harness, lod.Initialize(heightField, setup.cellWidth, setup.cellHeight, cellCountX, cellCountY));
+		TEST_CHECK(harness, lod.GetLevelCount() == terrain->GetLodLevelCount());
+
+		bool errorsMatch = true;
+		for (int cellId = 0; cellId < cellCount; cellId++) {
+			errorsMatch = errorsMatch && (memcmp(lod.GetCellErrors(cellId), terrain->GetCellLodErrors(cellId), sizeof(float) * lod.GetLevelCount()) == 0);
+		}
+
+		// The pyramid bounds the corners of the quads as the cells decode them.  Every quad is in exactly one cell.
+		int quadCountX = setup.terrainWidth - 1;
+		int quadCountY = setup.terrainHeight - 1;
+		float* quadMins = new float[quadCountX * quadCountY];
+		float* quadMaxs = new float[quadCountX * quadCountY];
+
+		for (int row = 0; row < quadCountY; row++) {
+			for (int column = 0; column < quadCountX; column++) {
+				int cellId = ((row / (setup.cellHeight - 1)) * cellCountX) + (column / (setup.cellWidth - 1));
+				const TerrainMesh::VertexType* corner = vertices + (cellId * vertexCount) + ((row % (setup.cellHeight - 1)) * setup.cellWidth) + (column % (setup.cellWidth - 1));
+				const TerrainMesh::DecodeType& decode = decodes[cellId];
+				float minHeight = FLT_MAX;
+				float maxHeight = -FLT_MAX;
+
+				for (int k = 0; k < 4; k++) {
+					const TerrainMesh::VertexType& vertex = corner[((k >> 1) * setup.cellWidth) + (k & 1)];
+					float cornerHeight = decode.minHeight + (static_cast<float>(vertex.position[2]) * decode.heightStep);
+
+					minHeight = std::min(minHeight, cornerHeight);
+					maxHeight = std::max(maxHeight, cornerHeight);
+				}
+
+				quadMins[(row * quadCountX) + column] = minHeight;
+				quadMaxs[(row * quadCountX) + column] = maxHeight;
+			}
+		}
+
+		// Random rectangles of every size, some over the edges.  The answer has to hold the quads the rectangle touches
+		// and be exactly the quads of the blocks the pyramid merges for it, which are one leaf of one quad wide at the
+		// bottom level and double in size each level up.
+		bool pyramidMatch = true;
+		float backZ = static_cast<float>(setup.terrainHeight - 1);
+
+		for (int rectangle = 0; rectangle < 500; rectangle++) {
+			float sizeX = GetRandom(state) * GetRandom(state) * static_cast<float>(quadCountX);
+			float sizeZ = GetRandom(state) * GetRandom(state) * static_cast<float>(quadCountY);
+			float minX = (GetRandom(state) * (static_cast<float>(quadCountX) + 8.0f)) - 4.0f - (sizeX * 0.5f);
+			float minZ = (GetRandom(state) * (static_cast<float>(quadCountY) + 8.0f)) - 4.0f - (sizeZ * 0.5f);
+
+			float minHeight;
+			float maxHeight;
+			if (!terrain->GetHeightBounds(minX, minZ, minX + sizeX, minZ + sizeZ, minHeight, maxHeight)) {
+				continue;
+			}
+
+			int startColumn = std::min(static_cast<int>(std::max(floorf(minX), 0.0f)), quadCountX - 1);
+			int startRow = std::min(static_cast<int>(std::max(floorf(backZ - (minZ + sizeZ)), 0.0f)), quadCountY - 1);
+			int endColumn = std::max(static_cast<int>(std::min(ceilf(minX + sizeX), static_cast<float>(quadCountX))), startColumn + 1);
+			int endRow = std::max(static_cast<int>(std::min(ceilf(backZ - minZ), static_cast<float>(quadCountY))), startRow + 1);
+
+			int span = std::max(endColumn - 1 - startColumn, endRow - 1 - startRow);
+			int level = 0;
+			while ((span > 1) && ((1 << level) < span)) {
+				level++;
+			}
+
+			int blockStartColumn = (startColumn >> level) << level;
+			int blockStartRow = (startRow >> level) << level;
+			int blockEndColumn = std::min((((endColumn - 1) >> level) + 1) << level, quadCountX);
+			int blockEndRow = std::min((((endRow - 1) >> level) + 1) << level, quadCountY);
+
+			float touchedMin = FLT_MAX;
+			float touchedMax = -FLT_MAX;
+			float blockMin = FLT_MAX;
+			float blockMax = -FLT_MAX;
+
+			for (int row = blockStartRow; row < blockEndRow; row++) {
+				for (int column = blockStartColumn; column < blockEndColumn; column++) {
+					float quadMin = quadMins[(row * quadCountX) + column];
+					float quadMax = quadMaxs[(row * quadCountX) + column];
+
+					blockMin = std::min(blockMin, quadMin);
+					blockMax = std::max(blockMax, quadMax);
+
+					if ((row >= startRow) && (row < endRow) && (column >= startColumn) && (column < endColumn)) {
+						touchedMin = std::min(touchedMin, quadMin);
+						touchedMax = std::max(touchedMax, quadMax);
+					}
+				}
+			}
+
+			pyramidMatch = pyramidMatch && (minHeight <= touchedMin) && (maxHeight >= touchedMax) && (minHeight == blockMin) && (maxHeight == blockMax);
+		}
+
+		TEST_CHECK(harness, heightsMatch);
+		TEST_CHECK(harness, normalsMatch);
+		TEST_CHECK(harness, boundsMatch);
+		TEST_CHECK(harness, decodesMatch);
+		TEST_CHECK(harness, verticesMatch);
+		TEST_CHECK(harness, cullsMatch);
+		TEST_CHECK(harness, errorsMatch);
+		TEST_CHECK(harness, pyramidMatch);
+
+		delete[] quadMaxs;
+		delete[] quadMins;
+		delete[] expectedCells;
+		delete[] visibleCells;
+		delete[] decodes;
+		delete[] cellVertices;
+		delete[] vertices;
+		delete heightField;
+	}
+}
+
+void TestTerrainEdits(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	// Neither side is a whole number of cells, so the last cells hang over the far edges into the padding.
+	TestTerrain::SetupType setup = TestTerrain::GetSyntheticSetup(170, 17);
+	setup.terrainHeight = 121;
+	setup.editable = true;
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("terrain-edits", setup));
+
+	Terrain* terrain = new Terrain;
+	bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+	TEST_CHECK(harness, result);
+	TEST_CHECK(harness, terrain->GetHeightField() != nullptr);
+	if (!result || !terrain->GetHeightField()) {
+		delete terrain;
+		return;
+	}
+
+	ID3D11DeviceContext* deviceContext = device.GetDeviceContext();
+	float farX = static_cast<float>(setup.terrainWidth - 1);
+	float farZ = static_cast<float>(setup.terrainHeight - 1);
+
+	// Every kind of brush on each corner first, then a random mix checked every so often.
+	const float corners[4][2] = { { 0.0f, 0.0f }, { farX, 0.0f }, { 0.0f, farZ }, { farX, farZ } };
+	bool applied = true;
+
+	for (int corner = 0; corner < 4; corner++) {
+		applied = applied && terrain->RaiseTerrain(deviceContext, corners[corner][0], corners[corner][1], 6.0f, 30.0f);
+		applied = applied && terrain->SmoothTerrain(deviceContext, corners[corner][0] + 2.0f, corners[corner][1] - 1.0f, 9.0f, 0.8f);
+		applied = applied && terrain->FlattenTerrain(deviceContext, corners[corner][0] - 3.0f, corners[corner][1] + 3.0f, 7.0f, 10.0f, 0.6f);
+		applied = applied && terrain->LowerTerrain(deviceContext, corners[corner][0] + 1.0f, corners[corner][1] + 1.0f, 4.0f, 12.0f);
+	}
+
+	unsigned int state = 0x5bd1e995u;
+	CheckEditedTerrain(harness, terrain, deviceContext, setup, state);
+
+	int editCount = 0;
+	for (int round = 0; round < 3; round++) {
+		for (int edit = 0; edit < 20; edit++) {
+			if (ApplyRandomEdit(terrain, deviceContext, setup, state)) {
+				editCount++;
+			}
+		}
+
+		CheckEditedTerrain(harness, terrain, deviceContext, setup, state);
+	}
+
+	// A brush that misses the terrain leaves it alone.
+	TEST_CHECK(harness, !terrain->RaiseTerrain(deviceContext, -30.0f, farZ * 0.5f, 10.0f, 5.0f));
+
+	harness.Report("%d random edits applied after the corners", editCount);
+	TEST_CHECK(harness, applied);
+	TEST_CHECK(harness, editCount > 40);
+
+	delete terrain;
+}
+
+void BenchmarkTerrainEdits(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	TestTerrain::SetupType setup = TestTerrain::GetShippedSetup();
+	setup.editable = true;
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("edit-benchmark", setup));
+
+	Terrain* terrain = new Terrain;
+	bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+	TEST_CHECK(harness, result);
+	if (!result) {
+		delete terrain;
+		return;
+	}
+
+	// Radius 16 brushes away from the edges, as an editor drags them across the terrain.
+	const int editCount = 200;
+	const float radius = 16.0f;
+	ID3D11DeviceContext* deviceContext = device.GetDeviceContext();
+	unsigned int state = 0x9e3779b9u;
+	double totalTime = 0.0;
+	double maxTime = 0.0;
+
+	for (int edit = 0; edit < editCount; edit++) {
+		float positionX = radius + (GetRandom(state) * (static_cast<float>(setup.terrainWidth - 1) - (2.0f * radius)));
+		float positionZ = radius + (GetRandom(state) * (static_cast<float>(setup.terrainHeight - 1) - (2.0f * radius)));
+
+		double startTime = TestHarness::GetTime();
+		TEST_CHECK(harness, terrain->RaiseTerrain(deviceContext, positionX, positionZ, radius, 4.0f));
+		double time = TestHarness::GetTime() - startTime;
+
+		totalTime += time;
+		maxTime = std::max(maxTime, time);
+	}
+
+	double averageTime = totalTime / static_cast<double>(editCount);
+	harness.Report("radius %g edit: %.3f ms average, %.3f ms worst over %d edits", radius, averageTime * 1000.0, maxTime * 1000.0, editCount);
+	TEST_CHECK(harness, averageTime < 0.001);
+
+	delete terrain;
+}
@@ -0,0 +1,351 @@
+#include "pch.h"
+#include "Tests.h"
+#include "TestTerrain.h"
+#include "TerrainKernels.h"
+
+namespace {
+	// The two pass normals the fused kernel replaced.  The face normals of the whole terrain go into an array first and
+	// each vertex then sums and normalizes the faces around it that are inside the terrain.
+	void CalculateReferenceNormals(const HeightField* heightField, unsigned int* packedNormals) {
+		int terrainWidth = heightField->GetTerrainWidth();
+		int terrainHeight = heightField->GetTerrainHeight();
+		float* faces = new float[(terrainWidth - 1) * (terrainHeight - 1) * 3];
+
+		for (int j = 0; j < terrainHeight - 1; j++) {
+			for (int i = 0; i < terrainWidth - 1; i++) {
+				// Bottom left, bottom right and upper left corners of the face.
+				float vertex1[3] = { heightField->GetPositionX(i), heightField->GetHeight(i, j + 1), heightField->GetPositionZ(j + 1) };
+				float vertex2[3] = { heightField->GetPositionX(i + 1), heightField->GetHeight(i + 1, j + 1), heightField->GetPositionZ(j + 1) };
+				float vertex3[3] = { heightField->GetPositionX(i), heightField->GetHeight(i, j), heightField->GetPositionZ(j) };
+				float vector1[3] = { vertex1[0] - vertex3[0], vertex1[1] - vertex3[1], vertex1[2] - vertex3[2] };
+				float vector2[3] = { vertex3[0] - vertex2[0], vertex3[1] - vertex2[1], vertex3[2] - vertex2[2] };
+				float* face = faces + ((((j * (terrainWidth - 1)) + i)) * 3);
+
+				face[0] = (vector1[1] * vector2[2]) - (vector1[2] * vector2[1]);
+				face[1] = (vector1[2] * vector2[0]) - (vector1[0] * vector2[2]);
+				face[2] = (vector1[0] * vector2[1]) - (vector1[1] * vector2[0]);
+
+				float length = sqrtf((face[0] * face[0]) + (face[1] * face[1]) + (face[2] * face[2]));
+				face[0] /= length;
+				face[1] /= length;
+				face[2] /= length;
+			}
+		}
+
+		for (int j = 0; j < terrainHeight; j++) {
+			for (int i = 0; i < terrainWidth; i++) {
+				float sum[3] = { 0.0f, 0.0f, 0.0f };
+
+				// Bottom left, bottom right, upper left and upper right faces.
+				const int offsets[4][2] = { { -1, -1 }, { 0, -1 }, { -1, 0 }, { 0, 0 } };
+				for (const int* offset : offsets) {
+					int faceX = i + offset[0];
+					int faceY = j + offset[1];
+
+					if ((faceX >= 0) && (faceY >= 0) && (faceX < terrainWidth - 1) && (faceY < terrainHeight - 1)) {
+						const float* face = faces + (((faceY * (terrainWidth - 1)) + faceX) * 3);
+
+						sum[0] += face[0];
+						sum[1] += face[1];
+						sum[2] += face[2];
+					}
+				}
+
+				float length = sqrtf((sum[0] * sum[0]) + (sum[1] * sum[1]) + (sum[2] * sum[2]));
+				packedNormals[(j * terrainWidth) + i] = HeightField::PackNormal(sum[0] / length, sum[1] / length, sum[2] / length);
+			}
+		}
+
+		delete[] faces;
+	}
+
+	// Largest difference between the two signed 16 bit halves of two packed normals.
+	int GetPackedDifference(unsigned int a, unsigned int b) {
+		int low = std::abs(static_cast<int>(static_cast<short>(a & 0xffff)) - static_cast<int>(static_cast<short>(b & 0xffff)));
+		int high = std::abs(static_cast<int>(static_cast<short>(a >> 16)) - static_cast<int>(static_cast<short>(b >> 16)));
+
+		return std::max(low, high);
+	}
+
+	// The per face tangent frames the tangent kernel replaced.  Each quad is two triangles of a list with the first
+	// texture across the quad, and every triangle solves its tangent and binormal from its texture coordinates,
+	// normalizes both and copies them into its three vertices.  One row of quads at a time goes into frames, six
+	// floats for each of the six vertices of a quad.
+	void CalculateReferenceTangents(const HeightField* heightField, int row, float* frames) {
+		int terrainWidth = heightField->GetTerrainWidth();
+
+		// Upper left, upper right, bottom left, then bottom left, upper right, bottom right.
+		const int corners[6][2] = { { 0, 0 }, { 1, 0 }, { 0, 1 }, { 0, 1 }, { 1, 0 }, { 1, 1 } };
+
+		for (int i = 0; i < terrainWidth - 1; i++) {
+			for (int face = 0; face < 2; face++) {
+				float vertices[3][5];
+
+				for (int k = 0; k < 3; k++) {
+					const int* corner = corners[(face * 3) + k];
+					vertices[k][0] = heightField->GetPositionX(i + corner[0]);
+					vertices[k][1] = heightField->GetHeight(i + corner[0], row + corner[1]);
+					vertices[k][2] = heightField->GetPositionZ(row + corner[1]);
+					vertices[k][3] = static_cast<float>(corner[0]);
+					vertices[k][4] = static_cast<float>(corner[1]);
+				}
+
+				float vector1[3] = { vertices[1][0] - vertices[0][0], vertices[1][1] - vertices[0][1], vertices[1][2] - vertices[0][2] };
+				float vector2[3] = { vertices[2][0] - vertices[0][0], vertices[2][1] - vertices[0][1], vertices[2][2] - vertices[0][2] };
+				float tuVector[2] = { vertices[1][3] - vertices[0][3], vertices[2][3] - vertices[0][3] };
+				float tvVector[2] = { vertices[1][4] - vertices[0][4], vertices[2][4] - vertices[0][4] };
+				float den = 1.0f / ((tuVector[0] * tvVector[1]) - (tuVector[1] * tvVector[0]));
+
+				float tangent[3];
+				float binormal[3];
+				for (int k = 0; k < 3; k++) {
+					tangent[k] = ((tvVector[1] * vector1[k]) - (tvVector[0] * vector2[k])) * den;
+					binormal[k] = ((tuVector[0] * vector2[k]) - (tuVector[1] * vector1[k])) * den;
+				}
+
+				float length = sqrtf((tangent[0] * tangent[0]) + (tangent[1] * tangent[1]) + (tangent[2] * tangent[2]));
+				float binormalLength = sqrtf((binormal[0] * binormal[0]) + (binormal[1] * binormal[1]) + (binormal[2] * binormal[2]));
+
+				for (int k = 0; k < 3; k++) {
+					float* frame = frames + ((((i * 6) + (face * 3)) + k) * 6);
+
+					frame[0] = tangent[0] / length;
+					frame[1] = tangent[1] / length;
+					frame[2] = tangent[2] / length;
+					frame[3] = binormal[0] / binormalLength;
+					frame[4] = binormal[1] / binormalLength;
+					frame[5] = binormal[2] / binormalLength;
+				}
+			}
+		}
+	}
+}
+
+void TestNormalKernel(TestHarness& harness) {
+	// A whole number of cells and a terrain that overhangs its far edges, and the shipped map.
+	TestTerrain::SetupType setups[3] = { TestTerrain::GetSyntheticSetup(257, 33), TestTerrain::GetSyntheticSetup(203, 17), TestTerrain::GetShippedSetup() };
+	setups[1].terrainHeight = 150;
+
+	for (const TestTerrain::SetupType& setup : setups) {
+		TestTerrain testTerrain;
+		TEST_CHECK(harness, testTerrain.Initialize("normal-kernel", setup));
+
+		HeightField* heightField = testTerrain.CreateHeightField();
+		TEST_CHECK(harness, heightField != nullptr);
+		if (!heightField) {
+			continue;
+		}
+
+		int terrainWidth = setup.terrainWidth;
+		int terrainHeight = setup.terrainHeight;
+		unsigned int* reference = new unsigned int[terrainWidth * terrainHeight];
+		CalculateReferenceNormals(heightField, reference);
+
+		// The kernel sums the faces in a different order and skips the normalizes, so a normal can round to the next
+		// step of the packing but never further.  The far edges of a padded field also take the flat faces of the
+		// padding, which the two pass normals never had, so only the samples inside them are compared.
+		int checkWidth = (heightField->GetWidth() > terrainWidth) ? terrainWidth - 1 : terrainWidth;
+		int checkHeight = (heightField->GetHeight() > terrainHeight) ? terrainHeight - 1 : terrainHeight;
+		int differentCount = 0;
+		int maxDifference = 0;
+
+		for (int j = 0; j < checkHeight; j++) {
+			const unsigned int* normals = heightField->GetNormalRow(j);
+
+			for (int i = 0; i < checkWidth; i++) {
+				int difference = GetPackedDifference(normals[i], reference[(j * terrainWidth) + i]);
+
+				differentCount += (difference != 0) ? 1 : 0;
+				maxDifference = std::max(maxDifference, difference);
+			}
+		}
+
+		harness.Report("%dx%d: %d of %d normals differ, by at most %d steps", terrainWidth, terrainHeight, differentCount, checkWidth * checkHeight, maxDifference);
+		TEST_CHECK(harness, maxDifference <= 1);
+
+		// Editing recomputes a block of columns, which has to give the same normals as the whole rows.
+		unsigned int* rows = new unsigned int[heightField->GetRowPitch() * heightField->GetHeight()];
+		memcpy(rows, heightField->GetNormalRow(0), sizeof(unsigned int) * heightField->GetRowPitch() * heightField->GetHeight());
+
+		TerrainKernels::CalculateNormals(heightField, 5, heightField->GetHeight() - 3, 3, heightField->GetWidth() - 7);
+		TEST_CHECK(harness, memcmp(rows, heightField->GetNormalRow(0), sizeof(unsigned int) * heightField->GetRowPitch() * heightField->GetHeight()) == 0);
+
+		delete[] rows;
+		delete[] reference;
+		delete heightField;
+	}
+}
+
+void BenchmarkNormalKernel(TestHarness& harness) {
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("normal-benchmark", TestTerrain::GetShippedSetup()));
+
+	HeightField* heightField = testTerrain.CreateHeightField();
+	TEST_CHECK(harness, heightField != nullptr);
+	if (!heightField) {
+		return;
+	}
+
+	unsigned int* reference = new unsigned int[heightField->GetTerrainWidth() * heightField->GetTerrainHeight()];
+
+	// Both run the whole terrain on one thread, best of a few runs.
+	const int runCount = 5;
+	double referenceTime = DBL_MAX;
+	double kernelTime = DBL_MAX;
+
+	for (int run = 0; run < runCount; run++) {
+		double startTime = TestHarness::GetTime();
+		CalculateReferenceNormals(heightField, reference);
+		referenceTime = std::min(referenceTime, TestHarness::GetTime() - startTime);
+
+		startTime = TestHarness::GetTime();
+		TerrainKernels::CalculateNormals(heightField, 0, heightField->GetHeight());
+		kernelTime = std::min(kernelTime, TestHarness::GetTime() - startTime);
+	}
+
+	harness.Report("two pass: %.2f ms", referenceTime * 1000.0);
+	harness.Report("fused %s: %.2f ms, %.1fx", TerrainKernels::SupportsAvx2() ? "AVX2" : "SSE2", kernelTime * 1000.0, referenceTime / kernelTime);
+
+	delete[] reference;
+	delete heightField;
+}
+
+void TestTangentKernel(TestHarness& harness) {
+	// Neither side is a whole number of vectors, so every row ends in the scalar tail of the vector paths.
+	TestTerrain::SetupType setup = TestTerrain::GetSyntheticSetup(203, 17);
+	setup.terrainHeight = 150;
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("tangent-kernel", setup));
+
+	HeightField* heightField = testTerrain.CreateHeightField();
+	TEST_CHECK(harness, heightField != nullptr);
+	if (!heightField) {
+		return;
+	}
+
+	// Whole rows and then row segments the length of a cell and shorter, from the first column, from odd columns and
+	// up to the last, on the first, last and every other row.
+	int width = heightField->GetWidth();
+	int height = heightField->GetHeight();
+	const int segments[5][2] = { { 0, width }, { 0, setup.cellWidth }, { 3, 13 }, { setup.cellWidth - 1, setup.cellWidth }, { width - 11, 11 } };
+	const int frameCount = 4;
+	int segmentFrames = 0;
+
+	for (const int* segment : segments) {
+		segmentFrames += segment[1] * frameCount;
+	}
+
+	TerrainKernels::InstructionSet originalSet = TerrainKernels::GetInstructionSet();
+	int setCount = TerrainKernels::SupportsAvx2() ? 3 : 2;
+	float* frames[3];
+
+	for (int set = 0; set < setCount; set++) {
+		TerrainKernels::SetInstructionSet(static_cast<TerrainKernels::InstructionSet>(set));
+
+		frames[set] = new float[height * segmentFrames];
+		float* output = frames[set];
+
+		for (int row = 0; row < height; row++) {
+			for (const int* segment : segments) {
+				int count = segment[1];
+				TerrainKernels::CalculateTangentFrames(heightField, row, segment[0], count, output, output + count, output + (count * 2), output + (count * 3));
+				output += count * frameCount;
+			}
+		}
+	}
+
+	TerrainKernels::SetInstructionSet(originalSet);
+
+	// Every set has to give the scalar frames bit for bit.
+	bool setsMatch = true;
+	for (int set = 1; set < setCount; set++) {
+		setsMatch = setsMatch && (memcmp(frames[set], frames[0], sizeof(float) * height * segmentFrames) == 0);
+	}
+
+	// And the scalar frames are unit length, with the tangent up the slope along +X and the binormal down the rows.
+	bool framesUnit = true;
+	for (int row = 0; row < height; row++) {
+		const float* output = frames[0] + (row * segmentFrames);
+		int count = segments[0][1];
+
+		for (int i = 0; i < count; i++) {
+			float tangentX = output[i];
+			float tangentY = output[count + i];
+			float binormalY = output[(count * 2) + i];
+			float binormalZ = output[(count * 3) + i];
+
+			framesUnit = framesUnit && (fabsf((tangentX * tangentX) + (tangentY * tangentY) - 1.0f) <= 1.0e-6f) && (tangentX > 0.0f);
+			framesUnit = framesUnit && (fabsf((binormalY * binormalY) + (binormalZ * binormalZ) - 1.0f) <= 1.0e-6f) && (binormalZ < 0.0f);
+		}
+	}
+
+	harness.Report("%dx%d field: %d instruction sets over %d rows", width, height, setCount, height);
+
+	TEST_CHECK(harness, setsMatch);
+	TEST_CHECK(harness, framesUnit);
+
+	for (int set = 0; set < setCount; set++) {
+		delete[] frames[set];
+	}
+	delete heightField;
+}
+
+void BenchmarkTangentKernel(TestHarness& harness) {
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("tangent-benchmark", TestTerrain::GetShippedSetup()));
+
+	HeightField* heightField = testTerrain.CreateHeightField();
+	TEST_CHECK(harness, heightField != nullptr);
+	if (!heightField) {
+		return;
+	}
+
+	int terrainWidth = heightField->GetTerrainWidth();
+	int terrainHeight = heightField->GetTerrainHeight();
+	float* referenceFrames = new float[(terrainWidth - 1) * 6 * 6];
+	float* frames = new float[terrainWidth * 4];
+
+	// Both cover the whole terrain a row at a time on one thread, best of a few runs.  The faces fill a row of the old
+	// triangle list and the kernel a row of vertex frames.
+	const int runCount = 5;
+	double referenceTime = DBL_MAX;
+	double scalarTime = DBL_MAX;
+	double kernelTime = DBL_MAX;
+	float checksum = 0.0f;
+	TerrainKernels::InstructionSet originalSet = TerrainKernels::GetInstructionSet();
+
+	for (int run = 0; run < runCount; run++) {
+		double startTime = TestHarness::GetTime();
+		for (int row = 0; row < terrainHeight - 1; row++) {
+			CalculateReferenceTangents(heightField, row, referenceFrames);
+			checksum += referenceFrames[row % ((terrainWidth - 1) * 36)];
+		}
+		referenceTime = std::min(referenceTime, TestHarness::GetTime() - startTime);
+
+		// The scalar path shows how much of the gain is the work the faces did and how much is the vectors.
+		for (int set = 0; set < 2; set++) {
+			TerrainKernels::SetInstructionSet((set == 0) ? TerrainKernels::SCALAR : originalSet);
+
+			startTime = TestHarness::GetTime();
+			for (int row = 0; row < terrainHeight; row++) {
+				TerrainKernels::CalculateTangentFrames(heightField, row, 0, terrainWidth, frames, frames + terrainWidth, frames + (terrainWidth * 2), frames + (terrainWidth * 3));
+				checksum += frames[row % (terrainWidth * 4)];
+			}
+			double time = TestHarness::GetTime() - startTime;
+
+			scalarTime = (set == 0) ? std::min(scalarTime, time) : scalarTime;
+			kernelTime = (set == 1) ? std::min(kernelTime, time) : kernelTime;
+		}
+	}
+
+	TerrainKernels::SetInstructionSet(originalSet);
+
+	harness.Report("per face: %.2f ms", referenceTime * 1000.0);
+	harness.Report("per vertex scalar: %.2f ms, %.1fx", scalarTime * 1000.0, referenceTime / scalarTime);
+	harness.Report("per vertex %s: %.2f ms, %.1fx (checksum %g)", TerrainKernels::SupportsAvx2() ? "AVX2" : "SSE2", kernelTime * 1000.0, referenceTime / kernelTime, checksum);
+
+	delete[] frames;
+	delete[] referenceFrames;
+	delete heightField;
+}
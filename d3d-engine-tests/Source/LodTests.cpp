@@ -0,0 +1,420 @@
+#include "pch.h"
+#include "Tests.h"
+#include "TestDevice.h"
+#include "TestTerrain.h"
+#include "Terrain.h"
+#include "TerrainLod.h"
+#include "TerrainMesh.h"
+
+using namespace DirectX;
+
+namespace {
+	struct GridType {
+		int cellWidth;
+		int cellHeight;
+		int cellCountX;
+		int cellCountY;
+		int terrainWidth;
+		int terrainHeight;
+	};
+
+	// Camera paths recorded over the terrain as fractions of its size, each flown in a straight line between its
+	// points.  They cross the middle, skim the edges, circle a corner and come in from outside the terrain.
+	const int PATH_LENGTH = 6;
+	const int PATH_STEPS = 40;
+	const float PATHS[][PATH_LENGTH][2] = {
+		{ { -0.2f, 0.5f }, { 0.1f, 0.45f }, { 0.4f, 0.55f }, { 0.6f, 0.5f }, { 0.9f, 0.4f }, { 1.2f, 0.5f } },
+		{ { 0.0f, 0.0f }, { 0.2f, 0.25f }, { 0.5f, 0.5f }, { 0.55f, 0.6f }, { 0.8f, 0.85f }, { 1.0f, 1.0f } },
+		{ { 0.02f, 0.98f }, { 0.3f, 0.99f }, { 0.6f, 0.97f }, { 0.98f, 0.98f }, { 0.99f, 0.6f }, { 0.97f, 0.02f } },
+		{ { 0.1f, 0.0f }, { 0.2f, 0.05f }, { 0.25f, 0.2f }, { 0.15f, 0.3f }, { 0.05f, 0.2f }, { 0.1f, 0.1f } },
+		{ { 3.0f, -1.0f }, { 2.0f, 0.0f }, { 1.5f, 0.3f }, { 1.05f, 0.5f }, { 0.7f, 0.6f }, { 0.5f, 0.5f } },
+	};
+
+	// The morph the terrain vertex shader applies at a distance.
+	float GetMorphWeight(float start, float end, float distance) {
+		float scale = (end > start) ? (1.0f / (end - start)) : 0.0f;
+
+		return std::min(std::max((distance - start) * scale, 0.0f), 1.0f);
+	}
+
+	// Finest level a grid point along a cell edge is drawn in, which the vertex shader gets from its lowest set bit.
+	int GetVertexLevel(int index, int levelCount) {
+		int level = 0;
+
+		while ((level < levelCount - 1) && ((index & (1 << level)) == 0)) {
+			level++;
+		}
+
+		return level;
+	}
+
+	// Distance across the ground from the camera to a grid point of the terrain, which collapses onto the far edges.
+	float GetPointDistance(const GridType& grid, int x, int y, float cameraX, float cameraZ) {
+		float positionX = static_cast<float>(std::min(x, grid.terrainWidth - 1)) - cameraX;
+		float positionZ = static_cast<float>(std::max(grid.terrainHeight - 1 - y, 0)) - cameraZ;
+
+		return sqrtf((positionX * positionX) + (positionZ * positionZ));
+	}
+
+	struct ResultType {
+		bool selected;
+		bool budget;
+		bool neighbours;
+		bool edges;
+		bool sealed;
+	};
+
+	// Selects the levels of every cell for one camera position and checks that each cell keeps to the error budget, that
+	// no cell is more than a level from the cells around it and that the two copies of every shared edge vertex agree.
+	void CheckLevels(const TerrainLod& lod, const GridType& grid, float pixelError, float projectionScale, float cameraX, float cameraZ, int* levels, int* histogram, ResultType& result) {
+		int cellCount = grid.cellCountX * grid.cellCountY;
+		int levelCount = lod.GetLevelCount();
+
+		int* cellIds = new int[cellCount];
+		for (int i = 0; i < cellCount; i++) {
+			cellIds[i] = i;
+		}
+
+		lod.SelectLevels(cameraX, cameraZ, cellIds, cellCount, levels);
+
+		for (int cellId = 0; cellId < cellCount; cellId++) {
+			float distance = lod.GetCellDistance(cellId, cameraX, cameraZ);
+			const float* errors = lod.GetCellErrors(cellId);
+			int level = levels[cellId];
+
+			histogram[level]++;
+			result.selected = result.selected && (level == lod.SelectLevel(cellId, distance));
+
+			// The level drawn projects to within the budget, and so does the next one once the cell starts morphing to it.
+			float allowed = pixelError * distance * 1.0001f;
+			if (level > 0) {
+				result.budget = result.budget && (errors[level] * projectionScale <= allowed);
+			}
+
+			if ((level < levelCount - 1) && (distance >= lod.GetMorphStart(cellId, level))) {
+				result.budget = result.budget && (errors[level + 1] * projectionScale <= allowed);
+			}
+
+			int nodeIndexX = cellId % grid.cellCountX;
+			int nodeIndexY = cellId / grid.cellCountX;
+
+			for (int offsetY = -1; offsetY <= 1; offsetY++) {
+				for (int offsetX = -1; offsetX <= 1; offsetX++) {
+					int neighbourX = nodeIndexX + offsetX;
+					int neighbourY = nodeIndexY + offsetY;
+
+					if ((neighbourX >= 0) && (neighbourY >= 0) && (neighbourX < grid.cellCountX) && (neighbourY < grid.cellCountY)) {
+						result.neighbours = result.neighbours && (std::abs(level - levels[(neighbourY * grid.cellCountX) + neighbourX]) <= 1);
+					}
+				}
+			}
+		}
+
+		// Walk the right and bottom edge of every cell, so each shared edge once.
+		for (int cellId = 0; cellId < cellCount; cellId++) {
+			int nodeIndexX = cellId % grid.cellCountX;
+			int nodeIndexY = cellId / grid.cellCountX;
+
+			for (int side = 0; side < 2; side++) {
+				bool vertical = (side == 0);
+				if ((vertical && (nodeIndexX == grid.cellCountX - 1)) || (!vertical && (nodeIndexY == grid.cellCountY - 1))) {
+					continue;
+				}
+
+				int neighbour = vertical ? cellId + 1 : cellId + grid.cellCountX;
+				int edge = vertical ? 1 : 3;
+				int neighbourEdge = vertical ? 0 : 2;
+				TerrainLod::MorphType morph = lod.GetMorph(cellId, levels[cellId]);
+				TerrainLod::MorphType neighbourMorph = lod.GetMorph(neighbour, levels[neighbour]);
+
+				// At the same level both cells morph the edge over the same band.
+				if (levels[cellId] == levels[neighbour]) {
+					result.edges = result.edges && (morph.edgeStarts[edge] == neighbourMorph.edgeStarts[neighbourEdge]) && (morph.edgeEnds[edge] == neighbourMorph.edgeEnds[neighbourEdge]);
+					continue;
+				}
+
+				// A level apart, the finer cell's own edge vertices have to be fully on the coarser edge and the coarser
+				// cell's edge vertices, which the finer cell draws where they are, can't have started moving.  The
+				// shader's reciprocal can leave a fully morphed weight a rounding step under one.
+				bool finerFirst = levels[cellId] < levels[neighbour];
+				int fineLevel = std::min(levels[cellId], levels[neighbour]);
+				const TerrainLod::MorphType& fine = finerFirst ? morph : neighbourMorph;
+				const TerrainLod::MorphType& coarse = finerFirst ? neighbourMorph : morph;
+				int fineEdge = finerFirst ? edge : neighbourEdge;
+				int coarseEdge = finerFirst ? neighbourEdge : edge;
+				int edgeLength = vertical ? grid.cellHeight - 1 : grid.cellWidth - 1;
+
+				for (int k = 1; k < edgeLength; k++) {
+					int x = vertical ? (nodeIndexX + 1) * (grid.cellWidth - 1) : (nodeIndexX * (grid.cellWidth - 1)) + k;
+					int y = vertical ? (nodeIndexY * (grid.cellHeight - 1)) + k : (nodeIndexY + 1) * (grid.cellHeight - 1);
+					float distance = GetPointDistance(grid, x, y, cameraX, cameraZ);
+					int vertexLevel = GetVertexLevel(k, levelCount);
+
+					if (vertexLevel == fineLevel) {
+						result.sealed = result.sealed && (GetMorphWeight(fine.edgeStarts[fineEdge], fine.edgeEnds[fineEdge], distance) >= 0.9999f);
+					}
+					else if (vertexLevel == fineLevel + 1) {
+						result.sealed = result.sealed && (GetMorphWeight(coarse.edgeStarts[coarseEdge], coarse.edgeEnds[coarseEdge], distance) == 0.0f);
+					}
+				}
+			}
+		}
+
+		delete[] cellIds;
+	}
+
+	// Flies every recorded path over the terrain and checks the levels at each step.
+	void CheckPaths(TestHarness& harness, const char* name, const TerrainLod& lod, const GridType& grid, float pixelError, float projectionScale) {
+		int levelCount = lod.GetLevelCount();
+		int* levels = new int[grid.cellCountX * grid.cellCountY];
+		int histogram[16] = {};
+		ResultType result = { true, true, true, true, true };
+
+		for (const auto& path : PATHS) {
+			for (int point = 0; point < PATH_LENGTH - 1; point++) {
+				for (int step = 0; step < PATH_STEPS; step++) {
+					float t = static_cast<float>(step) / static_cast<float>(PATH_STEPS);
+					float cameraX = ((path[point][0] * (1.0f - t)) + (path[point + 1][0] * t)) * static_cast<float>(grid.terrainWidth - 1);
+					float cameraZ = ((path[point][1] * (1.0f - t)) + (path[point + 1][1] * t)) * static_cast<float>(grid.terrainHeight - 1);
+
+					CheckLevels(lod, grid, pixelError, projectionScale, cameraX, cameraZ, levels, histogram, result);
+				}
+			}
+		}
+
+		char counts[128] = "";
+		for (int level = 0; level < levelCount; level++) {
+			char count[16];
+			sprintf_s(count, "%s%d", (level > 0) ? " " : "", histogram[level]);
+			strcat_s(counts, count);
+		}
+
+		harness.Report("%s, %g pixels: cells at each level %s", name, pixelError, counts);
+
+		TEST_CHECK(harness, result.selected);
+		TEST_CHECK(harness, result.budget);
+		TEST_CHECK(harness, result.neighbours);
+		TEST_CHECK(harness, result.edges);
+		TEST_CHECK(harness, result.sealed);
+
+		delete[] levels;
+	}
+}
+
+void TestLodSelection(TestHarness& harness) {
+	// A 1080 line screen with a 45 degree field of view, as the scene sets it up.
+	const float projectionScale = 540.0f / tanf(3.14159265f / 8.0f);
+
+	TestTerrain::SetupType setup = TestTerrain::GetSyntheticSetup(513, 33);
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("lod-selection", setup));
+
+	HeightField* heightField = testTerrain.CreateHeightField();
+	TEST_CHECK(harness, heightField != nullptr);
+	if (!heightField) {
+		return;
+	}
+
+	GridType grid = { setup.cellWidth, setup.cellHeight, (heightField->GetWidth() - 1) / (setup.cellWidth - 1), (heightField->GetHeight() - 1) / (setup.cellHeight - 1), setup.terrainWidth, setup.terrainHeight };
+
+	// The errors measured on the terrain, at budgets from tight to loose enough to bring out the coarse levels.
+	TerrainLod lod;
+	TEST_CHECK(harness, lod.Initialize(heightField, grid.cellWidth, grid.cellHeight, grid.cellCountX, grid.cellCountY));
+
+	const float pixelErrors[] = { 2.0f, 32.0f, 512.0f };
+	for (float pixelError : pixelErrors) {
+		lod.SetErrorBudget(pixelError, projectionScale);
+		CheckPaths(harness, "measured", lod, grid, pixelError, projectionScale);
+	}
+
+	// Flat cells next to rough ones want levels far apart, which the selection has to hold to one level.  The errors
+	// of each cell grow with the spacing of its levels.
+	int levelCount = lod.GetLevelCount();
+	int cellCount = grid.cellCountX * grid.cellCountY;
+	float* cellErrors = new float[cellCount * levelCount];
+	const float roughness[4] = { 0.0f, 0.02f, 0.2f, 1.0f };
+
+	for (int cellId = 0; cellId < cellCount; cellId++) {
+		float cellRoughness = roughness[(TestTerrain::GetSyntheticHeight(cellId % grid.cellCountX, cellId / grid.cellCountX, 7) >> 6) & 3];
+
+		for (int level = 0; level < levelCount; level++) {
+			cellErrors[(cellId * levelCount) + level] = cellRoughness * static_cast<float>((1 << level) - 1);
+		}
+	}
+
+	lod.SetCellErrors(cellErrors);
+	lod.SetErrorBudget(8.0f, projectionScale);
+	CheckPaths(harness, "mixed", lod, grid, 8.0f, projectionScale);
+
+	// With the left half of the terrain flat and the right half rough, the flat cell at the left edge goes to a coarser
+	// level than the rough cell at the right edge the same distance away.
+	int* levels = new int[cellCount];
+	int* cellIds = new int[cellCount];
+	for (int i = 0; i < cellCount; i++) {
+		cellIds[i] = i;
+	}
+
+	for (int cellId = 0; cellId < cellCount; cellId++) {
+		for (int level = 0; level < levelCount; level++) {
+			cellErrors[(cellId * levelCount) + level] = ((cellId % grid.cellCountX) < grid.cellCountX / 2) ? 0.0f : static_cast<float>((1 << level) - 1);
+		}
+	}
+
+	int row = (grid.cellCountY / 2) - 1;
+	float centerX = static_cast<float>(grid.terrainWidth - 1) * 0.5f;
+	float centerZ = static_cast<float>(grid.terrainHeight - 1 - ((row + 1) * (grid.cellHeight - 1)));
+
+	lod.SetCellErrors(cellErrors);
+	lod.SelectLevels(centerX, centerZ, cellIds, cellCount, levels);
+
+	TEST_CHECK(harness, lod.GetCellDistance(row * grid.cellCountX, centerX, centerZ) == lod.GetCellDistance(((row + 1) * grid.cellCountX) - 1, centerX, centerZ));
+	TEST_CHECK(harness, levels[row * grid.cellCountX] > levels[((row + 1) * grid.cellCountX) - 1]);
+
+	delete[] cellIds;
+	delete[] levels;
+	delete[] cellErrors;
+	delete heightField;
+}
+
+void TestLodErrors(TestHarness& harness) {
+	TerrainLod lod;
+	TEST_CHECK(harness, lod.Initialize(33, 33, 4, 3, 129, 97));
+
+	int levelCount = lod.GetLevelCount();
+	TEST_CHECK(harness, levelCount == TerrainMesh::GetLevelCount(33, 33));
+
+	// Without a budget every cell stays at full resolution however far away it is.
+	TEST_CHECK(harness, lod.SelectLevel(0, 1.0e9f) == 0);
+	TEST_CHECK(harness, lod.SelectLevel(11, 1.0e9f) == 0);
+
+	// A paged terrain only measures some of its cells and every cell takes the worst of them.
+	float* sample = new float[2 * levelCount];
+	for (int level = 0; level < levelCount; level++) {
+		sample[level] = static_cast<float>(level);
+		sample[levelCount + level] = (level == 1) ? 10.0f : 0.5f;
+	}
+
+	lod.SetLevelErrors(sample, 2);
+
+	bool worst = true;
+	for (int cellId = 0; cellId < 12; cellId++) {
+		const float* errors = lod.GetCellErrors(cellId);
+
+		for (int level = 0; level < levelCount; level++) {
+			worst = worst && (errors[level] == std::max(sample[level], sample[levelCount + level]));
+		}
+	}
+
+	TEST_CHECK(harness, worst);
+
+	// Once there is a budget the bands grow outwards and only the coarsest level reaches every distance.
+	lod.SetErrorBudget(8.0f, 1000.0f);
+
+	bool ordered = true;
+	for (int cellId = 0; cellId < 12; cellId++) {
+		for (int level = 0; level < levelCount - 1; level++) {
+			ordered = ordered && (lod.GetMorphStart(cellId, level) < lod.GetMorphEnd(cellId, level)) && (lod.GetRange(cellId, level) < lod.GetRange(cellId, level + 1));
+			ordered = ordered && ((level == 0) || (lod.GetMorphStart(cellId, level) > lod.GetRange(cellId, level - 1)));
+		}
+
+		ordered = ordered && (lod.GetRange(cellId, levelCount - 1) == FLT_MAX);
+	}
+
+	TEST_CHECK(harness, ordered);
+	TEST_CHECK(harness, lod.SelectLevel(5, 1.0e9f) == levelCount - 1);
+
+	delete[] sample;
+}
+
+void TestLodEdit(TestHarness& harness) {
+	TestTerrain::SetupType setup = TestTerrain::GetSyntheticSetup(257, 33);
+	setup.editable = true;
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("lod-edit", setup));
+
+	HeightField* heightField = testTerrain.CreateHeightField();
+	TEST_CHECK(harness, heightField != nullptr);
+	if (!heightField) {
+		return;
+	}
+
+	int cellCountX = (heightField->GetWidth() - 1) / (setup.cellWidth - 1);
+	int cellCountY = (heightField->GetHeight() - 1) / (setup.cellHeight - 1);
+	int cellCount = cellCountX * cellCountY;
+
+	TerrainLod lod;
+	TEST_CHECK(harness, lod.Initialize(heightField, setup.cellWidth, setup.cellHeight, cellCountX, cellCountY));
+	lod.SetErrorBudget(8.0f, 1000.0f);
+
+	// Raise a spike across the corner of four cells and measure just those again, which has to come out the same as
+	// measuring the whole edited terrain.
+	for (int j = 28; j < 38; j++) {
+		for (int i = 60; i < 70; i++) {
+			heightField->SetHeight(i, j, heightField->GetHeight(i, j) + 50.0f);
+		}
+	}
+
+	lod.UpdateCellErrors(heightField, 1, 0, 2, 1);
+
+	TerrainLod measured;
+	TEST_CHECK(harness, measured.Initialize(heightField, setup.cellWidth, setup.cellHeight, cellCountX, cellCountY));
+	measured.SetErrorBudget(8.0f, 1000.0f);
+
+	int levelCount = lod.GetLevelCount();
+	bool same = true;
+
+	for (int cellId = 0; cellId < cellCount; cellId++) {
+		same = same && (memcmp(lod.GetCellErrors(cellId), measured.GetCellErrors(cellId), sizeof(float) * levelCount) == 0);
+
+		for (int level = 0; level < levelCount; level++) {
+			same = same && (lod.GetRange(cellId, level) == measured.GetRange(cellId, level)) && (lod.GetMorphStart(cellId, level) == measured.GetMorphStart(cellId, level));
+		}
+	}
+
+	TEST_CHECK(harness, same);
+
+	delete heightField;
+
+	// An edit to a loaded terrain has to reach its level of detail, so a spike raised in the middle of a cell makes it
+	// draw finer from the same place.
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	Terrain* terrain = new Terrain;
+	TEST_CHECK(harness, terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename()));
+
+	float centerX = static_cast<float>(setup.terrainWidth - 1) * 0.5f;
+	float centerZ = static_cast<float>(setup.terrainHeight - 1) * 0.5f;
+	Vector3 cameraPosition(centerX, 300.0f, centerZ - 400.0f);
+
+	Frustum frustum;
+	frustum.Initialize(1500.0f);
+	frustum.ConstructFrustum(XMMatrixPerspectiveFovLH(3.14159265f / 4.0f, 16.0f / 9.0f, 0.1f, 1500.0f),
+		XMMatrixLookAtLH(XMVectorSet(cameraPosition.x, cameraPosition.y, cameraPosition.z, 1.0f), XMVectorSet(centerX, 0.0f, centerZ, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)));
+
+	// A loose budget so the untouched cell is well away from full resolution.
+	terrain->SetLodErrorBudget(64.0f, 1000.0f);
+
+	int column = static_cast<int>(centerX) / (setup.cellWidth - 1);
+	int row = static_cast<int>(static_cast<float>(setup.terrainHeight - 1) - centerZ - 16.0f) / (setup.cellHeight - 1);
+	int cellId = (row * cellCountX) + column;
+
+	terrain->CullCells(&frustum);
+	terrain->SelectLod(cameraPosition);
+	int levelBefore = terrain->GetCellLodLevel(cellId);
+
+	float spikeX = static_cast<float>((column * (setup.cellWidth - 1)) + (setup.cellWidth / 2));
+	float spikeZ = static_cast<float>(setup.terrainHeight - 1 - ((row * (setup.cellHeight - 1)) + (setup.cellHeight / 2)));
+	TEST_CHECK(harness, terrain->RaiseTerrain(device.GetDeviceContext(), spikeX, spikeZ, 3.0f, 200.0f));
+
+	terrain->CullCells(&frustum);
+	terrain->SelectLod(cameraPosition);
+	int levelAfter = terrain->GetCellLodLevel(cellId);
+
+	harness.Report("edited cell went from level %d to level %d", levelBefore, levelAfter);
+	TEST_CHECK(harness, levelBefore > 0);
+	TEST_CHECK(harness, levelAfter < levelBefore);
+
+	delete terrain;
+}
@@ -0,0 +1,401 @@
+#include "pch.h"
+#include "Tests.h"
+#include "TestTerrain.h"
+#include "TerrainKernels.h"
+#include "TerrainMesh.h"
+
+#include <set>
+#include <utility>
+
+namespace {
+	// Angle in degrees between two directions.
+	double GetAngle(double ax, double ay, double az, double bx, double by, double bz) {
+		double dot = ((ax * bx) + (ay * by) + (az * bz)) / (sqrt((ax * ax) + (ay * ay) + (az * az)) * sqrt((bx * bx) + (by * by) + (bz * bz)));
+
+		return acos(std::min(std::max(dot, -1.0), 1.0)) * (180.0 / 3.14159265358979);
+	}
+
+	// Height the next level's surface has under a vertex that is dropped on the way out of the given level, on a field
+	// that is a whole number of cells so none of the coarser quads are squashed.
+	float GetReferenceMorphHeight(const HeightField* heightField, int x, int y, int i, int j, int level) {
+		int stride = 1 << level;
+		bool oddColumn = ((i >> level) & 1) != 0;
+		bool oddRow = ((j >> level) & 1) != 0;
+
+		if (oddColumn && oddRow) {
+			return (heightField->GetHeight(x + stride, y - stride) + heightField->GetHeight(x - stride, y + stride)) * 0.5f;
+		}
+
+		if (oddColumn) {
+			return (heightField->GetHeight(x - stride, y) + heightField->GetHeight(x + stride, y)) * 0.5f;
+		}
+
+		if (oddRow) {
+			return (heightField->GetHeight(x, y - stride) + heightField->GetHeight(x, y + stride)) * 0.5f;
+		}
+
+		return heightField->GetHeight(x, y);
+	}
+}
+
+void TestMeshIndices(TestHarness& harness) {
+	// Square and rectangular cells, down to a single quad and up to the most vertices 16 bit indices can reach.
+	const int sizes[][2] = { { 2, 2 }, { 3, 5 }, { 17, 17 }, { 33, 33 }, { 49, 33 }, { 65, 65 }, { 257, 255 } };
+
+	for (const int* size : sizes) {
+		int cellWidth = size[0];
+		int cellHeight = size[1];
+		int vertexCount = TerrainMesh::GetVertexCount(cellWidth, cellHeight);
+		int levelCount = TerrainMesh::GetLevelCount(cellWidth, cellHeight);
+
+		TEST_CHECK(harness, vertexCount == cellWidth * cellHeight);
+		TEST_CHECK(harness, vertexCount <= 65536);
+		TEST_CHECK(harness, TerrainMesh::GetIndexCount(cellWidth, cellHeight, 0) == (cellWidth - 1) * (cellHeight - 1) * 6);
+
+		int start = 0;
+		for (int level = 0; level < levelCount; level++) {
+			int stride = 1 << level;
+			int indexCount = TerrainMesh::GetIndexCount(cellWidth, cellHeight, level);
+
+			TEST_CHECK(harness, TerrainMesh::GetIndexStart(cellWidth, cellHeight, level) == start);
+			TEST_CHECK(harness, ((cellWidth - 1) % stride == 0) && ((cellHeight - 1) % stride == 0));
+			TEST_CHECK(harness, indexCount > 0 && indexCount % 6 == 0);
+			start += indexCount;
+
+			unsigned short* indices = new unsigned short[indexCount];
+			TerrainMesh::BuildIndices(indices, cellWidth, cellHeight, level);
+
+			// Every triangle uses grid points of this level, winds the same way and covers half a quad of the level.
+			// Together they have to cover the cell exactly once, which the total area and the shared edges show.
+			std::set<std::pair<int, int>> edges;
+			long long area = 0;
+			bool inRange = true;
+			bool onLevel = true;
+			bool wound = true;
+			bool manifold = true;
+
+			for (int t = 0; t < indexCount; t += 3) {
+				int columns[3];
+				int rows[3];
+
+				for (int k = 0; k < 3; k++) {
+					int index = indices[t + k];
+
+					inRange = inRange && (index < vertexCount);
+					columns[k] = index % cellWidth;
+					rows[k] = index / cellWidth;
+					onLevel = onLevel && (columns[k] % stride == 0) && (rows[k] % stride == 0);
+				}
+
+				long long twiceArea = (static_cast<long long>(columns[1] - columns[0]) * (rows[2] - rows[0])) -
+					(static_cast<long long>(columns[2] - columns[0]) * (rows[1] - rows[0]));
+				wound = wound && (twiceArea == static_cast<long long>(stride) * stride);
+				area += twiceArea;
+
+				for (int k = 0; k < 3; k++) {
+					manifold = edges.insert(std::make_pair(indices[t + k], indices[t + ((k + 1) % 3)])).second && manifold;
+				}
+			}
+
+			TEST_CHECK(harness, inRange);
+			TEST_CHECK(harness, onLevel);
+			TEST_CHECK(harness, wound);
+			TEST_CHECK(harness, area == 2ll * (cellWidth - 1) * (cellHeight - 1));
+
+			// No edge is used twice in the same direction, and an edge without its reverse is on the border of the cell.
+			bool closed = true;
+			for (const std::pair<int, int>& edge : edges) {
+				if (edges.count(std::make_pair(edge.second, edge.first)) != 0) {
+					continue;
+				}
+
+				int column0 = edge.first % cellWidth;
+				int row0 = edge.first / cellWidth;
+				int column1 = edge.second % cellWidth;
+				int row1 = edge.second / cellWidth;
+				bool border = ((column0 == column1) && ((column0 == 0) || (column0 == cellWidth - 1))) || ((row0 == row1) && ((row0 == 0) || (row0 == cellHeight - 1)));
+
+				closed = closed && border;
+			}
+
+			TEST_CHECK(harness, manifold);
+			TEST_CHECK(harness, closed);
+
+			delete[] indices;
+		}
+	}
+}
+
+void TestMeshVertices(TestHarness& harness) {
+	// A terrain that isn't a whole number of cells, so the last row and column of cells hang over the far edges.
+	TestTerrain::SetupType setup = TestTerrain::GetSyntheticSetup(140, 33);
+	setup.terrainHeight = 101;
+	setup.cellWidth = 17;
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("mesh-vertices", setup));
+
+	HeightField* heightField = testTerrain.CreateHeightField();
+	TEST_CHECK(harness, heightField != nullptr);
+	if (!heightField) {
+		return;
+	}
+
+	int cellCountX = (heightField->GetWidth() - 1) / (setup.cellWidth - 1);
+	int cellCountY = (heightField->GetHeight() - 1) / (setup.cellHeight - 1);
+	int vertexCount = TerrainMesh::GetVertexCount(setup.cellWidth, setup.cellHeight);
+	TerrainMesh::VertexType* vertices = new TerrainMesh::VertexType[vertexCount * cellCountX * cellCountY];
+
+	for (int nodeIndexY = 0; nodeIndexY < cellCountY; nodeIndexY++) {
+		for (int nodeIndexX = 0; nodeIndexX < cellCountX; nodeIndexX++) {
+			TerrainMesh::VertexType* cellVertices = vertices + (((nodeIndexY * cellCountX) + nodeIndexX) * vertexCount);
+			float bounds[6];
+
+			TerrainMesh::CalculateBounds(heightField, nodeIndexX, nodeIndexY, setup.cellWidth, setup.cellHeight, bounds);
+			TerrainMesh::DecodeType decode = TerrainMesh::GetDecode(bounds, setup.cellWidth, setup.cellHeight);
+			TerrainMesh::BuildVertices(cellVertices, decode, heightField, nodeIndexX, nodeIndexY, setup.cellWidth, setup.cellHeight);
+
+			// The vertices are the grid points of the cell in rows, and sit where the height field puts them.
+			bool inOrder = true;
+			bool inPlace = true;
+			bool inBounds = true;
+
+			for (int j = 0; j < setup.cellHeight; j++) {
+				for (int i = 0; i < setup.cellWidth; i++) {
+					const TerrainMesh::VertexType& vertex = cellVertices[(j * setup.cellWidth) + i];
+					int x = (nodeIndexX * (setup.cellWidth - 1)) + i;
+					int y = (nodeIndexY * (setup.cellHeight - 1)) + j;
+					Vector3 position = TerrainMesh::DecodePosition(vertex, decode);
+
+					inOrder = inOrder && (vertex.position[0] == i) && (vertex.position[1] == j);
+					inPlace = inPlace && (position.x == heightField->GetPositionX(x)) && (position.z == heightField->GetPositionZ(y));
+					inBounds = inBounds && (position.x >= bounds[3]) && (position.x <= bounds[0]) && (position.z <= bounds[2]) && (position.z >= bounds[5]) &&
+						(position.y >= bounds[4]) && (position.y <= bounds[1] + decode.heightStep);
+				}
+			}
+
+			TEST_CHECK(harness, inOrder);
+			TEST_CHECK(harness, inPlace);
+			TEST_CHECK(harness, inBounds);
+		}
+	}
+
+	// Cells share the grid points along their borders, so both copies have to agree on where they are and how they're lit.
+	bool shared = true;
+
+	for (int nodeIndexY = 0; nodeIndexY < cellCountY; nodeIndexY++) {
+		for (int nodeIndexX = 0; nodeIndexX + 1 < cellCountX; nodeIndexX++) {
+			const TerrainMesh::VertexType* left = vertices + (((nodeIndexY * cellCountX) + nodeIndexX) * vertexCount);
+			const TerrainMesh::VertexType* right = left + vertexCount;
+
+			for (int j = 0; j < setup.cellHeight; j++) {
+				const TerrainMesh::VertexType& a = left[(j * setup.cellWidth) + setup.cellWidth - 1];
+				const TerrainMesh::VertexType& b = right[j * setup.cellWidth];
+
+				shared = shared && (a.normal == b.normal) && (a.tangent == b.tangent) && ((a.color & 0x00ffffff) == (b.color & 0x00ffffff));
+			}
+		}
+	}
+
+	for (int nodeIndexY = 0; nodeIndexY + 1 < cellCountY; nodeIndexY++) {
+		for (int nodeIndexX = 0; nodeIndexX < cellCountX; nodeIndexX++) {
+			const TerrainMesh::VertexType* top = vertices + (((nodeIndexY * cellCountX) + nodeIndexX) * vertexCount);
+			const TerrainMesh::VertexType* bottom = top + (cellCountX * vertexCount);
+
+			for (int i = 0; i < setup.cellWidth; i++) {
+				const TerrainMesh::VertexType& a = top[((setup.cellHeight - 1) * setup.cellWidth) + i];
+				const TerrainMesh::VertexType& b = bottom[i];
+
+				shared = shared && (a.normal == b.normal) && (a.tangent == b.tangent) && ((a.color & 0x00ffffff) == (b.color & 0x00ffffff));
+			}
+		}
+	}
+
+	TEST_CHECK(harness, shared);
+
+	delete[] vertices;
+	delete heightField;
+}
+
+void TestHeightQuantization(TestHarness& harness) {
+	// A terrain that is a whole number of cells, with the first cell flattened so it has no height range at all.
+	TestTerrain::SetupType setup = TestTerrain::GetSyntheticSetup(257, 33);
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("height-quantization", setup));
+
+	HeightField* heightField = testTerrain.CreateHeightField();
+	TEST_CHECK(harness, heightField != nullptr);
+	if (!heightField) {
+		return;
+	}
+
+	for (int j = 0; j < setup.cellHeight; j++) {
+		for (int i = 0; i < setup.cellWidth; i++) {
+			heightField->SetHeight(i, j, 10.0f);
+		}
+	}
+
+	TerrainKernels::CalculateNormals(heightField, 0, heightField->GetHeight());
+
+	int cellCountX = (heightField->GetWidth() - 1) / (setup.cellWidth - 1);
+	int cellCountY = (heightField->GetHeight() - 1) / (setup.cellHeight - 1);
+	int vertexCount = TerrainMesh::GetVertexCount(setup.cellWidth, setup.cellHeight);
+	TerrainMesh::VertexType* vertices = new TerrainMesh::VertexType[vertexCount];
+
+	// Every height is rounded to the nearest step of its cell's range, so it decodes to within half a step.  The heights
+	// themselves are a few hundred units, which float arithmetic only holds to a few parts in ten million.
+	double maxHeightError = 0.0;
+	double maxMorphError = 0.0;
+	bool heightsInStep = true;
+	bool morphsInStep = true;
+	bool flatExact = true;
+
+	for (int nodeIndexY = 0; nodeIndexY < cellCountY; nodeIndexY++) {
+		for (int nodeIndexX = 0; nodeIndexX < cellCountX; nodeIndexX++) {
+			float bounds[6];
+			TerrainMesh::CalculateBounds(heightField, nodeIndexX, nodeIndexY, setup.cellWidth, setup.cellHeight, bounds);
+
+			TerrainMesh::DecodeType decode = TerrainMesh::GetDecode(bounds, setup.cellWidth, setup.cellHeight);
+			TerrainMesh::BuildVertices(vertices, decode, heightField, nodeIndexX, nodeIndexY, setup.cellWidth, setup.cellHeight);
+
+			for (int j = 0; j < setup.cellHeight; j++) {
+				for (int i = 0; i < setup.cellWidth; i++) {
+					const TerrainMesh::VertexType& vertex = vertices[(j * setup.cellWidth) + i];
+					int x = (nodeIndexX * (setup.cellWidth - 1)) + i;
+					int y = (nodeIndexY * (setup.cellHeight - 1)) + j;
+					int level = TerrainMesh::DecodeVertexLevel(vertex, decode);
+
+					float height = heightField->GetHeight(x, y);
+					float morphHeight = (level < decode.levelCount - 1) ? GetReferenceMorphHeight(heightField, x, y, i, j, level) : height;
+					double allowed = (0.5 * decode.heightStep) + (4.0 * FLT_EPSILON * std::max(fabsf(height), 1.0f));
+
+					double heightError = fabs(static_cast<double>(TerrainMesh::DecodePosition(vertex, decode).y) - height);
+					double morphError = fabs(static_cast<double>(TerrainMesh::DecodeMorphHeight(vertex, decode)) - morphHeight);
+
+					heightsInStep = heightsInStep && (heightError <= allowed);
+					morphsInStep = morphsInStep && (morphError <= allowed);
+
+					if (decode.heightStep > 0.0f) {
+						maxHeightError = std::max(maxHeightError, heightError / decode.heightStep);
+						maxMorphError = std::max(maxMorphError, morphError / decode.heightStep);
+					}
+					else {
+						flatExact = flatExact && (heightError == 0.0) && (morphError == 0.0);
+					}
+				}
+			}
+
+			if ((nodeIndexX == 0) && (nodeIndexY == 0)) {
+				TEST_CHECK(harness, decode.heightStep == 0.0f);
+			}
+		}
+	}
+
+	harness.Report("heights within %.3f steps, morph heights within %.3f steps", maxHeightError, maxMorphError);
+
+	TEST_CHECK(harness, heightsInStep);
+	TEST_CHECK(harness, morphsInStep);
+	TEST_CHECK(harness, flatExact);
+
+	delete[] vertices;
+	delete heightField;
+}
+
+void TestNormalPacking(TestHarness& harness) {
+	// Directions spread evenly over the whole sphere on a Fibonacci spiral, and the upper hemisphere again more densely
+	// since that is where the terrain normals are.
+	const int sphereCount = 200000;
+	const double goldenAngle = 3.14159265358979 * (3.0 - sqrt(5.0));
+	double maxSphereAngle = 0.0;
+	double maxUpperAngle = 0.0;
+
+	for (int k = 0; k < 2 * sphereCount; k++) {
+		bool upper = k >= sphereCount;
+		int index = k % sphereCount;
+		double y = upper ? 1.0 - ((index + 0.5) / sphereCount) : 1.0 - (2.0 * (index + 0.5) / sphereCount);
+		double radius = sqrt(std::max(1.0 - (y * y), 0.0));
+		float nx = static_cast<float>(radius * cos(goldenAngle * index));
+		float ny = static_cast<float>(y);
+		float nz = static_cast<float>(radius * sin(goldenAngle * index));
+
+		float ux;
+		float uy;
+		float uz;
+		HeightField::UnpackNormal(HeightField::PackNormal(nx, ny, nz), ux, uy, uz);
+
+		double angle = GetAngle(nx, ny, nz, ux, uy, uz);
+		if (upper) {
+			maxUpperAngle = std::max(maxUpperAngle, angle);
+		}
+		else {
+			maxSphereAngle = std::max(maxSphereAngle, angle);
+		}
+	}
+
+	harness.Report("packed normals within %.5f degrees over the sphere and %.5f over the upper hemisphere", maxSphereAngle, maxUpperAngle);
+
+	// Sixteen bits a coordinate keep every direction to within a few thousandths of a degree.
+	TEST_CHECK(harness, maxSphereAngle < 0.005);
+	TEST_CHECK(harness, maxUpperAngle < 0.005);
+
+	// The vertices of a cell keep their tangents packed the same way and rebuild the binormal from the sign in the
+	// alpha, which has to land on the same side as the binormal the tangent frame had.
+	TestTerrain::SetupType setup = TestTerrain::GetSyntheticSetup(129, 33);
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("normal-packing", setup));
+
+	HeightField* heightField = testTerrain.CreateHeightField();
+	TEST_CHECK(harness, heightField != nullptr);
+	if (!heightField) {
+		return;
+	}
+
+	int cellCountX = (heightField->GetWidth() - 1) / (setup.cellWidth - 1);
+	int cellCountY = (heightField->GetHeight() - 1) / (setup.cellHeight - 1);
+	TerrainMesh::VertexType* vertices = new TerrainMesh::VertexType[TerrainMesh::GetVertexCount(setup.cellWidth, setup.cellHeight)];
+	float* tangentX = new float[setup.cellWidth * 4];
+	float* tangentY = tangentX + setup.cellWidth;
+	float* binormalY = tangentY + setup.cellWidth;
+	float* binormalZ = binormalY + setup.cellWidth;
+	double maxTangentAngle = 0.0;
+	bool binormalSides = true;
+
+	for (int nodeIndexY = 0; nodeIndexY < cellCountY; nodeIndexY++) {
+		for (int nodeIndexX = 0; nodeIndexX < cellCountX; nodeIndexX++) {
+			float bounds[6];
+			TerrainMesh::CalculateBounds(heightField, nodeIndexX, nodeIndexY, setup.cellWidth, setup.cellHeight, bounds);
+
+			TerrainMesh::DecodeType decode = TerrainMesh::GetDecode(bounds, setup.cellWidth, setup.cellHeight);
+			TerrainMesh::BuildVertices(vertices, decode, heightField, nodeIndexX, nodeIndexY, setup.cellWidth, setup.cellHeight);
+
+			for (int j = 0; j < setup.cellHeight; j++) {
+				int y = (nodeIndexY * (setup.cellHeight - 1)) + j;
+				TerrainKernels::CalculateTangentFrames(heightField, y, nodeIndexX * (setup.cellWidth - 1), setup.cellWidth, tangentX, tangentY, binormalY, binormalZ);
+
+				for (int i = 0; i < setup.cellWidth; i++) {
+					const TerrainMesh::VertexType& vertex = vertices[(j * setup.cellWidth) + i];
+
+					float tx;
+					float ty;
+					float tz;
+					HeightField::UnpackNormal(vertex.tangent, tx, ty, tz);
+					maxTangentAngle = std::max(maxTangentAngle, GetAngle(tangentX[i], tangentY[i], 0.0, tx, ty, tz));
+
+					Vector3 binormal = TerrainMesh::DecodeBinormal(vertex);
+					binormalSides = binormalSides && (((binormal.y * binormalY[i]) + (binormal.z * binormalZ[i])) > 0.0f);
+				}
+			}
+		}
+	}
+
+	harness.Report("packed tangents within %.5f degrees", maxTangentAngle);
+
+	TEST_CHECK(harness, maxTangentAngle < 0.005);
+	TEST_CHECK(harness, binormalSides);
+
+	delete[] tangentX;
+	delete[] vertices;
+	delete heightField;
+}
@@ -0,0 +1,1111 @@
+#include "pch.h"
+#include "Tests.h"
+#include "TestDevice.h"
+#include "TestFlythrough.h"
+#include "TestTerrain.h"
+#include "Terrain.h"
+#include "TerrainKernels.h"
+#include "TerrainMesh.h"
+#include "TerrainPyramid.h"
+
+#include <thread>
+
+namespace {
+	// Small deterministic generator so every run casts the same rays.
+	float GetRandom(unsigned int& state) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+
+		return static_cast<float>(state >> 8) / 16777216.0f;
+	}
+
+	// The vertices of every cell decoded the way the terrain decodes them for its queries, so the reference tests the
+	// very same triangles.
+	float* BuildReferenceVertices(const HeightField* heightField, const TestTerrain::SetupType& setup, int cellCountX, int cellCountY) {
+		int vertexCount = TerrainMesh::GetVertexCount(setup.cellWidth, setup.cellHeight);
+		TerrainMesh::VertexType* vertices = new TerrainMesh::VertexType[vertexCount];
+		float* positions = new float[cellCountX * cellCountY * vertexCount * 3];
+
+		for (int nodeIndexY = 0; nodeIndexY < cellCountY; nodeIndexY++) {
+			for (int nodeIndexX = 0; nodeIndexX < cellCountX; nodeIndexX++) {
+				float bounds[6];
+				TerrainMesh::CalculateBounds(heightField, nodeIndexX, nodeIndexY, setup.cellWidth, setup.cellHeight, bounds);
+
+				TerrainMesh::DecodeType decode = TerrainMesh::GetDecode(bounds, setup.cellWidth, setup.cellHeight);
+				TerrainMesh::BuildVertices(vertices, decode, heightField, nodeIndexX, nodeIndexY, setup.cellWidth, setup.cellHeight);
+
+				float* cellPositions = positions + (((nodeIndexY * cellCountX) + nodeIndexX) * vertexCount * 3);
+				for (int i = 0; i < vertexCount; i++) {
+					Vector3 position = TerrainMesh::DecodePosition(vertices[i], decode);
+
+					cellPositions[(i * 3) + 0] = position.x;
+					cellPositions[(i * 3) + 1] = position.y;
+					cellPositions[(i * 3) + 2] = position.z;
+				}
+			}
+		}
+
+		delete[] vertices;
+
+		return positions;
+	}
+
+	// Tests the ray against every triangle of the terrain in double precision and keeps the nearest hit.
+	bool CastReferenceRay(const float* positions, const TestTerrain::SetupType& setup, int cellCountX, const Vector3& origin, const Vector3& direction, float maxDistance, double& nearestDistance, double normal[3]) {
+		int vertexCount = TerrainMesh::GetVertexCount(setup.cellWidth, setup.cellHeight);
+		const int triangles[2][3] = { { 0, 1, 2 }, { 2, 1, 3 } };
+		bool found = false;
+
+		nearestDistance = DBL_MAX;
+
+		for (int row = 0; row < setup.terrainHeight - 1; row++) {
+			for (int column = 0; column < setup.terrainWidth - 1; column++) {
+				int nodeIndexX = column / (setup.cellWidth - 1);
+				int nodeIndexY = row / (setup.cellHeight - 1);
+				int index = ((row - (nodeIndexY * (setup.cellHeight - 1))) * setup.cellWidth) + (column - (nodeIndexX * (setup.cellWidth - 1)));
+				const float* cellPositions = positions + (((nodeIndexY * cellCountX) + nodeIndexX) * vertexCount * 3);
+				const float* corners[4] = { cellPositions + (index * 3), cellPositions + ((index + 1) * 3), cellPositions + ((index + setup.cellWidth) * 3), cellPositions + ((index + setup.cellWidth + 1) * 3) };
+
+				for (const int* triangle : triangles) {
+					const float* v0 = corners[triangle[0]];
+					const float* v1 = corners[triangle[1]];
+					const float* v2 = corners[triangle[2]];
+					double edge1[3] = { static_cast<double>(v1[0]) - v0[0], static_cast<double>(v1[1]) - v0[1], static_cast<double>(v1[2]) - v0[2] };
+					double edge2[3] = { static_cast<double>(v2[0]) - v0[0], static_cast<double>(v2[1]) - v0[1], static_cast<double>(v2[2]) - v0[2] };
+					double p[3] = { (direction.y * edge2[2]) - (direction.z * edge2[1]), (direction.z * edge2[0]) - (direction.x * edge2[2]), (direction.x * edge2[1]) - (direction.y * edge2[0]) };
+					double determinant = (edge1[0] * p[0]) + (edge1[1] * p[1]) + (edge1[2] * p[2]);
+					if (determinant == 0.0) {
+						continue;
+					}
+
+					double s[3] = { static_cast<double>(origin.x) - v0[0], static_cast<double>(origin.y) - v0[1], static_cast<double>(origin.z) - v0[2] };
+					double u = ((s[0] * p[0]) + (s[1] * p[1]) + (s[2] * p[2])) / determinant;
+					double q[3] = { (s[1] * edge1[2]) - (s[2] * edge1[1]), (s[2] * edge1[0]) - (s[0] * edge1[2]), (s[0] * edge1[1]) - (s[1] * edge1[0]) };
+					double v = ((direction.x * q[0]) + (direction.y * q[1]) + (direction.z * q[2])) / determinant;
+					double distance = ((edge2[0] * q[0]) + (edge2[1] * q[1]) + (edge2[2] * q[2])) / determinant;
+
+					if ((u < 0.0) || (v < 0.0) || (u + v > 1.0) || (distance < 0.0) || (distance > maxDistance) || (distance >= nearestDistance)) {
+						continue;
+					}
+
+					double length = sqrt(((edge1[1] * edge2[2]) - (edge1[2] * edge2[1])) * ((edge1[1] * edge2[2]) - (edge1[2] * edge2[1])) +
+						((edge1[2] * edge2[0]) - (edge1[0] * edge2[2])) * ((edge1[2] * edge2[0]) - (edge1[0] * edge2[2])) +
+						((edge1[0] * edge2[1]) - (edge1[1] * edge2[0])) * ((edge1[0] * edge2[1]) - (edge1[1] * edge2[0])));
+
+					normal[0] = ((edge1[1] * edge2[2]) - (edge1[2] * edge2[1])) / length;
+					normal[1] = ((edge1[2] * edge2[0]) - (edge1[0] * edge2[2])) / length;
+					normal[2] = ((edge1[0] * edge2[1]) - (edge1[1] * edge2[0])) / length;
+					nearestDistance = distance;
+					found = true;
+				}
+			}
+		}
+
+		return found;
+	}
+
+	// A random ray over the terrain, a third of them straight down, a third skimming just over the ground and the rest
+	// from anywhere around the terrain in any direction.
+	void GetRandomRay(const Terrain* terrain, const TestTerrain::SetupType& setup, unsigned int& state, Vector3& origin, Vector3& direction, float& maxDistance) {
+		float sizeX = static_cast<float>(setup.terrainWidth - 1);
+		float sizeZ = static_cast<float>(setup.terrainHeight - 1);
+		int kind = static_cast<int>(GetRandom(state) * 3.0f);
+
+		origin = Vector3((GetRandom(state) * 1.2f - 0.1f) * sizeX, 0.0f, (GetRandom(state) * 1.2f - 0.1f) * sizeZ);
+		maxDistance = (GetRandom(state) < 0.5f) ? FLT_MAX : GetRandom(state) * 2.0f * sizeX;
+
+		float ground = 0.0f;
+		terrain->GetHeightAtPosition(origin.x, origin.z, ground);
+
+		if (kind == 0) {
+			origin.y = ground + 50.0f + (GetRandom(state) * 100.0f);
+			direction = Vector3((GetRandom(state) - 0.5f) * 0.01f, -1.0f, (GetRandom(state) - 0.5f) * 0.01f);
+		}
+		else if (kind == 1) {
+			origin.y = ground + 0.5f + (GetRandom(state) * 2.0f);
+			direction = Vector3(GetRandom(state) - 0.5f, (GetRandom(state) - 0.7f) * 0.05f, GetRandom(state) - 0.5f);
+		}
+		else {
+			origin.y = (GetRandom(state) * 400.0f) - 50.0f;
+			direction = Vector3(GetRandom(state) - 0.5f, GetRandom(state) - 0.5f, GetRandom(state) - 0.5f);
+		}
+
+		float length = sqrtf((direction.x * direction.x) + (direction.y * direction.y) + (direction.z * direction.z));
+		direction = Vector3(direction.x / length, direction.y / length, direction.z / length);
+	}
+
+	// The height of a triangle under a point as the terrain worked it out before the grid lookup, kept operation for
+	// operation so the heights can be compared bit for bit.
+	bool CheckReferenceHeightOfTriangle(float x, float z, float& height, const float v0[3], const float v1[3], const float v2[3]) {
+		float startVector[3] = { x, 0.0f, z };
+		float directionVector[3] = { 0.0f, -1.0f, 0.0f };
+
+		float edge1[3] = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
+		float edge2[3] = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
+
+		float normal[3];
+		normal[0] = (edge1[1] * edge2[2]) - (edge1[2] * edge2[1]);
+		normal[1] = (edge1[2] * edge2[0]) - (edge1[0] * edge2[2]);
+		normal[2] = (edge1[0] * edge2[1]) - (edge1[1] * edge2[0]);
+
+		float magnitude = static_cast<float>(sqrt((normal[0] * normal[0]) + (normal[1] * normal[1]) + (normal[2] * normal[2])));
+		normal[0] = normal[0] / magnitude;
+		normal[1] = normal[1] / magnitude;
+		normal[2] = normal[2] / magnitude;
+
+		float D = ((-normal[0] * v0[0]) + (-normal[1] * v0[1]) + (-normal[2] * v0[2]));
+		float denominator = ((normal[0] * directionVector[0]) + (normal[1] * directionVector[1]) + (normal[2] * directionVector[2]));
+		if (fabs(denominator) < 0.0001f) {
+			return false;
+		}
+
+		float numerator = -1.0f * (((normal[0] * startVector[0]) + (normal[1] * startVector[1]) + (normal[2] * startVector[2])) + D);
+		float t = numerator / denominator;
+
+		float Q[3];
+		Q[0] = startVector[0] + (directionVector[0] * t);
+		Q[1] = startVector[1] + (directionVector[1] * t);
+		Q[2] = startVector[2] + (directionVector[2] * t);
+
+		// Each edge of the triangle in turn, a point more than the tolerance outside any of them misses.
+		const float* corners[3] = { v0, v1, v2 };
+		for (int k = 0; k < 3; k++) {
+			const float* a = corners[k];
+			const float* b = corners[(k + 1) % 3];
+			float e[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+
+			float edgeNormal[3];
+			edgeNormal[0] = (e[1] * normal[2]) - (e[2] * normal[1]);
+			edgeNormal[1] = (e[2] * normal[0]) - (e[0] * normal[2]);
+			edgeNormal[2] = (e[0] * normal[1]) - (e[1] * normal[0]);
+
+			float temp[3] = { Q[0] - a[0], Q[1] - a[1], Q[2] - a[2] };
+			float determinant = ((edgeNormal[0] * temp[0]) + (edgeNormal[1] * temp[1]) + (edgeNormal[2] * temp[2]));
+			if (determinant > 0.001f) {
+				return false;
+			}
+		}
+
+		height = Q[1];
+
+		return true;
+	}
+
+	// The old height query: scan the bounds of every cell for the one the point is inside, then walk the triangles of
+	// its finest level in index order until one is under the point.
+	bool GetReferenceHeight(const float* positions, const float* bounds, const unsigned short* indices, int indexCount, int vertexCount, int cellCount, float x, float z, float& height) {
+		for (int cellId = 0; cellId < cellCount; cellId++) {
+			const float* cellBounds = bounds + (cellId * 6);
+			if (!((x < cellBounds[0]) && (x > cellBounds[3]) && (z < cellBounds[2]) && (z > cellBounds[5]))) {
+				continue;
+			}
+
+			const float* cellPositions = positions + (cellId * vertexCount * 3);
+			for (int i = 0; i < indexCount; i += 3) {
+				if (CheckReferenceHeightOfTriangle(x, z, height, cellPositions + (indices[i] * 3), cellPositions + (indices[i + 1] * 3), cellPositions + (indices[i + 2] * 3))) {
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		return false;
+	}
+
+	// Points where the lookup is most likely to part from the scan: anywhere, on the grid lines, on the diagonals of
+	// the quads, on the edges of the cells and a hair either side of the grid.
+	void GetRandomPoint(const TestTerrain::SetupType& setup, unsigned int& state, float& x, float& z) {
+		float sizeX = static_cast<float>(setup.terrainWidth - 1);
+		float sizeZ = static_cast<float>(setup.terrainHeight - 1);
+		int kind = static_cast<int>(GetRandom(state) * 6.0f);
+
+		x = (GetRandom(state) * (sizeX + 2.0f)) - 1.0f;
+		z = (GetRandom(state) * (sizeZ + 2.0f)) - 1.0f;
+
+		if (kind == 1) {
+			x = floorf(x);
+		}
+		else if (kind == 2) {
+			z = floorf(z);
+		}
+		else if (kind == 3) {
+			z = floorf(z) + (x - floorf(x));
+		}
+		else if (kind == 4) {
+			float cellSize = static_cast<float>(setup.cellWidth - 1);
+			x = floorf(x / cellSize) * cellSize;
+			z = (GetRandom(state) < 0.5f) ? z : sizeZ - (floorf((sizeZ - z) / cellSize) * cellSize);
+		}
+		else if (kind == 5) {
+			x = nextafterf(floorf(x), (GetRandom(state) < 0.5f) ? -FLT_MAX : FLT_MAX);
+			z = nextafterf(floorf(z), (GetRandom(state) < 0.5f) ? -FLT_MAX : FLT_MAX);
+		}
+	}
+
+	// The bounds and finest level indices the old scan walks for a terrain.
+	void BuildReferenceCells(const HeightField* heightField, const TestTerrain::SetupType& setup, int cellCountX, int cellCountY, float*& bounds, unsigned short*& indices, int& indexCount) {
+		bounds = new float[cellCountX * cellCountY * 6];
+		for (int nodeIndexY = 0; nodeIndexY < cellCountY; nodeIndexY++) {
+			for (int nodeIndexX = 0; nodeIndexX < cellCountX; nodeIndexX++) {
+				TerrainMesh::CalculateBounds(heightField, nodeIndexX, nodeIndexY, setup.cellWidth, setup.cellHeight, bounds + (((nodeIndexY * cellCountX) + nodeIndexX) * 6));
+			}
+		}
+
+		indexCount = TerrainMesh::GetIndexCount(setup.cellWidth, setup.cellHeight, 0);
+		indices = new unsigned short[indexCount];
+		TerrainMesh::BuildIndices(indices, setup.cellWidth, setup.cellHeight, 0);
+	}
+
+	// The lowest and highest corner of every quad of the terrain as its cell decodes them, in rows from the back.
+	void BuildReferenceQuadBounds(const HeightField* heightField, const TestTerrain::SetupType& setup, float* quadMins, float* quadMaxs) {
+		int cellCountX = (heightField->GetWidth() - 1) / (setup.cellWidth - 1);
+		int cellCountY = (heightField->GetHeight() - 1) / (setup.cellHeight - 1);
+		int quadCountX = setup.terrainWidth - 1;
+		int quadCountY = setup.terrainHeight - 1;
+		TerrainMesh::VertexType* vertices = new TerrainMesh::VertexType[TerrainMesh::GetVertexCount(setup.cellWidth, setup.cellHeight)];
+
+		for (int nodeIndexY = 0; nodeIndexY < cellCountY; nodeIndexY++) {
+			for (int nodeIndexX = 0; nodeIndexX < cellCountX; nodeIndexX++) {
+				float bounds[6];
+				TerrainMesh::CalculateBounds(heightField, nodeIndexX, nodeIndexY, setup.cellWidth, setup.cellHeight, bounds);
+
+				TerrainMesh::DecodeType decode = TerrainMesh::GetDecode(bounds, setup.cellWidth, setup.cellHeight);
+				TerrainMesh::BuildVertices(vertices, decode, heightField, nodeIndexX, nodeIndexY, setup.cellWidth, setup.cellHeight);
+
+				// The quads of the last cells past the far edges collapse onto the edge and aren't part of the terrain.
+				int startColumn = nodeIndexX * (setup.cellWidth - 1);
+				int startRow = nodeIndexY * (setup.cellHeight - 1);
+				int endColumn = std::min(startColumn + setup.cellWidth - 1, quadCountX);
+				int endRow = std::min(startRow + setup.cellHeight - 1, quadCountY);
+
+				for (int row = startRow; row < endRow; row++) {
+					for (int column = startColumn; column < endColumn; column++) {
+						const TerrainMesh::VertexType* corner = vertices + ((row - startRow) * setup.cellWidth) + (column - startColumn);
+						float minHeight = FLT_MAX;
+						float maxHeight = -FLT_MAX;
+
+						for (int k = 0; k < 4; k++) {
+							float height = decode.minHeight + (static_cast<float>(corner[((k >> 1) * setup.cellWidth) + (k & 1)].position[2]) * decode.heightStep);
+
+							minHeight = std::min(minHeight, height);
+							maxHeight = std::max(maxHeight, height);
+						}
+
+						quadMins[(row * quadCountX) + column] = minHeight;
+						quadMaxs[(row * quadCountX) + column] = maxHeight;
+					}
+				}
+			}
+		}
+
+		delete[] vertices;
+	}
+
+	// A rectangle in or around an area of the terrain: of any size anywhere, flush with or past the far sides of the
+	// area, inside a single quad, or most of the area.
+	void GetRandomRectangle(unsigned int& state, float areaMinX, float areaMinZ, float areaMaxX, float areaMaxZ, float& minX, float& minZ, float& maxX, float& maxZ) {
+		float areaX = areaMaxX - areaMinX;
+		float areaZ = areaMaxZ - areaMinZ;
+		int kind = static_cast<int>(GetRandom(state) * 4.0f);
+		float sizeX = GetRandom(state) * GetRandom(state) * areaX;
+		float sizeZ = GetRandom(state) * GetRandom(state) * areaZ;
+
+		if (kind == 2) {
+			sizeX = GetRandom(state) * 0.5f;
+			sizeZ = GetRandom(state) * 0.5f;
+		}
+		else if (kind == 3) {
+			sizeX = (0.5f + (GetRandom(state) * 0.5f)) * areaX;
+			sizeZ = (0.5f + (GetRandom(state) * 0.5f)) * areaZ;
+		}
+
+		minX = areaMinX - 4.0f + (GetRandom(state) * (areaX + 8.0f - sizeX));
+		minZ = areaMinZ - 4.0f + (GetRandom(state) * (areaZ + 8.0f - sizeZ));
+
+		// The far sides are the highest X and lowest Z, where the last column and row of quads are.
+		if (kind == 1) {
+			int sides = 1 + static_cast<int>(GetRandom(state) * 3.0f);
+			float past = (GetRandom(state) < 0.5f) ? 0.0f : GetRandom(state) * 4.0f;
+
+			if (sides & 1) {
+				minX = areaMaxX + past - sizeX;
+			}
+			if (sides & 2) {
+				minZ = areaMinZ - past;
+			}
+		}
+
+		maxX = minX + sizeX;
+		maxZ = minZ + sizeZ;
+	}
+
+	// Height bounds of random rectangles against the quads under them.  The answer has to hold the quads a rectangle
+	// touches and, where every cell under the blocks the pyramid merges for it is in exactCells, be exactly the quads of
+	// those blocks.  The blocks are a leaf wide at the bottom level and double each level up to the first where the
+	// rectangle spans at most two of them.  Returns how many rectangles were wrong.
+	int CheckHeightBounds(TestHarness& harness, const Terrain* terrain, const TestTerrain::SetupType& setup, const float* quadMins, const float* quadMaxs, const bool* exactCells, float areaMinX, float areaMinZ, float areaMaxX, float areaMaxZ, int rectangleCount, unsigned int& state, int& exactCount, int& wideCount) {
+		int quadCountX = setup.terrainWidth - 1;
+		int quadCountY = setup.terrainHeight - 1;
+		int cellSizeX = setup.cellWidth - 1;
+		int cellSizeY = setup.cellHeight - 1;
+		int cellCountX = (quadCountX + cellSizeX - 1) / cellSizeX;
+		float backZ = static_cast<float>(quadCountY);
+		int mismatchCount = 0;
+
+		TerrainPyramid pyramid;
+		pyramid.Initialize(quadCountX, quadCountY);
+		int leafShift = pyramid.GetLeafShift();
+
+		for (int rectangle = 0; rectangle < rectangleCount; rectangle++) {
+			float minX;
+			float minZ;
+			float maxX;
+			float maxZ;
+			GetRandomRectangle(state, areaMinX, areaMinZ, areaMaxX, areaMaxZ, minX, minZ, maxX, maxZ);
+
+			float minHeight;
+			float maxHeight;
+			bool found = terrain->GetHeightBounds(minX, minZ, maxX, maxZ, minHeight, maxHeight);
+			bool overlaps = (maxX >= 0.0f) && (minX <= static_cast<float>(quadCountX)) && (maxZ >= 0.0f) && (minZ <= backZ);
+
+			if (found != overlaps) {
+				mismatchCount++;
+				continue;
+			}
+			if (!found) {
+				continue;
+			}
+
+			int startColumn = std::min(static_cast<int>(std::max(floorf(minX), 0.0f)), quadCountX - 1);
+			int startRow = std::min(static_cast<int>(std::max(floorf(backZ - maxZ), 0.0f)), quadCountY - 1);
+			int endColumn = std::max(static_cast<int>(std::min(ceilf(maxX), static_cast<float>(quadCountX))), startColumn + 1);
+			int endRow = std::max(static_cast<int>(std::min(ceilf(backZ - minZ), static_cast<float>(quadCountY))), startRow + 1);
+
+			int span = std::max(((endColumn - 1) >> leafShift) - (startColumn >> leafShift), ((endRow - 1) >> leafShift) - (startRow >> leafShift));
+			int level = 0;
+			while ((span > 1) && ((1 << level) < span)) {
+				level++;
+			}
+
+			int blockShift = leafShift + level;
+			int blockStartColumn = (startColumn >> blockShift) << blockShift;
+			int blockStartRow = (startRow >> blockShift) << blockShift;
+			int blockEndColumn = std::min((((endColumn - 1) >> blockShift) + 1) << blockShift, quadCountX);
+			int blockEndRow = std::min((((endRow - 1) >> blockShift) + 1) << blockShift, quadCountY);
+
+			float touchedMin = FLT_MAX;
+			float touchedMax = -FLT_MAX;
+			float blockMin = FLT_MAX;
+			float blockMax = -FLT_MAX;
+			bool exact = true;
+
+			for (int row = blockStartRow; row < blockEndRow; row++) {
+				for (int column = blockStartColumn; column < blockEndColumn; column++) {
+					float quadMin = quadMins[(row * quadCountX) + column];
+					float quadMax = quadMaxs[(row * quadCountX) + column];
+
+					blockMin = std::min(blockMin, quadMin);
+					blockMax = std::max(blockMax, quadMax);
+					exact = exact && (!exactCells || exactCells[((row / cellSizeY) * cellCountX) + (column / cellSizeX)]);
+
+					if ((row >= startRow) && (row < endRow) && (column >= startColumn) && (column < endColumn)) {
+						touchedMin = std::min(touchedMin, quadMin);
+						touchedMax = std::max(touchedMax, quadMax);
+					}
+				}
+			}
+
+			wideCount += (span > 1) ? 1 : 0;
+			exactCount += exact ? 1 : 0;
+
+			if ((minHeight > touchedMin) || (maxHeight < touchedMax) || (exact && ((minHeight != blockMin) || (maxHeight != blockMax)))) {
+				if (mismatchCount < 4) {
+					harness.Report("(%.9g, %.9g) to (%.9g, %.9g): %.9g to %.9g against %.9g to %.9g", minX, minZ, maxX, maxZ, minHeight, maxHeight, blockMin, blockMax);
+				}
+
+				mismatchCount++;
+			}
+		}
+
+		return mismatchCount;
+	}
+}
+
+void TestRayCast(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	// A whole number of cells, and a terrain that isn't so its last cells hang over the far edges.
+	TestTerrain::SetupType setups[2] = { TestTerrain::GetSyntheticSetup(129, 33), TestTerrain::GetSyntheticSetup(150, 17) };
+	setups[1].terrainHeight = 101;
+
+	for (const TestTerrain::SetupType& setup : setups) {
+		TestTerrain testTerrain;
+		TEST_CHECK(harness, testTerrain.Initialize("ray-cast", setup));
+
+		HeightField* heightField = testTerrain.CreateHeightField();
+		TEST_CHECK(harness, heightField != nullptr);
+
+		Terrain* terrain = new Terrain;
+		bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+		TEST_CHECK(harness, result);
+
+		if (!heightField || !result) {
+			delete terrain;
+			delete heightField;
+			continue;
+		}
+
+		int cellCountX = (heightField->GetWidth() - 1) / (setup.cellWidth - 1);
+		int cellCountY = (heightField->GetHeight() - 1) / (setup.cellHeight - 1);
+		float* positions = BuildReferenceVertices(heightField, setup, cellCountX, cellCountY);
+
+		// Every ray has to hit the same triangle at the same place as testing every triangle does.  The terrain lets a ray
+		// through a shared edge hit either triangle, so a hit is matched on where it is rather than which triangle it is.
+		const int rayCount = 3000;
+		unsigned int state = 12345;
+		int hitCount = 0;
+		bool hitsMatch = true;
+		bool positionsMatch = true;
+		bool normalsMatch = true;
+
+		for (int k = 0; k < rayCount; k++) {
+			Vector3 origin;
+			Vector3 direction;
+			float maxDistance;
+			GetRandomRay(terrain, setup, state, origin, direction, maxDistance);
+
+			Terrain::RayHitType hit;
+			bool found = terrain->RayCast(origin, direction, maxDistance, hit);
+
+			double referenceDistance;
+			double referenceNormal[3];
+			bool referenceFound = CastReferenceRay(positions, setup, cellCountX, origin, direction, maxDistance, referenceDistance, referenceNormal);
+
+			hitsMatch = hitsMatch && (found == referenceFound);
+			if (!found || !referenceFound) {
+				continue;
+			}
+
+			hitCount++;
+
+			double tolerance = 1.0e-4 * (1.0 + referenceDistance);
+			positionsMatch = positionsMatch && (fabs(hit.distance - referenceDistance) <= tolerance) &&
+				(fabs(hit.position.x - (origin.x + (direction.x * referenceDistance))) <= tolerance) &&
+				(fabs(hit.position.y - (origin.y + (direction.y * referenceDistance))) <= tolerance) &&
+				(fabs(hit.position.z - (origin.z + (direction.z * referenceDistance))) <= tolerance);
+
+			// Through an edge the two triangles can face different ways, so only a hit well inside one is held to its normal.
+			double dot = (hit.normal.x * referenceNormal[0]) + (hit.normal.y * referenceNormal[1]) + (hit.normal.z * referenceNormal[2]);
+			normalsMatch = normalsMatch && ((dot > 0.9999) || (fabs(hit.position.x - roundf(hit.position.x)) < 0.001f) ||
+				(fabs(hit.position.z - roundf(hit.position.z)) < 0.001f) || (fabs((hit.position.x - floorf(hit.position.x)) + (hit.position.z - floorf(hit.position.z)) - 1.0f) < 0.001f));
+		}
+
+		harness.Report("%dx%d: %d of %d rays hit", setup.terrainWidth, setup.terrainHeight, hitCount, rayCount);
+
+		TEST_CHECK(harness, hitCount > rayCount / 4);
+		TEST_CHECK(harness, hitsMatch);
+		TEST_CHECK(harness, positionsMatch);
+		TEST_CHECK(harness, normalsMatch);
+
+		// A segment can see its other end unless the surface crosses it before the end.
+		const int segmentCount = 1000;
+		Vector3* starts = new Vector3[segmentCount];
+		Vector3* ends = new Vector3[segmentCount];
+		bool* visible = new bool[segmentCount];
+		bool* referenceVisible = new bool[segmentCount];
+
+		for (int k = 0; k < segmentCount; k++) {
+			Vector3 points[2];
+
+			for (Vector3& point : points) {
+				point = Vector3(GetRandom(state) * static_cast<float>(setup.terrainWidth - 1), 0.0f, GetRandom(state) * static_cast<float>(setup.terrainHeight - 1));
+
+				float ground = 0.0f;
+				terrain->GetHeightAtPosition(point.x, point.z, ground);
+				point.y = ground + 1.0f + (GetRandom(state) * 20.0f);
+			}
+
+			starts[k] = points[0];
+			ends[k] = points[1];
+
+			float directionX = ends[k].x - starts[k].x;
+			float directionY = ends[k].y - starts[k].y;
+			float directionZ = ends[k].z - starts[k].z;
+			float length = sqrtf((directionX * directionX) + (directionY * directionY) + (directionZ * directionZ));
+
+			double referenceDistance;
+			double referenceNormal[3];
+			referenceVisible[k] = !CastReferenceRay(positions, setup, cellCountX, starts[k], Vector3(directionX / length, directionY / length, directionZ / length), length, referenceDistance, referenceNormal);
+		}
+
+		terrain->CheckLineOfSight(starts, ends, segmentCount, visible);
+
+		int visibleCount = 0;
+		bool sightsMatch = true;
+		for (int k = 0; k < segmentCount; k++) {
+			visibleCount += visible[k] ? 1 : 0;
+			sightsMatch = sightsMatch && (visible[k] == referenceVisible[k]);
+		}
+
+		harness.Report("%dx%d: %d of %d segments clear", setup.terrainWidth, setup.terrainHeight, visibleCount, segmentCount);
+
+		TEST_CHECK(harness, (visibleCount > 0) && (visibleCount < segmentCount));
+		TEST_CHECK(harness, sightsMatch);
+
+		delete[] referenceVisible;
+		delete[] visible;
+		delete[] ends;
+		delete[] starts;
+		delete[] positions;
+		delete terrain;
+		delete heightField;
+	}
+}
+
+void BenchmarkRayCast(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("ray-benchmark", TestTerrain::GetShippedSetup()));
+
+	Terrain* terrain = new Terrain;
+	bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+	TEST_CHECK(harness, result);
+	if (!result) {
+		delete terrain;
+		return;
+	}
+
+	// The same mix of rays as the test over the shipped terrain, cast one at a time on one thread.
+	const int rayCount = 1000000;
+	Vector3* origins = new Vector3[rayCount];
+	Vector3* directions = new Vector3[rayCount];
+	float* maxDistances = new float[rayCount];
+	unsigned int state = 54321;
+
+	for (int k = 0; k < rayCount; k++) {
+		GetRandomRay(terrain, testTerrain.GetSetup(), state, origins[k], directions[k], maxDistances[k]);
+	}
+
+	int hitCount = 0;
+	double startTime = TestHarness::GetTime();
+
+	for (int k = 0; k < rayCount; k++) {
+		Terrain::RayHitType hit;
+		hitCount += terrain->RayCast(origins[k], directions[k], maxDistances[k], hit) ? 1 : 0;
+	}
+
+	double rayTime = TestHarness::GetTime() - startTime;
+
+	harness.Report("ray casts: %.2f million rays a second on one thread, %d of %d hit", rayCount / rayTime / 1.0e6, hitCount, rayCount);
+
+	// Then segments between points just above the ground through the batched line of sight on every thread.
+	Vector3* ends = new Vector3[rayCount];
+	bool* visible = new bool[rayCount];
+
+	for (int k = 0; k < rayCount; k++) {
+		float ground = 0.0f;
+
+		origins[k] = Vector3(GetRandom(state) * 1024.0f, 0.0f, GetRandom(state) * 1024.0f);
+		terrain->GetHeightAtPosition(origins[k].x, origins[k].z, ground);
+		origins[k].y = ground + 2.0f;
+
+		ends[k] = Vector3(origins[k].x + ((GetRandom(state) - 0.5f) * 400.0f), 0.0f, origins[k].z + ((GetRandom(state) - 0.5f) * 400.0f));
+		ground = 0.0f;
+		terrain->GetHeightAtPosition(ends[k].x, ends[k].z, ground);
+		ends[k].y = ground + 2.0f;
+	}
+
+	startTime = TestHarness::GetTime();
+	terrain->CheckLineOfSight(origins, ends, rayCount, visible);
+	double sightTime = TestHarness::GetTime() - startTime;
+
+	harness.Report("line of sight: %.2f million segments a second on %u threads", rayCount / sightTime / 1.0e6, std::max(std::thread::hardware_concurrency(), 1u));
+
+	delete[] visible;
+	delete[] ends;
+	delete[] maxDistances;
+	delete[] directions;
+	delete[] origins;
+	delete terrain;
+}
+
+void TestHeightQueries(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	TestTerrain::SetupType setups[2] = { TestTerrain::GetSyntheticSetup(129, 33), TestTerrain::GetSyntheticSetup(150, 17) };
+	setups[1].terrainHeight = 101;
+
+	for (const TestTerrain::SetupType& setup : setups) {
+		TestTerrain testTerrain;
+		TEST_CHECK(harness, testTerrain.Initialize("height-queries", setup));
+
+		HeightField* heightField = testTerrain.CreateHeightField();
+		TEST_CHECK(harness, heightField != nullptr);
+
+		Terrain* terrain = new Terrain;
+		bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+		TEST_CHECK(harness, result);
+
+		if (!heightField || !result) {
+			delete terrain;
+			delete heightField;
+			continue;
+		}
+
+		int cellCountX = (heightField->GetWidth() - 1) / (setup.cellWidth - 1);
+		int cellCountY = (heightField->GetHeight() - 1) / (setup.cellHeight - 1);
+		int vertexCount = TerrainMesh::GetVertexCount(setup.cellWidth, setup.cellHeight);
+		float* positions = BuildReferenceVertices(heightField, setup, cellCountX, cellCountY);
+		float* bounds;
+		unsigned short* indices;
+		int indexCount;
+		BuildReferenceCells(heightField, setup, cellCountX, cellCountY, bounds, indices, indexCount);
+
+		// The lookup has to find the same points as the scan did and give them the very same heights.  The one place it
+		// may differ is where the scan reached the collapsed quads past the far edges and came back with NaN.
+		const int pointCount = 200000;
+		unsigned int state = 777;
+		int foundCount = 0;
+		int collapsedCount = 0;
+		int mismatchCount = 0;
+
+		for (int k = 0; k < pointCount; k++) {
+			float x;
+			float z;
+			GetRandomPoint(setup, state, x, z);
+
+			float height = 0.0f;
+			bool found = terrain->GetHeightAtPosition(x, z, height);
+
+			float referenceHeight = 0.0f;
+			bool referenceFound = GetReferenceHeight(positions, bounds, indices, indexCount, vertexCount, cellCountX * cellCountY, x, z, referenceHeight);
+
+			if (referenceFound && (referenceHeight != referenceHeight)) {
+				collapsedCount++;
+				mismatchCount += found ? 0 : 1;
+				continue;
+			}
+
+			foundCount += found ? 1 : 0;
+			if ((found != referenceFound) || (found && (memcmp(&height, &referenceHeight, sizeof(float)) != 0))) {
+				if (mismatchCount < 4) {
+					harness.Report("(%.9g, %.9g): %s %.9g against %s %.9g", x, z, found ? "found" : "missed", height, referenceFound ? "found" : "missed", referenceHeight);
+				}
+
+				mismatchCount++;
+			}
+		}
+
+		harness.Report("%dx%d: %d of %d points found, %d on collapsed quads, %d differ", setup.terrainWidth, setup.terrainHeight, foundCount, pointCount, collapsedCount, mismatchCount);
+
+		TEST_CHECK(harness, foundCount > pointCount / 2);
+		TEST_CHECK(harness, mismatchCount == 0);
+
+		delete[] indices;
+		delete[] bounds;
+		delete[] positions;
+		delete terrain;
+		delete heightField;
+	}
+}
+
+void TestHeightBounds(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	// A whole number of cells, one that isn't and is edited, and one paged with more quads than the pyramid has leaves
+	// so each leaf holds a block of them.
+	TestTerrain::SetupType setups[3] = { TestTerrain::GetSyntheticSetup(129, 33), TestTerrain::GetSyntheticSetup(150, 17), TestTerrain::GetSyntheticSetup(2049, 65) };
+	setups[1].terrainHeight = 101;
+	setups[1].editable = true;
+	setups[2].terrainHeight = 1025;
+	setups[2].pageRadius = 160.0f;
+	setups[2].pageBudget = 8;
+
+	for (const TestTerrain::SetupType& setup : setups) {
+		TestTerrain testTerrain;
+		TEST_CHECK(harness, testTerrain.Initialize("height-bounds", setup));
+
+		HeightField* heightField = testTerrain.CreateHeightField();
+		TEST_CHECK(harness, heightField != nullptr);
+
+		Terrain* terrain = new Terrain;
+		bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+		TEST_CHECK(harness, result);
+
+		if (!heightField || !result) {
+			delete terrain;
+			delete heightField;
+			continue;
+		}
+
+		const int rectangleCount = 2000;
+		int quadCountX = setup.terrainWidth - 1;
+		int quadCountY = setup.terrainHeight - 1;
+		float* quadMins = new float[quadCountX * quadCountY];
+		float* quadMaxs = new float[quadCountX * quadCountY];
+		unsigned int state = 97531;
+		int mismatchCount = 0;
+		int exactCount = 0;
+		int wideCount = 0;
+
+		if (setup.pageRadius <= 0.0f) {
+			// Over the whole terrain as loaded.
+			BuildReferenceQuadBounds(heightField, setup, quadMins, quadMaxs);
+			mismatchCount += CheckHeightBounds(harness, terrain, setup, quadMins, quadMaxs, nullptr, 0.0f, 0.0f, static_cast<float>(quadCountX), static_cast<float>(quadCountY), rectangleCount, state, exactCount, wideCount);
+
+			// Then after brushes over the middle and the edges, against the heights the edits left behind.
+			if (setup.editable) {
+				ID3D11DeviceContext* deviceContext = device.GetDeviceContext();
+				int editCount = 0;
+
+				for (int edit = 0; edit < 30; edit++) {
+					float radius = 2.0f + (GetRandom(state) * 14.0f);
+					float positionX = (GetRandom(state) * (static_cast<float>(quadCountX) + (2.0f * radius))) - radius;
+					float positionZ = (GetRandom(state) * (static_cast<float>(quadCountY) + (2.0f * radius))) - radius;
+
+					if ((edit % 3) == 0) {
+						editCount += terrain->RaiseTerrain(deviceContext, positionX, positionZ, radius, 5.0f + (GetRandom(state) * 30.0f)) ? 1 : 0;
+					}
+					else if ((edit % 3) == 1) {
+						editCount += terrain->LowerTerrain(deviceContext, positionX, positionZ, radius, 5.0f + (GetRandom(state) * 30.0f)) ? 1 : 0;
+					}
+					else {
+						editCount += terrain->SmoothTerrain(deviceContext, positionX, positionZ, radius, GetRandom(state)) ? 1 : 0;
+					}
+				}
+
+				TEST_CHECK(harness, editCount > 20);
+
+				BuildReferenceQuadBounds(terrain->GetHeightField(), setup, quadMins, quadMaxs);
+				mismatchCount += CheckHeightBounds(harness, terrain, setup, quadMins, quadMaxs, nullptr, 0.0f, 0.0f, static_cast<float>(quadCountX), static_cast<float>(quadCountY), rectangleCount, state, exactCount, wideCount);
+			}
+		}
+		else {
+			// Fly part of the way round and check around the camera every so often.  Only the cells that have been
+			// resident have leaves narrowed to their heights, the rest are held to holding the quads under them.
+			const int frameCount = 240;
+			TestFlythrough flythrough;
+			flythrough.Initialize(terrain, setup.terrainWidth, setup.terrainHeight, frameCount);
+
+			int cellCount = terrain->GetCellCount();
+			bool* residentCells = new bool[cellCount];
+			for (int cellId = 0; cellId < cellCount; cellId++) {
+				residentCells[cellId] = false;
+			}
+
+			BuildReferenceQuadBounds(heightField, setup, quadMins, quadMaxs);
+
+			for (int frame = 0; frame < frameCount / 2; frame++) {
+				Vector3 position = flythrough.GetPosition(frame);
+				TEST_CHECK(harness, terrain->PageCells(device.GetDevice(), position));
+
+				for (int cellId = 0; cellId < cellCount; cellId++) {
+					residentCells[cellId] = residentCells[cellId] || (terrain->GetCellSlot(cellId) >= 0);
+				}
+
+				if ((frame % 20) == 0) {
+					mismatchCount += CheckHeightBounds(harness, terrain, setup, quadMins, quadMaxs, residentCells, position.x - 128.0f, position.z - 128.0f, position.x + 128.0f, position.z + 128.0f, rectangleCount / 4, state, exactCount, wideCount);
+				}
+			}
+
+			mismatchCount += CheckHeightBounds(harness, terrain, setup, quadMins, quadMaxs, residentCells, 0.0f, 0.0f, static_cast<float>(quadCountX), static_cast<float>(quadCountY), rectangleCount, state, exactCount, wideCount);
+
+			delete[] residentCells;
+		}
+
+		harness.Report("%dx%d: %d rectangles exact, %d over more than one leaf, %d wrong", setup.terrainWidth, setup.terrainHeight, exactCount, wideCount, mismatchCount);
+
+		TEST_CHECK(harness, exactCount > rectangleCount / 2);
+		TEST_CHECK(harness, wideCount > rectangleCount / 2);
+		TEST_CHECK(harness, mismatchCount == 0);
+
+		delete[] quadMaxs;
+		delete[] quadMins;
+		delete terrain;
+		delete heightField;
+	}
+}
+
+void TestSurfaceQueries(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	TestTerrain::SetupType setups[2] = { TestTerrain::GetSyntheticSetup(129, 33), TestTerrain::GetSyntheticSetup(150, 17) };
+	setups[1].terrainHeight = 101;
+
+	TerrainKernels::InstructionSet originalSet = TerrainKernels::GetInstructionSet();
+	int setCount = TerrainKernels::SupportsAvx2() ? 3 : 2;
+
+	for (const TestTerrain::SetupType& setup : setups) {
+		TestTerrain testTerrain;
+		TEST_CHECK(harness, testTerrain.Initialize("surface-queries", setup));
+
+		HeightField* heightField = testTerrain.CreateHeightField();
+		TEST_CHECK(harness, heightField != nullptr);
+
+		Terrain* terrain = new Terrain;
+		bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+		TEST_CHECK(harness, result);
+
+		if (!heightField || !result) {
+			delete terrain;
+			delete heightField;
+			continue;
+		}
+
+		// A batch that isn't a whole number of vectors, made of the awkward points of the height test with vertices and
+		// NaN mixed in.
+		const int pointCount = 1003;
+		const int valueCount = 5;
+		int backZ = setup.terrainHeight - 1;
+		float* pointX = new float[pointCount];
+		float* pointZ = new float[pointCount];
+		bool* vertexPoint = new bool[pointCount];
+		unsigned int state = 2468;
+
+		for (int k = 0; k < pointCount; k++) {
+			GetRandomPoint(setup, state, pointX[k], pointZ[k]);
+			vertexPoint[k] = (k % 5) == 0;
+
+			if (vertexPoint[k]) {
+				pointX[k] = floorf(GetRandom(state) * static_cast<float>(setup.terrainWidth));
+				pointZ[k] = floorf(GetRandom(state) * static_cast<float>(setup.terrainHeight));
+			}
+			else if ((k % 89) == 1) {
+				pointX[k] = ((k % 2) == 0) ? NAN : pointX[k];
+				pointZ[k] = ((k % 2) == 0) ? pointZ[k] : NAN;
+			}
+		}
+
+		// Every instruction set runs the whole batch and then short batches from odd places in it, which go through
+		// the tails of the vector paths.  Heights, normals and slopes all have to come out bit for bit the same.
+		float* values[3];
+		bool* found[3];
+		bool tailsMatch = true;
+
+		for (int set = 0; set < setCount; set++) {
+			TerrainKernels::SetInstructionSet(static_cast<TerrainKernels::InstructionSet>(set));
+
+			values[set] = new float[pointCount * valueCount];
+			found[set] = new bool[pointCount * 2];
+			float* heights = values[set];
+			float* normalX = heights + pointCount;
+			float* normalY = normalX + pointCount;
+			float* normalZ = normalY + pointCount;
+			float* slopes = normalZ + pointCount;
+			terrain->GetHeightsAtPositions(pointX, pointZ, pointCount, heights, found[set]);
+			terrain->GetNormalsAtPositions(pointX, pointZ, pointCount, normalX, normalY, normalZ, slopes, found[set] + pointCount);
+
+			for (int count = 1; count <= 17; count++) {
+				int start = (count * 37) % (pointCount - count);
+				float shortValues[17 * 5];
+				bool shortFound[17 * 2];
+				terrain->GetHeightsAtPositions(pointX + start, pointZ + start, count, shortValues, shortFound);
+				terrain->GetNormalsAtPositions(pointX + start, pointZ + start, count, shortValues + 17, shortValues + 34, shortValues + 51, shortValues + 68, shortFound + 17);
+
+				for (int value = 0; value < 5; value++) {
+					tailsMatch = tailsMatch && (memcmp(shortValues + (value * 17), heights + (value * pointCount) + start, count * sizeof(float)) == 0);
+				}
+
+				tailsMatch = tailsMatch && (memcmp(shortFound, found[set] + start, count * sizeof(bool)) == 0);
+				tailsMatch = tailsMatch && (memcmp(shortFound + 17, found[set] + pointCount + start, count * sizeof(bool)) == 0);
+			}
+		}
+
+		TerrainKernels::SetInstructionSet(originalSet);
+
+		bool setsMatch = true;
+		for (int set = 1; set < setCount; set++) {
+			setsMatch = setsMatch && (memcmp(values[set], values[0], pointCount * valueCount * sizeof(float)) == 0);
+			setsMatch = setsMatch && (memcmp(found[set], found[0], pointCount * 2 * sizeof(bool)) == 0);
+		}
+
+		// Against the single queries and the height field, using the scalar results since the others match them.
+		const float* heights = values[0];
+		const float* normalX = heights + pointCount;
+		const float* normalY = normalX + pointCount;
+		const float* normalZ = normalY + pointCount;
+		const float* slopes = normalZ + pointCount;
+		int foundCount = 0;
+		bool foundMatch = true;
+		bool heightsMatch = true;
+		bool normalsUnit = true;
+		bool vertexNormalsMatch = true;
+		bool slopesMatch = true;
+		bool missesClear = true;
+
+		for (int k = 0; k < pointCount; k++) {
+			float x = pointX[k];
+			float z = pointZ[k];
+			bool inside = (x >= 0.0f) && (x <= static_cast<float>(setup.terrainWidth - 1)) && (z >= 0.0f) && (z <= static_cast<float>(backZ));
+
+			foundMatch = foundMatch && (found[0][k] == inside) && (found[0][pointCount + k] == inside);
+			if (!found[0][k]) {
+				missesClear = missesClear && (heights[k] == 0.0f) && (normalX[k] == 0.0f) && (normalY[k] == 1.0f) && (normalZ[k] == 0.0f) && (slopes[k] == 0.0f);
+				continue;
+			}
+
+			foundCount++;
+
+			float height = 0.0f;
+			if (terrain->GetHeightAtPosition(x, z, height)) {
+				heightsMatch = heightsMatch && (fabsf(heights[k] - height) <= 1.0e-4f * (1.0f + fabsf(height)));
+			}
+
+			float length = sqrtf((normalX[k] * normalX[k]) + (normalY[k] * normalY[k]) + (normalZ[k] * normalZ[k]));
+			normalsUnit = normalsUnit && (fabsf(length - 1.0f) <= 1.0e-5f) && (normalY[k] > 0.0f);
+
+			if (vertexPoint[k]) {
+				float vertexNormal[3];
+				HeightField::UnpackNormal(heightField->GetNormalRow(backZ - static_cast<int>(z))[static_cast<int>(x)], vertexNormal[0], vertexNormal[1], vertexNormal[2]);
+
+				float vertexLength = sqrtf((vertexNormal[0] * vertexNormal[0]) + (vertexNormal[1] * vertexNormal[1]) + (vertexNormal[2] * vertexNormal[2]));
+				vertexNormalsMatch = vertexNormalsMatch && (fabsf(normalX[k] - (vertexNormal[0] / vertexLength)) <= 1.0e-6f) &&
+					(fabsf(normalY[k] - (vertexNormal[1] / vertexLength)) <= 1.0e-6f) && (fabsf(normalZ[k] - (vertexNormal[2] / vertexLength)) <= 1.0e-6f);
+			}
+
+			// The slope of the triangle under the point from three heights well inside it, where the batch can't reach
+			// the next cell and its own rounding of the shared corners.
+			int column = std::min(static_cast<int>(x), setup.terrainWidth - 2);
+			int row = std::min(backZ - static_cast<int>(ceilf(z)), setup.terrainHeight - 2);
+			bool upper = ((x - static_cast<float>(column)) + (static_cast<float>(backZ - row) - z)) <= 1.0f;
+			float offset = upper ? 0.25f : 0.75f;
+			float step = upper ? 0.25f : -0.25f;
+			float sampleX[3] = { static_cast<float>(column) + offset, static_cast<float>(column) + offset + step, static_cast<float>(column) + offset };
+			float sampleZ[3] = { static_cast<float>(backZ - row) - offset, static_cast<float>(backZ - row) - offset, static_cast<float>(backZ - row) - offset - step };
+			float sampleHeights[3];
+			bool sampleFound[3];
+			terrain->GetHeightsAtPositions(sampleX, sampleZ, 3, sampleHeights, sampleFound);
+
+			float gradientX = (sampleHeights[1] - sampleHeights[0]) / step;
+			float gradientY = (sampleHeights[2] - sampleHeights[0]) / step;
+			float slope = sqrtf((gradientX * gradientX) + (gradientY * gradientY));
+			slopesMatch = slopesMatch && (fabsf(slopes[k] - slope) <= 1.0e-3f * (1.0f + slope));
+		}
+
+		// The queries only read the terrain, so any number of threads at once get the same answers.
+		const int taskCount = 16;
+		float* taskValues = new float[taskCount * pointCount * valueCount];
+		bool* taskFound = new bool[taskCount * pointCount * 2];
+
+		concurrency::parallel_for(0, taskCount, [&](int task) {
+			float* taskHeights = taskValues + (task * pointCount * valueCount);
+			bool* taskHeightsFound = taskFound + (task * pointCount * 2);
+			terrain->GetHeightsAtPositions(pointX, pointZ, pointCount, taskHeights, taskHeightsFound);
+			terrain->GetNormalsAtPositions(pointX, pointZ, pointCount, taskHeights + pointCount, taskHeights + (pointCount * 2), taskHeights + (pointCount * 3), taskHeights + (pointCount * 4), taskHeightsFound + pointCount);
+		});
+
+		// The tasks ran with the best set the CPU has, which matched the scalar results above.
+		bool threadsMatch = true;
+		for (int task = 0; task < taskCount; task++) {
+			threadsMatch = threadsMatch && (memcmp(taskValues + (task * pointCount * valueCount), values[0], pointCount * valueCount * sizeof(float)) == 0);
+			threadsMatch = threadsMatch && (memcmp(taskFound + (task * pointCount * 2), found[0], pointCount * 2 * sizeof(bool)) == 0);
+		}
+
+		harness.Report("%dx%d: %d of %d points found, %d instruction sets", setup.terrainWidth, setup.terrainHeight, foundCount, pointCount, setCount);
+
+		TEST_CHECK(harness, foundCount > pointCount / 2);
+		TEST_CHECK(harness, setsMatch);
+		TEST_CHECK(harness, tailsMatch);
+		TEST_CHECK(harness, foundMatch);
+		TEST_CHECK(harness, missesClear);
+		TEST_CHECK(harness, heightsMatch);
+		TEST_CHECK(harness, normalsUnit);
+		TEST_CHECK(harness, vertexNormalsMatch);
+		TEST_CHECK(harness, slopesMatch);
+		TEST_CHECK(harness, threadsMatch);
+
+		delete[] taskFound;
+		delete[] taskValues;
+		for (int set = 0; set < setCount; set++) {
+			delete[] found[set];
+			delete[] values[set];
+		}
+		delete[] vertexPoint;
+		delete[] pointZ;
+		delete[] pointX;
+		delete terrain;
+		delete heightField;
+	}
+}
+
+void BenchmarkHeightQueries(TestHarness& harness) {
+	TestDevice device;
+	TEST_CHECK(harness, device.Initialize());
+
+	TestTerrain testTerrain;
+	TEST_CHECK(harness, testTerrain.Initialize("height-benchmark", TestTerrain::GetShippedSetup()));
+
+	const TestTerrain::SetupType& setup = testTerrain.GetSetup();
+	HeightField* heightField = testTerrain.CreateHeightField();
+	TEST_CHECK(harness, heightField != nullptr);
+
+	Terrain* terrain = new Terrain;
+	bool result = terrain->Initialize(device.GetDevice(), testTerrain.GetSetupFilename());
+	TEST_CHECK(harness, result);
+
+	if (!heightField || !result) {
+		delete terrain;
+		delete heightField;
+		return;
+	}
+
+	int cellCountX = (heightField->GetWidth() - 1) / (setup.cellWidth - 1);
+	int cellCountY = (heightField->GetHeight() - 1) / (setup.cellHeight - 1);
+	int vertexCount = TerrainMesh::GetVertexCount(setup.cellWidth, setup.cellHeight);
+	float* positions = BuildReferenceVertices(heightField, setup, cellCountX, cellCountY);
+	float* bounds;
+	unsigned short* indices;
+	int indexCount;
+	BuildReferenceCells(heightField, setup, cellCountX, cellCountY, bounds, indices, indexCount);
+
+	// Random points over the shipped terrain.  The scan is slow enough that it only gets a slice of them.
+	const int pointCount = 1000000;
+	const int scanCount = 20000;
+	float* pointX = new float[pointCount];
+	float* pointZ = new float[pointCount];
+	unsigned int state = 4242;
+
+	for (int k = 0; k < pointCount; k++) {
+		pointX[k] = GetRandom(state) * static_cast<float>(setup.terrainWidth - 1);
+		pointZ[k] = GetRandom(state) * static_cast<float>(setup.terrainHeight - 1);
+	}
+
+	float heightSum = 0.0f;
+	double startTime = TestHarness::GetTime();
+
+	for (int k = 0; k < scanCount; k++) {
+		float height = 0.0f;
+		GetReferenceHeight(positions, bounds, indices, indexCount, vertexCount, cellCountX * cellCountY, pointX[k], pointZ[k], height);
+		heightSum += height;
+	}
+
+	double scanTime = (TestHarness::GetTime() - startTime) / scanCount;
+
+	startTime = TestHarness::GetTime();
+
+	for (int k = 0; k < pointCount; k++) {
+		float height = 0.0f;
+		terrain->GetHeightAtPosition(pointX[k], pointZ[k], height);
+		heightSum += height;
+	}
+
+	double lookupTime = (TestHarness::GetTime() - startTime) / pointCount;
+
+	harness.Report("cell scan %.3f us, grid lookup %.3f us a query, %.0fx faster (checksum %g)", scanTime * 1.0e6, lookupTime * 1.0e6, scanTime / lookupTime, heightSum);
+
+	delete[] pointZ;
+	delete[] pointX;
+	delete[] indices;
+	delete[] bounds;
+	delete[] positions;
+	delete terrain;
+	delete heightField;
+}
@@ -0,0 +1,33 @@
+#include "pch.h"
+#include "TestDevice.h"
+
+TestDevice::TestDevice() {}
+
+TestDevice::~TestDevice() {
+	Shutdown();
+}
+
+bool TestDevice::Initialize() {
+	D3D_FEATURE_LEVEL featureLevel = D3D_FEATURE_LEVEL_11_0;
+
+	HRESULT result = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_WARP, nullptr, 0, &featureLevel, 1, D3D11_SDK_VERSION,
+		m_device.GetAddressOf(), nullptr, m_deviceContext.GetAddressOf());
+	if (FAILED(result)) {
+		return false;
+	}
+
+	return true;
+}
+
+void TestDevice::Shutdown() {
+	m_deviceContext.Reset();
+	m_device.Reset();
+}
+
+ID3D11Device* TestDevice::GetDevice() const {
+	return m_device.Get();
+}
+
+ID3D11DeviceContext* TestDevice::GetDeviceContext() const {
+	return m_deviceContext.Get();
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <d3d11_2.h>
+
+// A WARP device for the tests that load a whole terrain.  The terrain only creates and updates buffers on it, so the
+// tests run the same on machines without a graphics card.
+class TestDevice {
+public:
+	TestDevice();
+	~TestDevice();
+
+	bool Initialize();
+	void Shutdown();
+
+	ID3D11Device* GetDevice() const;
+	ID3D11DeviceContext* GetDeviceContext() const;
+
+private:
+	TestDevice(const TestDevice&);
+
+	Microsoft::WRL::ComPtr<ID3D11Device> m_device;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> m_deviceContext;
+};
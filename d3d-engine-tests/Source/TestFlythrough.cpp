@@ -0,0 +1,77 @@
+#include "pch.h"
+#include "TestFlythrough.h"
+#include "Terrain.h"
+
+using namespace DirectX;
+
+const float TestFlythrough::FIELD_OF_VIEW = 3.14159265f / 4.0f;
+const float TestFlythrough::SCREEN_ASPECT = 16.0f / 9.0f;
+const float TestFlythrough::SCREEN_NEAR = 0.1f;
+const float TestFlythrough::SCREEN_DEPTH = 1500.0f;
+const float TestFlythrough::EYE_HEIGHT = 20.0f;
+
+TestFlythrough::TestFlythrough() :
+	m_Terrain(nullptr),
+	m_terrainWidth(0),
+	m_terrainHeight(0),
+	m_frameCount(0) {}
+
+TestFlythrough::TestFlythrough(const TestFlythrough&) :
+	m_Terrain(nullptr),
+	m_terrainWidth(0),
+	m_terrainHeight(0),
+	m_frameCount(0) {}
+
+TestFlythrough::~TestFlythrough() {}
+
+void TestFlythrough::Initialize(const Terrain* terrain, int terrainWidth, int terrainHeight, int frameCount) {
+	m_Terrain = terrain;
+	m_terrainWidth = terrainWidth;
+	m_terrainHeight = terrainHeight;
+	m_frameCount = frameCount;
+}
+
+int TestFlythrough::GetFrameCount() const {
+	return m_frameCount;
+}
+
+Vector3 TestFlythrough::GetPosition(int frame) const {
+	return GetPathPoint(static_cast<float>(frame) / static_cast<float>(m_frameCount));
+}
+
+XMMATRIX TestFlythrough::GetViewMatrix(int frame) const {
+	// Look at a point a little further along the path and slightly below the eye.
+	Vector3 position = GetPosition(frame);
+	Vector3 ahead = GetPathPoint((static_cast<float>(frame) + 0.5f) / static_cast<float>(m_frameCount));
+
+	XMVECTOR eye = XMVectorSet(position.x, position.y, position.z, 1.0f);
+	XMVECTOR focus = XMVectorSet(ahead.x, position.y - 2.0f, ahead.z, 1.0f);
+	XMVECTOR up = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+
+	return XMMatrixLookAtLH(eye, focus, up);
+}
+
+XMMATRIX TestFlythrough::GetProjectionMatrix() const {
+	return XMMatrixPerspectiveFovLH(FIELD_OF_VIEW, SCREEN_ASPECT, SCREEN_NEAR, SCREEN_DEPTH);
+}
+
+void TestFlythrough::ConstructFrustum(int frame, Frustum& frustum) const {
+	frustum.Initialize(SCREEN_DEPTH);
+	frustum.ConstructFrustum(GetProjectionMatrix(), GetViewMatrix(frame));
+}
+
+Vector3 TestFlythrough::GetPathPoint(float t) const {
+	// A loop round the middle of the terrain that bulges out towards the edges, so the view sweeps over the corners.
+	float angle = t * 2.0f * 3.14159265f;
+	float radius = 0.3f + (0.1f * cosf(4.0f * angle));
+	float x = (0.5f + (radius * cosf(angle))) * static_cast<float>(m_terrainWidth - 1);
+	float z = (0.5f + (radius * sinf(angle))) * static_cast<float>(m_terrainHeight - 1);
+
+	// Keep above the ground where there is any.
+	float height = 0.0f;
+	if (m_Terrain && !m_Terrain->GetHeightAtPosition(x, z, height)) {
+		height = 0.0f;
+	}
+
+	return Vector3(x, height + EYE_HEIGHT, z);
+}
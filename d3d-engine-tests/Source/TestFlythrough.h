@@ -0,0 +1,42 @@
+#pragma once
+
+#include "DXMath.h"
+#include "Frustum.h"
+
+class Terrain;
+
+// A camera flown low over a terrain for the culling benchmarks.  It loops round a rounded square over the middle of the
+// terrain a little above the ground and looks along the way it is going, so every frame sees a different mix of near
+// and far cells.  The projection matches the scene's.
+class TestFlythrough {
+public:
+	TestFlythrough();
+	~TestFlythrough();
+
+	void Initialize(const Terrain* terrain, int terrainWidth, int terrainHeight, int frameCount);
+
+	int GetFrameCount() const;
+	Vector3 GetPosition(int frame) const;
+	DirectX::XMMATRIX GetViewMatrix(int frame) const;
+	DirectX::XMMATRIX GetProjectionMatrix() const;
+	void ConstructFrustum(int frame, Frustum& frustum) const;
+
+	// Field of view, aspect and depth range of the projection, the same as the scene's.
+	static const float FIELD_OF_VIEW;
+	static const float SCREEN_ASPECT;
+	static const float SCREEN_NEAR;
+	static const float SCREEN_DEPTH;
+
+private:
+	TestFlythrough(const TestFlythrough&);
+
+	Vector3 GetPathPoint(float t) const;
+
+	// Height of the camera above the ground.
+	static const float EYE_HEIGHT;
+
+	const Terrain* m_Terrain;
+	int m_terrainWidth;
+	int m_terrainHeight;
+	int m_frameCount;
+};
@@ -0,0 +1,54 @@
+#include "pch.h"
+#include "TestHarness.h"
+
+TestHarness::TestHarness() :
+	m_failureCount(0),
+	m_printedCount(0) {}
+
+TestHarness::~TestHarness() {}
+
+void TestHarness::BeginTest() {
+	m_printedCount = 0;
+}
+
+void TestHarness::Check(bool condition, const char* expression, const char* file, int line) {
+	if (condition) {
+		return;
+	}
+
+	// A broken loop can fail thousands of checks, only the first few of each test are worth reading.
+	if (m_printedCount < MAX_PRINTED_FAILURES) {
+		std::printf("  FAILED %s(%d): %s\n", file, line, expression);
+	}
+	else if (m_printedCount == MAX_PRINTED_FAILURES) {
+		std::printf("  ...\n");
+	}
+
+	m_printedCount++;
+	m_failureCount++;
+}
+
+void TestHarness::Report(const char* format, ...) const {
+	char buffer[512];
+
+	va_list args;
+	va_start(args, format);
+	vsprintf_s(buffer, format, args);
+	va_end(args);
+
+	std::printf("  %s\n", buffer);
+}
+
+int TestHarness::GetFailureCount() const {
+	return m_failureCount;
+}
+
+double TestHarness::GetTime() {
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+
+	return static_cast<double>(counter.QuadPart) / static_cast<double>(frequency.QuadPart);
+}
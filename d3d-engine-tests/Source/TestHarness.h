@@ -0,0 +1,30 @@
+#pragma once
+
+// Keeps count of the failed checks of the terrain tests and prints their results and the benchmark timings.  Every test
+// and benchmark is a plain function taking the harness, listed in main.cpp in the order they run.
+class TestHarness {
+public:
+	typedef void (*TestFunction)(TestHarness&);
+
+	TestHarness();
+	~TestHarness();
+
+	void BeginTest();
+	void Check(bool condition, const char* expression, const char* file, int line);
+	void Report(const char* format, ...) const;
+	int GetFailureCount() const;
+
+	static double GetTime();
+
+private:
+	TestHarness(const TestHarness&);
+
+	// Failed checks printed per test before the rest are only counted.
+	static const int MAX_PRINTED_FAILURES = 8;
+
+	int m_failureCount;
+	int m_printedCount;
+};
+
+// Checks a condition and carries on with the test when it fails, so one run reports every broken case.
+#define TEST_CHECK(harness, condition) (harness).Check((condition), #condition, __FILE__, __LINE__)
@@ -0,0 +1,337 @@
+#include "pch.h"
+#include "TestTerrain.h"
+#include "TerrainKernels.h"
+
+namespace {
+#pragma pack(2)
+	struct BitmapFileHeaderType {
+		unsigned short bfType;
+		unsigned int   bfSize;
+		unsigned short bfReserved1;
+		unsigned short bfReserved2;
+		unsigned int   bfOffBits;
+	};
+#pragma pack()
+
+	struct BitmapInfoHeaderType {
+		unsigned int   biSize;
+		int            biWidth;
+		int            biHeight;
+		unsigned short biPlanes;
+		unsigned short biBitCount;
+		unsigned int   biCompression;
+		unsigned int   biSizeImage;
+		int            biXPelsPerMeter;
+		int            biYPelsPerMeter;
+		unsigned int   biClrUsed;
+		unsigned int   biClrImportant;
+	};
+}
+
+TestTerrain::TestTerrain() :
+	m_setup(),
+	m_initialized(false) {
+	m_setupFilename[0] = '\0';
+	m_heightMapFilename[0] = '\0';
+	m_colorMapFilename[0] = '\0';
+	m_cacheFilename[0] = '\0';
+	m_visibilityFilename[0] = '\0';
+}
+
+TestTerrain::~TestTerrain() {
+	Shutdown();
+}
+
+bool TestTerrain::Initialize(const char* name, const TestTerrain::SetupType& setup) {
+	Shutdown();
+
+	m_setup = setup;
+	m_initialized = true;
+
+	std::snprintf(m_setupFilename, FILENAME_LENGTH, "test-%s.txt", name);
+	std::snprintf(m_cacheFilename, FILENAME_LENGTH, "test-%s.cache", name);
+	std::snprintf(m_visibilityFilename, FILENAME_LENGTH, "test-%s.pvs", name);
+
+	// The shipped terrain is only read, the synthetic one gets its own source files.
+	if (m_setup.shipped) {
+		std::snprintf(m_heightMapFilename, FILENAME_LENGTH, "../Data/heightmap.r16");
+		std::snprintf(m_colorMapFilename, FILENAME_LENGTH, "../Data/colormap.bmp");
+	}
+	else {
+		std::snprintf(m_heightMapFilename, FILENAME_LENGTH, "test-%s.r16", name);
+		std::snprintf(m_colorMapFilename, FILENAME_LENGTH, "test-%s.bmp", name);
+
+		if (!WriteHeightMap() || !WriteColorMap()) {
+			return false;
+		}
+	}
+
+	return WriteSetupFile();
+}
+
+void TestTerrain::Shutdown() {
+	if (!m_initialized) {
+		return;
+	}
+
+	std::remove(m_setupFilename);
+	std::remove(m_cacheFilename);
+	std::remove(m_visibilityFilename);
+
+	if (!m_setup.shipped) {
+		std::remove(m_heightMapFilename);
+		std::remove(m_colorMapFilename);
+	}
+
+	m_initialized = false;
+}
+
+char* TestTerrain::GetSetupFilename() {
+	return m_setupFilename;
+}
+
+const char* TestTerrain::GetHeightMapFilename() const {
+	return m_heightMapFilename;
+}
+
+const char* TestTerrain::GetCacheFilename() const {
+	return m_cacheFilename;
+}
+
+const char* TestTerrain::GetVisibilityFilename() const {
+	return m_visibilityFilename;
+}
+
+const TestTerrain::SetupType& TestTerrain::GetSetup() const {
+	return m_setup;
+}
+
+HeightField* TestTerrain::CreateHeightField() const {
+	// Pad the field out to whole cells the same way the terrain does.
+	int cellCountX = ((m_setup.terrainWidth - 2) / (m_setup.cellWidth - 1)) + 1;
+	int cellCountY = ((m_setup.terrainHeight - 2) / (m_setup.cellHeight - 1)) + 1;
+
+	HeightField* heightField = new HeightField;
+	if (!heightField->Initialize((cellCountX * (m_setup.cellWidth - 1)) + 1, (cellCountY * (m_setup.cellHeight - 1)) + 1, m_setup.terrainWidth, m_setup.terrainHeight)) {
+		delete heightField;
+		return nullptr;
+	}
+
+	// Read the heights back from the height map file so the shipped terrain is covered too.
+	FILE* filePtr;
+	if (fopen_s(&filePtr, m_heightMapFilename, "rb") != 0) {
+		delete heightField;
+		return nullptr;
+	}
+
+	unsigned short* row = new unsigned short[m_setup.terrainWidth];
+	bool succeeded = true;
+
+	for (int j = 0; j < m_setup.terrainHeight; j++) {
+		if (fread(row, sizeof(unsigned short), m_setup.terrainWidth, filePtr) != static_cast<size_t>(m_setup.terrainWidth)) {
+			succeeded = false;
+			break;
+		}
+
+		float* heights = heightField->GetHeightRow(j);
+		for (int i = 0; i < m_setup.terrainWidth; i++) {
+			heights[i] = static_cast<float>(row[i]) / m_setup.heightScale;
+		}
+	}
+
+	delete[] row;
+	fclose(filePtr);
+
+	if (!succeeded) {
+		delete heightField;
+		return nullptr;
+	}
+
+	// The colors are left black, none of the checks on the field look at them.
+	heightField->ExtendHeights();
+	heightField->ExtendColors();
+	TerrainKernels::CalculateNormals(heightField, 0, heightField->GetHeight());
+
+	return heightField;
+}
+
+TestTerrain::SetupType TestTerrain::GetSyntheticSetup(int terrainSize, int cellSize) {
+	SetupType setup = {};
+
+	setup.terrainWidth = terrainSize;
+	setup.terrainHeight = terrainSize;
+	setup.heightScale = 300.0f;
+	setup.cellWidth = cellSize;
+	setup.cellHeight = cellSize;
+	setup.pageRadius = 0.0f;
+	setup.pageBudget = 256;
+	setup.cache = false;
+	setup.editable = false;
+	setup.visibility = false;
+	setup.visibilityHeight = 32.0f;
+	setup.seed = 1;
+	setup.shipped = false;
+
+	return setup;
+}
+
+TestTerrain::SetupType TestTerrain::GetShippedSetup() {
+	SetupType setup = GetSyntheticSetup(1025, 33);
+	setup.shipped = true;
+
+	return setup;
+}
+
+unsigned short TestTerrain::GetSyntheticHeight(int i, int j, unsigned int seed) {
+	// Each octave halves the period and the amplitude of the last, so the hills have detail down to a few samples.
+	float sum = 0.0f;
+	float amplitude = 1.0f;
+	float total = 0.0f;
+	float frequency = 1.0f / static_cast<float>(NOISE_PERIOD);
+
+	for (int octave = 0; octave < NOISE_OCTAVES; octave++) {
+		sum += amplitude * GetNoise(static_cast<float>(i) * frequency, static_cast<float>(j) * frequency, seed + octave);
+		total += amplitude;
+		amplitude *= 0.5f;
+		frequency *= 2.0f;
+	}
+
+	return static_cast<unsigned short>((sum / total) * 65535.0f);
+}
+
+bool TestTerrain::WriteHeightMap() const {
+	FILE* filePtr;
+	if (fopen_s(&filePtr, m_heightMapFilename, "wb") != 0) {
+		return false;
+	}
+
+	unsigned short* row = new unsigned short[m_setup.terrainWidth];
+	bool succeeded = true;
+
+	for (int j = 0; j < m_setup.terrainHeight && succeeded; j++) {
+		for (int i = 0; i < m_setup.terrainWidth; i++) {
+			row[i] = GetSyntheticHeight(i, j, m_setup.seed);
+		}
+
+		succeeded = fwrite(row, sizeof(unsigned short), m_setup.terrainWidth, filePtr) == static_cast<size_t>(m_setup.terrainWidth);
+	}
+
+	delete[] row;
+
+	return (fclose(filePtr) == 0) && succeeded;
+}
+
+bool TestTerrain::WriteColorMap() const {
+	// A bottom up 24 bit bitmap, each line padded to 4 bytes like the terrain expects.
+	int linePitch = (((m_setup.terrainWidth * 3) + 3) / 4) * 4;
+	int imageSize = linePitch * m_setup.terrainHeight;
+
+	BitmapFileHeaderType fileHeader = {};
+	fileHeader.bfType = 0x4d42;
+	fileHeader.bfOffBits = sizeof(BitmapFileHeaderType) + sizeof(BitmapInfoHeaderType);
+	fileHeader.bfSize = fileHeader.bfOffBits + imageSize;
+
+	BitmapInfoHeaderType infoHeader = {};
+	infoHeader.biSize = sizeof(BitmapInfoHeaderType);
+	infoHeader.biWidth = m_setup.terrainWidth;
+	infoHeader.biHeight = m_setup.terrainHeight;
+	infoHeader.biPlanes = 1;
+	infoHeader.biBitCount = 24;
+	infoHeader.biSizeImage = imageSize;
+
+	unsigned char* image = new unsigned char[imageSize];
+	memset(image, 0, imageSize);
+
+	for (int j = 0; j < m_setup.terrainHeight; j++) {
+		unsigned char* line = image + ((m_setup.terrainHeight - 1 - j) * linePitch);
+
+		for (int i = 0; i < m_setup.terrainWidth; i++) {
+			GetSyntheticColor(i, j, line[(i * 3) + 2], line[(i * 3) + 1], line[i * 3]);
+		}
+	}
+
+	FILE* filePtr;
+	if (fopen_s(&filePtr, m_colorMapFilename, "wb") != 0) {
+		delete[] image;
+		return false;
+	}
+
+	bool succeeded = (fwrite(&fileHeader, sizeof(fileHeader), 1, filePtr) == 1) && (fwrite(&infoHeader, sizeof(infoHeader), 1, filePtr) == 1) &&
+		(fwrite(image, 1, imageSize, filePtr) == static_cast<size_t>(imageSize));
+
+	delete[] image;
+
+	return (fclose(filePtr) == 0) && succeeded;
+}
+
+bool TestTerrain::WriteSetupFile() const {
+	std::ofstream fout(m_setupFilename);
+	if (fout.fail()) {
+		return false;
+	}
+
+	fout << "Terrain Filename: " << m_heightMapFilename << "\n";
+	fout << "Terrain Height: " << m_setup.terrainHeight << "\n";
+	fout << "Terrain Width: " << m_setup.terrainWidth << "\n";
+	fout << "Terrain Scaling: " << m_setup.heightScale << "\n";
+	fout << "Color Map Filename: " << m_colorMapFilename << "\n";
+	fout << "Cell Height: " << m_setup.cellHeight << "\n";
+	fout << "Cell Width: " << m_setup.cellWidth << "\n";
+	fout << "Page Radius: " << m_setup.pageRadius << "\n";
+	fout << "Page Budget: " << m_setup.pageBudget << "\n";
+
+	// The file names can't be left blank, so the setup stops before the cache unless a later field needs it.
+	if (m_setup.cache || m_setup.editable || m_setup.visibility) {
+		fout << "Cache Filename: " << m_cacheFilename << "\n";
+		fout << "Editable: " << (m_setup.editable ? 1 : 0) << "\n";
+
+		if (m_setup.visibility) {
+			fout << "Visibility Filename: " << m_visibilityFilename << "\n";
+			fout << "Visibility Height: " << m_setup.visibilityHeight << "\n";
+		}
+	}
+
+	fout.close();
+
+	return !fout.fail();
+}
+
+void TestTerrain::GetSyntheticColor(int i, int j, unsigned char& r, unsigned char& g, unsigned char& b) const {
+	// Shade the hills from green in the valleys to grey on the tops.
+	int height = GetSyntheticHeight(i, j, m_setup.seed) >> 8;
+
+	r = static_cast<unsigned char>(60 + ((height * 140) >> 8));
+	g = static_cast<unsigned char>(110 + ((height * 90) >> 8));
+	b = static_cast<unsigned char>(50 + ((height * 150) >> 8));
+}
+
+float TestTerrain::GetNoise(float x, float y, unsigned int seed) {
+	int cornerX = static_cast<int>(std::floor(x));
+	int cornerY = static_cast<int>(std::floor(y));
+	float fractionX = x - static_cast<float>(cornerX);
+	float fractionY = y - static_cast<float>(cornerY);
+
+	// Smoothstep between the random values at the corners so the hills have no creases along the lattice.
+	float weightX = fractionX * fractionX * (3.0f - (2.0f * fractionX));
+	float weightY = fractionY * fractionY * (3.0f - (2.0f * fractionY));
+
+	float v00 = static_cast<float>(HashCorner(cornerX, cornerY, seed) & 0xffff) / 65535.0f;
+	float v10 = static_cast<float>(HashCorner(cornerX + 1, cornerY, seed) & 0xffff) / 65535.0f;
+	float v01 = static_cast<float>(HashCorner(cornerX, cornerY + 1, seed) & 0xffff) / 65535.0f;
+	float v11 = static_cast<float>(HashCorner(cornerX + 1, cornerY + 1, seed) & 0xffff) / 65535.0f;
+
+	float top = v00 + ((v10 - v00) * weightX);
+	float bottom = v01 + ((v11 - v01) * weightX);
+
+	return top + ((bottom - top) * weightY);
+}
+
+unsigned int TestTerrain::HashCorner(int x, int y, unsigned int seed) {
+	unsigned int hash = (static_cast<unsigned int>(x) * 0x8da6b343u) ^ (static_cast<unsigned int>(y) * 0xd8163841u) ^ (seed * 0xcb1ab31fu);
+
+	hash ^= hash >> 13;
+	hash *= 0x5bd1e995u;
+	hash ^= hash >> 15;
+
+	return hash;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "HeightField.h"
+
+// Writes the setup file and source files of a terrain for the tests to load, either over the shipped height map or a
+// synthetic one of any size.  The synthetic height map is rolling hills from a few octaves of value noise, the same for
+// the same seed, so the tests can rebuild its height field without the device.  Every file is written to the working
+// directory under the name of the terrain and removed again on Shutdown.
+class TestTerrain {
+public:
+	struct SetupType {
+		int terrainWidth;
+		int terrainHeight;
+		float heightScale;
+		int cellWidth;
+		int cellHeight;
+		float pageRadius;
+		int pageBudget;
+		bool cache;
+		bool editable;
+		bool visibility;
+		float visibilityHeight;
+		unsigned int seed;
+		bool shipped;
+	};
+
+	TestTerrain();
+	~TestTerrain();
+
+	bool Initialize(const char* name, const SetupType& setup);
+	void Shutdown();
+
+	char* GetSetupFilename();
+	const char* GetHeightMapFilename() const;
+	const char* GetCacheFilename() const;
+	const char* GetVisibilityFilename() const;
+	const SetupType& GetSetup() const;
+	HeightField* CreateHeightField() const;
+
+	static SetupType GetSyntheticSetup(int terrainSize, int cellSize);
+	static SetupType GetShippedSetup();
+	static unsigned short GetSyntheticHeight(int i, int j, unsigned int seed);
+
+private:
+	TestTerrain(const TestTerrain&);
+
+	bool WriteHeightMap() const;
+	bool WriteColorMap() const;
+	bool WriteSetupFile() const;
+	void GetSyntheticColor(int i, int j, unsigned char& r, unsigned char& g, unsigned char& b) const;
+
+	static float GetNoise(float x, float y, unsigned int seed);
+	static unsigned int HashCorner(int x, int y, unsigned int seed);
+
+	// Period in samples of the broadest octave of the synthetic hills, and the octaves summed.
+	static const int NOISE_PERIOD = 128;
+	static const int NOISE_OCTAVES = 5;
+
+	static const int FILENAME_LENGTH = 256;
+
+	SetupType m_setup;
+	bool m_initialized;
+	char m_setupFilename[FILENAME_LENGTH];
+	char m_heightMapFilename[FILENAME_LENGTH];
+	char m_colorMapFilename[FILENAME_LENGTH];
+	char m_cacheFilename[FILENAME_LENGTH];
+	char m_visibilityFilename[FILENAME_LENGTH];
+};
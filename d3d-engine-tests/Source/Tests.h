@@ -0,0 +1,51 @@
+#pragma once
+
+#include "TestHarness.h"
+
+// BuildTests.cpp
+void TestPeakMemory(TestHarness&);
+void TestParallelBuild(TestHarness&);
+void BenchmarkParallelBuild(TestHarness&);
+void TestTerrainCache(TestHarness&);
+void BenchmarkTerrainCache(TestHarness&);
+void TestPaging(TestHarness&);
+
+// CullTests.cpp
+void BenchmarkCellSizes(TestHarness&);
+void TestRectangleKernel(TestHarness&);
+void BenchmarkPlaneCache(TestHarness&);
+void TestRectangleClassification(TestHarness&);
+void TestCullViews(TestHarness&);
+void TestOcclusion(TestHarness&);
+void TestVisibility(TestHarness&);
+void TestVisibleCellSort(TestHarness&);
+void BenchmarkVisibleCellSort(TestHarness&);
+
+// EditTests.cpp
+void TestTerrainEdits(TestHarness&);
+void BenchmarkTerrainEdits(TestHarness&);
+
+// KernelTests.cpp
+void TestNormalKernel(TestHarness&);
+void BenchmarkNormalKernel(TestHarness&);
+void TestTangentKernel(TestHarness&);
+void BenchmarkTangentKernel(TestHarness&);
+
+// LodTests.cpp
+void TestLodSelection(TestHarness&);
+void TestLodErrors(TestHarness&);
+void TestLodEdit(TestHarness&);
+
+// MeshTests.cpp
+void TestMeshIndices(TestHarness&);
+void TestMeshVertices(TestHarness&);
+void TestHeightQuantization(TestHarness&);
+void TestNormalPacking(TestHarness&);
+
+// QueryTests.cpp
+void TestRayCast(TestHarness&);
+void BenchmarkRayCast(TestHarness&);
+void TestHeightQueries(TestHarness&);
+void TestHeightBounds(TestHarness&);
+void TestSurfaceQueries(TestHarness&);
+void BenchmarkHeightQueries(TestHarness&);
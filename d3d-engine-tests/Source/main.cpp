@@ -0,0 +1,94 @@
+#include "pch.h"
+#include "Tests.h"
+
+namespace {
+	struct TestType {
+		const char* name;
+		TestHarness::TestFunction function;
+		bool benchmark;
+	};
+
+	// Tests run in this order.  The benchmarks only run when asked for with -bench since they load the shipped terrain
+	// many times over.  The peak memory test goes first since the peak of the process only grows.
+	const TestType TESTS[] = {
+		{ "PeakMemory", TestPeakMemory, false },
+		{ "ParallelBuild", TestParallelBuild, false },
+		{ "ParallelBuildBenchmark", BenchmarkParallelBuild, true },
+		{ "TerrainCache", TestTerrainCache, false },
+		{ "TerrainCacheBenchmark", BenchmarkTerrainCache, true },
+		{ "Paging", TestPaging, false },
+		{ "MeshIndices", TestMeshIndices, false },
+		{ "MeshVertices", TestMeshVertices, false },
+		{ "HeightQuantization", TestHeightQuantization, false },
+		{ "NormalPacking", TestNormalPacking, false },
+		{ "NormalKernel", TestNormalKernel, false },
+		{ "NormalKernelBenchmark", BenchmarkNormalKernel, true },
+		{ "TangentKernel", TestTangentKernel, false },
+		{ "TangentKernelBenchmark", BenchmarkTangentKernel, true },
+		{ "LodSelection", TestLodSelection, false },
+		{ "LodErrors", TestLodErrors, false },
+		{ "LodEdit", TestLodEdit, false },
+		{ "TerrainEdits", TestTerrainEdits, false },
+		{ "TerrainEditBenchmark", BenchmarkTerrainEdits, true },
+		{ "CellSizeBenchmark", BenchmarkCellSizes, true },
+		{ "RectangleKernel", TestRectangleKernel, false },
+		{ "PlaneCacheBenchmark", BenchmarkPlaneCache, true },
+		{ "RectangleClassification", TestRectangleClassification, false },
+		{ "CullViews", TestCullViews, false },
+		{ "Occlusion", TestOcclusion, false },
+		{ "Visibility", TestVisibility, false },
+		{ "VisibleCellSort", TestVisibleCellSort, false },
+		{ "VisibleCellSortBenchmark", BenchmarkVisibleCellSort, true },
+		{ "RayCast", TestRayCast, false },
+		{ "RayCastBenchmark", BenchmarkRayCast, true },
+		{ "HeightQueries", TestHeightQueries, false },
+		{ "HeightQueryBenchmark", BenchmarkHeightQueries, true },
+		{ "HeightBounds", TestHeightBounds, false },
+		{ "SurfaceQueries", TestSurfaceQueries, false },
+	};
+}
+
+int main(int argc, char* argv[]) {
+	bool benchmarks = false;
+	const char* filter = nullptr;
+
+	// -bench adds the benchmarks and any other argument only runs the tests with it in their name.
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-bench") == 0) {
+			benchmarks = true;
+		}
+		else {
+			filter = argv[i];
+		}
+	}
+
+	TestHarness harness;
+	int testCount = 0;
+	int failedCount = 0;
+
+	for (const TestType& test : TESTS) {
+		if ((test.benchmark && !benchmarks) || (filter && !strstr(test.name, filter))) {
+			continue;
+		}
+
+		std::printf("[ RUN    ] %s\n", test.name);
+
+		int failures = harness.GetFailureCount();
+		double startTime = TestHarness::GetTime();
+
+		harness.BeginTest();
+		test.function(harness);
+
+		bool passed = harness.GetFailureCount() == failures;
+		std::printf("[ %s ] %s (%.0f ms)\n", passed ? "    OK" : "FAILED", test.name, (TestHarness::GetTime() - startTime) * 1000.0);
+
+		testCount++;
+		if (!passed) {
+			failedCount++;
+		}
+	}
+
+	std::printf("%d of %d tests passed\n", testCount - failedCount, testCount);
+
+	return (failedCount == 0) ? 0 : 1;
+}
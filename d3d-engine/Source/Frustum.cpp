@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "Frustum.h"
+#include "TerrainKernels.h"
 
 using namespace DirectX;
 
@@ -289,3 +290,436 @@ bool Frustum::CheckRectangle2(float maxWidth, float maxHeight, float maxDepth, f
 
 	return true;
 }
+
+Frustum::Classification Frustum::ClassifySphere(float xCenter, float yCenter, float zCenter, float radius) const {
+	// The sphere is outside when its center is a radius behind any plane, and inside when it is a radius in front of all of them.
+	Classification classification = INSIDE;
+
+	for (int i = 0; i < 6; i++) {
+		float dotProduct = ((m_planes[i][0] * xCenter) + (m_planes[i][1] * yCenter) + (m_planes[i][2] * zCenter) + (m_planes[i][3] * 1.0f));
+		if (dotProduct <= -radius) {
+			return OUTSIDE;
+		}
+
+		if (dotProduct < radius) {
+			classification = INTERSECTING;
+		}
+	}
+
+	return classification;
+}
+
+Frustum::Classification Frustum::ClassifyRectangle(float maxWidth, float maxHeight, float maxDepth, float minWidth, float minHeight, float minDepth) const {
+	int planeMask = ALL_PLANES;
+	int lastPlane = 0;
+
+	return ClassifyRectangle(maxWidth, maxHeight, maxDepth, minWidth, minHeight, minDepth, planeMask, lastPlane);
+}
+
+Frustum::Classification Frustum::ClassifyRectangle(float maxWidth, float maxHeight, float maxDepth, float minWidth, float minHeight, float minDepth, int& planeMask, int& lastPlane) const {
+	// Only the planes left in the mask are tested, starting with the one that rejected the rectangle last time since
+	// the camera barely moves between frames.  A rejection records the plane that did it, otherwise every plane the
+	// rectangle is completely in front of is taken out of the mask so the boxes inside it can skip that plane too.
+	for (int n = 0; n < 6; n++) {
+		int i = (n == 0) ? lastPlane : ((n <= lastPlane) ? n - 1 : n);
+		if ((planeMask & (1 << i)) == 0) {
+			continue;
+		}
+
+		// The corner furthest in front of the plane decides whether the rectangle is outside.
+		float x = (m_planes[i][0] >= 0.0f) ? maxWidth : minWidth;
+		float y = (m_planes[i][1] >= 0.0f) ? maxHeight : minHeight;
+		float z = (m_planes[i][2] >= 0.0f) ? maxDepth : minDepth;
+
+		float dotProduct = ((m_planes[i][0] * x) + (m_planes[i][1] * y) + (m_planes[i][2] * z) + (m_planes[i][3] * 1.0f));
+		if (dotProduct < 0.0f) {
+			lastPlane = i;
+			return OUTSIDE;
+		}
+
+		// The corner furthest behind it decides whether the rectangle is completely inside.
+		x = (m_planes[i][0] >= 0.0f) ? minWidth : maxWidth;
+		y = (m_planes[i][1] >= 0.0f) ? minHeight : maxHeight;
+		z = (m_planes[i][2] >= 0.0f) ? minDepth : maxDepth;
+
+		dotProduct = ((m_planes[i][0] * x) + (m_planes[i][1] * y) + (m_planes[i][2] * z) + (m_planes[i][3] * 1.0f));
+		if (dotProduct >= 0.0f) {
+			planeMask &= ~(1 << i);
+		}
+	}
+
+	return (planeMask == 0) ? INSIDE : INTERSECTING;
+}
+
+void Frustum::ClassifyRectangles(const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth, int count, int planeMask, int& lastPlane, Classification* classifications, int* planeMasks) const {
+	// Each rectangle gets its classification and the planes of the mask it straddles, which is what its own children
+	// need to test.  The mask of a rectangle that is outside is left empty.  Like CheckRectangles the plane that last
+	// rejected a whole register is tried first.
+	const float* frontX[6];
+	const float* frontY[6];
+	const float* frontZ[6];
+	const float* backX[6];
+	const float* backY[6];
+	const float* backZ[6];
+
+	for (int i = 0; i < 6; i++) {
+		frontX[i] = (m_planes[i][0] >= 0.0f) ? maxWidth : minWidth;
+		frontY[i] = (m_planes[i][1] >= 0.0f) ? maxHeight : minHeight;
+		frontZ[i] = (m_planes[i][2] >= 0.0f) ? maxDepth : minDepth;
+		backX[i] = (m_planes[i][0] >= 0.0f) ? minWidth : maxWidth;
+		backY[i] = (m_planes[i][1] >= 0.0f) ? minHeight : maxHeight;
+		backZ[i] = (m_planes[i][2] >= 0.0f) ? minDepth : maxDepth;
+	}
+
+	__m128 zero = _mm_setzero_ps();
+	int k = 0;
+
+	for (; k + 4 <= count; k += 4) {
+		__m128 outside = _mm_setzero_ps();
+		__m128i straddled = _mm_setzero_si128();
+
+		for (int n = 0; n < 6; n++) {
+			int i = (n == 0) ? lastPlane : ((n <= lastPlane) ? n - 1 : n);
+			if ((planeMask & (1 << i)) == 0) {
+				continue;
+			}
+
+			__m128 planeX = _mm_set1_ps(m_planes[i][0]);
+			__m128 planeY = _mm_set1_ps(m_planes[i][1]);
+			__m128 planeZ = _mm_set1_ps(m_planes[i][2]);
+			__m128 planeW = _mm_set1_ps(m_planes[i][3]);
+
+			__m128 dotProduct = _mm_mul_ps(planeX, _mm_loadu_ps(frontX[i] + k));
+			dotProduct = _mm_add_ps(dotProduct, _mm_mul_ps(planeY, _mm_loadu_ps(frontY[i] + k)));
+			dotProduct = _mm_add_ps(dotProduct, _mm_mul_ps(planeZ, _mm_loadu_ps(frontZ[i] + k)));
+			dotProduct = _mm_add_ps(dotProduct, planeW);
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(dotProduct, zero));
+
+			dotProduct = _mm_mul_ps(planeX, _mm_loadu_ps(backX[i] + k));
+			dotProduct = _mm_add_ps(dotProduct, _mm_mul_ps(planeY, _mm_loadu_ps(backY[i] + k)));
+			dotProduct = _mm_add_ps(dotProduct, _mm_mul_ps(planeZ, _mm_loadu_ps(backZ[i] + k)));
+			dotProduct = _mm_add_ps(dotProduct, planeW);
+			straddled = _mm_or_si128(straddled, _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(dotProduct, zero)), _mm_set1_epi32(1 << i)));
+
+			// Stop once every rectangle in the register has been rejected, and start with this plane next time.
+			if (_mm_movemask_ps(outside) == 0xf) {
+				lastPlane = i;
+				break;
+			}
+		}
+
+		// Clear the masks of the rejected rectangles.
+		straddled = _mm_andnot_si128(_mm_castps_si128(outside), straddled);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(planeMasks + k), straddled);
+
+		int outsideBits = _mm_movemask_ps(outside);
+		for (int i = 0; i < 4; i++) {
+			if ((outsideBits >> i) & 1) {
+				classifications[k + i] = OUTSIDE;
+			}
+			else {
+				classifications[k + i] = (planeMasks[k + i] == 0) ? INSIDE : INTERSECTING;
+			}
+		}
+	}
+
+	// Classify the rest one by one.
+	for (; k < count; k++) {
+		int rectangleMask = planeMask;
+
+		classifications[k] = ClassifyRectangle(maxWidth[k], maxHeight[k], maxDepth[k], minWidth[k], minHeight[k], minDepth[k], rectangleMask, lastPlane);
+		planeMasks[k] = (classifications[k] == OUTSIDE) ? 0 : rectangleMask;
+	}
+}
+
+int Frustum::CheckRectangles(const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth, const int* ids, int count, int planeMask, int& lastPlane, int* visible) const {
+	// AVX2 support implies AVX.
+	static const bool useAvx = TerrainKernels::SupportsAvx2();
+
+	// Test the rectangles a register at a time and finish the rest one by one, the ids of the rectangles that are at
+	// least partly inside are packed into the visible list in the order they were given.  Only the planes in the mask
+	// are tested, the rectangles are taken to be inside the rest.  The plane that last rejected a whole register is
+	// tried first, the same way ClassifyRectangle does for a single rectangle, and is updated for the next call.  The
+	// list needs room for all of the ids since the vector paths write each one before deciding whether to keep it.
+	int visibleCount = 0;
+	int start;
+	if (useAvx) {
+		start = CheckRectanglesAvx(maxWidth, maxHeight, maxDepth, minWidth, minHeight, minDepth, ids, count, planeMask, lastPlane, visible, visibleCount);
+	}
+	else {
+		start = CheckRectanglesSse2(maxWidth, maxHeight, maxDepth, minWidth, minHeight, minDepth, ids, count, planeMask, lastPlane, visible, visibleCount);
+	}
+
+	for (int k = start; k < count; k++) {
+		int rectangleMask = planeMask;
+
+		if (ClassifyRectangle(maxWidth[k], maxHeight[k], maxDepth[k], minWidth[k], minHeight[k], minDepth[k], rectangleMask, lastPlane) != OUTSIDE) {
+			visible[visibleCount++] = ids[k];
+		}
+	}
+
+	return visibleCount;
+}
+
+void Frustum::CheckRectanglesInViews(const Frustum* const* frustums, unsigned int viewMask, const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth,
+	const int* ids, int count, const int* planeMasks, int* lastPlanes, int* const* visible, int* visibleCounts, unsigned int* idMasks) {
+	static const bool useAvx = TerrainKernels::SupportsAvx2();
+
+	// The same test as CheckRectangles for every view in the mask, but each register of rectangles is loaded once and
+	// tested against all of the views before moving on.  The ids each view keeps are added to the end of its visible
+	// list, with its count, plane mask and last rejecting plane found at the index of the view.  The optional masks
+	// indexed by id get the bit of every view that keeps the rectangle.
+	int start;
+	if (useAvx) {
+		start = CheckRectanglesInViewsAvx(frustums, viewMask, maxWidth, maxHeight, maxDepth, minWidth, minHeight, minDepth, ids, count, planeMasks, lastPlanes, visible, visibleCounts, idMasks);
+	}
+	else {
+		start = CheckRectanglesInViewsSse2(frustums, viewMask, maxWidth, maxHeight, maxDepth, minWidth, minHeight, minDepth, ids, count, planeMasks, lastPlanes, visible, visibleCounts, idMasks);
+	}
+
+	for (int view = 0; (viewMask >> view) != 0; view++) {
+		if ((viewMask & (1u << view)) == 0) {
+			continue;
+		}
+
+		for (int k = start; k < count; k++) {
+			int rectangleMask = planeMasks[view];
+
+			if (frustums[view]->ClassifyRectangle(maxWidth[k], maxHeight[k], maxDepth[k], minWidth[k], minHeight[k], minDepth[k], rectangleMask, lastPlanes[view]) == OUTSIDE) {
+				continue;
+			}
+
+			visible[view][visibleCounts[view]++] = ids[k];
+
+			if (idMasks) {
+				idMasks[ids[k]] |= 1u << view;
+			}
+		}
+	}
+}
+
+int Frustum::CheckRectanglesSse2(const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth, const int* ids, int count, int planeMask, int& lastPlane, int* visible, int& visibleCount) const {
+	// A rectangle is outside a plane when the corner furthest in front of it is behind it, which is the one corner
+	// of the eight CheckRectangle2 tries that can pass.  Rounding keeps that order so the results are the same.
+	const float* cornerX[6];
+	const float* cornerY[6];
+	const float* cornerZ[6];
+
+	for (int i = 0; i < 6; i++) {
+		cornerX[i] = (m_planes[i][0] >= 0.0f) ? maxWidth : minWidth;
+		cornerY[i] = (m_planes[i][1] >= 0.0f) ? maxHeight : minHeight;
+		cornerZ[i] = (m_planes[i][2] >= 0.0f) ? maxDepth : minDepth;
+	}
+
+	__m128 zero = _mm_setzero_ps();
+	int k = 0;
+
+	for (; k + 4 <= count; k += 4) {
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+		for (int n = 0; n < 6; n++) {
+			int i = (n == 0) ? lastPlane : ((n <= lastPlane) ? n - 1 : n);
+			if ((planeMask & (1 << i)) == 0) {
+				continue;
+			}
+
+			__m128 dotProduct = _mm_mul_ps(_mm_set1_ps(m_planes[i][0]), _mm_loadu_ps(cornerX[i] + k));
+			dotProduct = _mm_add_ps(dotProduct, _mm_mul_ps(_mm_set1_ps(m_planes[i][1]), _mm_loadu_ps(cornerY[i] + k)));
+			dotProduct = _mm_add_ps(dotProduct, _mm_mul_ps(_mm_set1_ps(m_planes[i][2]), _mm_loadu_ps(cornerZ[i] + k)));
+			dotProduct = _mm_add_ps(dotProduct, _mm_set1_ps(m_planes[i][3]));
+
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(dotProduct, zero));
+
+			// Stop once every rectangle in the register has been rejected, and start with this plane next time.
+			if (_mm_movemask_ps(inside) == 0) {
+				lastPlane = i;
+				break;
+			}
+		}
+
+		// Write every id and only step past the visible ones.
+		int insideBits = _mm_movemask_ps(inside);
+		for (int i = 0; i < 4; i++) {
+			visible[visibleCount] = ids[k + i];
+			visibleCount += (insideBits >> i) & 1;
+		}
+	}
+
+	return k;
+}
+
+int Frustum::CheckRectanglesAvx(const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth, const int* ids, int count, int planeMask, int& lastPlane, int* visible, int& visibleCount) const {
+	const float* cornerX[6];
+	const float* cornerY[6];
+	const float* cornerZ[6];
+
+	for (int i = 0; i < 6; i++) {
+		cornerX[i] = (m_planes[i][0] >= 0.0f) ? maxWidth : minWidth;
+		cornerY[i] = (m_planes[i][1] >= 0.0f) ? maxHeight : minHeight;
+		cornerZ[i] = (m_planes[i][2] >= 0.0f) ? maxDepth : minDepth;
+	}
+
+	__m256 zero = _mm256_setzero_ps();
+	int k = 0;
+
+	for (; k + 8 <= count; k += 8) {
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+		for (int n = 0; n < 6; n++) {
+			int i = (n == 0) ? lastPlane : ((n <= lastPlane) ? n - 1 : n);
+			if ((planeMask & (1 << i)) == 0) {
+				continue;
+			}
+
+			__m256 dotProduct = _mm256_mul_ps(_mm256_set1_ps(m_planes[i][0]), _mm256_loadu_ps(cornerX[i] + k));
+			dotProduct = _mm256_add_ps(dotProduct, _mm256_mul_ps(_mm256_set1_ps(m_planes[i][1]), _mm256_loadu_ps(cornerY[i] + k)));
+			dotProduct = _mm256_add_ps(dotProduct, _mm256_mul_ps(_mm256_set1_ps(m_planes[i][2]), _mm256_loadu_ps(cornerZ[i] + k)));
+			dotProduct = _mm256_add_ps(dotProduct, _mm256_set1_ps(m_planes[i][3]));
+
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(dotProduct, zero, _CMP_GE_OQ));
+
+			if (_mm256_movemask_ps(inside) == 0) {
+				lastPlane = i;
+				break;
+			}
+		}
+
+		int insideBits = _mm256_movemask_ps(inside);
+		for (int i = 0; i < 8; i++) {
+			visible[visibleCount] = ids[k + i];
+			visibleCount += (insideBits >> i) & 1;
+		}
+	}
+
+	return k;
+}
+
+int Frustum::CheckRectanglesInViewsSse2(const Frustum* const* frustums, unsigned int viewMask, const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth,
+	const int* ids, int count, const int* planeMasks, int* lastPlanes, int* const* visible, int* visibleCounts, unsigned int* idMasks) {
+	__m128 zero = _mm_setzero_ps();
+	int k = 0;
+
+	for (; k + 4 <= count; k += 4) {
+		__m128 maxX = _mm_loadu_ps(maxWidth + k);
+		__m128 maxY = _mm_loadu_ps(maxHeight + k);
+		__m128 maxZ = _mm_loadu_ps(maxDepth + k);
+		__m128 minX = _mm_loadu_ps(minWidth + k);
+		__m128 minY = _mm_loadu_ps(minHeight + k);
+		__m128 minZ = _mm_loadu_ps(minDepth + k);
+
+		for (int view = 0; (viewMask >> view) != 0; view++) {
+			if ((viewMask & (1u << view)) == 0) {
+				continue;
+			}
+
+			// Test the corner furthest in front of each plane, starting with the plane that last rejected a register.
+			const float (*planes)[4] = frustums[view]->m_planes;
+			int planeMask = planeMasks[view];
+			int& lastPlane = lastPlanes[view];
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+			for (int n = 0; n < 6; n++) {
+				int i = (n == 0) ? lastPlane : ((n <= lastPlane) ? n - 1 : n);
+				if ((planeMask & (1 << i)) == 0) {
+					continue;
+				}
+
+				__m128 dotProduct = _mm_mul_ps(_mm_set1_ps(planes[i][0]), (planes[i][0] >= 0.0f) ? maxX : minX);
+				dotProduct = _mm_add_ps(dotProduct, _mm_mul_ps(_mm_set1_ps(planes[i][1]), (planes[i][1] >= 0.0f) ? maxY : minY));
+				dotProduct = _mm_add_ps(dotProduct, _mm_mul_ps(_mm_set1_ps(planes[i][2]), (planes[i][2] >= 0.0f) ? maxZ : minZ));
+				dotProduct = _mm_add_ps(dotProduct, _mm_set1_ps(planes[i][3]));
+
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(dotProduct, zero));
+
+				if (_mm_movemask_ps(inside) == 0) {
+					lastPlane = i;
+					break;
+				}
+			}
+
+			// Write every id and only step past the visible ones, marking them for the view as they are kept.
+			int insideBits = _mm_movemask_ps(inside);
+			int* list = visible[view];
+			int visibleCount = visibleCounts[view];
+
+			for (int i = 0; i < 4; i++) {
+				list[visibleCount] = ids[k + i];
+				visibleCount += (insideBits >> i) & 1;
+			}
+
+			visibleCounts[view] = visibleCount;
+
+			if (idMasks && (insideBits != 0)) {
+				for (int i = 0; i < 4; i++) {
+					idMasks[ids[k + i]] |= static_cast<unsigned int>((insideBits >> i) & 1) << view;
+				}
+			}
+		}
+	}
+
+	return k;
+}
+
+int Frustum::CheckRectanglesInViewsAvx(const Frustum* const* frustums, unsigned int viewMask, const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth,
+	const int* ids, int count, const int* planeMasks, int* lastPlanes, int* const* visible, int* visibleCounts, unsigned int* idMasks) {
+	__m256 zero = _mm256_setzero_ps();
+	int k = 0;
+
+	for (; k + 8 <= count; k += 8) {
+		__m256 maxX = _mm256_loadu_ps(maxWidth + k);
+		__m256 maxY = _mm256_loadu_ps(maxHeight + k);
+		__m256 maxZ = _mm256_loadu_ps(maxDepth + k);
+		__m256 minX = _mm256_loadu_ps(minWidth + k);
+		__m256 minY = _mm256_loadu_ps(minHeight + k);
+		__m256 minZ = _mm256_loadu_ps(minDepth + k);
+
+		for (int view = 0; (viewMask >> view) != 0; view++) {
+			if ((viewMask & (1u << view)) == 0) {
+				continue;
+			}
+
+			const float (*planes)[4] = frustums[view]->m_planes;
+			int planeMask = planeMasks[view];
+			int& lastPlane = lastPlanes[view];
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+			for (int n = 0; n < 6; n++) {
+				int i = (n == 0) ? lastPlane : ((n <= lastPlane) ? n - 1 : n);
+				if ((planeMask & (1 << i)) == 0) {
+					continue;
+				}
+
+				__m256 dotProduct = _mm256_mul_ps(_mm256_set1_ps(planes[i][0]), (planes[i][0] >= 0.0f) ? maxX : minX);
+				dotProduct = _mm256_add_ps(dotProduct, _mm256_mul_ps(_mm256_set1_ps(planes[i][1]), (planes[i][1] >= 0.0f) ? maxY : minY));
+				dotProduct = _mm256_add_ps(dotProduct, _mm256_mul_ps(_mm256_set1_ps(planes[i][2]), (planes[i][2] >= 0.0f) ? maxZ : minZ));
+				dotProduct = _mm256_add_ps(dotProduct, _mm256_set1_ps(planes[i][3]));
+
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(dotProduct, zero, _CMP_GE_OQ));
+
+				if (_mm256_movemask_ps(inside) == 0) {
+					lastPlane = i;
+					break;
+				}
+			}
+
+			int insideBits = _mm256_movemask_ps(inside);
+			int* list = visible[view];
+			int visibleCount = visibleCounts[view];
+
+			for (int i = 0; i < 8; i++) {
+				list[visibleCount] = ids[k + i];
+				visibleCount += (insideBits >> i) & 1;
+			}
+
+			visibleCounts[view] = visibleCount;
+
+			if (idMasks && (insideBits != 0)) {
+				for (int i = 0; i < 8; i++) {
+					idMasks[ids[k + i]] |= static_cast<unsigned int>((insideBits >> i) & 1) << view;
+				}
+			}
+		}
+	}
+
+	return k;
+}
@@ -4,6 +4,16 @@
 
 class Frustum {
 public:
+	// One bit per plane in the order ConstructFrustum builds them, starting with the near plane.
+	static const int ALL_PLANES = 0x3f;
+
+	// Where a volume is relative to the frustum.  Intersecting volumes straddle at least one plane.
+	enum Classification {
+		OUTSIDE,
+		INTERSECTING,
+		INSIDE
+	};
+
 	Frustum();
 	~Frustum();
 
@@ -14,9 +24,24 @@ public:
 	bool CheckSphere(float xCenter, float yCenter, float zCenter, float radius) const;
 	bool CheckRectangle(float xCenter, float yCenter, float zCenter, float xSize, float ySize, float zSize) const;
 	bool CheckRectangle2(float maxWidth, float maxHeight, float maxDepth, float minWidth, float minHeight, float minDepth) const;
+	Classification ClassifySphere(float xCenter, float yCenter, float zCenter, float radius) const;
+	Classification ClassifyRectangle(float maxWidth, float maxHeight, float maxDepth, float minWidth, float minHeight, float minDepth) const;
+	Classification ClassifyRectangle(float maxWidth, float maxHeight, float maxDepth, float minWidth, float minHeight, float minDepth, int& planeMask, int& lastPlane) const;
+	void ClassifyRectangles(const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth, int count, int planeMask, int& lastPlane, Classification* classifications, int* planeMasks) const;
+	int CheckRectangles(const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth, const int* ids, int count, int planeMask, int& lastPlane, int* visible) const;
+
+	static void CheckRectanglesInViews(const Frustum* const* frustums, unsigned int viewMask, const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth,
+		const int* ids, int count, const int* planeMasks, int* lastPlanes, int* const* visible, int* visibleCounts, unsigned int* idMasks);
 
 private:
 	Frustum(const Frustum&);
+	int CheckRectanglesSse2(const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth, const int* ids, int count, int planeMask, int& lastPlane, int* visible, int& visibleCount) const;
+	int CheckRectanglesAvx(const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth, const int* ids, int count, int planeMask, int& lastPlane, int* visible, int& visibleCount) const;
+	static int CheckRectanglesInViewsSse2(const Frustum* const* frustums, unsigned int viewMask, const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth,
+		const int* ids, int count, const int* planeMasks, int* lastPlanes, int* const* visible, int* visibleCounts, unsigned int* idMasks);
+	static int CheckRectanglesInViewsAvx(const Frustum* const* frustums, unsigned int viewMask, const float* maxWidth, const float* maxHeight, const float* maxDepth, const float* minWidth, const float* minHeight, const float* minDepth,
+		const int* ids, int count, const int* planeMasks, int* lastPlanes, int* const* visible, int* visibleCounts, unsigned int* idMasks);
+
 	float m_screenDepth;
 	float m_planes[6][4];
 };
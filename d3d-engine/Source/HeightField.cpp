@@ -0,0 +1,262 @@
+#include "pch.h"
+#include "HeightField.h"
+
+HeightField::HeightField() :
+	m_width(0),
+	m_height(0),
+	m_terrainWidth(0),
+	m_terrainHeight(0),
+	m_originX(0),
+	m_originY(0),
+	m_rowPitch(0),
+	m_heights(nullptr),
+	m_normals(nullptr),
+	m_colors(nullptr) {}
+
+HeightField::HeightField(const HeightField&) :
+	m_width(0),
+	m_height(0),
+	m_terrainWidth(0),
+	m_terrainHeight(0),
+	m_originX(0),
+	m_originY(0),
+	m_rowPitch(0),
+	m_heights(nullptr),
+	m_normals(nullptr),
+	m_colors(nullptr) {}
+
+HeightField::~HeightField() {
+	Shutdown();
+}
+
+bool HeightField::Initialize(int width, int height, int terrainWidth, int terrainHeight) {
+	Shutdown();
+
+	// A window of the terrain can be smaller than the terrain itself.
+	if ((terrainWidth <= 0) || (terrainHeight <= 0) || (width <= 0) || (height <= 0)) {
+		return false;
+	}
+
+	m_width = width;
+	m_height = height;
+	m_terrainWidth = terrainWidth;
+	m_terrainHeight = terrainHeight;
+	m_rowPitch = ((width + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT) * ROW_ALIGNMENT;
+
+	// Allocate each attribute as its own 32 byte aligned array.
+	size_t sampleCount = static_cast<size_t>(m_rowPitch) * static_cast<size_t>(m_height);
+	m_heights = static_cast<float*>(_aligned_malloc(sampleCount * sizeof(float), 32));
+	m_normals = static_cast<unsigned int*>(_aligned_malloc(sampleCount * sizeof(unsigned int), 32));
+	m_colors = static_cast<unsigned int*>(_aligned_malloc(sampleCount * sizeof(unsigned int), 32));
+	if (!m_heights || !m_normals || !m_colors) {
+		Shutdown();
+		return false;
+	}
+
+	// Clear the arrays so the row padding holds defined values.
+	memset(m_heights, 0, sampleCount * sizeof(float));
+	memset(m_normals, 0, sampleCount * sizeof(unsigned int));
+	memset(m_colors, 0, sampleCount * sizeof(unsigned int));
+
+	return true;
+}
+
+void HeightField::Shutdown() {
+	if (m_heights) {
+		_aligned_free(m_heights);
+		m_heights = nullptr;
+	}
+
+	if (m_normals) {
+		_aligned_free(m_normals);
+		m_normals = nullptr;
+	}
+
+	if (m_colors) {
+		_aligned_free(m_colors);
+		m_colors = nullptr;
+	}
+
+	m_width = 0;
+	m_height = 0;
+	m_terrainWidth = 0;
+	m_terrainHeight = 0;
+	m_originX = 0;
+	m_originY = 0;
+	m_rowPitch = 0;
+}
+
+void HeightField::ExtendHeights() {
+	ExtendHeights(0, 0, m_terrainWidth, m_terrainHeight);
+}
+
+void HeightField::ExtendHeights(int startColumn, int startRow, int endColumn, int endRow) {
+	// Only the samples past the edge that repeat a sample in the block need to change, so a block that reaches the
+	// last terrain column or row runs on to the end of the field.
+	if (endColumn >= m_terrainWidth) {
+		endColumn = m_width;
+	}
+
+	if (endRow >= m_terrainHeight) {
+		endRow = m_height;
+	}
+
+	// Repeat the last column of each terrain row and then the last terrain row into the samples past the edge.
+	for (int j = startRow; j < endRow; j++) {
+		float* heights = GetHeightRow(j);
+		const float* source = GetHeightRow(std::min(j, m_terrainHeight - 1));
+
+		for (int i = startColumn; i < endColumn; i++) {
+			if ((i >= m_terrainWidth) || (j >= m_terrainHeight)) {
+				heights[i] = source[std::min(i, m_terrainWidth - 1)];
+			}
+		}
+	}
+}
+
+void HeightField::ExtendColors() {
+	// Repeat the edge colors the same way.
+	for (int j = 0; j < m_height; j++) {
+		unsigned int* colors = m_colors + (j * m_rowPitch);
+		const unsigned int* source = m_colors + (std::min(j, m_terrainHeight - 1) * m_rowPitch);
+
+		for (int i = 0; i < m_width; i++) {
+			if ((i >= m_terrainWidth) || (j >= m_terrainHeight)) {
+				colors[i] = source[std::min(i, m_terrainWidth - 1)];
+			}
+		}
+	}
+}
+
+int HeightField::GetWidth() const {
+	return m_width;
+}
+
+int HeightField::GetHeight() const {
+	return m_height;
+}
+
+int HeightField::GetTerrainWidth() const {
+	return m_terrainWidth;
+}
+
+int HeightField::GetTerrainHeight() const {
+	return m_terrainHeight;
+}
+
+void HeightField::SetOrigin(int originX, int originY) {
+	m_originX = originX;
+	m_originY = originY;
+}
+
+int HeightField::GetOriginX() const {
+	return m_originX;
+}
+
+int HeightField::GetOriginY() const {
+	return m_originY;
+}
+
+int HeightField::GetRowPitch() const {
+	return m_rowPitch;
+}
+
+float HeightField::GetPositionX(int i) const {
+	// Samples past the edge collapse onto it.
+	return static_cast<float>(std::min(m_originX + i, m_terrainWidth - 1));
+}
+
+float HeightField::GetPositionZ(int j) const {
+	// Rows run from the back of the terrain to the front so the first row sits at the largest depth.
+	return static_cast<float>(m_terrainHeight - 1 - std::min(m_originY + j, m_terrainHeight - 1));
+}
+
+float HeightField::GetHeight(int i, int j) const {
+	return m_heights[(j * m_rowPitch) + i];
+}
+
+void HeightField::SetHeight(int i, int j, float height) {
+	m_heights[(j * m_rowPitch) + i] = height;
+}
+
+float* HeightField::GetHeightRow(int j) {
+	return m_heights + (j * m_rowPitch);
+}
+
+const float* HeightField::GetHeightRow(int j) const {
+	return m_heights + (j * m_rowPitch);
+}
+
+void HeightField::GetNormal(int i, int j, float& nx, float& ny, float& nz) const {
+	UnpackNormal(m_normals[(j * m_rowPitch) + i], nx, ny, nz);
+}
+
+void HeightField::SetNormal(int i, int j, float nx, float ny, float nz) {
+	m_normals[(j * m_rowPitch) + i] = PackNormal(nx, ny, nz);
+}
+
+unsigned int* HeightField::GetNormalRow(int j) {
+	return m_normals + (j * m_rowPitch);
+}
+
+const unsigned int* HeightField::GetNormalRow(int j) const {
+	return m_normals + (j * m_rowPitch);
+}
+
+void HeightField::GetColor(int i, int j, float& r, float& g, float& b) const {
+	unsigned int color = m_colors[(j * m_rowPitch) + i];
+
+	r = static_cast<float>(color & 0xff) / 255.0f;
+	g = static_cast<float>((color >> 8) & 0xff) / 255.0f;
+	b = static_cast<float>((color >> 16) & 0xff) / 255.0f;
+}
+
+void HeightField::SetColor(int i, int j, unsigned char r, unsigned char g, unsigned char b) {
+	m_colors[(j * m_rowPitch) + i] = r | (g << 8) | (b << 16) | (0xffu << 24);
+}
+
+const unsigned int* HeightField::GetColorRow(int j) const {
+	return m_colors + (j * m_rowPitch);
+}
+
+unsigned int HeightField::PackNormal(float nx, float ny, float nz) {
+	// Project the normal onto the octahedron around the Y axis, terrain normals point mostly up so they land in the
+	// inner half of the map where the precision is highest.
+	float length = fabsf(nx) + fabsf(ny) + fabsf(nz);
+	float u = nx / length;
+	float v = nz / length;
+
+	// Fold the lower hemisphere over the diagonals.
+	if (ny < 0.0f) {
+		float foldU = (1.0f - fabsf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+		float foldV = (1.0f - fabsf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+		u = foldU;
+		v = foldV;
+	}
+
+	// Store both coordinates as 16 bit signed normalized values.
+	int packedU = static_cast<int>(floorf(std::min(std::max(u, -1.0f), 1.0f) * 32767.0f + 0.5f));
+	int packedV = static_cast<int>(floorf(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f + 0.5f));
+
+	return (static_cast<unsigned int>(packedU) & 0xffff) | (static_cast<unsigned int>(packedV) << 16);
+}
+
+void HeightField::UnpackNormal(unsigned int packed, float& nx, float& ny, float& nz) {
+	float u = static_cast<float>(static_cast<short>(packed & 0xffff)) / 32767.0f;
+	float v = static_cast<float>(static_cast<short>(packed >> 16)) / 32767.0f;
+
+	nx = u;
+	ny = 1.0f - fabsf(u) - fabsf(v);
+	nz = v;
+
+	// Unfold the lower hemisphere.
+	if (ny < 0.0f) {
+		nx = (1.0f - fabsf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+		nz = (1.0f - fabsf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+	}
+
+	float length = sqrtf((nx * nx) + (ny * ny) + (nz * nz));
+	nx /= length;
+	ny /= length;
+	nz /= length;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+// Structure of arrays storage for the terrain height map.  The X and Z coordinates of a sample are implied by its
+// grid index so only the height, a packed normal and an RGBA8 color are kept per sample.  The grid can be larger than
+// the terrain so it covers a whole number of cells, the samples past the edge repeat the edge and share its position.
+// A field can also hold just a window of the terrain, its origin then gives the terrain sample at its first corner.
+class HeightField {
+public:
+	HeightField();
+	~HeightField();
+
+	bool Initialize(int width, int height, int terrainWidth, int terrainHeight);
+	void ExtendHeights();
+	void ExtendHeights(int startColumn, int startRow, int endColumn, int endRow);
+	void ExtendColors();
+	int GetWidth() const;
+	int GetHeight() const;
+	int GetTerrainWidth() const;
+	int GetTerrainHeight() const;
+	void SetOrigin(int originX, int originY);
+	int GetOriginX() const;
+	int GetOriginY() const;
+	int GetRowPitch() const;
+
+	float GetPositionX(int i) const;
+	float GetPositionZ(int j) const;
+
+	float GetHeight(int i, int j) const;
+	void SetHeight(int i, int j, float height);
+	float* GetHeightRow(int j);
+	const float* GetHeightRow(int j) const;
+
+	void GetNormal(int i, int j, float& nx, float& ny, float& nz) const;
+	void SetNormal(int i, int j, float nx, float ny, float nz);
+	unsigned int* GetNormalRow(int j);
+	const unsigned int* GetNormalRow(int j) const;
+
+	void GetColor(int i, int j, float& r, float& g, float& b) const;
+	void SetColor(int i, int j, unsigned char r, unsigned char g, unsigned char b);
+	const unsigned int* GetColorRow(int j) const;
+
+	static unsigned int PackNormal(float nx, float ny, float nz);
+	static void UnpackNormal(unsigned int packed, float& nx, float& ny, float& nz);
+
+private:
+	HeightField(const HeightField&);
+	void Shutdown();
+
+	// Rows are padded to a multiple of this many samples so every row starts on an aligned boundary.
+	static const int ROW_ALIGNMENT = 8;
+
+	int m_width;
+	int m_height;
+	int m_terrainWidth;
+	int m_terrainHeight;
+	int m_originX;
+	int m_originY;
+	int m_rowPitch;
+	float* m_heights;
+	unsigned int* m_normals;
+	unsigned int* m_colors;
+};
@@ -0,0 +1,79 @@
+#include "pch.h"
+#include "MappedFile.h"
+
+MappedFile::MappedFile() :
+	m_file(INVALID_HANDLE_VALUE),
+	m_mapping(nullptr),
+	m_data(nullptr),
+	m_size(0) {}
+
+MappedFile::MappedFile(const MappedFile&) :
+	m_file(INVALID_HANDLE_VALUE),
+	m_mapping(nullptr),
+	m_data(nullptr),
+	m_size(0) {}
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+bool MappedFile::Open(const char* filename) {
+	Close();
+
+	// Open the file for reading, the pages are sampled at random so don't let the cache read ahead.
+	m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size) || (size.QuadPart == 0)) {
+		Close();
+		return false;
+	}
+
+	m_size = static_cast<unsigned long long>(size.QuadPart);
+
+	// Map a read only view of the whole file.
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_mapping) {
+		Close();
+		return false;
+	}
+
+	m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_data) {
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close() {
+	// Release the view, the mapping and the file.
+	if (m_data) {
+		UnmapViewOfFile(m_data);
+		m_data = nullptr;
+	}
+
+	if (m_mapping) {
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+
+	if (m_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+
+	m_size = 0;
+}
+
+const unsigned char* MappedFile::GetData() const {
+	return m_data;
+}
+
+unsigned long long MappedFile::GetSize() const {
+	return m_size;
+}
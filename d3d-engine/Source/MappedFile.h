@@ -0,0 +1,23 @@
+#pragma once
+
+// Read only view of a whole file mapped into the address space.  Pages are only read in from disk when they are first
+// touched, so files larger than the memory budget can be opened and sampled at random.
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const char* filename);
+	void Close();
+
+	const unsigned char* GetData() const;
+	unsigned long long GetSize() const;
+
+private:
+	MappedFile(const MappedFile&);
+
+	HANDLE m_file;
+	HANDLE m_mapping;
+	const unsigned char* m_data;
+	unsigned long long m_size;
+};
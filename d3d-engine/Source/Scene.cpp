@@ -111,6 +111,13 @@ bool Scene::Initialize(DXDeviceResources* direct3D, HWND hwnd, int screenWidth,
 		return false;
 	}
 
+	// Let the terrain level of detail introduce at most eight pixels of error.  Each cell is held to it with its own
+	// errors, so flat cells coarsen well before rough ones.  The projection scale is the number of pixels a unit high
+	// object covers at a distance of one.
+	Matrix projectionMatrix;
+	direct3D->GetProjMatrix(projectionMatrix);
+	m_Terrain->SetLodErrorBudget(8.0f, projectionMatrix._22 * static_cast<float>(screenHeight) * 0.5f);
+
 	m_displayUI = true;
 	m_wireFrame = false;
 	m_cellLines = false;
@@ -146,6 +153,12 @@ bool Scene::Frame(DXDeviceResources* Direct3D, InputContext* Input, ShaderManage
 	// Do the terrain frame processing.
 	m_Terrain->Frame();
 
+	// Bring in the terrain cells around the camera if the terrain is paged.
+	if (!m_Terrain->PageCells(Direct3D->GetDevice(), Vector3(posX, posY, posZ)))
+	{
+		return false;
+	}
+
 	// If the height is locked to the terrain then position the camera on top of it.
 	if (m_heightLocked)
 	{
@@ -249,6 +262,21 @@ bool Scene::Render(DXDeviceResources* direct3D, ShaderManager* shaderManager, Te
 	// Construct the frustum.
 	m_Frustum->ConstructFrustum(projectionMatrix, viewMatrix);
 
+	// Cull the terrain cells against the frustum with the quadtree.
+	m_Terrain->CullCells(m_Frustum);
+
+	// Drop the cells the baked visible set of the cell under the camera says can't be seen.
+	m_Terrain->ApplyVisibleSets(cameraPosition);
+
+	// Order the visible cells front to back so early depth testing rejects the far ones, the nearest are also the occluders.
+	m_Terrain->SortVisibleCells(viewMatrix);
+
+	// Drop the cells that are hidden behind nearer terrain.
+	m_Terrain->OccludeCells(DirectX::XMMatrixMultiply(viewMatrix, projectionMatrix));
+
+	// Pick the level of detail of each visible terrain cell for this camera position.
+	m_Terrain->SelectLod(cameraPosition);
+
 	// Clear the buffers to begin the scene.
 	direct3D->BeginScene(0.0f, 0.0f, 0.0f, 1.0f);
 
@@ -280,29 +308,31 @@ bool Scene::Render(DXDeviceResources* direct3D, ShaderManager* shaderManager, Te
 		direct3D->EnableWireframe();
 	}
 
-	// Render the terrain cells (and cell lines if needed).
-	for (int i = 0; i < m_Terrain->GetCellCount(); i++)
+	// Render the visible terrain cells (and cell lines if needed).
+	for (int k = 0; k < m_Terrain->GetVisibleCellCount(); k++)
 	{
-		// Render each terrain cell if it is visible only.
-		if (m_Terrain->RenderCell(direct3D->GetDeviceContext(), i, m_Frustum))
+		int i = m_Terrain->GetVisibleCell(k);
+		m_Terrain->RenderCell(direct3D->GetDeviceContext(), i);
+
+		TerrainLod::MorphType morph = m_Terrain->GetCellMorph(i);
+
+		// Render the cell buffers using the hgih quality terrain shader.
+		if (!shaderManager->RenderTerrainShader(direct3D->GetDeviceContext(), m_Terrain->GetCellIndexCount(i),
+			worldMatrix, viewMatrix, projectionMatrix, textureManager->GetTexture(0), textureManager->GetTexture(1), 
+			textureManager->GetTexture(2), textureManager->GetTexture(3), m_Light->GetDirection(), m_Light->GetDiffuseColor(),
+			cameraPosition, m_Terrain->GetCellLodLevel(i), morph, m_Terrain->GetCellDecode(i)))
 		{
-			// Render the cell buffers using the hgih quality terrain shader.
-			if (!shaderManager->RenderTerrainShader(direct3D->GetDeviceContext(), m_Terrain->GetCellIndexCount(i),
-				worldMatrix, viewMatrix, projectionMatrix, textureManager->GetTexture(0), textureManager->GetTexture(1), 
-				textureManager->GetTexture(2), textureManager->GetTexture(3), m_Light->GetDirection(), m_Light->GetDiffuseColor()))
-			{
-				return false;
-			}
+			return false;
+		}
 
-			// If needed then render the bounding box around this terrain cell using the color shader. 
-			if (m_cellLines)
+		// If needed then render the bounding box around this terrain cell using the color shader. 
+		if (m_cellLines)
+		{
+			m_Terrain->RenderCellLines(direct3D->GetDeviceContext(), i);
+			if (!shaderManager->RenderColorShader(direct3D->GetDeviceContext(), m_Terrain->GetCellLinesIndexCount(i),
+				worldMatrix, viewMatrix, projectionMatrix))
 			{
-				m_Terrain->RenderCellLines(direct3D->GetDeviceContext(), i);
-				if (!shaderManager->RenderColorShader(direct3D->GetDeviceContext(), m_Terrain->GetCellLinesIndexCount(i),
-					worldMatrix, viewMatrix, projectionMatrix))
-				{
-					return false;
-				}
+				return false;
 			}
 		}
 	}
@@ -314,7 +344,8 @@ bool Scene::Render(DXDeviceResources* direct3D, ShaderManager* shaderManager, Te
 	}
 
 	// Update the render counts in the UI.
-	if (!m_UserInterface->UpdateRenderCounts(direct3D->GetDeviceContext(), m_Terrain->GetRenderCount(), m_Terrain->GetCellsDrawn(), m_Terrain->GetCellsCulled()))
+	if (!m_UserInterface->UpdateRenderCounts(direct3D->GetDeviceContext(), m_Terrain->GetRenderCount(), m_Terrain->GetCellsDrawn(), m_Terrain->GetCellsCulled(),
+		m_Terrain->GetCellsOccluded(), m_Terrain->GetOcclusionTime()))
 	{
 		return false;
 	}
@@ -68,6 +68,6 @@ bool ShaderManager::RenderSkyDomeShader(ID3D11DeviceContext* deviceContext, int
 	return m_SkyDomeShader.Render(deviceContext, indexCount, worldMatrix, viewMatrix, projMatrix, apex, center);
 }
 
-bool ShaderManager::RenderTerrainShader(ID3D11DeviceContext* deviceContext, int indexCount, Matrix worldMatrix, Matrix viewMatrix, Matrix projMatrix, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* normalMap, ID3D11ShaderResourceView* normalMap2, ID3D11ShaderResourceView* normalMap3, Vector3 lightDirection, Color diffuse) const {
-	return m_TerrainShader.Render(deviceContext, indexCount, worldMatrix, viewMatrix, projMatrix, texture, normalMap, normalMap2, normalMap3, lightDirection, diffuse);
+bool ShaderManager::RenderTerrainShader(ID3D11DeviceContext* deviceContext, int indexCount, Matrix worldMatrix, Matrix viewMatrix, Matrix projMatrix, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* normalMap, ID3D11ShaderResourceView* normalMap2, ID3D11ShaderResourceView* normalMap3, Vector3 lightDirection, Color diffuse, Vector3 cameraPosition, int lodLevel, const TerrainLod::MorphType& morph, const TerrainMesh::DecodeType& decode) const {
+	return m_TerrainShader.Render(deviceContext, indexCount, worldMatrix, viewMatrix, projMatrix, texture, normalMap, normalMap2, normalMap3, lightDirection, diffuse, cameraPosition, lodLevel, morph, decode);
 }
@@ -20,7 +20,7 @@ public:
 	bool RenderLightShader(ID3D11DeviceContext* deviceContext, int indexCount, Matrix worldMatrix, Matrix viewMatrix, Matrix projectionMatrix, ID3D11ShaderResourceView* texture, Vector3 lightDirection, Color diffuse) const;
 	bool RenderFontShader(ID3D11DeviceContext* deviceContext, int indexCount, Matrix worldMatrix, Matrix viewMatrix, Matrix projectionMatrix, ID3D11ShaderResourceView* texture, Color color) const;
 	bool RenderSkyDomeShader(ID3D11DeviceContext* deviceContext, int indexCount, Matrix worldMatrix, Matrix viewMatrix, Matrix projMatrix, Color apex, Color center) const;
-	bool RenderTerrainShader(ID3D11DeviceContext* deviceContext, int indexCount, Matrix worldMatrix, Matrix viewMatrix, Matrix projMatrix, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* normalMap, ID3D11ShaderResourceView* normalMap2, ID3D11ShaderResourceView* normalMap3, Vector3 lightDirection, Color diffuse) const;
+	bool RenderTerrainShader(ID3D11DeviceContext* deviceContext, int indexCount, Matrix worldMatrix, Matrix viewMatrix, Matrix projMatrix, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* normalMap, ID3D11ShaderResourceView* normalMap2, ID3D11ShaderResourceView* normalMap3, Vector3 lightDirection, Color diffuse, Vector3 cameraPosition, int lodLevel, const TerrainLod::MorphType& morph, const TerrainMesh::DecodeType& decode) const;
 
 private:
 	ShaderManager(const ShaderManager& other);
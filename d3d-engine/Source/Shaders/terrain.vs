@@ -13,19 +13,34 @@ cbuffer MatrixBuffer
 	matrix projectionMatrix;
 };
 
+cbuffer LodBuffer
+{
+	float3 cameraPosition;
+	float lodLevel;
+	float morphStart;
+	float morphScale;
+	float levelCount;
+	float minHeight;
+	float4 cellBounds;
+	float2 textureScale;
+	float heightStep;
+	float padding;
+	float4 edgeMorphStarts;
+	float4 edgeMorphScales;
+	float2 cellQuads;
+	float2 padding2;
+};
+
 
 //////////////
 // TYPEDEFS //
 //////////////
 struct VertexInputType
 {
-    float4 position : POSITION;
-    float2 tex : TEXCOORD0;
-	float3 normal : NORMAL;
-	float3 tangent : TANGENT;
-	float3 binormal : BINORMAL;
-	float3 color : COLOR;
-	float2 tex2 : TEXCOORD1;
+    uint4 position : POSITION;
+	float2 normal : NORMAL;
+	float2 tangent : TANGENT;
+	float4 color : COLOR;
 };
 
 struct PixelInputType
@@ -41,6 +56,23 @@ struct PixelInputType
 };
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Octahedral Decode
+////////////////////////////////////////////////////////////////////////////////
+float3 DecodeDirection(float2 encoded)
+{
+	float3 direction = float3(encoded.x, 1.0f - abs(encoded.x) - abs(encoded.y), encoded.y);
+
+	// Unfold the lower hemisphere.
+	if (direction.y < 0.0f)
+	{
+		direction.xz = (1.0f - abs(encoded.yx)) * (encoded.xy >= 0.0f ? 1.0f : -1.0f);
+	}
+
+	return normalize(direction);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Vertex Shader
 ////////////////////////////////////////////////////////////////////////////////
@@ -49,32 +81,78 @@ PixelInputType TerrainVertexShader(VertexInputType input)
     PixelInputType output;
     
 
-	// Change the position vector to be 4 units for proper matrix calculations.
-    input.position.w = 1.0f;
+	// Put the vertex back in the world from its column and row in the cell and its quantized heights.  Grid points past
+	// the far edges of the terrain collapse onto the edge.
+	float4 position;
+	position.x = min(cellBounds.x + (float)input.position.x, cellBounds.z);
+	position.y = minHeight + ((float)input.position.z * heightStep);
+	position.z = max(cellBounds.y - (float)input.position.y, cellBounds.w);
+	position.w = 1.0f;
+
+	float morphHeight = minHeight + ((float)input.position.w * heightStep);
+
+	// The finest level a vertex is drawn in is the lowest set bit of its column and row, and the corner is in every level.
+	float vertexLevel = (float)min(firstbitlow(input.position.x | input.position.y), (uint)levelCount - 1);
+
+	// Vertices that the next level of detail drops slide onto its surface over the far end of this level's range.
+	// The distance is measured across the ground to match the level selection.
+	float morphDistance = length(mul(position, worldMatrix).xz - cameraPosition.xz);
+	// A vertex on an edge shared with the next cell uses the band of that edge, which both cells agree on, so the two
+	// copies of it always end up in the same place.  The corners are in every level so they never morph.
+	float vertexMorphStart = morphStart;
+	float vertexMorphScale = morphScale;
+	if (input.position.x == 0)
+	{
+		vertexMorphStart = edgeMorphStarts.x;
+		vertexMorphScale = edgeMorphScales.x;
+	}
+	else if (input.position.x == (uint)cellQuads.x)
+	{
+		vertexMorphStart = edgeMorphStarts.y;
+		vertexMorphScale = edgeMorphScales.y;
+	}
+	else if (input.position.y == 0)
+	{
+		vertexMorphStart = edgeMorphStarts.z;
+		vertexMorphScale = edgeMorphScales.z;
+	}
+	else if (input.position.y == (uint)cellQuads.y)
+	{
+		vertexMorphStart = edgeMorphStarts.w;
+		vertexMorphScale = edgeMorphScales.w;
+	}
+
+	float morphWeight = (vertexLevel == lodLevel) ? saturate((morphDistance - vertexMorphStart) * vertexMorphScale) : 0.0f;
+	position.y = lerp(position.y, morphHeight, morphWeight);
 
 	// Calculate the position of the vertex against the world, view, and projection matrices.
-    output.position = mul(input.position, worldMatrix);
+    output.position = mul(position, worldMatrix);
     output.position = mul(output.position, viewMatrix);
     output.position = mul(output.position, projectionMatrix);
     
-	// Store the texture coordinates for the pixel shader.
-    output.tex = input.tex;
-   	output.tex2 = input.tex2;
+	// The first texture repeats once per quad and the second spans the whole cell once.
+    output.tex = float2(input.position.xy);
+   	output.tex2 = float2(input.position.xy) * textureScale;
+
+	// Unpack the normal and tangent, and rebuild the binormal from them and the side it is on.
+	float3 normal = DecodeDirection(input.normal);
+	float3 tangent = DecodeDirection(input.tangent);
+	float3 binormal = ((input.color.a * 2.0f) - 1.0f) * normalize(cross(normal, tangent));
 
     // Calculate the normal vector against the world matrix only and then normalize the final value.
-    output.normal = mul(input.normal, (float3x3)worldMatrix);
+    output.normal = mul(normal, (float3x3)worldMatrix);
     output.normal = normalize(output.normal);
 
 	// Calculate the tangent vector against the world matrix only and then normalize the final value.
-    output.tangent = mul(input.tangent, (float3x3)worldMatrix);
+    output.tangent = mul(tangent, (float3x3)worldMatrix);
     output.tangent = normalize(output.tangent);
 
     // Calculate the binormal vector against the world matrix only and then normalize the final value.
-    output.binormal = mul(input.binormal, (float3x3)worldMatrix);
+    output.binormal = mul(binormal, (float3x3)worldMatrix);
     output.binormal = normalize(output.binormal);
 
 	// Store the input color for the pixel shader to use.
-    output.color = float4(input.color, 1.0f);
+    output.color = float4(input.color.rgb, 1.0f);
 
 	// Store the position value in a second input value for depth value calculations.
     output.depthPosition = output.position;
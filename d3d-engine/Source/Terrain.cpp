@@ -4,13 +4,55 @@
 Terrain::Terrain() :
 	m_terrainHeight(0),
 	m_terrainWidth(0),
-	m_vertexCount(0),
 	m_heightScale(0),
+	m_pageRadius(0),
+	m_pageBudget(0),
+	m_editable(false),
 	m_terrainFilename(nullptr),
 	m_colorMapFilename(nullptr),
-	m_heightMap(nullptr),
-	m_terrainModel(nullptr),
+	m_cacheFilename(nullptr),
+	m_visibilityFilename(nullptr),
+	m_visibilityHeight(0),
+	m_contentHash(0),
+	m_HeightField(nullptr),
+	m_HeightMapFile(nullptr),
+	m_ColorMapFile(nullptr),
+	m_colorMapOffset(0),
+	m_colorMapPitch(0),
 	m_TerrainCells(nullptr),
+	m_TerrainLod(nullptr),
+	m_TerrainQuadTree(nullptr),
+	m_TerrainPyramid(nullptr),
+	m_TerrainSurface(nullptr),
+	m_TerrainOcclusion(nullptr),
+	m_occluderVertices(nullptr),
+	m_occlusionBounds(nullptr),
+	m_TerrainVisibility(nullptr),
+	m_visibleSet(nullptr),
+	m_visibleSetCell(-1),
+	m_cellIndexBuffer(nullptr),
+	m_cellIndices(nullptr),
+	m_cellLevels(nullptr),
+	m_visibleCells(nullptr),
+	m_visibleCellCount(0),
+	m_visibleDepths(nullptr),
+	m_sortKeys(nullptr),
+	m_sortScratchKeys(nullptr),
+	m_sortScratchCells(nullptr),
+	m_cellSlots(nullptr),
+	m_slotCells(nullptr),
+	m_slotFrames(nullptr),
+	m_slotPrevious(nullptr),
+	m_slotNext(nullptr),
+	m_pageRequests(nullptr),
+	m_slotCount(0),
+	m_slotHead(-1),
+	m_slotTail(-1),
+	m_pageFrame(0),
+	m_cellWidth(0),
+	m_cellHeight(0),
+	m_cellCountX(0),
+	m_cellCountY(0),
 	m_cellCount(0),
 	m_renderCount(0),
 	m_cellsDrawn(0),
@@ -20,13 +62,55 @@ Terrain::Terrain() :
 Terrain::Terrain(const Terrain&) :
 	m_terrainHeight(0),
 	m_terrainWidth(0),
-	m_vertexCount(0),
 	m_heightScale(0),
+	m_pageRadius(0),
+	m_pageBudget(0),
+	m_editable(false),
 	m_terrainFilename(nullptr),
 	m_colorMapFilename(nullptr),
-	m_heightMap(nullptr),
-	m_terrainModel(nullptr),
+	m_cacheFilename(nullptr),
+	m_visibilityFilename(nullptr),
+	m_visibilityHeight(0),
+	m_contentHash(0),
+	m_HeightField(nullptr),
+	m_HeightMapFile(nullptr),
+	m_ColorMapFile(nullptr),
+	m_colorMapOffset(0),
+	m_colorMapPitch(0),
 	m_TerrainCells(nullptr),
+	m_TerrainLod(nullptr),
+	m_TerrainQuadTree(nullptr),
+	m_TerrainPyramid(nullptr),
+	m_TerrainSurface(nullptr),
+	m_TerrainOcclusion(nullptr),
+	m_occluderVertices(nullptr),
+	m_occlusionBounds(nullptr),
+	m_TerrainVisibility(nullptr),
+	m_visibleSet(nullptr),
+	m_visibleSetCell(-1),
+	m_cellIndexBuffer(nullptr),
+	m_cellIndices(nullptr),
+	m_cellLevels(nullptr),
+	m_visibleCells(nullptr),
+	m_visibleCellCount(0),
+	m_visibleDepths(nullptr),
+	m_sortKeys(nullptr),
+	m_sortScratchKeys(nullptr),
+	m_sortScratchCells(nullptr),
+	m_cellSlots(nullptr),
+	m_slotCells(nullptr),
+	m_slotFrames(nullptr),
+	m_slotPrevious(nullptr),
+	m_slotNext(nullptr),
+	m_pageRequests(nullptr),
+	m_slotCount(0),
+	m_slotHead(-1),
+	m_slotTail(-1),
+	m_pageFrame(0),
+	m_cellWidth(0),
+	m_cellHeight(0),
+	m_cellCountX(0),
+	m_cellCountY(0),
 	m_cellCount(0),
 	m_renderCount(0),
 	m_cellsDrawn(0),
@@ -34,17 +118,35 @@ Terrain::Terrain(const Terrain&) :
 
 Terrain::~Terrain() {
 	ShutdownTerrainCells();
-	ShutdownTerrainModel();
 	ShutdownHeightMap();
 }
 
 bool Terrain::Initialize(ID3D11Device* device, char* setupFilename) {
-	m_heightMap = new HeightMapType[m_terrainWidth * m_terrainHeight];
-
 	if (!LoadSetupFile(setupFilename)) {
 		return false;
 	}
 
+	// A paged terrain builds its cells straight out of the mapped files as the camera comes near them.
+	if (m_pageRadius > 0.0f) {
+		return InitializePaged(device);
+	}
+
+	// The baked cells and visible sets are matched to the source files and setup they were made from.
+	if ((m_cacheFilename || m_visibilityFilename) && !m_editable) {
+		if (!CalculateContentHash()) {
+			return false;
+		}
+	}
+
+	// Load the baked cells instead if the cache was made from the same source files and setup.  An editable terrain
+	// needs the height field the cells are built from so it always loads the source files.
+	if (m_cacheFilename && !m_editable) {
+		TerrainCache cache;
+		if (cache.Open(m_cacheFilename, TerrainCache::MakeHeader(m_contentHash, m_terrainWidth, m_terrainHeight, m_cellWidth, m_cellHeight, m_cellCountX, m_cellCountY))) {
+			return InitializeCached(device, &cache);
+		}
+	}
+
 	if (!LoadRawHeightMap()) {
 		return false;
 	}
@@ -52,8 +154,6 @@ bool Terrain::Initialize(ID3D11Device* device, char* setupFilename) {
 	delete[] m_terrainFilename;
 	m_terrainFilename = nullptr;
 
-	SetTerrainCoordinates();
-
 	if (!CalculateNormals()) {
 		m_terrainFilename = nullptr;
 		return false;
@@ -63,32 +163,188 @@ bool Terrain::Initialize(ID3D11Device* device, char* setupFilename) {
 		return false;
 	}
 
-	if (!BuildTerrainModel()) {
+	// Create and load the cells straight from the height field.
+	if (!LoadTerrainCells(device, nullptr)) {
 		return false;
 	}
 
-	ShutdownHeightMap();
+	// Measure the error of each level of detail while the full resolution heights are still around.
+	if (!LoadTerrainLod(nullptr)) {
+		return false;
+	}
+
+	// Bake the finished cells for the next start.  A cache that can't be written only costs that start the time to build them again.
+	if (m_cacheFilename) {
+		SaveTerrainCache();
 
-	// Calculate the tangent and binormal
-	CalculateTerrainVectors();
+		delete[] m_cacheFilename;
+		m_cacheFilename = nullptr;
+	}
 
-	// Create and load the cells with the terrain data.
-	if (!LoadTerrainCells(device)) {
+	if (!LoadTerrainVisibility()) {
 		return false;
 	}
 
-	// Release the terrain model now that the terrain cells have been loaded.
-	ShutdownTerrainModel();
+	// Release the height field now that the terrain cells have been loaded, unless it is kept around for editing.
+	if (!m_editable) {
+		ShutdownHeightMap();
+	}
 
 	return true;
 }
 
+bool Terrain::InitializeCached(ID3D11Device* device, const TerrainCache* cache) {
+	// None of the source files are read.
+	delete[] m_terrainFilename;
+	m_terrainFilename = nullptr;
+
+	delete[] m_colorMapFilename;
+	m_colorMapFilename = nullptr;
+
+	delete[] m_cacheFilename;
+	m_cacheFilename = nullptr;
+
+	// Create the cells straight from the mapped vertices.
+	if (!LoadTerrainCells(device, cache)) {
+		return false;
+	}
+
+	if (!LoadTerrainLod(cache)) {
+		return false;
+	}
+
+	return LoadTerrainVisibility();
+}
+
+bool Terrain::InitializePaged(ID3D11Device* device) {
+	if (!MapHeightMap()) {
+		return false;
+	}
+
+	delete[] m_terrainFilename;
+	m_terrainFilename = nullptr;
+
+	if (!MapColorMap()) {
+		return false;
+	}
+
+	delete[] m_colorMapFilename;
+	m_colorMapFilename = nullptr;
+
+	// Paged cells are built from the source files as they are needed so there is nothing to bake, and the visible sets
+	// need every cell resident to trace against.
+	delete[] m_cacheFilename;
+	m_cacheFilename = nullptr;
+
+	delete[] m_visibilityFilename;
+	m_visibilityFilename = nullptr;
+
+	// Create the empty cell slots and the bounds of every cell.
+	if (!LoadPagedCells(device)) {
+		return false;
+	}
+
+	return LoadPagedLod();
+}
+
 void Terrain::Frame() {
 	m_renderCount = 0;
 	m_cellsDrawn = 0;
 	m_cellsCulled = 0;
 }
 
+bool Terrain::PageCells(ID3D11Device* device, const Vector3& cameraPosition) {
+	// Every cell is always resident when the terrain isn't paged.
+	if (m_pageRadius <= 0.0f) {
+		return true;
+	}
+
+	m_pageFrame++;
+
+	// Find the block of cells the ring around the camera overlaps, rows run towards -Z from the back of the terrain.
+	float cellSizeX = static_cast<float>(m_cellWidth - 1);
+	float cellSizeZ = static_cast<float>(m_cellHeight - 1);
+	float backZ = static_cast<float>(m_terrainHeight - 1);
+
+	int startX = static_cast<int>(std::max(floorf((cameraPosition.x - m_pageRadius) / cellSizeX), 0.0f));
+	int endX = static_cast<int>(std::min(floorf((cameraPosition.x + m_pageRadius) / cellSizeX), static_cast<float>(m_cellCountX - 1)));
+	int startY = static_cast<int>(std::max(floorf((backZ - (cameraPosition.z + m_pageRadius)) / cellSizeZ), 0.0f));
+	int endY = static_cast<int>(std::min(floorf((backZ - (cameraPosition.z - m_pageRadius)) / cellSizeZ), static_cast<float>(m_cellCountY - 1)));
+
+	// Keep the resident cells in the ring fresh and collect the ones that still have to be built.
+	int requestCount = 0;
+
+	for (int j = startY; j <= endY; j++) {
+		for (int i = startX; i <= endX; i++) {
+			int cellId = (j * m_cellCountX) + i;
+			if (m_TerrainLod->GetCellDistance(cellId, cameraPosition.x, cameraPosition.z) > m_pageRadius) {
+				continue;
+			}
+
+			if (m_cellSlots[cellId] >= 0) {
+				TouchSlot(m_cellSlots[cellId]);
+			}
+			else {
+				m_pageRequests[requestCount++] = cellId;
+			}
+		}
+	}
+
+	// Build the closest missing cells first and only so many each frame.
+	std::sort(m_pageRequests, m_pageRequests + requestCount, [&](int first, int second) {
+		return m_TerrainLod->GetCellDistance(first, cameraPosition.x, cameraPosition.z) < m_TerrainLod->GetCellDistance(second, cameraPosition.x, cameraPosition.z);
+	});
+
+	requestCount = std::min(requestCount, static_cast<int>(MAX_PAGE_BUILDS));
+
+	// Give each one a slot, stopping once the budget is taken up by cells that are in the ring.
+	int buildCount = 0;
+
+	for (int k = 0; k < requestCount; k++) {
+		int slot = AcquireSlot();
+		if (slot < 0) {
+			break;
+		}
+
+		m_slotCells[slot] = m_pageRequests[k];
+		m_cellSlots[m_pageRequests[k]] = slot;
+		TouchSlot(slot);
+
+		m_pageRequests[buildCount++] = slot;
+	}
+
+	// Build the new cells in parallel like the cells of a terrain that isn't paged.
+	std::atomic<bool> succeeded(true);
+	concurrency::parallel_for(0, buildCount, [&](int k) {
+		if (!BuildPagedCell(device, m_pageRequests[k])) {
+			succeeded = false;
+		}
+	});
+
+	if (!succeeded) {
+		return false;
+	}
+
+	// Narrow the height pyramid over the new cells to the heights they were built with.  The leaves along the cell
+	// edges can be shared so this runs one cell at a time.
+	for (int k = 0; k < buildCount; k++) {
+		int cellId = m_slotCells[m_pageRequests[k]];
+
+		UpdateTerrainPyramid(cellId % m_cellCountX, cellId / m_cellCountX, cellId % m_cellCountX, cellId / m_cellCountX);
+	}
+
+	return true;
+}
+
+void Terrain::SetLodErrorBudget(float pixelError, float projectionScale) {
+	m_TerrainLod->SetErrorBudget(pixelError, projectionScale);
+}
+
+void Terrain::SelectLod(const Vector3& cameraPosition) {
+	// Only the cells that are going to be drawn need a level.
+	m_TerrainLod->SelectLevels(cameraPosition.x, cameraPosition.z, m_visibleCells, m_visibleCellCount, m_cellLevels);
+}
+
 bool Terrain::LoadSetupFile(char* filename) {
 	int stringLength;
 	std::ifstream fin;
@@ -151,152 +407,173 @@ bool Terrain::LoadSetupFile(char* filename) {
 	// Read in the color map file name.
 	fin >> m_colorMapFilename;
 
-	// Close the setup file.
-	fin.close();
+	// Older setup files stop after the color map so default to cells of 33x33 vertices.
+	m_cellHeight = DEFAULT_CELL_SIZE;
+	m_cellWidth = DEFAULT_CELL_SIZE;
 
-	return true;
-}
+	// Read up to the value of cell height.
+	fin.get(input);
+	while ((input != ':') && !fin.eof()) {
+		fin.get(input);
+	}
 
-void Terrain::ShutdownHeightMap() {
-	// Release the height map array.
-	if (m_heightMap) {
-		delete[] m_heightMap;
-		m_heightMap = nullptr;
+	// Read in the cell height.
+	if (!fin.eof()) {
+		fin >> m_cellHeight;
+	}
+
+	// Read up to the value of cell width.
+	fin.get(input);
+	while ((input != ':') && !fin.eof()) {
+		fin.get(input);
 	}
-}
 
-void Terrain::SetTerrainCoordinates() const {
-	// adjust height map coordinates.
-	for (int j = 0; j < m_terrainHeight; j++) {
-		for (int i = 0; i < m_terrainWidth; i++) {
-			int index = (m_terrainWidth * j) + i;
+	// Read in the cell width.
+	if (!fin.eof()) {
+		fin >> m_cellWidth;
+	}
 
-			// Set the X and Z coordinates.
-			m_heightMap[index].x = static_cast<float>(i);
-			m_heightMap[index].z = -static_cast<float>(j);
+	// Without a page radius the whole terrain is loaded up front.
+	m_pageRadius = 0.0f;
+	m_pageBudget = DEFAULT_PAGE_BUDGET;
 
-			// Move the terrain depth into the positive range.  For example from (0, -256) to (256, 0).
-			m_heightMap[index].z += static_cast<float>(m_terrainHeight - 1);
+	// Read up to the value of page radius.
+	fin.get(input);
+	while ((input != ':') && !fin.eof()) {
+		fin.get(input);
+	}
 
-			// Scale the height.
-			m_heightMap[index].y /= m_heightScale;
-		}
+	// Read in the page radius.
+	if (!fin.eof()) {
+		fin >> m_pageRadius;
 	}
-}
 
-bool Terrain::CalculateNormals() const {
-	// Create a temporary array to hold the face normal vectors.
-	VectorType* normals = new VectorType[(m_terrainHeight - 1) * (m_terrainWidth - 1)];
-
-	// Go through all the faces in the mesh and calculate their normals.
-	for (int j = 0; j < (m_terrainHeight - 1); j++) {
-		for (int i = 0; i < (m_terrainWidth - 1); i++) {
-			int index1 = (j + 1) * m_terrainWidth + i;      // Bottom left vertex.
-			int index2 = (j + 1) * m_terrainWidth + (i + 1);  // Bottom right vertex.
-			int index3 = j * m_terrainWidth + i;          // Upper left vertex.
-			float vertex1[3];
-			float vertex2[3];
-			float vertex3[3];
-			float vector1[3];
-			float vector2[3];
-			// Get three vertices from the face.
-			vertex1[0] = m_heightMap[index1].x;
-			vertex1[1] = m_heightMap[index1].y;
-			vertex1[2] = m_heightMap[index1].z;
-
-			vertex2[0] = m_heightMap[index2].x;
-			vertex2[1] = m_heightMap[index2].y;
-			vertex2[2] = m_heightMap[index2].z;
-
-			vertex3[0] = m_heightMap[index3].x;
-			vertex3[1] = m_heightMap[index3].y;
-			vertex3[2] = m_heightMap[index3].z;
-
-			// Calculate the two vectors for this face.
-			vector1[0] = vertex1[0] - vertex3[0];
-			vector1[1] = vertex1[1] - vertex3[1];
-			vector1[2] = vertex1[2] - vertex3[2];
-			vector2[0] = vertex3[0] - vertex2[0];
-			vector2[1] = vertex3[1] - vertex2[1];
-			vector2[2] = vertex3[2] - vertex2[2];
-
-			int index = (j * (m_terrainWidth - 1)) + i;
-
-			// Calculate the cross product of those two vectors to get the un-normalized value for this face normal.
-			normals[index].x = (vector1[1] * vector2[2]) - (vector1[2] * vector2[1]);
-			normals[index].y = (vector1[2] * vector2[0]) - (vector1[0] * vector2[2]);
-			normals[index].z = (vector1[0] * vector2[1]) - (vector1[1] * vector2[0]);
-
-			// Calculate the length.
-			float length = static_cast<float>(sqrt(normals[index].x * normals[index].x + normals[index].y * normals[index].y + normals[index].z * normals[index].z));
-
-			// Normalize the final value for this face using the length.
-			normals[index].x = (normals[index].x / length);
-			normals[index].y = (normals[index].y / length);
-			normals[index].z = (normals[index].z / length);
-		}
-	}
-
-	// Now go through all the vertices and take a sum of the face normals that touch this vertex.
-	for (int j = 0; j < m_terrainHeight; j++) {
-		for (int i = 0; i < m_terrainWidth; i++) {
-			float sum[3];
-			// Initialize the sum.
-			sum[0] = 0.0f;
-			sum[1] = 0.0f;
-			sum[2] = 0.0f;
-
-			// Bottom left face.
-			if (i - 1 >= 0 && j - 1 >= 0) {
-				int index = ((j - 1) * (m_terrainWidth - 1)) + (i - 1);
-
-				sum[0] += normals[index].x;
-				sum[1] += normals[index].y;
-				sum[2] += normals[index].z;
-			}
+	// Read up to the value of page budget.
+	fin.get(input);
+	while ((input != ':') && !fin.eof()) {
+		fin.get(input);
+	}
 
-			// Bottom right face.
-			if (i < m_terrainWidth - 1 && j - 1 >= 0) {
-				int index = ((j - 1) * (m_terrainWidth - 1)) + i;
+	// Read in the page budget in megabytes.
+	if (!fin.eof()) {
+		fin >> m_pageBudget;
+	}
 
-				sum[0] += normals[index].x;
-				sum[1] += normals[index].y;
-				sum[2] += normals[index].z;
-			}
+	// Read up to the cache file name.
+	fin.get(input);
+	while ((input != ':') && !fin.eof()) {
+		fin.get(input);
+	}
 
-			// Upper left face.
-			if (i - 1 >= 0 && j < m_terrainHeight - 1) {
-				int index = (j * (m_terrainWidth - 1)) + (i - 1);
+	// Read in the cache file name, without one the cells are built from the source files every time.
+	m_cacheFilename = new char[stringLength];
+	m_cacheFilename[0] = '\0';
 
-				sum[0] += normals[index].x;
-				sum[1] += normals[index].y;
-				sum[2] += normals[index].z;
-			}
+	if (!fin.eof()) {
+		fin >> m_cacheFilename;
+	}
+
+	if (m_cacheFilename[0] == '\0') {
+		delete[] m_cacheFilename;
+		m_cacheFilename = nullptr;
+	}
 
-			// Upper right face.
-			if (i < m_terrainWidth - 1 && j < m_terrainHeight - 1) {
-				int index = (j * (m_terrainWidth - 1)) + i;
+	// Read up to the value of editable.
+	m_editable = false;
 
-				sum[0] += normals[index].x;
-				sum[1] += normals[index].y;
-				sum[2] += normals[index].z;
-			}
+	fin.get(input);
+	while ((input != ':') && !fin.eof()) {
+		fin.get(input);
+	}
+
+	// Read in whether the height field is kept so the terrain can be edited.
+	if (!fin.eof()) {
+		fin >> m_editable;
+	}
 
-			// Calculate the length of this normal.
-			float length = static_cast<float>(sqrt((sum[0] * sum[0]) + (sum[1] * sum[1]) + (sum[2] * sum[2])));
+	// Read up to the visibility file name.
+	fin.get(input);
+	while ((input != ':') && !fin.eof()) {
+		fin.get(input);
+	}
 
-			// Get an index to the vertex location in the height map array.
-			int index = (j * m_terrainWidth) + i;
+	// Read in the visibility file name, without one the cells are only culled against the frustum.
+	m_visibilityFilename = new char[stringLength];
+	m_visibilityFilename[0] = '\0';
 
-			// Normalize the final shared normal for this vertex and store it in the height map array.
-			m_heightMap[index].nx = (sum[0] / length);
-			m_heightMap[index].ny = (sum[1] / length);
-			m_heightMap[index].nz = (sum[2] / length);
-		}
+	if (!fin.eof()) {
+		fin >> m_visibilityFilename;
+	}
+
+	if (m_visibilityFilename[0] == '\0') {
+		delete[] m_visibilityFilename;
+		m_visibilityFilename = nullptr;
+	}
+
+	// Read up to the value of visibility height.
+	m_visibilityHeight = static_cast<float>(DEFAULT_VISIBILITY_HEIGHT);
+
+	fin.get(input);
+	while ((input != ':') && !fin.eof()) {
+		fin.get(input);
+	}
+
+	// Read in how far above the cells the eyes of the visible sets go.
+	if (!fin.eof()) {
+		fin >> m_visibilityHeight;
+	}
+
+	// Close the setup file.
+	fin.close();
+
+	// A cell needs at least one quad and its vertices have to fit the 16 bit indices of the shared index patterns.
+	if ((m_cellHeight < 2) || (m_cellWidth < 2) || (TerrainMesh::GetVertexCount(m_cellWidth, m_cellHeight) > 65536)) {
+		return false;
+	}
+
+	if ((m_terrainWidth < 2) || (m_terrainHeight < 2) || (m_pageBudget <= 0)) {
+		return false;
+	}
+
+	// Calculate the number of cells needed to cover the terrain, the last row and column of cells hang over the far
+	// edges unless the terrain is a whole number of cells.
+	m_cellCountX = ((m_terrainWidth - 2) / (m_cellWidth - 1)) + 1;
+	m_cellCountY = ((m_terrainHeight - 2) / (m_cellHeight - 1)) + 1;
+	m_cellCount = m_cellCountX * m_cellCountY;
+
+	return true;
+}
+
+void Terrain::ShutdownHeightMap() {
+	// Release the height field.
+	if (m_HeightField) {
+		delete m_HeightField;
+		m_HeightField = nullptr;
 	}
 
-	// Release the temporary normals.
-	delete[] normals;
+	// Release the mapped files of a paged terrain.
+	if (m_HeightMapFile) {
+		delete m_HeightMapFile;
+		m_HeightMapFile = nullptr;
+	}
+
+	if (m_ColorMapFile) {
+		delete m_ColorMapFile;
+		m_ColorMapFile = nullptr;
+	}
+}
+
+bool Terrain::CalculateNormals() const {
+	// Each band of vertex rows reads the faces above and below it straight from the height field so the bands never
+	// have to wait on each other.  The padding past the edges gets normals as well since the edge cells draw it.
+	int rowCount = m_HeightField->GetHeight();
+
+	concurrency::parallel_for(0, GetBuildTileCount(rowCount), [&](int tile) {
+		int startRow = tile * BUILD_TILE_ROWS;
+		int endRow = std::min(startRow + BUILD_TILE_ROWS, rowCount);
+
+		TerrainKernels::CalculateNormals(m_HeightField, startRow, endRow);
+	});
 
 	return true;
 }
@@ -330,8 +607,9 @@ bool Terrain::LoadColorMap() const {
 	}
 
 	// Calculate the size of the bitmap image data.
-	// Since this is non-divide by 2 dimensions (eg. 257x257) need to add extra byte to each line.
-	int imageSize = m_terrainHeight * ((m_terrainWidth * 3) + 1);
+	// Each line is padded out to a multiple of 4 bytes (eg. an extra byte for 257x257).
+	int linePitch = (((m_terrainWidth * 3) + 3) / 4) * 4;
+	int imageSize = m_terrainHeight * linePitch;
 
 	// Allocate memory for the bitmap image data.
 	unsigned char* bitmapImage = new unsigned char[imageSize];
@@ -351,485 +629,1118 @@ bool Terrain::LoadColorMap() const {
 		return false;
 	}
 
-	// Initialize the position in the image data buffer.
-	int k = 0;
+	// Read the image data into the color portion of the height field.
+	concurrency::parallel_for(0, GetBuildTileCount(m_terrainHeight), [&](int tile) {
+		int startRow = tile * BUILD_TILE_ROWS;
+		int endRow = std::min(startRow + BUILD_TILE_ROWS, m_terrainHeight);
 
-	// Read the image data into the color map portion of the height map structure.
-	for (int j = 0; j < m_terrainHeight; j++) {
-		for (int i = 0; i < m_terrainWidth; i++) {
-			// Bitmaps are upside down so load bottom to top into the array.
-			int index = (m_terrainWidth * (m_terrainHeight - 1 - j)) + i;
+		for (int j = startRow; j < endRow; j++) {
+			int k = j * linePitch;
 
-			m_heightMap[index].b = static_cast<float>(bitmapImage[k]) / 255.0f;
-			m_heightMap[index].g = static_cast<float>(bitmapImage[k + 1]) / 255.0f;
-			m_heightMap[index].r = static_cast<float>(bitmapImage[k + 2]) / 255.0f;
+			for (int i = 0; i < m_terrainWidth; i++) {
+				// Bitmaps are upside down so load bottom to top into the height field.
+				m_HeightField->SetColor(i, m_terrainHeight - 1 - j, bitmapImage[k + 2], bitmapImage[k + 1], bitmapImage[k]);
 
-			k += 3;
+				k += 3;
+			}
 		}
-
-		// Compensate for extra byte at end of each line in non-divide by 2 bitmaps (eg. 257x257).
-		k++;
-	}
+	});
 
 	// Release the bitmap image data.
 	delete[] bitmapImage;
 
+	// Fill the colors past the edges of the terrain.
+	m_HeightField->ExtendColors();
+
 	// Release the color map filename now that is has been read in.
 	delete[] m_colorMapFilename;
 
 	return true;
 }
 
-bool Terrain::BuildTerrainModel() {
-	float quadsCovered;
-	float incrementSize;
-	float tu2Left;
-	float tu2Right;
-	float tv2Bottom;
-	float tv2Top;
-
-
-	// Calculate the number of vertices in the 3D terrain model.
-	m_vertexCount = (m_terrainHeight - 1) * (m_terrainWidth - 1) * 6;
-
-	// Create the 3D terrain model array.
-	m_terrainModel = new ModelType[m_vertexCount];
-	if (!m_terrainModel) {
-		return false;
-	}
-
-	// Setup the increment size for the second set of textures.
-	// This is a fixed 33x33 vertex array per cell so there will be 32 rows of quads in a cell.
-	quadsCovered = 32.0f;
-	incrementSize = 1.0f / quadsCovered;
-
-	// Initialize the texture increments.
-	tu2Left = 0.0f;
-	tu2Right = incrementSize;
-	tv2Top = 0.0f;
-	tv2Bottom = incrementSize;
-
-	int index = 0;
-
-	// Load the 3D terrain model with the height map terrain data.
-	// We will be creating 2 triangles for each of the four points in a quad.
-	for (int j = 0; j < (m_terrainHeight - 1); j++) {
-		for (int i = 0; i < (m_terrainWidth - 1); i++) {
-			// Get the indexes to the four points of the quad.
-			int index1 = (m_terrainWidth * j) + i;          // Upper left.
-			int index2 = (m_terrainWidth * j) + (i + 1);      // Upper right.
-			int index3 = (m_terrainWidth * (j + 1)) + i;      // Bottom left.
-			int index4 = (m_terrainWidth * (j + 1)) + (i + 1);  // Bottom right.
-
-			// Now create two triangles for that quad.
-			// Triangle 1 - Upper left.
-			m_terrainModel[index].x = m_heightMap[index1].x;
-			m_terrainModel[index].y = m_heightMap[index1].y;
-			m_terrainModel[index].z = m_heightMap[index1].z;
-			m_terrainModel[index].tu = 0.0f;
-			m_terrainModel[index].tv = 0.0f;
-			m_terrainModel[index].nx = m_heightMap[index1].nx;
-			m_terrainModel[index].ny = m_heightMap[index1].ny;
-			m_terrainModel[index].nz = m_heightMap[index1].nz;
-			m_terrainModel[index].r = m_heightMap[index1].r;
-			m_terrainModel[index].g = m_heightMap[index1].g;
-			m_terrainModel[index].b = m_heightMap[index1].b;
-			m_terrainModel[index].tu2 = tu2Left;
-			m_terrainModel[index].tv2 = tv2Top;
-			index++;
-
-			// Triangle 1 - Upper right.
-			m_terrainModel[index].x = m_heightMap[index2].x;
-			m_terrainModel[index].y = m_heightMap[index2].y;
-			m_terrainModel[index].z = m_heightMap[index2].z;
-			m_terrainModel[index].tu = 1.0f;
-			m_terrainModel[index].tv = 0.0f;
-			m_terrainModel[index].nx = m_heightMap[index2].nx;
-			m_terrainModel[index].ny = m_heightMap[index2].ny;
-			m_terrainModel[index].nz = m_heightMap[index2].nz;
-			m_terrainModel[index].r = m_heightMap[index2].r;
-			m_terrainModel[index].g = m_heightMap[index2].g;
-			m_terrainModel[index].b = m_heightMap[index2].b;
-			m_terrainModel[index].tu2 = tu2Right;
-			m_terrainModel[index].tv2 = tv2Top;
-			index++;
-
-			// Triangle 1 - Bottom left.
-			m_terrainModel[index].x = m_heightMap[index3].x;
-			m_terrainModel[index].y = m_heightMap[index3].y;
-			m_terrainModel[index].z = m_heightMap[index3].z;
-			m_terrainModel[index].tu = 0.0f;
-			m_terrainModel[index].tv = 1.0f;
-			m_terrainModel[index].nx = m_heightMap[index3].nx;
-			m_terrainModel[index].ny = m_heightMap[index3].ny;
-			m_terrainModel[index].nz = m_heightMap[index3].nz;
-			m_terrainModel[index].r = m_heightMap[index3].r;
-			m_terrainModel[index].g = m_heightMap[index3].g;
-			m_terrainModel[index].b = m_heightMap[index3].b;
-			m_terrainModel[index].tu2 = tu2Left;
-			m_terrainModel[index].tv2 = tv2Bottom;
-			index++;
-
-			// Triangle 2 - Bottom left.
-			m_terrainModel[index].x = m_heightMap[index3].x;
-			m_terrainModel[index].y = m_heightMap[index3].y;
-			m_terrainModel[index].z = m_heightMap[index3].z;
-			m_terrainModel[index].tu = 0.0f;
-			m_terrainModel[index].tv = 1.0f;
-			m_terrainModel[index].nx = m_heightMap[index3].nx;
-			m_terrainModel[index].ny = m_heightMap[index3].ny;
-			m_terrainModel[index].nz = m_heightMap[index3].nz;
-			m_terrainModel[index].r = m_heightMap[index3].r;
-			m_terrainModel[index].g = m_heightMap[index3].g;
-			m_terrainModel[index].b = m_heightMap[index3].b;
-			m_terrainModel[index].tu2 = tu2Left;
-			m_terrainModel[index].tv2 = tv2Bottom;
-			index++;
-
-			// Triangle 2 - Upper right.
-			m_terrainModel[index].x = m_heightMap[index2].x;
-			m_terrainModel[index].y = m_heightMap[index2].y;
-			m_terrainModel[index].z = m_heightMap[index2].z;
-			m_terrainModel[index].tu = 1.0f;
-			m_terrainModel[index].tv = 0.0f;
-			m_terrainModel[index].nx = m_heightMap[index2].nx;
-			m_terrainModel[index].ny = m_heightMap[index2].ny;
-			m_terrainModel[index].nz = m_heightMap[index2].nz;
-			m_terrainModel[index].r = m_heightMap[index2].r;
-			m_terrainModel[index].g = m_heightMap[index2].g;
-			m_terrainModel[index].b = m_heightMap[index2].b;
-			m_terrainModel[index].tu2 = tu2Right;
-			m_terrainModel[index].tv2 = tv2Top;
-			index++;
-
-			// Triangle 2 - Bottom right.
-			m_terrainModel[index].x = m_heightMap[index4].x;
-			m_terrainModel[index].y = m_heightMap[index4].y;
-			m_terrainModel[index].z = m_heightMap[index4].z;
-			m_terrainModel[index].tu = 1.0f;
-			m_terrainModel[index].tv = 1.0f;
-			m_terrainModel[index].nx = m_heightMap[index4].nx;
-			m_terrainModel[index].ny = m_heightMap[index4].ny;
-			m_terrainModel[index].nz = m_heightMap[index4].nz;
-			m_terrainModel[index].r = m_heightMap[index4].r;
-			m_terrainModel[index].g = m_heightMap[index4].g;
-			m_terrainModel[index].b = m_heightMap[index4].b;
-			m_terrainModel[index].tu2 = tu2Right;
-			m_terrainModel[index].tv2 = tv2Bottom;
-			index++;
-
-			// Increment the second tu texture coords.
-			tu2Left += incrementSize;
-			tu2Right += incrementSize;
-
-			// Reset the second tu texture coordinate increments.
-			if (tu2Right > 1.0f) {
-				tu2Left = 0.0f;
-				tu2Right = incrementSize;
-			}
-		}
+bool Terrain::LoadTerrainCells(ID3D11Device* device, const TerrainCache* cache) {
+	if (!LoadCellIndexBuffer(device)) {
+		return false;
+	}
 
-		// Increment the second tv texture coords.
-		tv2Top += incrementSize;
-		tv2Bottom += incrementSize;
+	// Create the terrain cell array, every cell stays in the slot with its own index.
+	m_TerrainCells = new TerrainCell[m_cellCount];
+	if (!m_TerrainCells) {
+		return false;
+	}
 
-		// Reset the second tu texture coordinate increments.
-		if (tv2Bottom > 1.0f) {
-			tv2Top = 0.0f;
-			tv2Bottom = incrementSize;
-		}
+	m_slotCount = m_cellCount;
+	m_cellSlots = new int[m_cellCount];
+
+	for (int i = 0; i < m_cellCount; i++) {
+		m_cellSlots[i] = i;
 	}
 
-	return true;
-}
+	if (!LoadTerrainSurface()) {
+		return false;
+	}
 
-void Terrain::ShutdownTerrainModel() {
-	// Release the terrain model data.
-	if (m_terrainModel) {
-		delete[] m_terrainModel;
-		m_terrainModel = nullptr;
-	}
-}
-
-void Terrain::CalculateTerrainVectors() const {
-	VectorType tangent;
-	VectorType binormal;
-
-	// Calculate the number of faces in the terrain model.
-	int faceCount = m_vertexCount / 3;
-
-	// Initialize the index to the model data.
-	int index = 0;
-
-	// Go through all the faces and calculate the the tangent, binormal, and normal vectors.
-	for (int i = 0; i < faceCount; i++) {
-		TempVertexType vertex1;
-		TempVertexType vertex2;
-		TempVertexType vertex3;
-		// Get the three vertices for this face from the terrain model.
-		vertex1.x = m_terrainModel[index].x;
-		vertex1.y = m_terrainModel[index].y;
-		vertex1.z = m_terrainModel[index].z;
-		vertex1.tu = m_terrainModel[index].tu;
-		vertex1.tv = m_terrainModel[index].tv;
-		vertex1.nx = m_terrainModel[index].nx;
-		vertex1.ny = m_terrainModel[index].ny;
-		vertex1.nz = m_terrainModel[index].nz;
-		index++;
-
-		vertex2.x = m_terrainModel[index].x;
-		vertex2.y = m_terrainModel[index].y;
-		vertex2.z = m_terrainModel[index].z;
-		vertex2.tu = m_terrainModel[index].tu;
-		vertex2.tv = m_terrainModel[index].tv;
-		vertex2.nx = m_terrainModel[index].nx;
-		vertex2.ny = m_terrainModel[index].ny;
-		vertex2.nz = m_terrainModel[index].nz;
-		index++;
-
-		vertex3.x = m_terrainModel[index].x;
-		vertex3.y = m_terrainModel[index].y;
-		vertex3.z = m_terrainModel[index].z;
-		vertex3.tu = m_terrainModel[index].tu;
-		vertex3.tv = m_terrainModel[index].tv;
-		vertex3.nx = m_terrainModel[index].nx;
-		vertex3.ny = m_terrainModel[index].ny;
-		vertex3.nz = m_terrainModel[index].nz;
-		index++;
-
-		// Calculate the tangent and binormal of that face.
-		CalculateTangentBinormal(vertex1, vertex2, vertex3, tangent, binormal);
-
-		// Store the tangent and binormal for this face back in the model structure.
-		m_terrainModel[index - 1].tx = tangent.x;
-		m_terrainModel[index - 1].ty = tangent.y;
-		m_terrainModel[index - 1].tz = tangent.z;
-		m_terrainModel[index - 1].bx = binormal.x;
-		m_terrainModel[index - 1].by = binormal.y;
-		m_terrainModel[index - 1].bz = binormal.z;
-
-		m_terrainModel[index - 2].tx = tangent.x;
-		m_terrainModel[index - 2].ty = tangent.y;
-		m_terrainModel[index - 2].tz = tangent.z;
-		m_terrainModel[index - 2].bx = binormal.x;
-		m_terrainModel[index - 2].by = binormal.y;
-		m_terrainModel[index - 2].bz = binormal.z;
-
-		m_terrainModel[index - 3].tx = tangent.x;
-		m_terrainModel[index - 3].ty = tangent.y;
-		m_terrainModel[index - 3].tz = tangent.z;
-		m_terrainModel[index - 3].bx = binormal.x;
-		m_terrainModel[index - 3].by = binormal.y;
-		m_terrainModel[index - 3].bz = binormal.z;
-	}
-}
-
-void Terrain::CalculateTangentBinormal(TempVertexType vertex1, TempVertexType vertex2, TempVertexType vertex3, VectorType& tangent, VectorType& binormal) const {
-	float vector1[3];
-	float vector2[3];
-	float tuVector[2];
-	float tvVector[2];
-
-	// Calculate the two vectors for this face.
-	vector1[0] = vertex2.x - vertex1.x;
-	vector1[1] = vertex2.y - vertex1.y;
-	vector1[2] = vertex2.z - vertex1.z;
-
-	vector2[0] = vertex3.x - vertex1.x;
-	vector2[1] = vertex3.y - vertex1.y;
-	vector2[2] = vertex3.z - vertex1.z;
-
-	// Calculate the tu and tv texture space vectors.
-	tuVector[0] = vertex2.tu - vertex1.tu;
-	tvVector[0] = vertex2.tv - vertex1.tv;
-
-	tuVector[1] = vertex3.tu - vertex1.tu;
-	tvVector[1] = vertex3.tv - vertex1.tv;
-
-	// Calculate the denominator of the tangent/binormal equation.
-	float den = 1.0f / (tuVector[0] * tvVector[1] - tuVector[1] * tvVector[0]);
-
-	// Calculate the cross products and multiply by the coefficient to get the tangent and binormal.
-	tangent.x = (tvVector[1] * vector1[0] - tvVector[0] * vector2[0]) * den;
-	tangent.y = (tvVector[1] * vector1[1] - tvVector[0] * vector2[1]) * den;
-	tangent.z = (tvVector[1] * vector1[2] - tvVector[0] * vector2[2]) * den;
-
-	binormal.x = (tuVector[0] * vector2[0] - tuVector[1] * vector1[0]) * den;
-	binormal.y = (tuVector[0] * vector2[1] - tuVector[1] * vector1[1]) * den;
-	binormal.z = (tuVector[0] * vector2[2] - tuVector[1] * vector1[2]) * den;
-
-	// Calculate the length of the tangent.
-	float length = static_cast<float>(sqrt((tangent.x * tangent.x) + (tangent.y * tangent.y) + (tangent.z * tangent.z)));
-
-	// Normalize the tangent and then store it.
-	tangent.x = tangent.x / length;
-	tangent.y = tangent.y / length;
-	tangent.z = tangent.z / length;
-
-	// Calculate the length of the binormal.
-	length = static_cast<float>(sqrt((binormal.x * binormal.x) + (binormal.y * binormal.y) + (binormal.z * binormal.z)));
-
-	// Normalize the binormal and then store it.
-	binormal.x = binormal.x / length;
-	binormal.y = binormal.y / length;
-	binormal.z = binormal.z / length;
-}
-
-bool Terrain::LoadTerrainCells(ID3D11Device* device) {
-	// Set the height and width of each terrain cell to a fixed 33x33 vertex array.
-	int cellHeight = 33;
-	int cellWidth = 33;
-
-	// Calculate the number of cells needed to store the terrain data.
-	int cellRowCount = (m_terrainWidth - 1) / (cellWidth - 1);
-	m_cellCount = cellRowCount * cellRowCount;
-
-	// Create the terrain cell array.
-	m_TerrainCells = new TerrainCell[m_cellCount];
-	if (!m_TerrainCells) {
+	// Loop through and initialize all the terrain cells.  Buffer creation on the device is free threaded so the cells are built in parallel,
+	// and each cell only holds its own vertices while it is being built.  Baked cells are handed their vertices as they are.
+	std::atomic<bool> succeeded(true);
+	concurrency::parallel_for(0, m_cellCount, [&](int index) {
+		int i = index % m_cellCountX;
+		int j = index / m_cellCountX;
+
+		bool result;
+		if (cache) {
+			result = m_TerrainCells[index].Initialize(device, cache->GetCellVertices(index), cache->GetCellBounds(index), m_cellHeight, m_cellWidth, m_cellIndexBuffer.Get());
+		}
+		else {
+			result = m_TerrainCells[index].Initialize(device, m_HeightField, i, j, m_cellHeight, m_cellWidth, m_cellIndexBuffer.Get());
+		}
+
+		if (!result) {
+			succeeded = false;
+		}
+	});
+
+	if (!succeeded) {
 		return false;
 	}
 
-	// Loop through and initialize all the terrain cells.
-	for (int j = 0; j < cellRowCount; j++) {
-		for (int i = 0; i < cellRowCount; i++) {
-			int index = (cellRowCount * j) + i;
+	// Build the bounding quadtree over the finished cells and the list the visible cells are culled into.
+	m_TerrainQuadTree = new TerrainQuadTree;
+	if (!m_TerrainQuadTree->Initialize(m_cellCountX, m_cellCountY)) {
+		return false;
+	}
 
-			bool result = m_TerrainCells[index].Initialize(device, m_terrainModel, i, j, cellHeight, cellWidth, m_terrainWidth);
-			if (!result) {
-				return false;
-			}
+	for (int i = 0; i < m_cellCount; i++) {
+		float bounds[TerrainCache::BOUNDS_SIZE];
+		if (cache) {
+			memcpy(bounds, cache->GetCellBounds(i), sizeof(bounds));
 		}
+		else {
+			m_TerrainCells[i].GetCellDimensions(bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+		}
+
+		m_TerrainQuadTree->SetCellBounds(i, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
 	}
 
-	return true;
-}
+	m_TerrainQuadTree->UpdateBounds();
 
-void Terrain::ShutdownTerrainCells() {
-	// Release the terrain cell array.
-	if (m_TerrainCells) {
-		delete[] m_TerrainCells;
-		m_TerrainCells = nullptr;
+	m_visibleCells = new int[m_cellCount];
+	m_visibleCellCount = 0;
+	m_visibleDepths = new float[m_cellCount];
+	m_sortKeys = new unsigned short[m_cellCount];
+	m_sortScratchKeys = new unsigned short[m_cellCount];
+	m_sortScratchCells = new int[m_cellCount];
+
+	// Gather the height bounds of the finished cells into the pyramid.
+	if (!LoadTerrainPyramid()) {
+		return false;
 	}
+
+	return LoadTerrainOcclusion();
 }
 
-bool Terrain::RenderCell(ID3D11DeviceContext* deviceContext, int cellId, Frustum* Frustum) {
-	float maxWidth;
-	float maxHeight;
-	float maxDepth;
-	float minWidth;
-	float minHeight;
-	float minDepth;
-	bool result;
+bool Terrain::LoadCellIndexBuffer(ID3D11Device* device) {
+	// Build the index patterns of every level of detail, one after another, that every cell shares.  The cells are
+	// small enough for 16 bit indices.
+	int levelCount = TerrainMesh::GetLevelCount(m_cellWidth, m_cellHeight);
+	int indexCount = TerrainMesh::GetIndexStart(m_cellWidth, m_cellHeight, levelCount);
+	m_cellIndices = new unsigned short[indexCount];
 
-	// Get the dimensions of the terrain cell.
-	m_TerrainCells[cellId].GetCellDimensions(maxWidth, maxHeight, maxDepth, minWidth, minHeight, minDepth);
+	for (int level = 0; level < levelCount; level++) {
+		TerrainMesh::BuildIndices(m_cellIndices + TerrainMesh::GetIndexStart(m_cellWidth, m_cellHeight, level), m_cellWidth, m_cellHeight, level);
+	}
 
-	// Check if the cell is visible.  If it is not visible then just return and don't render it.
-	result = Frustum->CheckRectangle2(maxWidth, maxHeight, maxDepth, minWidth, minHeight, minDepth);
-	if (!result) {
-		// Increment the number of cells that were culled.
-		m_cellsCulled++;
+	// Set up the description of the shared static index buffer.
+	D3D11_BUFFER_DESC indexBufferDesc = {};
 
-		return false;
-	}
+	indexBufferDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	indexBufferDesc.ByteWidth = sizeof(unsigned short) * indexCount;
+	indexBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+	indexBufferDesc.CPUAccessFlags = 0;
+	indexBufferDesc.MiscFlags = 0;
+	indexBufferDesc.StructureByteStride = 0;
 
-	// If it is visible then render it.
-	m_TerrainCells[cellId].Render(deviceContext);
+	// Give the subresource structure a pointer to the index data.
+	D3D11_SUBRESOURCE_DATA indexData = {};
 
-	// Add the polygons in the cell to the render count.
-	m_renderCount += (m_TerrainCells[cellId].GetVertexCount() / 3);
+	indexData.pSysMem = m_cellIndices;
+	indexData.SysMemPitch = 0;
+	indexData.SysMemSlicePitch = 0;
 
-	// Increment the number of cells that were actually drawn.
-	m_cellsDrawn++;
+	// Create the index buffer.
+	HRESULT result = device->CreateBuffer(&indexBufferDesc, &indexData, m_cellIndexBuffer.GetAddressOf());
+	if (FAILED(result)) {
+		return false;
+	}
 
 	return true;
 }
 
-void Terrain::RenderCellLines(ID3D11DeviceContext* deviceContext, int cellId) const {
-	m_TerrainCells[cellId].RenderLineBuffers(deviceContext);
-}
-
-int Terrain::GetCellIndexCount(int cellId) const {
-	return m_TerrainCells[cellId].GetIndexCount();
-}
+bool Terrain::LoadPagedCells(ID3D11Device* device) {
+	if (!LoadCellIndexBuffer(device)) {
+		return false;
+	}
 
-int Terrain::GetCellLinesIndexCount(int cellId) const {
-	return m_TerrainCells[cellId].GetLineBuffersIndexCount();
-}
+	// Work out how many cells fit in the budget, counting the vertex buffer and the surface copy of each.
+	unsigned long long cellBytes = static_cast<unsigned long long>(TerrainMesh::GetVertexCount(m_cellWidth, m_cellHeight)) * (sizeof(TerrainMesh::VertexType) + TerrainSurface::VERTEX_SIZE);
+	unsigned long long budgetBytes = static_cast<unsigned long long>(m_pageBudget) * 1024 * 1024;
+	m_slotCount = static_cast<int>(std::max(std::min(budgetBytes / cellBytes, static_cast<unsigned long long>(m_cellCount)), 1ull));
 
-int Terrain::GetCellCount() const {
-	return m_cellCount;
-}
+	// Create the empty slots the resident cells are built into.
+	m_TerrainCells = new TerrainCell[m_slotCount];
+	if (!m_TerrainCells) {
+		return false;
+	}
 
-int Terrain::GetRenderCount() const {
-	return m_renderCount;
-}
+	m_slotCells = new int[m_slotCount];
+	m_slotFrames = new int[m_slotCount];
+	m_slotPrevious = new int[m_slotCount];
+	m_slotNext = new int[m_slotCount];
+
+	// Chain the slots into the least recently used list, the slots are handed out from the tail.
+	for (int i = 0; i < m_slotCount; i++) {
+		m_slotCells[i] = -1;
+		m_slotFrames[i] = -1;
+		m_slotPrevious[i] = i - 1;
+		m_slotNext[i] = (i + 1 < m_slotCount) ? i + 1 : -1;
+	}
 
-int Terrain::GetCellsDrawn() const {
-	return m_cellsDrawn;
-}
+	m_slotHead = 0;
+	m_slotTail = m_slotCount - 1;
 
-int Terrain::GetCellsCulled() const {
-	return m_cellsCulled;
-}
+	// No cell is resident to begin with.
+	m_cellSlots = new int[m_cellCount];
+	m_pageRequests = new int[m_cellCount];
 
-bool Terrain::GetHeightAtPosition(float inputX, float inputZ, float& height) const {
-	// Loop through all of the terrain cells to find out which one the inputX and inputZ would be inside.
-	int cellId = -1;
 	for (int i = 0; i < m_cellCount; i++) {
-		// Get the current cell dimensions.
-		float maxWidth;
-		float maxHeight;
-		float maxDepth;
-		float minWidth;
-		float minHeight;
-		float minDepth;
-		m_TerrainCells[i].GetCellDimensions(maxWidth, maxHeight, maxDepth, minWidth, minHeight, minDepth);
-
-		// Check to see if the positions are in this cell.
-		if ((inputX < maxWidth) && (inputX > minWidth) && (inputZ < maxDepth) && (inputZ > minDepth)) {
-			cellId = i;
-			i = m_cellCount;
-		}
+		m_cellSlots[i] = -1;
 	}
 
-	// If we didn't find a cell then the input position is off the terrain grid.
-	if (cellId == -1) {
+	if (!LoadTerrainSurface()) {
 		return false;
 	}
 
-	// If this is the right cell then check all the triangles in this cell to see what the height of the triangle at this position is.
-	for (int i = 0; i < (m_TerrainCells[cellId].GetVertexCount() / 3); i++) {
-		int index = i * 3;
-		float vertex1[3];
-		float vertex2[3];
-		float vertex3[3];
-		vertex1[0] = m_TerrainCells[cellId].m_vertexList[index].x;
-		vertex1[1] = m_TerrainCells[cellId].m_vertexList[index].y;
-		vertex1[2] = m_TerrainCells[cellId].m_vertexList[index].z;
-		index++;
+	// Build the bounding quadtree from the bounds of every cell so the culling doesn't depend on what is resident.
+	m_TerrainQuadTree = new TerrainQuadTree;
+	if (!m_TerrainQuadTree->Initialize(m_cellCountX, m_cellCountY)) {
+		return false;
+	}
 
-		vertex2[0] = m_TerrainCells[cellId].m_vertexList[index].x;
-		vertex2[1] = m_TerrainCells[cellId].m_vertexList[index].y;
-		vertex2[2] = m_TerrainCells[cellId].m_vertexList[index].z;
-		index++;
+	LoadCellBounds();
 
-		vertex3[0] = m_TerrainCells[cellId].m_vertexList[index].x;
-		vertex3[1] = m_TerrainCells[cellId].m_vertexList[index].y;
-		vertex3[2] = m_TerrainCells[cellId].m_vertexList[index].z;
+	m_visibleCells = new int[m_cellCount];
+	m_visibleCellCount = 0;
+	m_visibleDepths = new float[m_cellCount];
+	m_sortKeys = new unsigned short[m_cellCount];
+	m_sortScratchKeys = new unsigned short[m_cellCount];
+	m_sortScratchCells = new int[m_cellCount];
 
-		// Check to see if this is the polygon we are looking for.
-		bool foundHeight = CheckHeightOfTriangle(inputX, inputZ, height, vertex1, vertex2, vertex3);
-		if (foundHeight) {
-			return true;
-		}
+	// Start the height pyramid from the bounds of the cells, it narrows as the cells are built.
+	if (!LoadTerrainPyramid()) {
+		return false;
 	}
 
-	return false;
+	return LoadTerrainOcclusion();
 }
 
-bool Terrain::CheckHeightOfTriangle(float x, float z, float& height, float v0[3], float v1[3], float v2[3]) const {
+void Terrain::LoadCellBounds() const {
+	const unsigned short* rawImage = reinterpret_cast<const unsigned short*>(m_HeightMapFile->GetData());
+
+	// Scan each row of cells in parallel for the lowest and highest point of each cell, the padding past the edges
+	// only repeats the edge so it is left out.
+	concurrency::parallel_for(0, m_cellCountY, [&](int nodeIndexY) {
+		int startRow = nodeIndexY * (m_cellHeight - 1);
+		int endRow = std::min(startRow + m_cellHeight, m_terrainHeight);
+
+		for (int nodeIndexX = 0; nodeIndexX < m_cellCountX; nodeIndexX++) {
+			int startColumn = nodeIndexX * (m_cellWidth - 1);
+			int endColumn = std::min(startColumn + m_cellWidth, m_terrainWidth);
+			float maxHeight = -FLT_MAX;
+			float minHeight = FLT_MAX;
+
+			for (int j = startRow; j < endRow; j++) {
+				for (int i = startColumn; i < endColumn; i++) {
+					float height = static_cast<float>(rawImage[(static_cast<unsigned long long>(m_terrainWidth) * j) + i]) / m_heightScale;
+
+					maxHeight = std::max(maxHeight, height);
+					minHeight = std::min(minHeight, height);
+				}
+			}
+
+			// The footprint is the same as the positions the vertices of the cell get.
+			m_TerrainQuadTree->SetCellBounds((nodeIndexY * m_cellCountX) + nodeIndexX, static_cast<float>(endColumn - 1), maxHeight,
+				static_cast<float>(m_terrainHeight - 1 - startRow), static_cast<float>(startColumn), minHeight, static_cast<float>(m_terrainHeight - endRow));
+		}
+	});
+
+	m_TerrainQuadTree->UpdateBounds();
+}
+
+bool Terrain::LoadTerrainSurface() {
+	// Every slot copies its vertices into the surface for the batched queries as it is built.
+	m_TerrainSurface = new TerrainSurface;
+	if (!m_TerrainSurface->Initialize(m_terrainWidth, m_terrainHeight, m_cellWidth, m_cellHeight, m_cellCountX, m_slotCount, m_cellSlots)) {
+		return false;
+	}
+
+	for (int slot = 0; slot < m_slotCount; slot++) {
+		m_TerrainCells[slot].SetSurface(m_TerrainSurface, slot);
+	}
+
+	return true;
+}
+
+bool Terrain::LoadTerrainPyramid() {
+	// The pyramid covers the quads of the terrain, the padding past the far edges collapses onto the edge.
+	m_TerrainPyramid = new TerrainPyramid;
+	if (!m_TerrainPyramid->Initialize(m_terrainWidth - 1, m_terrainHeight - 1)) {
+		return false;
+	}
+
+	int leafShift = m_TerrainPyramid->GetLeafShift();
+	int leafCountX = ((m_terrainWidth - 2) >> leafShift) + 1;
+	int leafCountY = ((m_terrainHeight - 2) >> leafShift) + 1;
+
+	LoadPyramidLeaves(0, 0, leafCountX, leafCountY);
+	m_TerrainPyramid->UpdateLevels(0, 0, leafCountX, leafCountY);
+
+	return true;
+}
+
+bool Terrain::LoadTerrainOcclusion() {
+	m_TerrainOcclusion = new TerrainOcclusion;
+	if (!m_TerrainOcclusion->Initialize(OCCLUSION_WIDTH, OCCLUSION_HEIGHT, OCCLUDER_SIZE, MAX_OCCLUDERS)) {
+		return false;
+	}
+
+	// Room for the occluders and a box for every cell that can be visible.
+	m_occluderVertices = new float[MAX_OCCLUDERS * m_TerrainOcclusion->GetOccluderVertexCount() * 3];
+	m_occlusionBounds = new float[m_cellCount * TerrainCache::BOUNDS_SIZE];
+
+	return true;
+}
+
+void Terrain::LoadOccluder(int cellId, float* vertices) const {
+	int cellSizeX = m_cellWidth - 1;
+	int cellSizeY = m_cellHeight - 1;
+	int startColumn = (cellId % m_cellCountX) * cellSizeX;
+	int startRow = (cellId / m_cellCountX) * cellSizeY;
+	float backZ = static_cast<float>(m_terrainHeight - 1);
+
+	// The last row and column of cells can hang over the far edges.
+	int quadCountX = std::min(cellSizeX, m_terrainWidth - 1 - startColumn);
+	int quadCountY = std::min(cellSizeY, m_terrainHeight - 1 - startRow);
+
+	// Split the quads of the cell into blocks and drop each corner to the lowest height of the blocks around it in the
+	// cell.  Every triangle of the occluder is then under the lowest height of its block, so it never covers terrain
+	// that can be seen.
+	for (int b = 0; b <= OCCLUDER_SIZE; b++) {
+		int row = startRow + ((b * quadCountY) / OCCLUDER_SIZE);
+		int firstRow = startRow + ((std::max(b - 1, 0) * quadCountY) / OCCLUDER_SIZE);
+		int lastRow = std::max(startRow + ((std::min(b + 1, static_cast<int>(OCCLUDER_SIZE)) * quadCountY) / OCCLUDER_SIZE), firstRow + 1);
+
+		for (int a = 0; a <= OCCLUDER_SIZE; a++) {
+			int column = startColumn + ((a * quadCountX) / OCCLUDER_SIZE);
+			int firstColumn = startColumn + ((std::max(a - 1, 0) * quadCountX) / OCCLUDER_SIZE);
+			int lastColumn = std::max(startColumn + ((std::min(a + 1, static_cast<int>(OCCLUDER_SIZE)) * quadCountX) / OCCLUDER_SIZE), firstColumn + 1);
+			float minHeight;
+			float maxHeight;
+
+			m_TerrainPyramid->GetBounds(firstColumn, firstRow, lastColumn, lastRow, minHeight, maxHeight);
+
+			float* vertex = vertices + (((b * (OCCLUDER_SIZE + 1)) + a) * 3);
+			vertex[0] = static_cast<float>(column);
+			vertex[1] = minHeight;
+			vertex[2] = backZ - static_cast<float>(row);
+		}
+	}
+}
+
+void Terrain::LoadPyramidLeaves(int startLeafX, int startLeafY, int endLeafX, int endLeafY) const {
+	int leafShift = m_TerrainPyramid->GetLeafShift();
+	int cellSizeX = m_cellWidth - 1;
+	int cellSizeY = m_cellHeight - 1;
+
+	// The leaves bound the heights the queries see, which are the heights the resident cells were built with.  A cell
+	// that isn't resident only has its bounds, which hold whatever heights it will be built with once those are
+	// quantized across them.  A cell that was paged out keeps the leaves it narrowed since it comes back the same.
+	concurrency::parallel_for(0, endLeafY - startLeafY, [&](int row) {
+		int leafY = startLeafY + row;
+		int startRow = leafY << leafShift;
+		int endRow = std::min((leafY + 1) << leafShift, m_terrainHeight - 1);
+
+		for (int leafX = startLeafX; leafX < endLeafX; leafX++) {
+			int startColumn = leafX << leafShift;
+			int endColumn = std::min((leafX + 1) << leafShift, m_terrainWidth - 1);
+			float minHeight = FLT_MAX;
+			float maxHeight = -FLT_MAX;
+
+			// Every quad is in exactly one cell, so visit each cell the leaf overlaps for the quads it has there.
+			for (int nodeIndexY = startRow / cellSizeY; nodeIndexY <= (endRow - 1) / cellSizeY; nodeIndexY++) {
+				for (int nodeIndexX = startColumn / cellSizeX; nodeIndexX <= (endColumn - 1) / cellSizeX; nodeIndexX++) {
+					int cellId = (nodeIndexY * m_cellCountX) + nodeIndexX;
+					int slot = m_cellSlots[cellId];
+
+					if (slot < 0) {
+						float bounds[TerrainCache::BOUNDS_SIZE];
+						m_TerrainQuadTree->GetCellBounds(cellId, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+
+						// The top step can round just past the highest height.
+						TerrainMesh::DecodeType decode = TerrainMesh::GetDecode(bounds, m_cellWidth, m_cellHeight);
+
+						minHeight = std::min(minHeight, decode.minHeight);
+						maxHeight = std::max(maxHeight, std::max(bounds[1], decode.minHeight + (static_cast<float>(TerrainMesh::HEIGHT_STEPS) * decode.heightStep)));
+						continue;
+					}
+
+					// Take the corners of the quads of the leaf that are in this cell.
+					int firstColumn = std::max(startColumn - (nodeIndexX * cellSizeX), 0);
+					int lastColumn = std::min(endColumn - (nodeIndexX * cellSizeX), cellSizeX);
+					int firstRow = std::max(startRow - (nodeIndexY * cellSizeY), 0);
+					int lastRow = std::min(endRow - (nodeIndexY * cellSizeY), cellSizeY);
+					float cellMin;
+					float cellMax;
+					m_TerrainSurface->GetHeightRange(slot, firstColumn, firstRow, lastColumn, lastRow, cellMin, cellMax);
+
+					minHeight = std::min(minHeight, cellMin);
+					maxHeight = std::max(maxHeight, cellMax);
+				}
+			}
+
+			m_TerrainPyramid->SetLeafBounds(leafX, leafY, minHeight, maxHeight);
+		}
+	});
+}
+
+void Terrain::UpdateTerrainPyramid(int startCellX, int startCellY, int endCellX, int endCellY) {
+	int leafShift = m_TerrainPyramid->GetLeafShift();
+
+	// Find the leaves over the quads of the cells, the last row and column of cells can hang over the far edges.
+	int startLeafX = (startCellX * (m_cellWidth - 1)) >> leafShift;
+	int startLeafY = (startCellY * (m_cellHeight - 1)) >> leafShift;
+	int endLeafX = ((std::min((endCellX + 1) * (m_cellWidth - 1), m_terrainWidth - 1) - 1) >> leafShift) + 1;
+	int endLeafY = ((std::min((endCellY + 1) * (m_cellHeight - 1), m_terrainHeight - 1) - 1) >> leafShift) + 1;
+
+	LoadPyramidLeaves(startLeafX, startLeafY, endLeafX, endLeafY);
+	m_TerrainPyramid->UpdateLevels(startLeafX, startLeafY, endLeafX, endLeafY);
+}
+
+HeightField* Terrain::LoadPageWindow(int nodeIndexX, int nodeIndexY) const {
+	int gridWidth = (m_cellCountX * (m_cellWidth - 1)) + 1;
+	int gridHeight = (m_cellCountY * (m_cellHeight - 1)) + 1;
+
+	// Take the samples of the cell and one more all around for the normals and tangents, without leaving the grid so
+	// the edges of the terrain come out the same as when it is loaded whole.
+	int startX = std::max((nodeIndexX * (m_cellWidth - 1)) - 1, 0);
+	int startY = std::max((nodeIndexY * (m_cellHeight - 1)) - 1, 0);
+	int endX = std::min((nodeIndexX * (m_cellWidth - 1)) + m_cellWidth + 1, gridWidth);
+	int endY = std::min((nodeIndexY * (m_cellHeight - 1)) + m_cellHeight + 1, gridHeight);
+
+	HeightField* window = new HeightField;
+	if (!window->Initialize(endX - startX, endY - startY, m_terrainWidth, m_terrainHeight)) {
+		delete window;
+		return nullptr;
+	}
+
+	window->SetOrigin(startX, startY);
+
+	const unsigned short* rawImage = reinterpret_cast<const unsigned short*>(m_HeightMapFile->GetData());
+	const unsigned char* bitmapImage = m_ColorMapFile->GetData() + m_colorMapOffset;
+
+	for (int j = 0; j < window->GetHeight(); j++) {
+		// Samples past the edges repeat the edge.
+		int row = std::min(startY + j, m_terrainHeight - 1);
+		float* heights = window->GetHeightRow(j);
+
+		// Bitmaps are upside down so the terrain rows are read from the bottom up.
+		const unsigned char* colors = bitmapImage + (static_cast<unsigned long long>(m_colorMapPitch) * (m_terrainHeight - 1 - row));
+
+		for (int i = 0; i < window->GetWidth(); i++) {
+			int column = std::min(startX + i, m_terrainWidth - 1);
+
+			heights[i] = static_cast<float>(rawImage[(static_cast<unsigned long long>(m_terrainWidth) * row) + column]) / m_heightScale;
+			window->SetColor(i, j, colors[(column * 3) + 2], colors[(column * 3) + 1], colors[column * 3]);
+		}
+	}
+
+	TerrainKernels::CalculateNormals(window, 0, window->GetHeight());
+
+	return window;
+}
+
+bool Terrain::BuildPagedCell(ID3D11Device* device, int slot) {
+	int nodeIndexX = m_slotCells[slot] % m_cellCountX;
+	int nodeIndexY = m_slotCells[slot] / m_cellCountX;
+
+	// Build the cell from a window of the mapped files that is only held while the cell is built.
+	HeightField* window = LoadPageWindow(nodeIndexX, nodeIndexY);
+	if (!window) {
+		return false;
+	}
+
+	bool result = m_TerrainCells[slot].Initialize(device, window, nodeIndexX, nodeIndexY, m_cellHeight, m_cellWidth, m_cellIndexBuffer.Get());
+
+	delete window;
+
+	return result;
+}
+
+int Terrain::AcquireSlot() {
+	int slot = m_slotTail;
+
+	// Every slot has been used this frame so the budget is full.
+	if (m_slotFrames[slot] == m_pageFrame) {
+		return -1;
+	}
+
+	// Evict the cell in the least recently used slot.
+	if (m_slotCells[slot] >= 0) {
+		m_cellSlots[m_slotCells[slot]] = -1;
+		m_slotCells[slot] = -1;
+		m_TerrainCells[slot].Shutdown();
+	}
+
+	return slot;
+}
+
+void Terrain::TouchSlot(int slot) {
+	m_slotFrames[slot] = m_pageFrame;
+
+	if (slot == m_slotHead) {
+		return;
+	}
+
+	// Unlink the slot and put it back at the head of the list.
+	m_slotNext[m_slotPrevious[slot]] = m_slotNext[slot];
+	if (m_slotNext[slot] >= 0) {
+		m_slotPrevious[m_slotNext[slot]] = m_slotPrevious[slot];
+	}
+	else {
+		m_slotTail = m_slotPrevious[slot];
+	}
+
+	m_slotPrevious[slot] = -1;
+	m_slotNext[slot] = m_slotHead;
+	m_slotPrevious[m_slotHead] = slot;
+	m_slotHead = slot;
+}
+
+bool Terrain::LoadTerrainLod(const TerrainCache* cache) {
+	m_TerrainLod = new TerrainLod;
+
+	// Baked cells come with the errors that were measured when they were built.
+	if (cache) {
+		if (!m_TerrainLod->Initialize(m_cellWidth, m_cellHeight, m_cellCountX, m_cellCountY, m_terrainWidth, m_terrainHeight)) {
+			return false;
+		}
+
+		m_TerrainLod->SetCellErrors(cache->GetCellErrors(0));
+	}
+	else if (!m_TerrainLod->Initialize(m_HeightField, m_cellWidth, m_cellHeight, m_cellCountX, m_cellCountY)) {
+		return false;
+	}
+
+	// Start every cell at full resolution until the first selection.
+	m_cellLevels = new int[m_cellCount];
+	memset(m_cellLevels, 0, sizeof(int) * m_cellCount);
+
+	return true;
+}
+
+bool Terrain::LoadPagedLod() {
+	m_TerrainLod = new TerrainLod;
+	if (!m_TerrainLod->Initialize(m_cellWidth, m_cellHeight, m_cellCountX, m_cellCountY, m_terrainWidth, m_terrainHeight)) {
+		return false;
+	}
+
+	// Measuring every cell would read the whole terrain, so measure an even spread of at most so many cells.
+	int step = 1;
+	while ((((m_cellCountX + step - 1) / step) * ((m_cellCountY + step - 1) / step)) > MAX_LOD_SAMPLE_CELLS) {
+		step++;
+	}
+
+	int sampleCountX = (m_cellCountX + step - 1) / step;
+	int sampleCount = sampleCountX * ((m_cellCountY + step - 1) / step);
+	int levelCount = m_TerrainLod->GetLevelCount();
+	float* cellErrors = new float[sampleCount * levelCount];
+
+	std::atomic<bool> succeeded(true);
+	concurrency::parallel_for(0, sampleCount, [&](int index) {
+		int nodeIndexX = (index % sampleCountX) * step;
+		int nodeIndexY = (index / sampleCountX) * step;
+
+		HeightField* window = LoadPageWindow(nodeIndexX, nodeIndexY);
+		if (!window) {
+			succeeded = false;
+			return;
+		}
+
+		m_TerrainLod->CalculateCellErrors(window, nodeIndexX, nodeIndexY, cellErrors + (index * levelCount));
+
+		delete window;
+	});
+
+	if (succeeded) {
+		m_TerrainLod->SetLevelErrors(cellErrors, sampleCount);
+	}
+
+	delete[] cellErrors;
+
+	// Start every cell at full resolution until the first selection.
+	m_cellLevels = new int[m_cellCount];
+	memset(m_cellLevels, 0, sizeof(int) * m_cellCount);
+
+	return succeeded;
+}
+
+void Terrain::ShutdownTerrainCells() {
+	// Release the terrain cell array.
+	if (m_TerrainCells) {
+		delete[] m_TerrainCells;
+		m_TerrainCells = nullptr;
+	}
+
+	// Release the shared cell index pattern.
+	if (m_cellIndices) {
+		delete[] m_cellIndices;
+		m_cellIndices = nullptr;
+	}
+
+	m_cellIndexBuffer.Reset();
+
+	// Release the cell slots.
+	if (m_cellSlots) {
+		delete[] m_cellSlots;
+		m_cellSlots = nullptr;
+	}
+
+	if (m_slotCells) {
+		delete[] m_slotCells;
+		delete[] m_slotFrames;
+		delete[] m_slotPrevious;
+		delete[] m_slotNext;
+		m_slotCells = nullptr;
+		m_slotFrames = nullptr;
+		m_slotPrevious = nullptr;
+		m_slotNext = nullptr;
+	}
+
+	if (m_pageRequests) {
+		delete[] m_pageRequests;
+		m_pageRequests = nullptr;
+	}
+
+	m_slotCount = 0;
+
+	// Release the quadtree, the height pyramid, the surface and the visible cell list.
+	if (m_TerrainQuadTree) {
+		delete m_TerrainQuadTree;
+		m_TerrainQuadTree = nullptr;
+	}
+
+	if (m_TerrainPyramid) {
+		delete m_TerrainPyramid;
+		m_TerrainPyramid = nullptr;
+	}
+
+	if (m_TerrainSurface) {
+		delete m_TerrainSurface;
+		m_TerrainSurface = nullptr;
+	}
+
+	if (m_visibleCells) {
+		delete[] m_visibleCells;
+		m_visibleCells = nullptr;
+	}
+
+	if (m_visibleDepths) {
+		delete[] m_visibleDepths;
+		delete[] m_sortKeys;
+		delete[] m_sortScratchKeys;
+		delete[] m_sortScratchCells;
+		m_visibleDepths = nullptr;
+		m_sortKeys = nullptr;
+		m_sortScratchKeys = nullptr;
+		m_sortScratchCells = nullptr;
+	}
+
+	m_visibleCellCount = 0;
+
+	// Release the visible sets.
+	if (m_TerrainVisibility) {
+		delete m_TerrainVisibility;
+		m_TerrainVisibility = nullptr;
+	}
+
+	if (m_visibleSet) {
+		delete[] m_visibleSet;
+		m_visibleSet = nullptr;
+	}
+
+	m_visibleSetCell = -1;
+
+	if (m_visibilityFilename) {
+		delete[] m_visibilityFilename;
+		m_visibilityFilename = nullptr;
+	}
+
+	// Release the occlusion culler and its buffers.
+	if (m_TerrainOcclusion) {
+		delete m_TerrainOcclusion;
+		m_TerrainOcclusion = nullptr;
+	}
+
+	if (m_occluderVertices) {
+		delete[] m_occluderVertices;
+		m_occluderVertices = nullptr;
+	}
+
+	if (m_occlusionBounds) {
+		delete[] m_occlusionBounds;
+		m_occlusionBounds = nullptr;
+	}
+
+	// Release the level of detail selection.
+	if (m_TerrainLod) {
+		delete m_TerrainLod;
+		m_TerrainLod = nullptr;
+	}
+
+	if (m_cellLevels) {
+		delete[] m_cellLevels;
+		m_cellLevels = nullptr;
+	}
+}
+
+void Terrain::CullCells(const Frustum* frustum) {
+	// Walk the quadtree to collect the cells that are at least partly inside the frustum.
+	int visibleCount = m_TerrainQuadTree->Cull(frustum, m_visibleCells);
+
+	// Only the cells that are resident can be drawn.
+	m_visibleCellCount = 0;
+
+	for (int i = 0; i < visibleCount; i++) {
+		if (m_cellSlots[m_visibleCells[i]] >= 0) {
+			m_visibleCells[m_visibleCellCount++] = m_visibleCells[i];
+		}
+	}
+
+	// Every other cell was culled, whether on its own or as part of a rejected subtree.
+	m_cellsCulled = m_cellCount - m_visibleCellCount;
+}
+
+bool Terrain::CullViews(const Frustum* const* frustums, int viewCount, int* const* visibleCells, int* visibleCounts, unsigned int* cellMasks) {
+	// Walk the quadtree once for every view, such as the camera, the shadow cascades and the reflection.  Each list
+	// needs room for every cell and the optional masks get a bit for each view that can see the cell.  No more than
+	// TerrainQuadTree::MAX_VIEWS views can be culled together, more leave every list empty.
+	if (!m_TerrainQuadTree->CullViews(frustums, viewCount, visibleCells, visibleCounts, cellMasks)) {
+		return false;
+	}
+
+	// Only the cells that are resident can be drawn in any of the views.
+	for (int view = 0; view < viewCount; view++) {
+		int visibleCount = 0;
+
+		for (int i = 0; i < visibleCounts[view]; i++) {
+			int cellId = visibleCells[view][i];
+
+			if (m_cellSlots[cellId] >= 0) {
+				visibleCells[view][visibleCount++] = cellId;
+			}
+			else if (cellMasks) {
+				cellMasks[cellId] = 0;
+			}
+		}
+
+		visibleCounts[view] = visibleCount;
+	}
+
+	return true;
+}
+
+void Terrain::ApplyVisibleSets(const Vector3& cameraPosition) {
+	if (!m_TerrainVisibility) {
+		return;
+	}
+
+	// Find the cell the camera is over, rows run towards -Z from the back of the terrain.
+	float backZ = static_cast<float>(m_terrainHeight - 1);
+	int cellX = static_cast<int>(floorf(cameraPosition.x / static_cast<float>(m_cellWidth - 1)));
+	int cellY = static_cast<int>(floorf((backZ - cameraPosition.z) / static_cast<float>(m_cellHeight - 1)));
+
+	if ((cellX < 0) || (cellX >= m_cellCountX) || (cellY < 0) || (cellY >= m_cellCountY)) {
+		return;
+	}
+
+	// The set only covers eyes up to the view height above the top of the cell.
+	int cellId = (cellY * m_cellCountX) + cellX;
+	float bounds[TerrainCache::BOUNDS_SIZE];
+	m_TerrainQuadTree->GetCellBounds(cellId, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+
+	if (cameraPosition.y > bounds[1] + m_visibilityHeight) {
+		return;
+	}
+
+	if (cellId != m_visibleSetCell) {
+		m_TerrainVisibility->GetVisibleSet(cellId, m_visibleSet);
+		m_visibleSetCell = cellId;
+	}
+
+	// Keep the cells in the frustum that the set says can be seen.
+	int visibleCount = 0;
+
+	for (int i = 0; i < m_visibleCellCount; i++) {
+		if (TerrainVisibility::IsVisible(m_visibleSet, m_visibleCells[i])) {
+			m_visibleCells[visibleCount++] = m_visibleCells[i];
+		}
+	}
+
+	m_visibleCellCount = visibleCount;
+	m_cellsCulled = m_cellCount - m_visibleCellCount;
+}
+
+void Terrain::SortVisibleCells(const Matrix& viewMatrix) {
+	if (m_visibleCellCount == 0) {
+		return;
+	}
+
+	// Find the view space depth of the center of each visible box.
+	float nearest = FLT_MAX;
+	float farthest = -FLT_MAX;
+
+	for (int i = 0; i < m_visibleCellCount; i++) {
+		float bounds[TerrainCache::BOUNDS_SIZE];
+		m_TerrainQuadTree->GetCellBounds(m_visibleCells[i], bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+
+		float centerX = (bounds[0] + bounds[3]) * 0.5f;
+		float centerY = (bounds[1] + bounds[4]) * 0.5f;
+		float centerZ = (bounds[2] + bounds[5]) * 0.5f;
+
+		m_visibleDepths[i] = (centerX * viewMatrix._13) + (centerY * viewMatrix._23) + (centerZ * viewMatrix._33) + viewMatrix._43;
+		nearest = std::min(nearest, m_visibleDepths[i]);
+		farthest = std::max(farthest, m_visibleDepths[i]);
+	}
+
+	// Spread the depths over 16 bit keys, which is far finer than the cells are apart.
+	float scale = (farthest > nearest) ? 65535.0f / (farthest - nearest) : 0.0f;
+
+	for (int i = 0; i < m_visibleCellCount; i++) {
+		m_sortKeys[i] = static_cast<unsigned short>((m_visibleDepths[i] - nearest) * scale);
+	}
+
+	// Sort the cells by their keys a byte at a time, lowest byte first.  Each pass is stable so the second one keeps
+	// the order of the first within each bucket, and after both passes the cells are back in the visible list.
+	unsigned short* keys = m_sortKeys;
+	unsigned short* sortedKeys = m_sortScratchKeys;
+	int* cells = m_visibleCells;
+	int* sortedCells = m_sortScratchCells;
+
+	for (int shift = 0; shift < 16; shift += 8) {
+		int starts[256] = {};
+
+		for (int i = 0; i < m_visibleCellCount; i++) {
+			starts[(keys[i] >> shift) & 0xFF]++;
+		}
+
+		int total = 0;
+
+		for (int bucket = 0; bucket < 256; bucket++) {
+			int count = starts[bucket];
+			starts[bucket] = total;
+			total += count;
+		}
+
+		for (int i = 0; i < m_visibleCellCount; i++) {
+			int index = starts[(keys[i] >> shift) & 0xFF]++;
+
+			sortedKeys[index] = keys[i];
+			sortedCells[index] = cells[i];
+		}
+
+		std::swap(keys, sortedKeys);
+		std::swap(cells, sortedCells);
+	}
+}
+
+void Terrain::OccludeCells(const Matrix& viewProjection) {
+	// The visible list is front to back so the first cells are the nearest, and they are the occluders.
+	int occluderCount = std::min(m_visibleCellCount, static_cast<int>(MAX_OCCLUDERS));
+
+	int vertexCount = m_TerrainOcclusion->GetOccluderVertexCount();
+	concurrency::parallel_for(0, occluderCount, [&](int k) {
+		LoadOccluder(m_visibleCells[k], m_occluderVertices + (k * vertexCount * 3));
+	});
+
+	// Every visible cell is a candidate, including the occluders since nearer ones can hide them.
+	for (int k = 0; k < m_visibleCellCount; k++) {
+		float* bounds = m_occlusionBounds + (k * TerrainCache::BOUNDS_SIZE);
+
+		m_TerrainQuadTree->GetCellBounds(m_visibleCells[k], bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+	}
+
+	m_visibleCellCount = m_TerrainOcclusion->Cull(viewProjection, m_occluderVertices, occluderCount, m_occlusionBounds, m_visibleCells, m_visibleCellCount);
+	m_cellsCulled = m_cellCount - m_visibleCellCount;
+}
+
+void Terrain::RenderCell(ID3D11DeviceContext* deviceContext, int cellId) {
+	// Render the cell with the index pattern of its level of detail.
+	m_TerrainCells[m_cellSlots[cellId]].Render(deviceContext, TerrainMesh::GetIndexStart(m_cellWidth, m_cellHeight, m_cellLevels[cellId]));
+
+	// Add the polygons in the cell to the render count.
+	m_renderCount += (GetCellIndexCount(cellId) / 3);
+
+	// Increment the number of cells that were actually drawn.
+	m_cellsDrawn++;
+}
+
+void Terrain::RenderCellLines(ID3D11DeviceContext* deviceContext, int cellId) const {
+	m_TerrainCells[m_cellSlots[cellId]].RenderLineBuffers(deviceContext);
+}
+
+int Terrain::GetCellIndexCount(int cellId) const {
+	return TerrainMesh::GetIndexCount(m_cellWidth, m_cellHeight, m_cellLevels[cellId]);
+}
+
+int Terrain::GetCellLinesIndexCount(int cellId) const {
+	return m_TerrainCells[m_cellSlots[cellId]].GetLineBuffersIndexCount();
+}
+
+int Terrain::GetCellLodLevel(int cellId) const {
+	return m_cellLevels[cellId];
+}
+
+const float* Terrain::GetCellLodErrors(int cellId) const {
+	// The error of every level of detail of the cell in world units, finest first.
+	return m_TerrainLod->GetCellErrors(cellId);
+}
+
+int Terrain::GetLodLevelCount() const {
+	return m_TerrainLod->GetLevelCount();
+}
+
+void Terrain::GetCellBounds(int cellId, float& maxWidth, float& maxHeight, float& maxDepth, float& minWidth, float& minHeight, float& minDepth) const {
+	m_TerrainQuadTree->GetCellBounds(cellId, maxWidth, maxHeight, maxDepth, minWidth, minHeight, minDepth);
+}
+
+TerrainLod::MorphType Terrain::GetCellMorph(int cellId) const {
+	return m_TerrainLod->GetMorph(cellId, m_cellLevels[cellId]);
+}
+
+const TerrainMesh::DecodeType& Terrain::GetCellDecode(int cellId) const {
+	return m_TerrainCells[m_cellSlots[cellId]].GetDecode();
+}
+
+bool Terrain::GetCellVertices(ID3D11DeviceContext* deviceContext, int cellId, TerrainMesh::VertexType* vertices) const {
+	// Read back the vertices of a resident cell exactly as they are drawn.
+	if (m_cellSlots[cellId] < 0) {
+		return false;
+	}
+
+	return m_TerrainCells[m_cellSlots[cellId]].ReadVertices(deviceContext, vertices);
+}
+
+const HeightField* Terrain::GetHeightField() const {
+	// Only an editable terrain keeps its height field once it has loaded.
+	return m_HeightField;
+}
+
+int Terrain::GetCellCount() const {
+	return m_cellCount;
+}
+
+int Terrain::GetSlotCount() const {
+	return m_slotCount;
+}
+
+int Terrain::GetCellSlot(int cellId) const {
+	// The slot the cell is resident in, or -1 if a paged terrain doesn't have it in memory.
+	return m_cellSlots[cellId];
+}
+
+int Terrain::GetSlotCell(int slot) const {
+	// Every cell has its own slot when the terrain isn't paged.
+	return m_slotCells ? m_slotCells[slot] : slot;
+}
+
+const char* Terrain::GetVisibilityFilename() const {
+	// Null for a terrain that doesn't use visible sets, editable and paged terrains never do.
+	return m_visibilityFilename;
+}
+
+bool Terrain::HasVisibleSets() const {
+	// Only sets baked for this terrain and its settings get mapped.
+	return m_TerrainVisibility != nullptr;
+}
+
+int Terrain::GetVisibleCellCount() const {
+	return m_visibleCellCount;
+}
+
+int Terrain::GetVisibleCell(int index) const {
+	return m_visibleCells[index];
+}
+
+int Terrain::GetRenderCount() const {
+	return m_renderCount;
+}
+
+int Terrain::GetCellsDrawn() const {
+	return m_cellsDrawn;
+}
+
+int Terrain::GetCellsCulled() const {
+	return m_cellsCulled;
+}
+
+int Terrain::GetCellsOccluded() const {
+	return m_TerrainOcclusion->GetCellsRejected();
+}
+
+float Terrain::GetOcclusionTime() const {
+	return m_TerrainOcclusion->GetCullTime();
+}
+
+bool Terrain::GetHeightAtPosition(float inputX, float inputZ, float& height) const {
+	int cellSizeX = m_cellWidth - 1;
+	int cellSizeY = m_cellHeight - 1;
+	int backZ = m_terrainHeight - 1;
+
+	// If the position isn't inside the grid then it is off the terrain.
+	if (!(inputX > 0.0f) || !(inputX < static_cast<float>(m_terrainWidth - 1)) || !(inputZ > 0.0f) || !(inputZ < static_cast<float>(backZ))) {
+		return false;
+	}
+
+	// Go straight to the cell from the grid, rows run towards -Z from the back of the terrain.  The whole parts of the
+	// column and row are exact so a point on the edge between two cells is found in neither, as it always was.
+	int column = static_cast<int>(inputX);
+	int row = backZ - static_cast<int>(ceilf(inputZ));
+	int nodeIndexX = std::min(column / cellSizeX, m_cellCountX - 1);
+	int nodeIndexY = std::min(row / cellSizeY, m_cellCountY - 1);
+	int slot = m_cellSlots[(nodeIndexY * m_cellCountX) + nodeIndexX];
+	if (slot < 0) {
+		return false;
+	}
+
+	const TerrainCell& cell = m_TerrainCells[slot];
+
+	// Check to see if the position is inside this cell.
+	float maxWidth;
+	float maxHeight;
+	float maxDepth;
+	float minWidth;
+	float minHeight;
+	float minDepth;
+	cell.GetCellDimensions(maxWidth, maxHeight, maxDepth, minWidth, minHeight, minDepth);
+
+	if (!((inputX < maxWidth) && (inputX > minWidth) && (inputZ < maxDepth) && (inputZ > minDepth))) {
+		return false;
+	}
+
+	// Check the quad the position is in along with the neighbours it is close enough to for the edge tolerance of
+	// CheckHeightOfTriangle to take it.  They go in the order of the index pattern so the height comes from the same
+	// triangle a walk through all of the triangles of the cell finds first.
+	int quadX = column - (nodeIndexX * cellSizeX);
+	int quadY = row - (nodeIndexY * cellSizeY);
+	int quadCountX = static_cast<int>(maxWidth - minWidth);
+	int quadCountY = static_cast<int>(maxDepth - minDepth);
+	float fractionX = inputX - floorf(inputX);
+	float fractionY = ceilf(inputZ) - inputZ;
+	const float margin = 0.01f;
+
+	for (int j = quadY - 1; j <= quadY + 1; j++) {
+		if ((j < 0) || (j >= quadCountY) || ((j < quadY) && (fractionY > margin)) || ((j > quadY) && (fractionY < 1.0f - margin))) {
+			continue;
+		}
+
+		for (int i = quadX - 1; i <= quadX + 1; i++) {
+			if ((i < 0) || (i >= quadCountX) || ((i < quadX) && (fractionX > margin)) || ((i > quadX) && (fractionX < 1.0f - margin))) {
+				continue;
+			}
+
+			if (CheckHeightOfQuad(slot, i, j, inputX, inputZ, height)) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+bool Terrain::GetHeightBounds(float minX, float minZ, float maxX, float maxZ, float& minHeight, float& maxHeight) const {
+	float backZ = static_cast<float>(m_terrainHeight - 1);
+
+	// The area has to overlap the terrain.
+	if ((maxX < 0.0f) || (minX > static_cast<float>(m_terrainWidth - 1)) || (maxZ < 0.0f) || (minZ > backZ)) {
+		return false;
+	}
+
+	// Find the quads the area touches, rows run towards -Z from the back of the terrain.  An area with no width still
+	// takes the quad it lies in.
+	int quadCountX = m_terrainWidth - 1;
+	int quadCountY = m_terrainHeight - 1;
+	int startColumn = std::min(static_cast<int>(std::max(floorf(minX), 0.0f)), quadCountX - 1);
+	int startRow = std::min(static_cast<int>(std::max(floorf(backZ - maxZ), 0.0f)), quadCountY - 1);
+	int endColumn = std::max(static_cast<int>(std::min(ceilf(maxX), static_cast<float>(quadCountX))), startColumn + 1);
+	int endRow = std::max(static_cast<int>(std::min(ceilf(backZ - minZ), static_cast<float>(quadCountY))), startRow + 1);
+
+	m_TerrainPyramid->GetBounds(startColumn, startRow, endColumn, endRow, minHeight, maxHeight);
+
+	return true;
+}
+
+bool Terrain::RayCast(const Vector3& origin, const Vector3& direction, float maxDistance, RayHitType& hit) const {
+	// Measure the distances along the ray in world units.
+	float length = sqrtf((direction.x * direction.x) + (direction.y * direction.y) + (direction.z * direction.z));
+	if (length <= 0.0f) {
+		return false;
+	}
+
+	return TraceRay(origin, Vector3(direction.x / length, direction.y / length, direction.z / length), maxDistance, hit);
+}
+
+void Terrain::CheckLineOfSight(const Vector3* starts, const Vector3* ends, int count, bool* visible) const {
+	// Split the segments into batches so each task traces a good number of them.
+	int batchCount = (count + LINE_OF_SIGHT_BATCH - 1) / LINE_OF_SIGHT_BATCH;
+
+	concurrency::parallel_for(0, batchCount, [&](int batch) {
+		int end = std::min((batch + 1) * LINE_OF_SIGHT_BATCH, count);
+
+		for (int k = batch * LINE_OF_SIGHT_BATCH; k < end; k++) {
+			visible[k] = CheckSegment(starts[k], ends[k]);
+		}
+	});
+}
+
+void Terrain::GetHeightsAtPositions(const float* positionX, const float* positionZ, int count, float* heights, bool* found) const {
+	// Unlike GetHeightAtPosition a position right on the edge of the terrain is found.
+	m_TerrainSurface->GetHeights(positionX, positionZ, count, heights, found);
+}
+
+void Terrain::GetNormalsAtPositions(const float* positionX, const float* positionZ, int count, float* normalX, float* normalY, float* normalZ, float* slopes, bool* found) const {
+	// The normals are blended from the vertex normals and the slope is the rise over the run of the triangle.
+	m_TerrainSurface->GetNormals(positionX, positionZ, count, normalX, normalY, normalZ, slopes, found);
+}
+
+bool Terrain::CheckHeightOfQuad(int slot, int i, int j, float inputX, float inputZ, float& height) const {
+	// Decode the corners of the quad and check its two triangles in the order the index pattern has them.
+	int index = (j * m_cellWidth) + i;
+	int corners[4] = { index, index + 1, index + m_cellWidth, index + m_cellWidth + 1 };
+	float vertices[4][3];
+
+	for (int k = 0; k < 4; k++) {
+		m_TerrainSurface->GetVertex(slot, corners[k], vertices[k]);
+	}
+
+	// Triangle 1 - Upper left, upper right, bottom left.
+	if (CheckHeightOfTriangle(inputX, inputZ, height, vertices[0], vertices[1], vertices[2])) {
+		return true;
+	}
+
+	// Triangle 2 - Bottom left, upper right, bottom right.
+	return CheckHeightOfTriangle(inputX, inputZ, height, vertices[2], vertices[1], vertices[3]);
+}
+
+bool Terrain::CheckHeightOfTriangle(float x, float z, float& height, float v0[3], float v1[3], float v2[3]) const {
 	// Starting position of the ray that is being cast.
 	float startVector[3];
 	startVector[0] = x;
@@ -842,121 +1753,561 @@ bool Terrain::CheckHeightOfTriangle(float x, float z, float& height, float v0[3]
 	directionVector[1] = -1.0f;
 	directionVector[2] = 0.0f;
 
-	// Calculate the two edges from the three points given.
-	float edge1[3];
-	edge1[0] = v1[0] - v0[0];
-	edge1[1] = v1[1] - v0[1];
-	edge1[2] = v1[2] - v0[2];
+	// Calculate the two edges from the three points given.
+	float edge1[3];
+	edge1[0] = v1[0] - v0[0];
+	edge1[1] = v1[1] - v0[1];
+	edge1[2] = v1[2] - v0[2];
+
+	float edge2[3];
+	edge2[0] = v2[0] - v0[0];
+	edge2[1] = v2[1] - v0[1];
+	edge2[2] = v2[2] - v0[2];
+
+	// Calculate the normal of the triangle from the two edges.
+	float normal[3];
+	normal[0] = (edge1[1] * edge2[2]) - (edge1[2] * edge2[1]);
+	normal[1] = (edge1[2] * edge2[0]) - (edge1[0] * edge2[2]);
+	normal[2] = (edge1[0] * edge2[1]) - (edge1[1] * edge2[0]);
+
+	float magnitude = static_cast<float>(sqrt((normal[0] * normal[0]) + (normal[1] * normal[1]) + (normal[2] * normal[2])));
+	normal[0] = normal[0] / magnitude;
+	normal[1] = normal[1] / magnitude;
+	normal[2] = normal[2] / magnitude;
+
+	// Find the distance from the origin to the plane.
+	float D = ((-normal[0] * v0[0]) + (-normal[1] * v0[1]) + (-normal[2] * v0[2]));
+
+	// Get the denominator of the equation.
+	float denominator = ((normal[0] * directionVector[0]) + (normal[1] * directionVector[1]) + (normal[2] * directionVector[2]));
+
+	// Make sure the result doesn't get too close to zero to prevent divide by zero.
+	if (fabs(denominator) < 0.0001f) {
+		return false;
+	}
+
+	// Get the numerator of the equation.
+	float numerator = -1.0f * (((normal[0] * startVector[0]) + (normal[1] * startVector[1]) + (normal[2] * startVector[2])) + D);
+
+	// Calculate where we intersect the triangle.
+	float t = numerator / denominator;
+
+	// Find the intersection vector.
+	float Q[3];
+	Q[0] = startVector[0] + (directionVector[0] * t);
+	Q[1] = startVector[1] + (directionVector[1] * t);
+	Q[2] = startVector[2] + (directionVector[2] * t);
+
+	float e1[3];
+	// Find the three edges of the triangle.
+	e1[0] = v1[0] - v0[0];
+	e1[1] = v1[1] - v0[1];
+	e1[2] = v1[2] - v0[2];
+
+	float e2[3];
+	e2[0] = v2[0] - v1[0];
+	e2[1] = v2[1] - v1[1];
+	e2[2] = v2[2] - v1[2];
+
+	float e3[3];
+	e3[0] = v0[0] - v2[0];
+	e3[1] = v0[1] - v2[1];
+	e3[2] = v0[2] - v2[2];
+
+	// Calculate the normal for the first edge.
+	float edgeNormal[3];
+	edgeNormal[0] = (e1[1] * normal[2]) - (e1[2] * normal[1]);
+	edgeNormal[1] = (e1[2] * normal[0]) - (e1[0] * normal[2]);
+	edgeNormal[2] = (e1[0] * normal[1]) - (e1[1] * normal[0]);
+
+	// Calculate the determinant to see if it is on the inside, outside, or directly on the edge.
+	float temp[3];
+	temp[0] = Q[0] - v0[0];
+	temp[1] = Q[1] - v0[1];
+	temp[2] = Q[2] - v0[2];
+
+	float determinant = ((edgeNormal[0] * temp[0]) + (edgeNormal[1] * temp[1]) + (edgeNormal[2] * temp[2]));
+
+	// Check if it is outside.
+	if (determinant > 0.001f) {
+		return false;
+	}
+
+	// Calculate the normal for the second edge.
+	edgeNormal[0] = (e2[1] * normal[2]) - (e2[2] * normal[1]);
+	edgeNormal[1] = (e2[2] * normal[0]) - (e2[0] * normal[2]);
+	edgeNormal[2] = (e2[0] * normal[1]) - (e2[1] * normal[0]);
+
+	// Calculate the determinant to see if it is on the inside, outside, or directly on the edge.
+	temp[0] = Q[0] - v1[0];
+	temp[1] = Q[1] - v1[1];
+	temp[2] = Q[2] - v1[2];
+
+	determinant = ((edgeNormal[0] * temp[0]) + (edgeNormal[1] * temp[1]) + (edgeNormal[2] * temp[2]));
+
+	// Check if it is outside.
+	if (determinant > 0.001f) {
+		return false;
+	}
+
+	// Calculate the normal for the third edge.
+	edgeNormal[0] = (e3[1] * normal[2]) - (e3[2] * normal[1]);
+	edgeNormal[1] = (e3[2] * normal[0]) - (e3[0] * normal[2]);
+	edgeNormal[2] = (e3[0] * normal[1]) - (e3[1] * normal[0]);
+
+	// Calculate the determinant to see if it is on the inside, outside, or directly on the edge.
+	temp[0] = Q[0] - v2[0];
+	temp[1] = Q[1] - v2[1];
+	temp[2] = Q[2] - v2[2];
+
+	determinant = ((edgeNormal[0] * temp[0]) + (edgeNormal[1] * temp[1]) + (edgeNormal[2] * temp[2]));
+
+	// Check if it is outside.
+	if (determinant > 0.001f) {
+		return false;
+	}
+
+	height = Q[1];
+
+	return true;
+}
+
+bool Terrain::RaiseTerrain(ID3D11DeviceContext* deviceContext, float positionX, float positionZ, float radius, float amount) {
+	int startColumn;
+	int startRow;
+	int endColumn;
+	int endRow;
+	if (!GetBrushBlock(positionX, positionZ, radius, startColumn, startRow, endColumn, endRow)) {
+		return false;
+	}
+
+	// Move each sample by the amount at the middle of the brush, fading out towards its edge.
+	for (int j = startRow; j < endRow; j++) {
+		float* heights = m_HeightField->GetHeightRow(j);
+
+		for (int i = startColumn; i < endColumn; i++) {
+			heights[i] += amount * GetBrushWeight(i, j, positionX, positionZ, radius);
+		}
+	}
+
+	UpdateTerrainBlock(deviceContext, startColumn, startRow, endColumn, endRow);
+
+	return true;
+}
+
+bool Terrain::LowerTerrain(ID3D11DeviceContext* deviceContext, float positionX, float positionZ, float radius, float amount) {
+	return RaiseTerrain(deviceContext, positionX, positionZ, radius, -amount);
+}
+
+bool Terrain::FlattenTerrain(ID3D11DeviceContext* deviceContext, float positionX, float positionZ, float radius, float height, float strength) {
+	int startColumn;
+	int startRow;
+	int endColumn;
+	int endRow;
+	if (!GetBrushBlock(positionX, positionZ, radius, startColumn, startRow, endColumn, endRow)) {
+		return false;
+	}
+
+	// Pull each sample towards the height, a strength of one puts the middle of the brush right on it.
+	for (int j = startRow; j < endRow; j++) {
+		float* heights = m_HeightField->GetHeightRow(j);
+
+		for (int i = startColumn; i < endColumn; i++) {
+			float weight = std::min(strength * GetBrushWeight(i, j, positionX, positionZ, radius), 1.0f);
+
+			heights[i] += (height - heights[i]) * weight;
+		}
+	}
+
+	UpdateTerrainBlock(deviceContext, startColumn, startRow, endColumn, endRow);
+
+	return true;
+}
+
+bool Terrain::SmoothTerrain(ID3D11DeviceContext* deviceContext, float positionX, float positionZ, float radius, float strength) {
+	int startColumn;
+	int startRow;
+	int endColumn;
+	int endRow;
+	if (!GetBrushBlock(positionX, positionZ, radius, startColumn, startRow, endColumn, endRow)) {
+		return false;
+	}
+
+	// Copy the block and the ring of samples around it so the samples that have already been smoothed don't feed
+	// into their neighbours.
+	int copyStartColumn = std::max(startColumn - 1, 0);
+	int copyStartRow = std::max(startRow - 1, 0);
+	int copyEndColumn = std::min(endColumn + 1, m_terrainWidth);
+	int copyEndRow = std::min(endRow + 1, m_terrainHeight);
+	int copyWidth = copyEndColumn - copyStartColumn;
+	float* original = new float[copyWidth * (copyEndRow - copyStartRow)];
+
+	for (int j = copyStartRow; j < copyEndRow; j++) {
+		memcpy(original + ((j - copyStartRow) * copyWidth), m_HeightField->GetHeightRow(j) + copyStartColumn, sizeof(float) * copyWidth);
+	}
+
+	// Pull each sample towards the average of itself and its neighbours on the terrain.
+	for (int j = startRow; j < endRow; j++) {
+		float* heights = m_HeightField->GetHeightRow(j);
+
+		for (int i = startColumn; i < endColumn; i++) {
+			float sum = 0.0f;
+			int count = 0;
+
+			for (int y = std::max(j - 1, copyStartRow); y < std::min(j + 2, copyEndRow); y++) {
+				for (int x = std::max(i - 1, copyStartColumn); x < std::min(i + 2, copyEndColumn); x++) {
+					sum += original[((y - copyStartRow) * copyWidth) + (x - copyStartColumn)];
+					count++;
+				}
+			}
+
+			float weight = std::min(strength * GetBrushWeight(i, j, positionX, positionZ, radius), 1.0f);
+
+			heights[i] += ((sum / static_cast<float>(count)) - heights[i]) * weight;
+		}
+	}
+
+	delete[] original;
+
+	UpdateTerrainBlock(deviceContext, startColumn, startRow, endColumn, endRow);
+
+	return true;
+}
+
+bool Terrain::CalculateContentHash() {
+	MappedFile heightMapFile;
+	if (!heightMapFile.Open(m_terrainFilename)) {
+		return false;
+	}
+
+	MappedFile colorMapFile;
+	if (!colorMapFile.Open(m_colorMapFilename)) {
+		return false;
+	}
+
+	// Hash the setup values the cells are built from followed by the contents of both source files.
+	float setup[5] = { static_cast<float>(m_terrainWidth), static_cast<float>(m_terrainHeight), m_heightScale, static_cast<float>(m_cellWidth), static_cast<float>(m_cellHeight) };
+
+	m_contentHash = TerrainCache::Hash(setup, sizeof(setup), 0);
+	m_contentHash = TerrainCache::Hash(heightMapFile.GetData(), heightMapFile.GetSize(), m_contentHash);
+	m_contentHash = TerrainCache::Hash(colorMapFile.GetData(), colorMapFile.GetSize(), m_contentHash);
+
+	return true;
+}
+
+bool Terrain::SaveTerrainCache() const {
+	TerrainCache cache;
+
+	TerrainCache::HeaderType header = TerrainCache::MakeHeader(m_contentHash, m_terrainWidth, m_terrainHeight, m_cellWidth, m_cellHeight, m_cellCountX, m_cellCountY);
+
+	if (!cache.Create(m_cacheFilename, header)) {
+		return false;
+	}
+
+	// Write the bounds of every cell.
+	float* bounds = new float[m_cellCount * TerrainCache::BOUNDS_SIZE];
+
+	for (int i = 0; i < m_cellCount; i++) {
+		float* cellBounds = bounds + (i * TerrainCache::BOUNDS_SIZE);
+		m_TerrainCells[i].GetCellDimensions(cellBounds[0], cellBounds[1], cellBounds[2], cellBounds[3], cellBounds[4], cellBounds[5]);
+	}
+
+	bool result = cache.WriteCellBounds(bounds, m_cellCount);
+
+	delete[] bounds;
+
+	if (!result) {
+		return false;
+	}
+
+	// Then the level of detail errors of every cell, which are stored in the same order.
+	if (!cache.WriteCellErrors(m_TerrainLod->GetCellErrors(0), m_cellCount)) {
+		return false;
+	}
+
+	// The cells don't keep their vertices so build them again a row of cells at a time and write each row out.
+	int vertexCount = TerrainMesh::GetVertexCount(m_cellWidth, m_cellHeight);
+	TerrainMesh::VertexType* vertices = new TerrainMesh::VertexType[m_cellCountX * vertexCount];
+
+	for (int j = 0; (j < m_cellCountY) && result; j++) {
+		concurrency::parallel_for(0, m_cellCountX, [&](int i) {
+			const TerrainMesh::DecodeType& decode = m_TerrainCells[(j * m_cellCountX) + i].GetDecode();
+			TerrainMesh::BuildVertices(vertices + (i * vertexCount), decode, m_HeightField, i, j, m_cellWidth, m_cellHeight);
+		});
+
+		result = cache.WriteCellVertices(vertices, m_cellCountX);
+	}
+
+	delete[] vertices;
+
+	if (!result) {
+		return false;
+	}
+
+	return cache.Finish();
+}
+
+bool Terrain::LoadTerrainVisibility() {
+	// Only a static terrain can use the visible sets, an edit can open up a view they say is hidden.
+	if (!m_visibilityFilename) {
+		return true;
+	}
+
+	if (m_editable) {
+		delete[] m_visibilityFilename;
+		m_visibilityFilename = nullptr;
+		return true;
+	}
+
+	// Map the sets baked for this terrain.  Baking traces every pair of cells so it is left to the bake tool, which runs
+	// BakeVisibleSets after each build, and sets that are missing or were baked for another terrain only cost this
+	// start the cells they would have culled.  The file name is kept so the sets can still be baked.
+	TerrainVisibility::HeaderType header = TerrainVisibility::MakeHeader(m_contentHash, m_cellCountX, m_cellCountY, m_visibilityHeight, VISIBILITY_DEPTH);
+
+	m_TerrainVisibility = new TerrainVisibility;
+	if (!m_TerrainVisibility->Open(m_visibilityFilename, header)) {
+		delete m_TerrainVisibility;
+		m_TerrainVisibility = nullptr;
+		return true;
+	}
+
+	// The set of the cell under the camera is unpacked whenever the camera moves to another cell.
+	m_visibleSet = new unsigned int[TerrainVisibility::GetWordCount(m_cellCount)];
+	m_visibleSetCell = -1;
+
+	return true;
+}
+
+bool Terrain::BakeVisibleSets() {
+	// Only a static terrain with a visible set file in its setup has sets to bake.
+	if (!m_visibilityFilename) {
+		return false;
+	}
+
+	// Let go of any sets already mapped so the file can be written over.
+	if (m_TerrainVisibility) {
+		delete m_TerrainVisibility;
+		m_TerrainVisibility = nullptr;
+	}
+
+	if (m_visibleSet) {
+		delete[] m_visibleSet;
+		m_visibleSet = nullptr;
+	}
+
+	m_visibleSetCell = -1;
+
+	TerrainVisibility::HeaderType header = TerrainVisibility::MakeHeader(m_contentHash, m_cellCountX, m_cellCountY, m_visibilityHeight, VISIBILITY_DEPTH);
+	if (!SaveTerrainVisibility(header)) {
+		return false;
+	}
+
+	// Map what was written so the sets are used from here on.
+	if (!LoadTerrainVisibility()) {
+		return false;
+	}
+
+	return m_TerrainVisibility != nullptr;
+}
+
+bool Terrain::SaveTerrainVisibility(const TerrainVisibility::HeaderType& header) const {
+	unsigned char** sets = new unsigned char*[m_cellCount];
+	unsigned int* setSizes = new unsigned int[m_cellCount];
+	int wordCount = TerrainVisibility::GetWordCount(m_cellCount);
+	float cellSizeX = static_cast<float>(m_cellWidth - 1);
+	float cellSizeZ = static_cast<float>(m_cellHeight - 1);
+	float backZ = static_cast<float>(m_terrainHeight - 1);
+
+	// A cell is only left out of a set once the ground is proven to hide it from every eye that uses the set.  The eyes
+	// cover the ground ApplyVisibleSets picks the cell for, up to the view height above the top of its box, and the
+	// targets are anywhere on the surface of the other cell, so no higher than the top of its box.  The cells around a
+	// cell are always in its set.
+	concurrency::parallel_for(0, m_cellCount, [&](int viewerCell) {
+		unsigned int* bits = new unsigned int[wordCount];
+		unsigned char* encoded = new unsigned char[TerrainVisibility::GetMaxEncodedSize(m_cellCount)];
+		float bounds[TerrainCache::BOUNDS_SIZE];
+
+		memset(bits, 0, wordCount * sizeof(unsigned int));
+
+		int viewerX = viewerCell % m_cellCountX;
+		int viewerY = viewerCell / m_cellCountX;
+		m_TerrainQuadTree->GetCellBounds(viewerCell, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+
+		RegionType eye;
+		eye.minX = static_cast<float>(viewerX) * cellSizeX;
+		eye.maxX = eye.minX + cellSizeX;
+		eye.maxZ = backZ - (static_cast<float>(viewerY) * cellSizeZ);
+		eye.minZ = eye.maxZ - cellSizeZ;
+		eye.height = bounds[1] + m_visibilityHeight;
+
+		for (int targetCell = 0; targetCell < m_cellCount; targetCell++) {
+			bool visible = (abs((targetCell % m_cellCountX) - viewerX) <= 1) && (abs((targetCell / m_cellCountX) - viewerY) <= 1);
+
+			if (!visible) {
+				m_TerrainQuadTree->GetCellBounds(targetCell, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+
+				RegionType target;
+				target.minX = bounds[3];
+				target.minZ = bounds[5];
+				target.maxX = bounds[0];
+				target.maxZ = bounds[2];
+				target.height = bounds[1];
+
+				visible = !CheckRegionHidden(eye, target, VISIBILITY_DEPTH);
+			}
+
+			if (visible) {
+				bits[targetCell >> 5] |= 1u << (targetCell & 31);
+			}
+		}
+
+		setSizes[viewerCell] = TerrainVisibility::EncodeSet(bits, m_cellCount, encoded);
+		sets[viewerCell] = new unsigned char[setSizes[viewerCell]];
+		memcpy(sets[viewerCell], encoded, setSizes[viewerCell]);
 
-	float edge2[3];
-	edge2[0] = v2[0] - v0[0];
-	edge2[1] = v2[1] - v0[1];
-	edge2[2] = v2[2] - v0[2];
+		delete[] bits;
+		delete[] encoded;
+	});
 
-	// Calculate the normal of the triangle from the two edges.
-	float normal[3];
-	normal[0] = (edge1[1] * edge2[2]) - (edge1[2] * edge2[1]);
-	normal[1] = (edge1[2] * edge2[0]) - (edge1[0] * edge2[2]);
-	normal[2] = (edge1[0] * edge2[1]) - (edge1[1] * edge2[0]);
+	bool result = TerrainVisibility::Save(m_visibilityFilename, header, sets, setSizes);
 
-	float magnitude = static_cast<float>(sqrt((normal[0] * normal[0]) + (normal[1] * normal[1]) + (normal[2] * normal[2])));
-	normal[0] = normal[0] / magnitude;
-	normal[1] = normal[1] / magnitude;
-	normal[2] = normal[2] / magnitude;
+	for (int i = 0; i < m_cellCount; i++) {
+		delete[] sets[i];
+	}
 
-	// Find the distance from the origin to the plane.
-	float D = ((-normal[0] * v0[0]) + (-normal[1] * v0[1]) + (-normal[2] * v0[2]));
+	delete[] sets;
+	delete[] setSizes;
 
-	// Get the denominator of the equation.
-	float denominator = ((normal[0] * directionVector[0]) + (normal[1] * directionVector[1]) + (normal[2] * directionVector[2]));
+	return result;
+}
 
-	// Make sure the result doesn't get too close to zero to prevent divide by zero.
-	if (fabs(denominator) < 0.0001f) {
+bool Terrain::CheckRegionHidden(const RegionType& eye, const RegionType& target, int depth) const {
+	float eyeX = (eye.minX + eye.maxX) * 0.5f;
+	float eyeZ = (eye.minZ + eye.maxZ) * 0.5f;
+	float targetX = (target.minX + target.maxX) * 0.5f;
+	float targetZ = (target.minZ + target.maxZ) * 0.5f;
+
+	// A pair the segment between the middles of the two regions clears is almost always in plain view, leave it
+	// visible without tracing the rest.
+	if (CheckSegment(Vector3(eyeX, eye.height, eyeZ), Vector3(targetX, target.height, targetZ))) {
 		return false;
 	}
 
-	// Get the numerator of the equation.
-	float numerator = -1.0f * (((normal[0] * startVector[0]) + (normal[1] * startVector[1]) + (normal[2] * startVector[2])) + D);
+	// A segment from an eye to a target is at the point t of the way along it inside the rectangle the same part of
+	// the way from the eye region to the target region, and no higher than the same part of the way from the eye height
+	// to the target height.  If the lowest ground under any such rectangle is above that height every segment passes
+	// under the ground there.  Step through the rectangles about half of their size apart, a rectangle that leaves the
+	// terrain has no ground to prove anything with.  The ground has to clear the segments by a margin.
+	const float margin = 0.01f;
+	float lastX = static_cast<float>(m_terrainWidth - 1);
+	float backZ = static_cast<float>(m_terrainHeight - 1);
+	float distance = sqrtf(((targetX - eyeX) * (targetX - eyeX)) + ((targetZ - eyeZ) * (targetZ - eyeZ)));
+	float size = std::min(std::min(eye.maxX - eye.minX, eye.maxZ - eye.minZ), std::min(target.maxX - target.minX, target.maxZ - target.minZ));
+	int stepCount = std::max(2, static_cast<int>(ceilf((2.0f * distance) / std::max(size, 1.0f))));
+
+	for (int step = 1; step < stepCount; step++) {
+		float t = static_cast<float>(step) / static_cast<float>(stepCount);
+		float minX = eye.minX + ((target.minX - eye.minX) * t);
+		float minZ = eye.minZ + ((target.minZ - eye.minZ) * t);
+		float maxX = eye.maxX + ((target.maxX - eye.maxX) * t);
+		float maxZ = eye.maxZ + ((target.maxZ - eye.maxZ) * t);
+
+		if ((minX < 0.0f) || (maxX > lastX) || (minZ < 0.0f) || (maxZ > backZ)) {
+			continue;
+		}
 
-	// Calculate where we intersect the triangle.
-	float t = numerator / denominator;
+		float minHeight;
+		float maxHeight;
+		GetHeightBounds(minX, minZ, maxX, maxZ, minHeight, maxHeight);
 
-	// Find the intersection vector.
-	float Q[3];
-	Q[0] = startVector[0] + (directionVector[0] * t);
-	Q[1] = startVector[1] + (directionVector[1] * t);
-	Q[2] = startVector[2] + (directionVector[2] * t);
+		if (minHeight > eye.height + ((target.height - eye.height) * t) + margin) {
+			return true;
+		}
+	}
 
-	float e1[3];
-	// Find the three edges of the triangle.
-	e1[0] = v1[0] - v0[0];
-	e1[1] = v1[1] - v0[1];
-	e1[2] = v1[2] - v0[2];
+	if (depth == 0) {
+		return false;
+	}
 
-	float e2[3];
-	e2[0] = v2[0] - v1[0];
-	e2[1] = v2[1] - v1[1];
-	e2[2] = v2[2] - v1[2];
+	// Split both regions into quarters, each quarter of the target only as high as the ground under it.  The pair is
+	// hidden when every quarter of the eye region is hidden from every quarter of the target region.
+	RegionType eyes[4];
+	RegionType targets[4];
 
-	float e3[3];
-	e3[0] = v0[0] - v2[0];
-	e3[1] = v0[1] - v2[1];
-	e3[2] = v0[2] - v2[2];
+	for (int i = 0; i < 4; i++) {
+		eyes[i].minX = (i & 1) ? eyeX : eye.minX;
+		eyes[i].maxX = (i & 1) ? eye.maxX : eyeX;
+		eyes[i].minZ = (i & 2) ? eyeZ : eye.minZ;
+		eyes[i].maxZ = (i & 2) ? eye.maxZ : eyeZ;
+		eyes[i].height = eye.height;
 
-	// Calculate the normal for the first edge.
-	float edgeNormal[3];
-	edgeNormal[0] = (e1[1] * normal[2]) - (e1[2] * normal[1]);
-	edgeNormal[1] = (e1[2] * normal[0]) - (e1[0] * normal[2]);
-	edgeNormal[2] = (e1[0] * normal[1]) - (e1[1] * normal[0]);
+		targets[i].minX = (i & 1) ? targetX : target.minX;
+		targets[i].maxX = (i & 1) ? target.maxX : targetX;
+		targets[i].minZ = (i & 2) ? targetZ : target.minZ;
+		targets[i].maxZ = (i & 2) ? target.maxZ : targetZ;
 
-	// Calculate the determinant to see if it is on the inside, outside, or directly on the edge.
-	float temp[3];
-	temp[0] = Q[0] - v0[0];
-	temp[1] = Q[1] - v0[1];
-	temp[2] = Q[2] - v0[2];
+		float minHeight;
+		GetHeightBounds(targets[i].minX, targets[i].minZ, targets[i].maxX, targets[i].maxZ, minHeight, targets[i].height);
+		targets[i].height = std::min(targets[i].height, target.height);
+	}
 
-	float determinant = ((edgeNormal[0] * temp[0]) + (edgeNormal[1] * temp[1]) + (edgeNormal[2] * temp[2]));
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			if (!CheckRegionHidden(eyes[i], targets[j], depth - 1)) {
+				return false;
+			}
+		}
+	}
 
-	// Check if it is outside.
-	if (determinant > 0.001f) {
+	return true;
+}
+
+bool Terrain::MapHeightMap() {
+	// Map the 16 bit raw height map file instead of reading it in.
+	m_HeightMapFile = new MappedFile;
+	if (!m_HeightMapFile->Open(m_terrainFilename)) {
 		return false;
 	}
 
-	// Calculate the normal for the second edge.
-	edgeNormal[0] = (e2[1] * normal[2]) - (e2[2] * normal[1]);
-	edgeNormal[1] = (e2[2] * normal[0]) - (e2[0] * normal[2]);
-	edgeNormal[2] = (e2[0] * normal[1]) - (e2[1] * normal[0]);
-
-	// Calculate the determinant to see if it is on the inside, outside, or directly on the edge.
-	temp[0] = Q[0] - v1[0];
-	temp[1] = Q[1] - v1[1];
-	temp[2] = Q[2] - v1[2];
+	// Make sure the file holds the whole terrain.
+	unsigned long long imageSize = static_cast<unsigned long long>(m_terrainHeight) * m_terrainWidth * sizeof(unsigned short);
+	if (m_HeightMapFile->GetSize() < imageSize) {
+		return false;
+	}
 
-	determinant = ((edgeNormal[0] * temp[0]) + (edgeNormal[1] * temp[1]) + (edgeNormal[2] * temp[2]));
+	return true;
+}
 
-	// Check if it is outside.
-	if (determinant > 0.001f) {
+bool Terrain::MapColorMap() {
+	// Map the color map file.
+	m_ColorMapFile = new MappedFile;
+	if (!m_ColorMapFile->Open(m_colorMapFilename)) {
 		return false;
 	}
 
-	// Calculate the normal for the third edge.
-	edgeNormal[0] = (e3[1] * normal[2]) - (e3[2] * normal[1]);
-	edgeNormal[1] = (e3[2] * normal[0]) - (e3[0] * normal[2]);
-	edgeNormal[2] = (e3[0] * normal[1]) - (e3[1] * normal[0]);
+	if (m_ColorMapFile->GetSize() < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER)) {
+		return false;
+	}
 
-	// Calculate the determinant to see if it is on the inside, outside, or directly on the edge.
-	temp[0] = Q[0] - v2[0];
-	temp[1] = Q[1] - v2[1];
-	temp[2] = Q[2] - v2[2];
+	// Read the file header and the bitmap info header out of the mapping.
+	BITMAPFILEHEADER bitmapFileHeader = {};
+	memcpy(&bitmapFileHeader, m_ColorMapFile->GetData(), sizeof(BITMAPFILEHEADER));
 
-	determinant = ((edgeNormal[0] * temp[0]) + (edgeNormal[1] * temp[1]) + (edgeNormal[2] * temp[2]));
+	BITMAPINFOHEADER bitmapInfoHeader = {};
+	memcpy(&bitmapInfoHeader, m_ColorMapFile->GetData() + sizeof(BITMAPFILEHEADER), sizeof(BITMAPINFOHEADER));
 
-	// Check if it is outside.
-	if (determinant > 0.001f) {
+	// Make sure the color map dimensions are the same as the terrain dimensions for easy 1 to 1 mapping.
+	if ((bitmapInfoHeader.biWidth != m_terrainWidth) || (bitmapInfoHeader.biHeight != m_terrainHeight)) {
 		return false;
 	}
 
-	height = Q[1];
+	// Each line is padded out to a multiple of 4 bytes, make sure all of them are in the file.
+	m_colorMapOffset = bitmapFileHeader.bfOffBits;
+	m_colorMapPitch = (((m_terrainWidth * 3) + 3) / 4) * 4;
+
+	if (m_ColorMapFile->GetSize() < m_colorMapOffset + (static_cast<unsigned long long>(m_colorMapPitch) * m_terrainHeight)) {
+		return false;
+	}
 
 	return true;
 }
@@ -964,7 +2315,12 @@ bool Terrain::CheckHeightOfTriangle(float x, float z, float& height, float v0[3]
 bool Terrain::LoadRawHeightMap() {
 	FILE* filePtr;
 
-	m_heightMap = new  HeightMapType[m_terrainHeight * m_terrainWidth];
+	// Create the height field that will hold the terrain samples, padded out to the whole cells.
+	m_HeightField = new HeightField;
+	if (!m_HeightField->Initialize((m_cellCountX * (m_cellWidth - 1)) + 1, (m_cellCountY * (m_cellHeight - 1)) + 1, m_terrainWidth, m_terrainHeight)) {
+		return false;
+	}
+
 	// Open the 16 bit raw height map file for reading in binary.	
 	int error = fopen_s(&filePtr, m_terrainFilename, "rb");
 	if (error != 0) {
@@ -989,18 +2345,398 @@ bool Terrain::LoadRawHeightMap() {
 		return false;
 	}
 
-	int index;
-	// Copy the image data into the height map array.
-	for (int j = 0; j < m_terrainHeight; j++) {
-		for (int i = 0; i < m_terrainWidth; i++) {
-			index = (m_terrainWidth * j) + i;
+	// Copy the image data into the height field.
+	concurrency::parallel_for(0, GetBuildTileCount(m_terrainHeight), [&](int tile) {
+		int startRow = tile * BUILD_TILE_ROWS;
+		int endRow = std::min(startRow + BUILD_TILE_ROWS, m_terrainHeight);
+
+		for (int j = startRow; j < endRow; j++) {
+			float* heights = m_HeightField->GetHeightRow(j);
 
-			// Store the height at this point in the height map array.
-			m_heightMap[index].y = static_cast<float>(rawImage[index]);
+			for (int i = 0; i < m_terrainWidth; i++) {
+				// Store the scaled height at this point in the height field.
+				heights[i] = static_cast<float>(rawImage[(m_terrainWidth * j) + i]) / m_heightScale;
+			}
 		}
-	}
+	});
 
 	delete[] rawImage;
 
+	// Fill the samples past the edges of the terrain.
+	m_HeightField->ExtendHeights();
+
+	return true;
+}
+
+int Terrain::GetBuildTileCount(int rowCount) const {
+	return (rowCount + BUILD_TILE_ROWS - 1) / BUILD_TILE_ROWS;
+}
+
+bool Terrain::GetBrushBlock(float positionX, float positionZ, float radius, int& startColumn, int& startRow, int& endColumn, int& endRow) const {
+	// Only a terrain that kept its height field can be edited.
+	if (!m_HeightField || (radius <= 0.0f)) {
+		return false;
+	}
+
+	// Find the block of terrain samples under the brush, rows run towards -Z from the back of the terrain.
+	float column = positionX;
+	float row = static_cast<float>(m_terrainHeight - 1) - positionZ;
+
+	startColumn = static_cast<int>(std::max(ceilf(column - radius), 0.0f));
+	startRow = static_cast<int>(std::max(ceilf(row - radius), 0.0f));
+	endColumn = static_cast<int>(std::min(floorf(column + radius), static_cast<float>(m_terrainWidth - 1))) + 1;
+	endRow = static_cast<int>(std::min(floorf(row + radius), static_cast<float>(m_terrainHeight - 1))) + 1;
+
+	// The brush can miss the terrain altogether.
+	return (startColumn < endColumn) && (startRow < endRow);
+}
+
+float Terrain::GetBrushWeight(int i, int j, float positionX, float positionZ, float radius) const {
+	float x = m_HeightField->GetPositionX(i) - positionX;
+	float z = m_HeightField->GetPositionZ(j) - positionZ;
+	float distance = ((x * x) + (z * z)) / (radius * radius);
+
+	// Fall off smoothly from the middle of the brush to nothing at its edge.
+	if (distance >= 1.0f) {
+		return 0.0f;
+	}
+
+	return (1.0f - distance) * (1.0f - distance);
+}
+
+void Terrain::UpdateTerrainBlock(ID3D11DeviceContext* deviceContext, int startColumn, int startRow, int endColumn, int endRow) {
+	int width = m_HeightField->GetWidth();
+	int height = m_HeightField->GetHeight();
+
+	// Repeat the edited edge samples into the padding past the edge, which then changes along with the block.
+	m_HeightField->ExtendHeights(startColumn, startRow, endColumn, endRow);
+
+	if (endColumn >= m_terrainWidth) {
+		endColumn = width;
+	}
+
+	if (endRow >= m_terrainHeight) {
+		endRow = height;
+	}
+
+	// A normal is made from the faces around its sample so the samples next to the block need new normals as well.
+	startColumn = std::max(startColumn - 1, 0);
+	startRow = std::max(startRow - 1, 0);
+	endColumn = std::min(endColumn + 1, width);
+	endRow = std::min(endRow + 1, height);
+
+	TerrainKernels::CalculateNormals(m_HeightField, startRow, endRow, startColumn, endColumn);
+
+	// Rebuild every cell that holds one of those samples, neighbouring cells share the samples along their edges.  The
+	// tangents only look one sample to each side as well and the morph heights never leave the cell.
+	int startX = std::max(startColumn - 1, 0) / (m_cellWidth - 1);
+	int startY = std::max(startRow - 1, 0) / (m_cellHeight - 1);
+	int endX = std::min((endColumn - 1) / (m_cellWidth - 1), m_cellCountX - 1);
+	int endY = std::min((endRow - 1) / (m_cellHeight - 1), m_cellCountY - 1);
+
+	for (int j = startY; j <= endY; j++) {
+		for (int i = startX; i <= endX; i++) {
+			int cellId = (j * m_cellCountX) + i;
+			TerrainCell& cell = m_TerrainCells[m_cellSlots[cellId]];
+
+			cell.Update(deviceContext, m_HeightField, i, j, m_cellHeight, m_cellWidth);
+
+			float bounds[TerrainCache::BOUNDS_SIZE];
+			cell.GetCellDimensions(bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+			m_TerrainQuadTree->SetCellBounds(cellId, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+		}
+	}
+
+	// Refit the quadtree and the height pyramid around the new heights, and measure the level of detail errors of the
+	// rebuilt cells again so an edit that roughens a cell keeps it to the error budget.
+	m_TerrainQuadTree->UpdateBounds();
+	UpdateTerrainPyramid(startX, startY, endX, endY);
+	m_TerrainLod->UpdateCellErrors(m_HeightField, startX, startY, endX, endY);
+}
+
+bool Terrain::CheckSegment(const Vector3& start, const Vector3& end) const {
+	float directionX = end.x - start.x;
+	float directionY = end.y - start.y;
+	float directionZ = end.z - start.z;
+	float length = sqrtf((directionX * directionX) + (directionY * directionY) + (directionZ * directionZ));
+
+	// The two ends can see each other if the surface doesn't cross the segment between them, an end that lies on the
+	// surface counts as crossing it.
+	RayHitType hit;
+	return (length <= 0.0f) || !TraceRay(start, Vector3(directionX / length, directionY / length, directionZ / length), length, hit);
+}
+
+bool Terrain::TraceRay(const Vector3& origin, const Vector3& direction, float maxDistance, RayHitType& hit) const {
+	int quadCountX = m_terrainWidth - 1;
+	int quadCountY = m_terrainHeight - 1;
+
+	RayType ray;
+	ray.origin = origin;
+	ray.direction = direction;
+	ray.maxDistance = maxDistance;
+	ray.gridX = origin.x;
+	ray.gridY = static_cast<float>(m_terrainHeight - 1) - origin.z;
+	ray.directionX = direction.x;
+	ray.directionY = -direction.z;
+	ray.inverseX = (ray.directionX != 0.0f) ? 1.0f / ray.directionX : 0.0f;
+	ray.inverseY = (ray.directionY != 0.0f) ? 1.0f / ray.directionY : 0.0f;
+
+	// Only the part of the ray over the terrain can hit it.
+	float distance = 0.0f;
+	float endDistance = maxDistance;
+	if (!ClipRay(ray.gridX, ray.directionX, ray.inverseX, static_cast<float>(quadCountX), distance, endDistance) ||
+		!ClipRay(ray.gridY, ray.directionY, ray.inverseY, static_cast<float>(quadCountY), distance, endDistance)) {
+		return false;
+	}
+
+	// Walk the blocks of the height pyramid along the ray starting from the single block at the top.  A block the ray
+	// passes over or under is stepped across whole, otherwise the walk goes down into the child the ray is in until it
+	// reaches a leaf, whose quads are tested in order.
+	int leafShift = m_TerrainPyramid->GetLeafShift();
+	int topLevel = m_TerrainPyramid->GetLevelCount() - 1;
+	int level = topLevel;
+	int blockX = 0;
+	int blockY = 0;
+	int stepX = (ray.directionX < 0.0f) ? -1 : 1;
+	int stepY = (ray.directionY < 0.0f) ? -1 : 1;
+
+	for (;;) {
+		int shift = leafShift + level;
+		float startColumn = static_cast<float>(blockX << shift);
+		float endColumn = static_cast<float>(std::min((blockX + 1) << shift, quadCountX));
+		float startRow = static_cast<float>(blockY << shift);
+		float endRow = static_cast<float>(std::min((blockY + 1) << shift, quadCountY));
+
+		// Find where the ray leaves the block and the heights it has over the block.
+		float exitX = GetRayExit(ray.gridX, ray.directionX, ray.inverseX, startColumn, endColumn);
+		float exitY = GetRayExit(ray.gridY, ray.directionY, ray.inverseY, startRow, endRow);
+		float exitDistance = std::min(std::min(exitX, exitY), endDistance);
+		float startHeight = origin.y + (distance * direction.y);
+		float endHeight = origin.y + (exitDistance * direction.y);
+
+		float minHeight;
+		float maxHeight;
+		m_TerrainPyramid->GetBlockBounds(level, blockX, blockY, minHeight, maxHeight);
+
+		if ((std::max(startHeight, endHeight) >= minHeight) && (std::min(startHeight, endHeight) <= maxHeight)) {
+			if (level == 0) {
+				if (TraceLeaf(ray, blockX, blockY, distance, exitDistance, hit)) {
+					return true;
+				}
+			}
+			else {
+				// Go down into the child the ray is in, the point can sit on the edge of the child so it is kept in
+				// this block.
+				level--;
+				shift--;
+
+				int childX = GetRayBlock(ray.gridX + (distance * ray.directionX), ray.directionX, shift);
+				int childY = GetRayBlock(ray.gridY + (distance * ray.directionY), ray.directionY, shift);
+
+				blockX = std::min(std::max(childX, blockX * 2), std::min((blockX * 2) + 1, m_TerrainPyramid->GetLevelWidth(level) - 1));
+				blockY = std::min(std::max(childY, blockY * 2), std::min((blockY * 2) + 1, m_TerrainPyramid->GetLevelHeight(level) - 1));
+				continue;
+			}
+		}
+
+		if (exitDistance >= endDistance) {
+			return false;
+		}
+
+		distance = std::max(distance, exitDistance);
+
+		// Step into the next block across the side the ray leaves through, and go up for as long as that step also
+		// leaves the parent so empty space is crossed in the largest blocks it can be.
+		if (exitX <= exitY) {
+			blockX += stepX;
+			if ((blockX < 0) || (blockX >= m_TerrainPyramid->GetLevelWidth(level))) {
+				return false;
+			}
+
+			while ((level < topLevel) && ((blockX & 1) == ((stepX > 0) ? 0 : 1))) {
+				level++;
+				blockX >>= 1;
+				blockY >>= 1;
+			}
+		}
+		else {
+			blockY += stepY;
+			if ((blockY < 0) || (blockY >= m_TerrainPyramid->GetLevelHeight(level))) {
+				return false;
+			}
+
+			while ((level < topLevel) && ((blockY & 1) == ((stepY > 0) ? 0 : 1))) {
+				level++;
+				blockX >>= 1;
+				blockY >>= 1;
+			}
+		}
+	}
+}
+
+bool Terrain::TraceLeaf(const RayType& ray, int leafX, int leafY, float distance, float endDistance, RayHitType& hit) const {
+	int leafShift = m_TerrainPyramid->GetLeafShift();
+	int startColumn = leafX << leafShift;
+	int endColumn = std::min((leafX + 1) << leafShift, m_terrainWidth - 1);
+	int startRow = leafY << leafShift;
+	int endRow = std::min((leafY + 1) << leafShift, m_terrainHeight - 1);
+
+	// Step through the quads of the leaf along the ray, the first quad with a hit holds the nearest one.
+	int column = std::min(std::max(GetRayBlock(ray.gridX + (distance * ray.directionX), ray.directionX, 0), startColumn), endColumn - 1);
+	int row = std::min(std::max(GetRayBlock(ray.gridY + (distance * ray.directionY), ray.directionY, 0), startRow), endRow - 1);
+
+	for (;;) {
+		if (CheckRayOfQuad(ray, column, row, hit)) {
+			return true;
+		}
+
+		float exitX = GetRayExit(ray.gridX, ray.directionX, ray.inverseX, static_cast<float>(column), static_cast<float>(column + 1));
+		float exitY = GetRayExit(ray.gridY, ray.directionY, ray.inverseY, static_cast<float>(row), static_cast<float>(row + 1));
+		if (std::min(exitX, exitY) >= endDistance) {
+			return false;
+		}
+
+		if (exitX <= exitY) {
+			column += (ray.directionX < 0.0f) ? -1 : 1;
+			if ((column < startColumn) || (column >= endColumn)) {
+				return false;
+			}
+		}
+		else {
+			row += (ray.directionY < 0.0f) ? -1 : 1;
+			if ((row < startRow) || (row >= endRow)) {
+				return false;
+			}
+		}
+	}
+}
+
+bool Terrain::CheckRayOfQuad(const RayType& ray, int column, int row, RayHitType& hit) const {
+	// Find the cell the quad is in, a cell that isn't resident has no surface to hit.
+	int nodeIndexX = column / (m_cellWidth - 1);
+	int nodeIndexY = row / (m_cellHeight - 1);
+	int slot = m_cellSlots[(nodeIndexY * m_cellCountX) + nodeIndexX];
+	if (slot < 0) {
+		return false;
+	}
+
+	// Get the corners of the quad from the same vertices the height queries use.
+	int index = ((row - (nodeIndexY * (m_cellHeight - 1))) * m_cellWidth) + (column - (nodeIndexX * (m_cellWidth - 1)));
+	int corners[4] = { index, index + 1, index + m_cellWidth, index + m_cellWidth + 1 };
+	float vertices[4][3];
+
+	for (int i = 0; i < 4; i++) {
+		m_TerrainSurface->GetVertex(slot, corners[i], vertices[i]);
+	}
+
+	// Test both triangles in the same corner order the cell is drawn with and keep the nearer hit.
+	const int triangles[2][3] = { { 0, 1, 2 }, { 2, 1, 3 } };
+	int nearest = -1;
+	float nearestDistance = FLT_MAX;
+
+	for (int i = 0; i < 2; i++) {
+		float distance;
+		if (CheckRayOfTriangle(ray, vertices[triangles[i][0]], vertices[triangles[i][1]], vertices[triangles[i][2]], distance) && (distance < nearestDistance)) {
+			nearest = i;
+			nearestDistance = distance;
+		}
+	}
+
+	if (nearest < 0) {
+		return false;
+	}
+
+	// The normal of the triangle comes from its two edges like the normal in CheckHeightOfTriangle, which faces up.
+	const float* v0 = vertices[triangles[nearest][0]];
+	const float* v1 = vertices[triangles[nearest][1]];
+	const float* v2 = vertices[triangles[nearest][2]];
+	float edge1[3] = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
+	float edge2[3] = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
+	float normal[3];
+	normal[0] = (edge1[1] * edge2[2]) - (edge1[2] * edge2[1]);
+	normal[1] = (edge1[2] * edge2[0]) - (edge1[0] * edge2[2]);
+	normal[2] = (edge1[0] * edge2[1]) - (edge1[1] * edge2[0]);
+
+	float magnitude = sqrtf((normal[0] * normal[0]) + (normal[1] * normal[1]) + (normal[2] * normal[2]));
+
+	hit.position = Vector3(ray.origin.x + (ray.direction.x * nearestDistance), ray.origin.y + (ray.direction.y * nearestDistance), ray.origin.z + (ray.direction.z * nearestDistance));
+	hit.normal = Vector3(normal[0] / magnitude, normal[1] / magnitude, normal[2] / magnitude);
+	hit.distance = nearestDistance;
+
 	return true;
 }
+
+bool Terrain::CheckRayOfTriangle(const RayType& ray, const float v0[3], const float v1[3], const float v2[3], float& distance) {
+	// Points this far outside an edge still count so a ray through the shared edge of two triangles can't slip between them.
+	const float edgeTolerance = 0.00001f;
+
+	float edge1[3] = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
+	float edge2[3] = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
+
+	// Solve for the barycentric coordinates of the hit and the distance to it, a ray along the plane never hits it.
+	float p[3];
+	p[0] = (ray.direction.y * edge2[2]) - (ray.direction.z * edge2[1]);
+	p[1] = (ray.direction.z * edge2[0]) - (ray.direction.x * edge2[2]);
+	p[2] = (ray.direction.x * edge2[1]) - (ray.direction.y * edge2[0]);
+
+	float determinant = (edge1[0] * p[0]) + (edge1[1] * p[1]) + (edge1[2] * p[2]);
+	if (determinant == 0.0f) {
+		return false;
+	}
+
+	float inverse = 1.0f / determinant;
+	float s[3] = { ray.origin.x - v0[0], ray.origin.y - v0[1], ray.origin.z - v0[2] };
+
+	float u = ((s[0] * p[0]) + (s[1] * p[1]) + (s[2] * p[2])) * inverse;
+	if ((u < -edgeTolerance) || (u > 1.0f + edgeTolerance)) {
+		return false;
+	}
+
+	float q[3];
+	q[0] = (s[1] * edge1[2]) - (s[2] * edge1[1]);
+	q[1] = (s[2] * edge1[0]) - (s[0] * edge1[2]);
+	q[2] = (s[0] * edge1[1]) - (s[1] * edge1[0]);
+
+	float v = ((ray.direction.x * q[0]) + (ray.direction.y * q[1]) + (ray.direction.z * q[2])) * inverse;
+	if ((v < -edgeTolerance) || (u + v > 1.0f + edgeTolerance)) {
+		return false;
+	}
+
+	distance = ((edge2[0] * q[0]) + (edge2[1] * q[1]) + (edge2[2] * q[2])) * inverse;
+
+	return (distance >= 0.0f) && (distance <= ray.maxDistance);
+}
+
+bool Terrain::ClipRay(float position, float direction, float inverse, float limit, float& startDistance, float& endDistance) {
+	// A ray along the side has to start within it.
+	if (direction == 0.0f) {
+		return (position >= 0.0f) && (position <= limit);
+	}
+
+	float distance1 = -position * inverse;
+	float distance2 = (limit - position) * inverse;
+
+	startDistance = std::max(startDistance, std::min(distance1, distance2));
+	endDistance = std::min(endDistance, std::max(distance1, distance2));
+
+	return startDistance <= endDistance;
+}
+
+float Terrain::GetRayExit(float position, float direction, float inverse, float start, float end) {
+	if (direction > 0.0f) {
+		return (end - position) * inverse;
+	}
+
+	if (direction < 0.0f) {
+		return (start - position) * inverse;
+	}
+
+	return FLT_MAX;
+}
+
+int Terrain::GetRayBlock(float position, float direction, int shift) {
+	// A point on the edge between two blocks belongs to the one the ray is going into.
+	float block = position / static_cast<float>(1 << shift);
+
+	return static_cast<int>((direction < 0.0f) ? ceilf(block) - 1.0f : floorf(block));
+}
@@ -2,7 +2,18 @@
 
 #include <d3d11_2.h>
 #include "TerrainCell.h"
+#include "TerrainMesh.h"
 #include "Frustum.h"
+#include "HeightField.h"
+#include "TerrainKernels.h"
+#include "TerrainLod.h"
+#include "TerrainQuadTree.h"
+#include "TerrainPyramid.h"
+#include "TerrainSurface.h"
+#include "TerrainOcclusion.h"
+#include "TerrainVisibility.h"
+#include "MappedFile.h"
+#include "TerrainCache.h"
 
 class Terrain {
 
@@ -30,99 +41,215 @@ class Terrain {
 		unsigned int   biClrImportant;
 	} BITMAPINFOHEADER;
 
-	struct HeightMapType {
-		float x;
-		float y;
-		float z;
-		float nx;
-		float ny;
-		float nz;
-		float r;
-		float g;
-		float b;
-	};
-
-	struct ModelType {
-		float x;
-		float y;
-		float z;
-		float tu;
-		float tv;
-		float nx;
-		float ny;
-		float nz;
-		float tx;
-		float ty;
-		float tz;
-		float bx;
-		float by;
-		float bz;
-		float r;
-		float g;
-		float b;
-		float tu2;
-		float tv2;
-	};
-
-	struct VectorType {
-		float x;
-		float y;
-		float z;
-	};
+public:
+	// Most cells a paged terrain builds in one frame, so coming into a new area doesn't stall a single frame.
+	static const int MAX_PAGE_BUILDS = 32;
 
-	struct TempVertexType {
-		float x;
-		float y;
-		float z;
-		float tu;
-		float tv;
-		float nx;
-		float ny;
-		float nz;
+	// Where a ray first meets the surface, with the normal of the triangle it hit and the distance along the ray.
+	struct RayHitType {
+		Vector3 position;
+		Vector3 normal;
+		float distance;
 	};
 
-public:
 	Terrain();
 	~Terrain();
 
 	bool Initialize(ID3D11Device*, char*);
+	bool BakeVisibleSets();
 	void Frame();
-	bool RenderCell(ID3D11DeviceContext*, int, Frustum*);
+	bool PageCells(ID3D11Device*, const Vector3& cameraPosition);
+	void SetLodErrorBudget(float pixelError, float projectionScale);
+	void SelectLod(const Vector3& cameraPosition);
+	void CullCells(const Frustum*);
+	bool CullViews(const Frustum* const* frustums, int viewCount, int* const* visibleCells, int* visibleCounts, unsigned int* cellMasks);
+	void ApplyVisibleSets(const Vector3& cameraPosition);
+	void SortVisibleCells(const Matrix& viewMatrix);
+	void OccludeCells(const Matrix& viewProjection);
+	void RenderCell(ID3D11DeviceContext*, int);
 	void RenderCellLines(ID3D11DeviceContext*, int) const;
 	int GetCellIndexCount(int) const;
 	int GetCellLinesIndexCount(int) const;
+	int GetCellLodLevel(int) const;
+	const float* GetCellLodErrors(int) const;
+	int GetLodLevelCount() const;
+	void GetCellBounds(int, float& maxWidth, float& maxHeight, float& maxDepth, float& minWidth, float& minHeight, float& minDepth) const;
+	TerrainLod::MorphType GetCellMorph(int) const;
+	const TerrainMesh::DecodeType& GetCellDecode(int) const;
+	bool GetCellVertices(ID3D11DeviceContext*, int, TerrainMesh::VertexType*) const;
+	const HeightField* GetHeightField() const;
 	int GetCellCount() const;
+	int GetSlotCount() const;
+	int GetCellSlot(int) const;
+	int GetSlotCell(int) const;
+	const char* GetVisibilityFilename() const;
+	bool HasVisibleSets() const;
+	int GetVisibleCellCount() const;
+	int GetVisibleCell(int) const;
 	int GetRenderCount() const;
 	int GetCellsDrawn() const;
 	int GetCellsCulled() const;
+	int GetCellsOccluded() const;
+	float GetOcclusionTime() const;
 	bool GetHeightAtPosition(float, float, float&) const;
+	bool GetHeightBounds(float minX, float minZ, float maxX, float maxZ, float& minHeight, float& maxHeight) const;
+	bool RayCast(const Vector3& origin, const Vector3& direction, float maxDistance, RayHitType& hit) const;
+	void CheckLineOfSight(const Vector3* starts, const Vector3* ends, int count, bool* visible) const;
+	void GetHeightsAtPositions(const float* positionX, const float* positionZ, int count, float* heights, bool* found) const;
+	void GetNormalsAtPositions(const float* positionX, const float* positionZ, int count, float* normalX, float* normalY, float* normalZ, float* slopes, bool* found) const;
+	bool RaiseTerrain(ID3D11DeviceContext*, float positionX, float positionZ, float radius, float amount);
+	bool LowerTerrain(ID3D11DeviceContext*, float positionX, float positionZ, float radius, float amount);
+	bool FlattenTerrain(ID3D11DeviceContext*, float positionX, float positionZ, float radius, float height, float strength);
+	bool SmoothTerrain(ID3D11DeviceContext*, float positionX, float positionZ, float radius, float strength);
 
 private:
+	// A ray in both world space and the quad grid, where columns run along +X and rows run towards -Z.
+	struct RayType {
+		Vector3 origin;
+		Vector3 direction;
+		float maxDistance;
+		float gridX;
+		float gridY;
+		float directionX;
+		float directionY;
+		float inverseX;
+		float inverseY;
+	};
+
+	// A rectangle of the ground and the highest point over it a segment can start or end at.
+	struct RegionType {
+		float minX;
+		float minZ;
+		float maxX;
+		float maxZ;
+		float height;
+	};
+
 	Terrain(const Terrain&);
 
 	bool LoadSetupFile(char*);
+	bool InitializePaged(ID3D11Device*);
+	bool InitializeCached(ID3D11Device*, const TerrainCache*);
+	bool CalculateContentHash();
+	bool SaveTerrainCache() const;
+	bool LoadTerrainVisibility();
+	bool SaveTerrainVisibility(const TerrainVisibility::HeaderType& header) const;
+	bool CheckRegionHidden(const RegionType& eye, const RegionType& target, int depth) const;
+	bool CheckSegment(const Vector3& start, const Vector3& end) const;
 	void ShutdownHeightMap();
-	void SetTerrainCoordinates() const;
 	bool CalculateNormals() const;
 	bool LoadColorMap() const;
-	bool BuildTerrainModel();
-	void ShutdownTerrainModel();
-	void CalculateTerrainVectors() const;
-	void CalculateTangentBinormal(TempVertexType, TempVertexType, TempVertexType, VectorType&, VectorType&) const;
 	bool LoadRawHeightMap();
-	bool LoadTerrainCells(ID3D11Device*);
+	bool MapHeightMap();
+	bool MapColorMap();
+	bool LoadTerrainCells(ID3D11Device*, const TerrainCache*);
+	bool LoadCellIndexBuffer(ID3D11Device*);
+	bool LoadPagedCells(ID3D11Device*);
+	void LoadCellBounds() const;
+	bool LoadTerrainPyramid();
+	bool LoadTerrainSurface();
+	bool LoadTerrainOcclusion();
+	void LoadOccluder(int cellId, float* vertices) const;
+	void LoadPyramidLeaves(int startLeafX, int startLeafY, int endLeafX, int endLeafY) const;
+	void UpdateTerrainPyramid(int startCellX, int startCellY, int endCellX, int endCellY);
+	HeightField* LoadPageWindow(int nodeIndexX, int nodeIndexY) const;
+	bool BuildPagedCell(ID3D11Device*, int slot);
+	int AcquireSlot();
+	void TouchSlot(int slot);
+	bool LoadTerrainLod(const TerrainCache*);
+	bool LoadPagedLod();
 	void ShutdownTerrainCells();
+	bool CheckHeightOfQuad(int slot, int i, int j, float inputX, float inputZ, float& height) const;
 	bool CheckHeightOfTriangle(float, float, float&, float[3], float[3], float[3]) const;
+	bool TraceRay(const Vector3& origin, const Vector3& direction, float maxDistance, RayHitType& hit) const;
+	bool TraceLeaf(const RayType& ray, int leafX, int leafY, float distance, float endDistance, RayHitType& hit) const;
+	bool CheckRayOfQuad(const RayType& ray, int column, int row, RayHitType& hit) const;
+	static bool CheckRayOfTriangle(const RayType& ray, const float v0[3], const float v1[3], const float v2[3], float& distance);
+	static bool ClipRay(float position, float direction, float inverse, float limit, float& startDistance, float& endDistance);
+	static float GetRayExit(float position, float direction, float inverse, float start, float end);
+	static int GetRayBlock(float position, float direction, int shift);
+	int GetBuildTileCount(int rowCount) const;
+	bool GetBrushBlock(float positionX, float positionZ, float radius, int& startColumn, int& startRow, int& endColumn, int& endRow) const;
+	float GetBrushWeight(int i, int j, float positionX, float positionZ, float radius) const;
+	void UpdateTerrainBlock(ID3D11DeviceContext*, int startColumn, int startRow, int endColumn, int endRow);
+
+	// The build stages split the terrain into bands of rows and process the bands in parallel.
+	static const int BUILD_TILE_ROWS = 32;
+
+	// Size of the cells in vertices along each side when the setup file doesn't give one.
+	static const int DEFAULT_CELL_SIZE = 33;
+
+	// Megabytes of cells a paged terrain keeps resident when the setup file doesn't give a budget.
+	static const int DEFAULT_PAGE_BUDGET = 256;
+
+	// Most cells a paged terrain measures the level of detail errors on.
+	static const int MAX_LOD_SAMPLE_CELLS = 4096;
+
+	// Segments each task of a batched line of sight query takes.
+	static const int LINE_OF_SIGHT_BATCH = 256;
+
+	// Size of the occlusion depth buffer, the quads along each side of an occluder and the most cells used as occluders.
+	static const int OCCLUSION_WIDTH = 256;
+	static const int OCCLUSION_HEIGHT = 144;
+	static const int OCCLUDER_SIZE = 4;
+	static const int MAX_OCCLUDERS = 256;
+
+	// Height above the top of a cell the eyes of the visible sets are baked at when the setup file doesn't give one,
+	// and how many times a pair of cells the bake can't prove is hidden is split into quarters to try again.
+	static const int DEFAULT_VISIBILITY_HEIGHT = 32;
+	static const int VISIBILITY_DEPTH = 2;
 
 	int m_terrainHeight;
 	int m_terrainWidth;
-	int m_vertexCount;
 	float m_heightScale;
+	float m_pageRadius;
+	int m_pageBudget;
+	bool m_editable;
 	char *m_terrainFilename;
 	char *m_colorMapFilename;
-	HeightMapType* m_heightMap;
-	ModelType* m_terrainModel;
+	char *m_cacheFilename;
+	char *m_visibilityFilename;
+	float m_visibilityHeight;
+	unsigned long long m_contentHash;
+	HeightField* m_HeightField;
+	MappedFile* m_HeightMapFile;
+	MappedFile* m_ColorMapFile;
+	unsigned int m_colorMapOffset;
+	int m_colorMapPitch;
 	TerrainCell* m_TerrainCells;
+	TerrainLod* m_TerrainLod;
+	TerrainQuadTree* m_TerrainQuadTree;
+	TerrainPyramid* m_TerrainPyramid;
+	TerrainSurface* m_TerrainSurface;
+	TerrainOcclusion* m_TerrainOcclusion;
+	float* m_occluderVertices;
+	float* m_occlusionBounds;
+	TerrainVisibility* m_TerrainVisibility;
+	unsigned int* m_visibleSet;
+	int m_visibleSetCell;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> m_cellIndexBuffer;
+	unsigned short* m_cellIndices;
+	int* m_cellLevels;
+	int* m_visibleCells;
+	int m_visibleCellCount;
+	float* m_visibleDepths;
+	unsigned short* m_sortKeys;
+	unsigned short* m_sortScratchKeys;
+	int* m_sortScratchCells;
+	int* m_cellSlots;
+	int* m_slotCells;
+	int* m_slotFrames;
+	int* m_slotPrevious;
+	int* m_slotNext;
+	int* m_pageRequests;
+	int m_slotCount;
+	int m_slotHead;
+	int m_slotTail;
+	int m_pageFrame;
+	int m_cellWidth;
+	int m_cellHeight;
+	int m_cellCountX;
+	int m_cellCountY;
 	int m_cellCount;
 	int m_renderCount;
 	int m_cellsDrawn;
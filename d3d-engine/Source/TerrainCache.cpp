@@ -0,0 +1,220 @@
+#include "pch.h"
+#include "TerrainCache.h"
+
+TerrainCache::TerrainCache() :
+	m_File(nullptr),
+	m_output(nullptr),
+	m_header(),
+	m_bounds(nullptr),
+	m_errors(nullptr),
+	m_vertices(nullptr),
+	m_cellVertexCount(0) {}
+
+TerrainCache::TerrainCache(const TerrainCache&) :
+	m_File(nullptr),
+	m_output(nullptr),
+	m_header(),
+	m_bounds(nullptr),
+	m_errors(nullptr),
+	m_vertices(nullptr),
+	m_cellVertexCount(0) {}
+
+TerrainCache::~TerrainCache() {
+	Close();
+}
+
+bool TerrainCache::Open(const char* filename, const HeaderType& expected) {
+	Close();
+
+	// Map the cache file.
+	m_File = new MappedFile;
+	if (!m_File->Open(filename) || (m_File->GetSize() < sizeof(HeaderType))) {
+		Close();
+		return false;
+	}
+
+	memcpy(&m_header, m_File->GetData(), sizeof(HeaderType));
+
+	// The cache is only any use if it was baked by this version from the same sources and setup.
+	if ((m_header.magic != expected.magic) || (m_header.version != expected.version) || (m_header.contentHash != expected.contentHash) ||
+		(m_header.terrainWidth != expected.terrainWidth) || (m_header.terrainHeight != expected.terrainHeight) ||
+		(m_header.cellWidth != expected.cellWidth) || (m_header.cellHeight != expected.cellHeight) ||
+		(m_header.cellCountX != expected.cellCountX) || (m_header.cellCountY != expected.cellCountY) ||
+		(m_header.vertexSize != expected.vertexSize) || (m_header.levelCount != expected.levelCount)) {
+		Close();
+		return false;
+	}
+
+	// Make sure all of the cells made it into the file.
+	if (m_File->GetSize() < GetFileSize(m_header)) {
+		Close();
+		return false;
+	}
+
+	// The bounds follow the header, the errors follow the bounds and the vertices follow the errors.
+	int cellCount = m_header.cellCountX * m_header.cellCountY;
+	m_cellVertexCount = TerrainMesh::GetVertexCount(m_header.cellWidth, m_header.cellHeight);
+	m_bounds = reinterpret_cast<const float*>(m_File->GetData() + sizeof(HeaderType));
+	m_errors = m_bounds + (cellCount * BOUNDS_SIZE);
+	m_vertices = reinterpret_cast<const unsigned char*>(m_errors + (cellCount * m_header.levelCount));
+
+	return true;
+}
+
+void TerrainCache::Close() {
+	// Release the mapping.
+	if (m_File) {
+		delete m_File;
+		m_File = nullptr;
+	}
+
+	// Close an unfinished cache, its header was never written so it won't be opened.
+	if (m_output) {
+		fclose(m_output);
+		m_output = nullptr;
+	}
+
+	m_bounds = nullptr;
+	m_errors = nullptr;
+	m_vertices = nullptr;
+	m_cellVertexCount = 0;
+}
+
+const TerrainCache::HeaderType* TerrainCache::GetHeader() const {
+	return &m_header;
+}
+
+const float* TerrainCache::GetCellBounds(int cellId) const {
+	return m_bounds + (cellId * BOUNDS_SIZE);
+}
+
+const float* TerrainCache::GetCellErrors(int cellId) const {
+	return m_errors + (cellId * m_header.levelCount);
+}
+
+const TerrainMesh::VertexType* TerrainCache::GetCellVertices(int cellId) const {
+	return reinterpret_cast<const TerrainMesh::VertexType*>(m_vertices + (static_cast<unsigned long long>(cellId) * m_cellVertexCount * m_header.vertexSize));
+}
+
+bool TerrainCache::Create(const char* filename, const HeaderType& header) {
+	Close();
+
+	int error = fopen_s(&m_output, filename, "wb");
+	if (error != 0) {
+		m_output = nullptr;
+		return false;
+	}
+
+	m_header = header;
+
+	// Hold the place of the header with one that won't validate until all of the cells are written.
+	HeaderType placeholder = {};
+	if (fwrite(&placeholder, sizeof(HeaderType), 1, m_output) != 1) {
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool TerrainCache::WriteCellBounds(const float* bounds, int cellCount) {
+	size_t count = static_cast<size_t>(cellCount) * BOUNDS_SIZE;
+	if (fwrite(bounds, sizeof(float), count, m_output) != count) {
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool TerrainCache::WriteCellErrors(const float* errors, int cellCount) {
+	size_t count = static_cast<size_t>(cellCount) * m_header.levelCount;
+	if (fwrite(errors, sizeof(float), count, m_output) != count) {
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool TerrainCache::WriteCellVertices(const TerrainMesh::VertexType* vertices, int cellCount) {
+	size_t count = static_cast<size_t>(cellCount) * TerrainMesh::GetVertexCount(m_header.cellWidth, m_header.cellHeight);
+	if (fwrite(vertices, sizeof(TerrainMesh::VertexType), count, m_output) != count) {
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool TerrainCache::Finish() {
+	// Go back and write the real header now that the rest of the file is complete.
+	bool result = (fseek(m_output, 0, SEEK_SET) == 0) && (fwrite(&m_header, sizeof(HeaderType), 1, m_output) == 1);
+
+	if (fclose(m_output) != 0) {
+		result = false;
+	}
+
+	m_output = nullptr;
+
+	return result;
+}
+
+TerrainCache::HeaderType TerrainCache::MakeHeader(unsigned long long contentHash, int terrainWidth, int terrainHeight, int cellWidth, int cellHeight, int cellCountX, int cellCountY) {
+	HeaderType header = {};
+
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.contentHash = contentHash;
+	header.terrainWidth = terrainWidth;
+	header.terrainHeight = terrainHeight;
+	header.cellWidth = cellWidth;
+	header.cellHeight = cellHeight;
+	header.cellCountX = cellCountX;
+	header.cellCountY = cellCountY;
+	header.vertexSize = sizeof(TerrainMesh::VertexType);
+	header.levelCount = std::min(TerrainMesh::GetLevelCount(cellWidth, cellHeight), static_cast<int>(MAX_LEVELS));
+
+	return header;
+}
+
+unsigned long long TerrainCache::Hash(const void* data, unsigned long long size, unsigned long long seed) {
+	const unsigned long long prime1 = 0x9E3779B185EBCA87ull;
+	const unsigned long long prime2 = 0xC2B2AE3D27D4EB4Full;
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	unsigned long long hash = seed + (size * prime1);
+	unsigned long long index = 0;
+
+	// Mix in eight bytes at a time, the source files are megabytes long so the hash has to run near memory speed.
+	for (; index + 8 <= size; index += 8) {
+		unsigned long long word;
+		memcpy(&word, bytes + index, sizeof(word));
+
+		word *= prime2;
+		word = (word << 31) | (word >> 33);
+		hash ^= word * prime1;
+		hash = (((hash << 27) | (hash >> 37)) * prime1) + prime2;
+	}
+
+	// Then the bytes left over one at a time.
+	for (; index < size; index++) {
+		hash ^= bytes[index] * prime1;
+		hash = ((hash << 11) | (hash >> 53)) * prime2;
+	}
+
+	// Spread every input bit across the whole result.
+	hash ^= hash >> 33;
+	hash *= prime2;
+	hash ^= hash >> 29;
+	hash *= prime1;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+unsigned long long TerrainCache::GetFileSize(const HeaderType& header) const {
+	unsigned long long cellCount = static_cast<unsigned long long>(header.cellCountX) * header.cellCountY;
+	unsigned long long vertexBytes = static_cast<unsigned long long>(TerrainMesh::GetVertexCount(header.cellWidth, header.cellHeight)) * header.vertexSize;
+
+	return sizeof(HeaderType) + (cellCount * BOUNDS_SIZE * sizeof(float)) + (cellCount * header.levelCount * sizeof(float)) + (cellCount * vertexBytes);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "MappedFile.h"
+#include "TerrainMesh.h"
+
+// Baked copy of the finished terrain cells.  The file holds a header, the bounds of every cell, the level of detail
+// errors of every cell and then the vertices of every cell exactly as they go into the vertex buffers, so loading is
+// just mapping the file and handing each cell its block.  The header carries a hash of the source files and setup values the cells were built from, and a
+// format version that has to be bumped whenever the layout or the vertex format changes.
+class TerrainCache {
+public:
+	// Most levels of detail the errors are kept for, the same as the level of detail selection.
+	static const int MAX_LEVELS = 16;
+
+	struct HeaderType {
+		unsigned int magic;
+		unsigned int version;
+		unsigned long long contentHash;
+		int terrainWidth;
+		int terrainHeight;
+		int cellWidth;
+		int cellHeight;
+		int cellCountX;
+		int cellCountY;
+		int vertexSize;
+		int levelCount;
+	};
+
+	TerrainCache();
+	~TerrainCache();
+
+	bool Open(const char* filename, const HeaderType& expected);
+	void Close();
+
+	const HeaderType* GetHeader() const;
+	const float* GetCellBounds(int cellId) const;
+	const float* GetCellErrors(int cellId) const;
+	const TerrainMesh::VertexType* GetCellVertices(int cellId) const;
+
+	bool Create(const char* filename, const HeaderType& header);
+	bool WriteCellBounds(const float* bounds, int cellCount);
+	bool WriteCellErrors(const float* errors, int cellCount);
+	bool WriteCellVertices(const TerrainMesh::VertexType* vertices, int cellCount);
+	bool Finish();
+
+	static HeaderType MakeHeader(unsigned long long contentHash, int terrainWidth, int terrainHeight, int cellWidth, int cellHeight, int cellCountX, int cellCountY);
+	static unsigned long long Hash(const void* data, unsigned long long size, unsigned long long seed);
+
+	// Number of bounds values stored per cell, the maximum corner followed by the minimum corner.
+	static const int BOUNDS_SIZE = 6;
+
+private:
+	TerrainCache(const TerrainCache&);
+
+	unsigned long long GetFileSize(const HeaderType& header) const;
+
+	static const unsigned int MAGIC = 0x4E525454;
+	static const unsigned int VERSION = 3;
+
+	MappedFile* m_File;
+	FILE* m_output;
+	HeaderType m_header;
+	const float* m_bounds;
+	const float* m_errors;
+	const unsigned char* m_vertices;
+	int m_cellVertexCount;
+};
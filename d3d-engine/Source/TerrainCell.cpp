@@ -3,7 +3,6 @@
 #include "Utility.h"
 
 TerrainCell::TerrainCell() :
-	m_vertexList(nullptr),
 	m_vertexBuffer(nullptr),
 	m_indexBuffer(nullptr),
 	m_lineVertexBuffer(nullptr),
@@ -19,10 +18,12 @@ TerrainCell::TerrainCell() :
 	m_minDepth(0),
 	m_positionX(0),
 	m_positionY(0),
-	m_positionZ(0) {}
+	m_positionZ(0),
+	m_decode(),
+	m_Surface(nullptr),
+	m_surfaceSlot(-1) {}
 
 TerrainCell::TerrainCell(const TerrainCell&) :
-	m_vertexList(nullptr),
 	m_vertexBuffer(nullptr),
 	m_indexBuffer(nullptr),
 	m_lineVertexBuffer(nullptr),
@@ -38,76 +39,158 @@ TerrainCell::TerrainCell(const TerrainCell&) :
 	m_minDepth(0),
 	m_positionX(0),
 	m_positionY(0),
-	m_positionZ(0) {}
+	m_positionZ(0),
+	m_decode(),
+	m_Surface(nullptr),
+	m_surfaceSlot(-1) {}
 
 TerrainCell::~TerrainCell() {
-	delete[] m_vertexList;
-	m_vertexList = nullptr;
+	Shutdown();
 }
 
-bool TerrainCell::Initialize(ID3D11Device* device, void* terrainModelPtr, int nodeIndexX, int nodeIndexY, int cellHeight, int cellWidth, int terrainWidth) {
-	// Coerce the pointer to the terrain model into the model type.
-	ModelType* terrainModel = static_cast<ModelType*>(terrainModelPtr);
+bool TerrainCell::Initialize(ID3D11Device* device, const HeightField* heightField, int nodeIndexX, int nodeIndexY, int cellHeight, int cellWidth, ID3D11Buffer* indexBuffer) {
+	// Find the bounds of the cell first since the vertices are stored relative to them.
+	float bounds[6];
+	TerrainMesh::CalculateBounds(heightField, nodeIndexX, nodeIndexY, cellWidth, cellHeight, bounds);
 
-	// Load the rendering buffers with the terrain data for this cell index.
-	HRESULT result = InitializeBuffers(device, nodeIndexX, nodeIndexY, cellHeight, cellWidth, terrainWidth, terrainModel);
-	if (FAILED(result)) {
+	// Load the vertex array straight from the grid of height field points covered by this cell.
+	TerrainMesh::VertexType* vertices = new TerrainMesh::VertexType[TerrainMesh::GetVertexCount(cellWidth, cellHeight)];
+	TerrainMesh::BuildVertices(vertices, TerrainMesh::GetDecode(bounds, cellWidth, cellHeight), heightField, nodeIndexX, nodeIndexY, cellWidth, cellHeight);
+
+	bool result = Initialize(device, vertices, bounds, cellHeight, cellWidth, indexBuffer);
+
+	delete[] vertices;
+
+	return result;
+}
+
+bool TerrainCell::Initialize(ID3D11Device* device, const TerrainMesh::VertexType* vertices, const float* bounds, int cellHeight, int cellWidth, ID3D11Buffer* indexBuffer) {
+	// The bounds the vertices were built against are needed to decode them.
+	SetCellDimensions(bounds);
+	m_decode = TerrainMesh::GetDecode(bounds, cellWidth, cellHeight);
+
+	// Load the rendering buffers with the finished vertices of this cell.
+	bool result = InitializeBuffers(device, vertices, cellHeight, cellWidth, indexBuffer);
+	if (!result) {
 		return false;
 	}
 
-	CalculateCellDimensions();
-
 	return BuildLineBuffers(device);
 }
 
-void TerrainCell::Render(ID3D11DeviceContext* deviceContext) const {
-	RenderBuffers(deviceContext);
+void TerrainCell::Update(ID3D11DeviceContext* deviceContext, const HeightField* heightField, int nodeIndexX, int nodeIndexY, int cellHeight, int cellWidth) {
+	// Build the vertices again the same way as when the cell was created, the bounds can have moved so they are found first.
+	float bounds[6];
+	TerrainMesh::CalculateBounds(heightField, nodeIndexX, nodeIndexY, cellWidth, cellHeight, bounds);
+
+	TerrainMesh::VertexType* vertices = new TerrainMesh::VertexType[m_vertexCount];
+	TerrainMesh::BuildVertices(vertices, TerrainMesh::GetDecode(bounds, cellWidth, cellHeight), heightField, nodeIndexX, nodeIndexY, cellWidth, cellHeight);
+
+	Update(deviceContext, vertices, bounds, cellHeight, cellWidth);
+
+	delete[] vertices;
 }
 
-int TerrainCell::GetVertexCount() const {
-	return m_vertexCount;
+void TerrainCell::Update(ID3D11DeviceContext* deviceContext, const TerrainMesh::VertexType* vertices, const float* bounds, int cellHeight, int cellWidth) {
+	SetCellDimensions(bounds);
+	m_decode = TerrainMesh::GetDecode(bounds, cellWidth, cellHeight);
+
+	// The cell keeps the same number of vertices so they are copied over the old ones instead of creating new buffers.
+	deviceContext->UpdateSubresource(m_vertexBuffer.Get(), 0, nullptr, vertices, 0, 0);
+	LoadSurface(vertices);
+
+	// Move the bounding box lines to the new bounds.
+	ColorVertexType lineVertices[LINE_VERTEX_COUNT];
+	unsigned long lineIndices[LINE_VERTEX_COUNT];
+	LoadLineVertices(lineVertices, lineIndices);
+
+	deviceContext->UpdateSubresource(m_lineVertexBuffer.Get(), 0, nullptr, lineVertices, 0, 0);
 }
 
-int TerrainCell::GetIndexCount() const {
-	return m_indexCount;
+void TerrainCell::SetSurface(TerrainSurface* surface, int slot) {
+	// The cell copies its vertices into this slot of the surface every time they are loaded.
+	m_Surface = surface;
+	m_surfaceSlot = slot;
+}
+
+void TerrainCell::Shutdown() {
+	// Release the buffers so the cell can be built again for another part of the terrain.
+	m_vertexBuffer.Reset();
+	m_indexBuffer.Reset();
+	m_lineVertexBuffer.Reset();
+	m_lineIndexBuffer.Reset();
+
+	m_vertexCount = 0;
+	m_indexCount = 0;
+	m_lineIndexCount = 0;
+
+	// Clear the dimensions so the empty cell can't be mistaken for part of the terrain.
+	m_maxWidth = 0.0f;
+	m_maxHeight = 0.0f;
+	m_maxDepth = 0.0f;
+	m_minWidth = 0.0f;
+	m_minHeight = 0.0f;
+	m_minDepth = 0.0f;
+}
+
+void TerrainCell::Render(ID3D11DeviceContext* deviceContext, int indexStart) const {
+	RenderBuffers(deviceContext, indexStart);
 }
 
-bool TerrainCell::InitializeBuffers(ID3D11Device* device, int nodeIndexX, int nodeIndexY, int cellHeight, int cellWidth, int terrainWidth, ModelType* terrainModel) {
-	// Calculate the number of vertices in this terrain cell.
-	m_vertexCount = (cellHeight - 1) * (cellWidth - 1) * 6;
+bool TerrainCell::ReadVertices(ID3D11DeviceContext* deviceContext, TerrainMesh::VertexType* vertices) const {
+	// The cell doesn't keep its vertices, so copy the vertex buffer into a staging buffer the CPU can read.  This waits
+	// for the copy, so it is only for tools and tests.
+	Microsoft::WRL::ComPtr<ID3D11Device> device;
+	deviceContext->GetDevice(device.GetAddressOf());
 
-	// Set the index count to the same as the vertex count.
-	m_indexCount = m_vertexCount;
+	D3D11_BUFFER_DESC stagingBufferDesc = {};
 
-	VertexType* vertices = new VertexType[m_vertexCount];
-	unsigned long* indices = new unsigned long[m_indexCount];
+	stagingBufferDesc.Usage = D3D11_USAGE_STAGING;
+	stagingBufferDesc.ByteWidth = sizeof(TerrainMesh::VertexType) * m_vertexCount;
+	stagingBufferDesc.BindFlags = 0;
+	stagingBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	stagingBufferDesc.MiscFlags = 0;
+	stagingBufferDesc.StructureByteStride = 0;
 
-	// Setup the indexes into the terrain model data and the local vertex/index array.
-	int modelIndex = (nodeIndexX * (cellWidth - 1) + nodeIndexY * (cellHeight - 1) * (terrainWidth - 1)) * 6;
-	int index = 0;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> stagingBuffer;
+	HRESULT result = device->CreateBuffer(&stagingBufferDesc, nullptr, stagingBuffer.GetAddressOf());
+	if (FAILED(result)) {
+		return false;
+	}
+
+	deviceContext->CopyResource(stagingBuffer.Get(), m_vertexBuffer.Get());
 
-	// Load the vertex array and index array with data.
-	for (int j = 0; j < cellHeight - 1; j++) {
-		for (int i = 0; i < ((cellWidth - 1) * 6); i++) {
-			vertices[index].position = Vector3(terrainModel[modelIndex].x, terrainModel[modelIndex].y, terrainModel[modelIndex].z);
-			vertices[index].texture = Vector2(terrainModel[modelIndex].tu, terrainModel[modelIndex].tv);
-			vertices[index].normal = Vector3(terrainModel[modelIndex].nx, terrainModel[modelIndex].ny, terrainModel[modelIndex].nz);
-			vertices[index].tangent = Vector3(terrainModel[modelIndex].tx, terrainModel[modelIndex].ty, terrainModel[modelIndex].tz);
-			vertices[index].binormal = Vector3(terrainModel[modelIndex].bx, terrainModel[modelIndex].by, terrainModel[modelIndex].bz);
-			vertices[index].color = Color(terrainModel[modelIndex].r, terrainModel[modelIndex].g, terrainModel[modelIndex].b);
-			vertices[index].texture2 = Vector2(terrainModel[modelIndex].tu2, terrainModel[modelIndex].tv2);
-			indices[index] = index;
-			modelIndex++;
-			index++;
-		}
-		modelIndex += (terrainWidth * 6) - (cellWidth * 6);
+	D3D11_MAPPED_SUBRESOURCE mappedResource = {};
+	result = deviceContext->Map(stagingBuffer.Get(), 0, D3D11_MAP_READ, 0, &mappedResource);
+	if (FAILED(result)) {
+		return false;
 	}
 
+	memcpy(vertices, mappedResource.pData, sizeof(TerrainMesh::VertexType) * m_vertexCount);
+
+	deviceContext->Unmap(stagingBuffer.Get(), 0);
+
+	return true;
+}
+
+int TerrainCell::GetVertexCount() const {
+	return m_vertexCount;
+}
+
+int TerrainCell::GetIndexCount() const {
+	return m_indexCount;
+}
+
+bool TerrainCell::InitializeBuffers(ID3D11Device* device, const TerrainMesh::VertexType* vertices, int cellHeight, int cellWidth, ID3D11Buffer* indexBuffer) {
+	// Calculate the number of shared vertices and indices in this terrain cell.
+	m_vertexCount = TerrainMesh::GetVertexCount(cellWidth, cellHeight);
+	m_indexCount = TerrainMesh::GetIndexCount(cellWidth, cellHeight, 0);
+
 	// Set up the description of the static vertex buffer.
 	D3D11_BUFFER_DESC vertexBufferDesc = {};
 
 	vertexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	vertexBufferDesc.ByteWidth = sizeof(VertexType) * m_vertexCount;
+	vertexBufferDesc.ByteWidth = sizeof(TerrainMesh::VertexType) * m_vertexCount;
 	vertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
 	vertexBufferDesc.CPUAccessFlags = 0;
 	vertexBufferDesc.MiscFlags = 0;
@@ -123,105 +206,48 @@ bool TerrainCell::InitializeBuffers(ID3D11Device* device, int nodeIndexX, int no
 	// create the vertex buffer.
 	HRESULT result = device->CreateBuffer(&vertexBufferDesc, &vertexData, m_vertexBuffer.GetAddressOf());
 	if (FAILED(result)) {
-		delete[] vertices;
-		delete[] indices;
 		return false;
 	}
-	// Set up the description of the static index buffer.
-	D3D11_BUFFER_DESC indexBufferDesc = {};
 
-	indexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	indexBufferDesc.ByteWidth = sizeof(unsigned long) * m_indexCount;
-	indexBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	indexBufferDesc.CPUAccessFlags = 0;
-	indexBufferDesc.MiscFlags = 0;
-	indexBufferDesc.StructureByteStride = 0;
-
-	// Give the subresource structure a pointer to the index data.
-	D3D11_SUBRESOURCE_DATA indexData = {};
-
-	indexData.pSysMem = indices;
-	indexData.SysMemPitch = 0;
-	indexData.SysMemSlicePitch = 0;
+	// Every cell uses the same index pattern so just hold a reference to the shared 16 bit index buffer.
+	m_indexBuffer = indexBuffer;
 
-	// Create the index buffer.
-	result = device->CreateBuffer(&indexBufferDesc, &indexData, m_indexBuffer.GetAddressOf());
-	if (FAILED(result)) {
-		delete[] vertices;
-		delete[] indices;
-		return false;
-	}
+	// Copy the heights and normals into the surface the height queries read.
+	LoadSurface(vertices);
 
-	// Create a public vertex array that will be used for accessing vertex information about this cell.
-	m_vertexList = new VectorType[m_vertexCount];
+	return true;
+}
 
-	// Keep a local copy of the vertex position data for this cell.
-	for (int i = 0; i < m_vertexCount; i++) {
-		m_vertexList[i].x = vertices[i].position.x;
-		m_vertexList[i].y = vertices[i].position.y;
-		m_vertexList[i].z = vertices[i].position.z;
+void TerrainCell::LoadSurface(const TerrainMesh::VertexType* vertices) {
+	// The terrain keeps the only CPU copy of the vertices in its shared surface.
+	if (m_Surface) {
+		m_Surface->SetCell(m_surfaceSlot, vertices, m_decode);
 	}
-
-	delete[] vertices;
-	delete[] indices;
-
-	return true;
 }
 
-void TerrainCell::RenderBuffers(ID3D11DeviceContext* deviceContext) const {
+void TerrainCell::RenderBuffers(ID3D11DeviceContext* deviceContext, int indexStart) const {
 	// Set vertex buffer stride and offset.
-	unsigned int stride = sizeof(VertexType);
+	unsigned int stride = sizeof(TerrainMesh::VertexType);
 	unsigned int offset = 0;
 
 	// Set the vertex buffer to active in the input assembler so it can be rendered.
 	deviceContext->IASetVertexBuffers(0, 1, m_vertexBuffer.GetAddressOf(), &stride, &offset);
 
-	// Set the index buffer to active in the input assembler so it can be rendered.
-	deviceContext->IASetIndexBuffer(m_indexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+	// Set the index buffer to active in the input assembler so it can be rendered, starting at the pattern for the chosen level.
+	deviceContext->IASetIndexBuffer(m_indexBuffer.Get(), DXGI_FORMAT_R16_UINT, indexStart * sizeof(unsigned short));
 
 	// Set the type of primitive that should be rendered from this vertex buffer, in this case triangles.
 	deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 }
 
-void TerrainCell::CalculateCellDimensions() {
-	// Initialize the dimensions of the node.
-	m_maxWidth = -1000000.0f;
-	m_maxHeight = -1000000.0f;
-	m_maxDepth = -1000000.0f;
-
-	m_minWidth = 1000000.0f;
-	m_minHeight = 1000000.0f;
-	m_minDepth = 1000000.0f;
-
-	for (int i = 0; i < m_vertexCount; i++) {
-		float width = m_vertexList[i].x;
-		float height = m_vertexList[i].y;
-		float depth = m_vertexList[i].z;
-
-		// Check if the width exceeds the minimum or maximum.
-		if (width > m_maxWidth) {
-			m_maxWidth = width;
-		}
-		if (width < m_minWidth) {
-			m_minWidth = width;
-		}
-
-		// Check if the height exceeds the minimum or maximum.
-		if (height > m_maxHeight) {
-			m_maxHeight = height;
-		}
-		if (height < m_minHeight) {
-			m_minHeight = height;
-		}
-
-		// Check if the depth exceeds the minimum or maximum.
-		if (depth > m_maxDepth) {
-			m_maxDepth = depth;
-		}
-		if (depth < m_minDepth) {
-			m_minDepth = depth;
-		}
-	}
+void TerrainCell::SetCellDimensions(const float* bounds) {
+	// Take the dimensions of the node from the bounds the vertices were built against.
+	m_maxWidth = bounds[0];
+	m_maxHeight = bounds[1];
+	m_maxDepth = bounds[2];
+	m_minWidth = bounds[3];
+	m_minHeight = bounds[4];
+	m_minDepth = bounds[5];
 
 	// Calculate the center position of this cell.
 	m_positionX = (m_maxWidth - m_minWidth) + m_minWidth;
@@ -230,10 +256,7 @@ void TerrainCell::CalculateCellDimensions() {
 }
 
 bool TerrainCell::BuildLineBuffers(ID3D11Device* device) {
-	// Set the color of the lines to orange.
-	Color lineColor = Color(1.0f, 0.5f, 0.0f, 1.0f);
-
-	int vertexCount = 24;
+	int vertexCount = LINE_VERTEX_COUNT;
 	int indexCount = vertexCount;
 
 	ColorVertexType*  vertices = new ColorVertexType[vertexCount];
@@ -274,7 +297,37 @@ bool TerrainCell::BuildLineBuffers(ID3D11Device* device) {
 	indexData.SysMemPitch = 0;
 	indexData.SysMemSlicePitch = 0;
 
-	// Load the vertex and index array with data.
+	// Load the vertex and index array with the edges of the bounding box.
+	LoadLineVertices(vertices, indices);
+
+	// Create the vertex buffer.
+	HRESULT result = device->CreateBuffer(&vertexBufferDesc, &vertexData, m_lineVertexBuffer.GetAddressOf());
+	if (FAILED(result)) {
+		delete[] vertices;
+		delete[] indices;
+		return false;
+	}
+
+	// Create the index buffer.
+	result = device->CreateBuffer(&indexBufferDesc, &indexData, m_lineIndexBuffer.GetAddressOf());
+	if (FAILED(result)) {
+		delete[] vertices;
+		delete[] indices;
+		return false;
+	}
+	// Store the index count for rendering.
+	m_lineIndexCount = indexCount;
+
+	delete[] vertices;
+	delete[] indices;
+
+	return true;
+}
+
+void TerrainCell::LoadLineVertices(ColorVertexType* vertices, unsigned long* indices) const {
+	// Set the color of the lines to orange.
+	Color lineColor = Color(1.0f, 0.5f, 0.0f, 1.0f);
+
 	int index = 0;
 
 	// 8 Horizontal lines.
@@ -397,29 +450,6 @@ bool TerrainCell::BuildLineBuffers(ID3D11Device* device) {
 	vertices[index].position = Vector3(m_minWidth, m_minHeight, m_minDepth);
 	vertices[index].color = lineColor;
 	indices[index] = index;
-
-	// Create the vertex buffer.
-	HRESULT result = device->CreateBuffer(&vertexBufferDesc, &vertexData, m_lineVertexBuffer.GetAddressOf());
-	if (FAILED(result)) {
-		delete[] vertices;
-		delete[] indices;
-		return false;
-	}
-
-	// Create the index buffer.
-	result = device->CreateBuffer(&indexBufferDesc, &indexData, m_lineIndexBuffer.GetAddressOf());
-	if (FAILED(result)) {
-		delete[] vertices;
-		delete[] indices;
-		return false;
-	}
-	// Store the index count for rendering.
-	m_lineIndexCount = indexCount;
-
-	delete[] vertices;
-	delete[] indices;
-
-	return true;
 }
 
 void TerrainCell::RenderLineBuffers(ID3D11DeviceContext* deviceContext) const {
@@ -449,3 +479,7 @@ void TerrainCell::GetCellDimensions(float& maxWidth, float& maxHeight, float& ma
 	minHeight = m_minHeight;
 	minDepth = m_minDepth;
 }
+
+const TerrainMesh::DecodeType& TerrainCell::GetDecode() const {
+	return m_decode;
+}
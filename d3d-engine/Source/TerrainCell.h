@@ -2,71 +2,46 @@
 
 #include <d3d11_2.h>
 #include "DXMath.h"
+#include "TerrainMesh.h"
+#include "TerrainSurface.h"
 
 class TerrainCell {
-	struct VectorType {
-		float x;
-		float y;
-		float z;
-	};
-
-	struct ModelType {
-		float x;
-		float y;
-		float z;
-		float tu;
-		float tv;
-		float nx;
-		float ny;
-		float nz;
-		float tx;
-		float ty;
-		float tz;
-		float bx;
-		float by;
-		float bz;
-		float r;
-		float g;
-		float b;
-		float tu2;
-		float tv2;
-	};
-
 	struct ColorVertexType {
 		Vector3 position;
 		Color color;
 	};
 
-	struct VertexType {
-		Vector3 position;
-		Vector2 texture;
-		Vector3 normal;
-		Vector3 tangent;
-		Vector3 binormal;
-		Color color;
-		Vector2 texture2;
-	};
-
 public:
 	TerrainCell();
 	~TerrainCell();
 
-	bool Initialize(ID3D11Device* device, void* terrainModelPtr, int nodeIndexX, int nodeIndexY, int cellHeight, int cellWidth, int terrainWidth);
-	void Render(ID3D11DeviceContext* deviceContext) const;
+	bool Initialize(ID3D11Device* device, const HeightField* heightField, int nodeIndexX, int nodeIndexY, int cellHeight, int cellWidth, ID3D11Buffer* indexBuffer);
+	bool Initialize(ID3D11Device* device, const TerrainMesh::VertexType* vertices, const float* bounds, int cellHeight, int cellWidth, ID3D11Buffer* indexBuffer);
+	void Update(ID3D11DeviceContext* deviceContext, const HeightField* heightField, int nodeIndexX, int nodeIndexY, int cellHeight, int cellWidth);
+	void Update(ID3D11DeviceContext* deviceContext, const TerrainMesh::VertexType* vertices, const float* bounds, int cellHeight, int cellWidth);
+	void SetSurface(TerrainSurface* surface, int slot);
+	void Shutdown();
+	void Render(ID3D11DeviceContext* deviceContext, int indexStart) const;
 	void RenderLineBuffers(ID3D11DeviceContext* deviceContext) const;
+	bool ReadVertices(ID3D11DeviceContext* deviceContext, TerrainMesh::VertexType* vertices) const;
 
 	int GetVertexCount() const;
 	int GetIndexCount() const;
 	int GetLineBuffersIndexCount() const;
 	void GetCellDimensions(float& maxWidth, float& maxHeight, float& maxDepth, float& minWidth, float& minHeight, float& minDepth) const;
+	const TerrainMesh::DecodeType& GetDecode() const;
 
-	VectorType* m_vertexList;
 private:
 	TerrainCell(const TerrainCell&);
-	bool InitializeBuffers(ID3D11Device* device, int nodeIndexX, int nodeIndexY, int cellHeight, int cellWidth, int terrainWidth, ModelType* terrainModel);
-	void RenderBuffers(ID3D11DeviceContext*) const;
-	void CalculateCellDimensions();
+	bool InitializeBuffers(ID3D11Device* device, const TerrainMesh::VertexType* vertices, int cellHeight, int cellWidth, ID3D11Buffer* indexBuffer);
+	void LoadSurface(const TerrainMesh::VertexType* vertices);
+	void RenderBuffers(ID3D11DeviceContext*, int) const;
+	void SetCellDimensions(const float* bounds);
 	bool BuildLineBuffers(ID3D11Device*);
+	void LoadLineVertices(ColorVertexType* vertices, unsigned long* indices) const;
+
+	// Two vertices for each of the twelve edges of the bounding box.
+	static const int LINE_VERTEX_COUNT = 24;
 
 	Microsoft::WRL::ComPtr<ID3D11Buffer> m_vertexBuffer;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> m_indexBuffer;
@@ -88,4 +63,9 @@ private:
 	float m_positionY;
 	float m_positionZ;
 
+	TerrainMesh::DecodeType m_decode;
+
+	TerrainSurface* m_Surface;
+	int m_surfaceSlot;
+
 };
@@ -0,0 +1,342 @@
+#include "pch.h"
+#include "TerrainKernels.h"
+
+// The face below and right of sample (i, j) spans the samples (i, j + 1), (i + 1, j + 1) and (i, j).  With a unit grid
+// spacing its cross product reduces to two height differences for X and Z and a constant one for Y.  Every kernel
+// sums the four faces around a vertex in the same order so the vector and scalar paths give identical results.
+
+static void AddFaceNormalSse2(__m128 x, __m128 z, __m128& sumX, __m128& sumY, __m128& sumZ) {
+	__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_set1_ps(1.0f)), _mm_mul_ps(z, z));
+	__m128 inverseLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lengthSquared));
+
+	sumX = _mm_add_ps(sumX, _mm_mul_ps(x, inverseLength));
+	sumY = _mm_add_ps(sumY, inverseLength);
+	sumZ = _mm_add_ps(sumZ, _mm_mul_ps(z, inverseLength));
+}
+
+static __m128i PackNormalsSse2(__m128 x, __m128 y, __m128 z) {
+	// Project onto the octahedron, the sum of upward facing faces always lands in the upper half so nothing needs folding.
+	__m128 signMask = _mm_set1_ps(-0.0f);
+	__m128 length = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signMask, x), _mm_andnot_ps(signMask, y)), _mm_andnot_ps(signMask, z));
+	__m128 u = _mm_min_ps(_mm_max_ps(_mm_div_ps(x, length), _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+	__m128 v = _mm_min_ps(_mm_max_ps(_mm_div_ps(z, length), _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+	u = _mm_add_ps(_mm_mul_ps(u, _mm_set1_ps(32767.0f)), _mm_set1_ps(0.5f));
+	v = _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(32767.0f)), _mm_set1_ps(0.5f));
+
+	// SSE2 has no floor so truncate and step the negative values with a fraction down by one.
+	__m128i packedU = _mm_cvttps_epi32(u);
+	__m128i packedV = _mm_cvttps_epi32(v);
+	packedU = _mm_add_epi32(packedU, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(packedU), u)));
+	packedV = _mm_add_epi32(packedV, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(packedV), v)));
+
+	return _mm_or_si128(_mm_and_si128(packedU, _mm_set1_epi32(0xffff)), _mm_slli_epi32(packedV, 16));
+}
+
+static void AddFaceNormalAvx2(__m256 x, __m256 z, __m256& sumX, __m256& sumY, __m256& sumZ) {
+	__m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_set1_ps(1.0f)), _mm256_mul_ps(z, z));
+	__m256 inverseLength = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(lengthSquared));
+
+	sumX = _mm256_add_ps(sumX, _mm256_mul_ps(x, inverseLength));
+	sumY = _mm256_add_ps(sumY, inverseLength);
+	sumZ = _mm256_add_ps(sumZ, _mm256_mul_ps(z, inverseLength));
+}
+
+static __m256i PackNormalsAvx2(__m256 x, __m256 y, __m256 z) {
+	__m256 signMask = _mm256_set1_ps(-0.0f);
+	__m256 length = _mm256_add_ps(_mm256_add_ps(_mm256_andnot_ps(signMask, x), _mm256_andnot_ps(signMask, y)), _mm256_andnot_ps(signMask, z));
+	__m256 u = _mm256_min_ps(_mm256_max_ps(_mm256_div_ps(x, length), _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+	__m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_div_ps(z, length), _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+	u = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(u, _mm256_set1_ps(32767.0f)), _mm256_set1_ps(0.5f)));
+	v = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps(32767.0f)), _mm256_set1_ps(0.5f)));
+
+	__m256i packedU = _mm256_cvttps_epi32(u);
+	__m256i packedV = _mm256_cvttps_epi32(v);
+
+	return _mm256_or_si256(_mm256_and_si256(packedU, _mm256_set1_epi32(0xffff)), _mm256_slli_epi32(packedV, 16));
+}
+
+TerrainKernels::InstructionSet TerrainKernels::m_instructionSet = TerrainKernels::SupportsAvx2() ? TerrainKernels::AVX2 : TerrainKernels::SSE2;
+
+void TerrainKernels::CalculateNormals(HeightField* heightField, int startRow, int endRow) {
+	CalculateNormals(heightField, startRow, endRow, 0, heightField->GetWidth());
+}
+
+void TerrainKernels::CalculateNormals(HeightField* heightField, int startRow, int endRow, int startColumn, int endColumn) {
+	InstructionSet instructionSet = m_instructionSet;
+	int width = heightField->GetWidth();
+	int height = heightField->GetHeight();
+
+	// Every vertex reads the heights of its own faces directly so rows, and blocks of columns within them, can be
+	// processed in any order.
+	for (int j = startRow; j < endRow; j++) {
+		int column = startColumn;
+
+		// Only the inside rows have all four faces around each vertex, the first and last column never do.
+		if ((j > 0) && (j < height - 1) && (width > 2)) {
+			if (column == 0) {
+				CalculateNormalsScalar(heightField, j, 0, 1);
+				column = 1;
+			}
+
+			int insideEndColumn = std::min(endColumn, width - 1);
+			if (column < insideEndColumn) {
+				if (instructionSet == AVX2) {
+					column = CalculateNormalsAvx2(heightField, j, column, insideEndColumn);
+				}
+				else if (instructionSet == SSE2) {
+					column = CalculateNormalsSse2(heightField, j, column, insideEndColumn);
+				}
+			}
+		}
+
+		// Finish the row with whatever the vector loop did not cover.
+		CalculateNormalsScalar(heightField, j, column, endColumn);
+	}
+}
+
+void TerrainKernels::CalculateTangentFrames(const HeightField* heightField, int row, int startColumn, int count, float* tangentX, float* tangentY, float* binormalY, float* binormalZ) {
+	InstructionSet instructionSet = m_instructionSet;
+	int width = heightField->GetWidth();
+	int endColumn = startColumn + count;
+	int column = startColumn;
+
+	// The first column has no left neighbour so it takes a one sided difference.
+	if (column == 0) {
+		CalculateTangentFramesScalar(heightField, row, 0, 1, startColumn, tangentX, tangentY, binormalY, binormalZ);
+		column = 1;
+	}
+
+	// Vectorize the columns with a neighbour on both sides.
+	int insideEndColumn = std::min(endColumn, width - 1);
+	if (column < insideEndColumn) {
+		if (instructionSet == AVX2) {
+			column = CalculateTangentFramesAvx2(heightField, row, column, insideEndColumn, startColumn, tangentX, tangentY, binormalY, binormalZ);
+		}
+		else if (instructionSet == SSE2) {
+			column = CalculateTangentFramesSse2(heightField, row, column, insideEndColumn, startColumn, tangentX, tangentY, binormalY, binormalZ);
+		}
+	}
+
+	CalculateTangentFramesScalar(heightField, row, column, endColumn, startColumn, tangentX, tangentY, binormalY, binormalZ);
+}
+
+bool TerrainKernels::SupportsAvx2() {
+	int info[4];
+
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+
+	// The CPU has to support AVX and the OS has to save the YMM registers before AVX2 can be used.
+	__cpuid(info, 1);
+	if (((info[2] & (1 << 27)) == 0) || ((info[2] & (1 << 28)) == 0)) {
+		return false;
+	}
+
+	if ((_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+
+	__cpuidex(info, 7, 0);
+
+	return (info[1] & (1 << 5)) != 0;
+}
+
+TerrainKernels::InstructionSet TerrainKernels::GetInstructionSet() {
+	return m_instructionSet;
+}
+
+void TerrainKernels::SetInstructionSet(InstructionSet instructionSet) {
+	// Never go past what the CPU has.  Only change it while no kernel is running.
+	m_instructionSet = SupportsAvx2() ? instructionSet : std::min(instructionSet, SSE2);
+}
+
+void TerrainKernels::CalculateNormalsScalar(HeightField* heightField, int row, int startColumn, int endColumn) {
+	int width = heightField->GetWidth();
+	int height = heightField->GetHeight();
+	unsigned int* normals = heightField->GetNormalRow(row);
+
+	for (int i = startColumn; i < endColumn; i++) {
+		float sum[3] = { 0.0f, 0.0f, 0.0f };
+
+		// Bottom left face.
+		if ((i > 0) && (row > 0)) {
+			AddFaceNormal(heightField, i - 1, row - 1, sum);
+		}
+
+		// Bottom right face.
+		if ((i < width - 1) && (row > 0)) {
+			AddFaceNormal(heightField, i, row - 1, sum);
+		}
+
+		// Upper left face.
+		if ((i > 0) && (row < height - 1)) {
+			AddFaceNormal(heightField, i - 1, row, sum);
+		}
+
+		// Upper right face.
+		if ((i < width - 1) && (row < height - 1)) {
+			AddFaceNormal(heightField, i, row, sum);
+		}
+
+		// The packed normal is a projection of the direction so the sum does not need normalizing first.
+		normals[i] = HeightField::PackNormal(sum[0], sum[1], sum[2]);
+	}
+}
+
+int TerrainKernels::CalculateNormalsSse2(HeightField* heightField, int row, int startColumn, int endColumn) {
+	const float* previousRow = heightField->GetHeightRow(row - 1);
+	const float* currentRow = heightField->GetHeightRow(row);
+	const float* nextRow = heightField->GetHeightRow(row + 1);
+	unsigned int* normals = heightField->GetNormalRow(row);
+	int i = startColumn;
+
+	for (; i + 4 <= endColumn; i += 4) {
+		__m128 previousLeft = _mm_loadu_ps(previousRow + i - 1);
+		__m128 previousCenter = _mm_loadu_ps(previousRow + i);
+		__m128 left = _mm_loadu_ps(currentRow + i - 1);
+		__m128 center = _mm_loadu_ps(currentRow + i);
+		__m128 right = _mm_loadu_ps(currentRow + i + 1);
+		__m128 nextLeft = _mm_loadu_ps(nextRow + i - 1);
+		__m128 nextCenter = _mm_loadu_ps(nextRow + i);
+		__m128 nextRight = _mm_loadu_ps(nextRow + i + 1);
+		__m128 sumX = _mm_setzero_ps();
+		__m128 sumY = _mm_setzero_ps();
+		__m128 sumZ = _mm_setzero_ps();
+
+		AddFaceNormalSse2(_mm_sub_ps(left, center), _mm_sub_ps(left, previousLeft), sumX, sumY, sumZ);
+		AddFaceNormalSse2(_mm_sub_ps(center, right), _mm_sub_ps(center, previousCenter), sumX, sumY, sumZ);
+		AddFaceNormalSse2(_mm_sub_ps(nextLeft, nextCenter), _mm_sub_ps(nextLeft, left), sumX, sumY, sumZ);
+		AddFaceNormalSse2(_mm_sub_ps(nextCenter, nextRight), _mm_sub_ps(nextCenter, center), sumX, sumY, sumZ);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(normals + i), PackNormalsSse2(sumX, sumY, sumZ));
+	}
+
+	return i;
+}
+
+int TerrainKernels::CalculateNormalsAvx2(HeightField* heightField, int row, int startColumn, int endColumn) {
+	const float* previousRow = heightField->GetHeightRow(row - 1);
+	const float* currentRow = heightField->GetHeightRow(row);
+	const float* nextRow = heightField->GetHeightRow(row + 1);
+	unsigned int* normals = heightField->GetNormalRow(row);
+	int i = startColumn;
+
+	for (; i + 8 <= endColumn; i += 8) {
+		__m256 previousLeft = _mm256_loadu_ps(previousRow + i - 1);
+		__m256 previousCenter = _mm256_loadu_ps(previousRow + i);
+		__m256 left = _mm256_loadu_ps(currentRow + i - 1);
+		__m256 center = _mm256_loadu_ps(currentRow + i);
+		__m256 right = _mm256_loadu_ps(currentRow + i + 1);
+		__m256 nextLeft = _mm256_loadu_ps(nextRow + i - 1);
+		__m256 nextCenter = _mm256_loadu_ps(nextRow + i);
+		__m256 nextRight = _mm256_loadu_ps(nextRow + i + 1);
+		__m256 sumX = _mm256_setzero_ps();
+		__m256 sumY = _mm256_setzero_ps();
+		__m256 sumZ = _mm256_setzero_ps();
+
+		AddFaceNormalAvx2(_mm256_sub_ps(left, center), _mm256_sub_ps(left, previousLeft), sumX, sumY, sumZ);
+		AddFaceNormalAvx2(_mm256_sub_ps(center, right), _mm256_sub_ps(center, previousCenter), sumX, sumY, sumZ);
+		AddFaceNormalAvx2(_mm256_sub_ps(nextLeft, nextCenter), _mm256_sub_ps(nextLeft, left), sumX, sumY, sumZ);
+		AddFaceNormalAvx2(_mm256_sub_ps(nextCenter, nextRight), _mm256_sub_ps(nextCenter, center), sumX, sumY, sumZ);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(normals + i), PackNormalsAvx2(sumX, sumY, sumZ));
+	}
+
+	// Pick up a remaining group of four with SSE2 before falling back to scalar.
+	return CalculateNormalsSse2(heightField, row, i, endColumn);
+}
+
+void TerrainKernels::AddFaceNormal(const HeightField* heightField, int i, int j, float sum[3]) {
+	float x = heightField->GetHeight(i, j + 1) - heightField->GetHeight(i + 1, j + 1);
+	float z = heightField->GetHeight(i, j + 1) - heightField->GetHeight(i, j);
+	float inverseLength = 1.0f / sqrtf(((x * x) + 1.0f) + (z * z));
+
+	sum[0] += x * inverseLength;
+	sum[1] += inverseLength;
+	sum[2] += z * inverseLength;
+}
+
+void TerrainKernels::CalculateTangentFramesScalar(const HeightField* heightField, int row, int startColumn, int endColumn, int outputOffset, float* tangentX, float* tangentY, float* binormalY, float* binormalZ) {
+	int width = heightField->GetWidth();
+	int height = heightField->GetHeight();
+
+	// Take central differences of the heights, falling back to one sided differences on the terrain border.
+	int previousRow = std::max(row - 1, 0);
+	int nextRow = std::min(row + 1, height - 1);
+	float rowScale = 1.0f / static_cast<float>(nextRow - previousRow);
+
+	for (int i = startColumn; i < endColumn; i++) {
+		int leftColumn = std::max(i - 1, 0);
+		int rightColumn = std::min(i + 1, width - 1);
+		float columnScale = 1.0f / static_cast<float>(rightColumn - leftColumn);
+		int output = i - outputOffset;
+
+		// The tangent follows the first texture along +X.
+		float rise = (heightField->GetHeight(rightColumn, row) - heightField->GetHeight(leftColumn, row)) * columnScale;
+		float inverseLength = 1.0f / sqrtf(1.0f + (rise * rise));
+		tangentX[output] = inverseLength;
+		tangentY[output] = rise * inverseLength;
+
+		// The binormal follows the first texture down the rows, which is -Z.
+		rise = (heightField->GetHeight(i, nextRow) - heightField->GetHeight(i, previousRow)) * rowScale;
+		inverseLength = 1.0f / sqrtf(1.0f + (rise * rise));
+		binormalY[output] = rise * inverseLength;
+		binormalZ[output] = -inverseLength;
+	}
+}
+
+int TerrainKernels::CalculateTangentFramesSse2(const HeightField* heightField, int row, int startColumn, int endColumn, int outputOffset, float* tangentX, float* tangentY, float* binormalY, float* binormalZ) {
+	int previousRow = std::max(row - 1, 0);
+	int nextRow = std::min(row + 1, heightField->GetHeight() - 1);
+	const float* previousHeights = heightField->GetHeightRow(previousRow);
+	const float* currentHeights = heightField->GetHeightRow(row);
+	const float* nextHeights = heightField->GetHeightRow(nextRow);
+	__m128 rowScale = _mm_set1_ps(1.0f / static_cast<float>(nextRow - previousRow));
+	__m128 signMask = _mm_set1_ps(-0.0f);
+	int i = startColumn;
+
+	for (; i + 4 <= endColumn; i += 4) {
+		int output = i - outputOffset;
+
+		__m128 rise = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(currentHeights + i + 1), _mm_loadu_ps(currentHeights + i - 1)), _mm_set1_ps(0.5f));
+		__m128 inverseLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(_mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(rise, rise))));
+		_mm_storeu_ps(tangentX + output, inverseLength);
+		_mm_storeu_ps(tangentY + output, _mm_mul_ps(rise, inverseLength));
+
+		rise = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nextHeights + i), _mm_loadu_ps(previousHeights + i)), rowScale);
+		inverseLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(_mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(rise, rise))));
+		_mm_storeu_ps(binormalY + output, _mm_mul_ps(rise, inverseLength));
+		_mm_storeu_ps(binormalZ + output, _mm_xor_ps(inverseLength, signMask));
+	}
+
+	return i;
+}
+
+int TerrainKernels::CalculateTangentFramesAvx2(const HeightField* heightField, int row, int startColumn, int endColumn, int outputOffset, float* tangentX, float* tangentY, float* binormalY, float* binormalZ) {
+	int previousRow = std::max(row - 1, 0);
+	int nextRow = std::min(row + 1, heightField->GetHeight() - 1);
+	const float* previousHeights = heightField->GetHeightRow(previousRow);
+	const float* currentHeights = heightField->GetHeightRow(row);
+	const float* nextHeights = heightField->GetHeightRow(nextRow);
+	__m256 rowScale = _mm256_set1_ps(1.0f / static_cast<float>(nextRow - previousRow));
+	__m256 signMask = _mm256_set1_ps(-0.0f);
+	int i = startColumn;
+
+	for (; i + 8 <= endColumn; i += 8) {
+		int output = i - outputOffset;
+
+		__m256 rise = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(currentHeights + i + 1), _mm256_loadu_ps(currentHeights + i - 1)), _mm256_set1_ps(0.5f));
+		__m256 inverseLength = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(_mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(rise, rise))));
+		_mm256_storeu_ps(tangentX + output, inverseLength);
+		_mm256_storeu_ps(tangentY + output, _mm256_mul_ps(rise, inverseLength));
+
+		rise = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nextHeights + i), _mm256_loadu_ps(previousHeights + i)), rowScale);
+		inverseLength = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(_mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(rise, rise))));
+		_mm256_storeu_ps(binormalY + output, _mm256_mul_ps(rise, inverseLength));
+		_mm256_storeu_ps(binormalZ + output, _mm256_xor_ps(inverseLength, signMask));
+	}
+
+	return CalculateTangentFramesSse2(heightField, row, i, endColumn, outputOffset, tangentX, tangentY, binormalY, binormalZ);
+}
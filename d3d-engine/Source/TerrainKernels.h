@@ -0,0 +1,37 @@
+#pragma once
+
+#include "HeightField.h"
+
+// Vectorized generators for the per-vertex data derived from the height field.  The inside of the terrain is processed
+// with AVX2 or SSE2, picked at run time, and the border samples that are missing neighbours use a scalar path.
+class TerrainKernels {
+public:
+	// Instruction sets the kernels can run with.  The best one the CPU has is used unless another is asked for, which
+	// lets the tests run every path on the same data.
+	enum InstructionSet {
+		SCALAR,
+		SSE2,
+		AVX2
+	};
+
+	static void CalculateNormals(HeightField* heightField, int startRow, int endRow);
+	static void CalculateNormals(HeightField* heightField, int startRow, int endRow, int startColumn, int endColumn);
+	static void CalculateTangentFrames(const HeightField* heightField, int row, int startColumn, int count, float* tangentX, float* tangentY, float* binormalY, float* binormalZ);
+	static bool SupportsAvx2();
+	static InstructionSet GetInstructionSet();
+	static void SetInstructionSet(InstructionSet instructionSet);
+
+private:
+	TerrainKernels();
+	TerrainKernels(const TerrainKernels&);
+
+	static void CalculateNormalsScalar(HeightField* heightField, int row, int startColumn, int endColumn);
+	static int CalculateNormalsSse2(HeightField* heightField, int row, int startColumn, int endColumn);
+	static int CalculateNormalsAvx2(HeightField* heightField, int row, int startColumn, int endColumn);
+	static void AddFaceNormal(const HeightField* heightField, int i, int j, float sum[3]);
+	static void CalculateTangentFramesScalar(const HeightField* heightField, int row, int startColumn, int endColumn, int outputOffset, float* tangentX, float* tangentY, float* binormalY, float* binormalZ);
+	static int CalculateTangentFramesSse2(const HeightField* heightField, int row, int startColumn, int endColumn, int outputOffset, float* tangentX, float* tangentY, float* binormalY, float* binormalZ);
+	static int CalculateTangentFramesAvx2(const HeightField* heightField, int row, int startColumn, int endColumn, int outputOffset, float* tangentX, float* tangentY, float* binormalY, float* binormalZ);
+
+	static InstructionSet m_instructionSet;
+};
@@ -0,0 +1,389 @@
+#include "pch.h"
+#include "TerrainLod.h"
+#include "TerrainMesh.h"
+
+const float TerrainLod::MORPH_FRACTION = 0.3f;
+
+TerrainLod::TerrainLod() :
+	m_cellWidth(0),
+	m_cellHeight(0),
+	m_cellCountX(0),
+	m_cellCountY(0),
+	m_cellCount(0),
+	m_terrainWidth(0),
+	m_terrainHeight(0),
+	m_levelCount(0),
+	m_cellDiagonal(0),
+	m_pixelError(0),
+	m_projectionScale(0),
+	m_cellErrors(nullptr),
+	m_ranges(nullptr),
+	m_morphStarts(nullptr) {}
+
+TerrainLod::TerrainLod(const TerrainLod&) :
+	m_cellWidth(0),
+	m_cellHeight(0),
+	m_cellCountX(0),
+	m_cellCountY(0),
+	m_cellCount(0),
+	m_terrainWidth(0),
+	m_terrainHeight(0),
+	m_levelCount(0),
+	m_cellDiagonal(0),
+	m_pixelError(0),
+	m_projectionScale(0),
+	m_cellErrors(nullptr),
+	m_ranges(nullptr),
+	m_morphStarts(nullptr) {}
+
+TerrainLod::~TerrainLod() {
+	Shutdown();
+}
+
+bool TerrainLod::Initialize(const HeightField* heightField, int cellWidth, int cellHeight, int cellCountX, int cellCountY) {
+	if (!Initialize(cellWidth, cellHeight, cellCountX, cellCountY, heightField->GetTerrainWidth(), heightField->GetTerrainHeight())) {
+		return false;
+	}
+
+	// Find the largest height difference between the full resolution grid and each level of every cell.
+	float* cellErrors = new float[m_cellCount * m_levelCount];
+
+	concurrency::parallel_for(0, m_cellCount, [&](int index) {
+		CalculateCellErrors(heightField, index % cellCountX, index / cellCountX, cellErrors + (index * m_levelCount));
+	});
+
+	SetCellErrors(cellErrors);
+
+	delete[] cellErrors;
+
+	return true;
+}
+
+bool TerrainLod::Initialize(int cellWidth, int cellHeight, int cellCountX, int cellCountY, int terrainWidth, int terrainHeight) {
+	Shutdown();
+
+	m_cellWidth = cellWidth;
+	m_cellHeight = cellHeight;
+	m_cellCountX = cellCountX;
+	m_cellCountY = cellCountY;
+	m_cellCount = cellCountX * cellCountY;
+	m_terrainWidth = terrainWidth;
+	m_terrainHeight = terrainHeight;
+	m_levelCount = std::min(TerrainMesh::GetLevelCount(cellWidth, cellHeight), static_cast<int>(MAX_LEVELS));
+
+	// Distances are measured across the ground plane so the widest a cell can be is its horizontal diagonal.
+	float sizeX = static_cast<float>(cellWidth - 1);
+	float sizeZ = static_cast<float>(cellHeight - 1);
+	m_cellDiagonal = sqrtf((sizeX * sizeX) + (sizeZ * sizeZ));
+
+	// Nothing has been measured yet so every level of every cell is exact.
+	m_cellErrors = new float[m_cellCount * m_levelCount];
+	m_ranges = new float[m_cellCount * m_levelCount];
+	m_morphStarts = new float[m_cellCount * m_levelCount];
+
+	for (int i = 0; i < m_cellCount * m_levelCount; i++) {
+		m_cellErrors[i] = 0.0f;
+	}
+
+	// Until an error budget is given every cell is drawn at full resolution.
+	SetErrorBudget(0.0f, 0.0f);
+
+	return true;
+}
+
+void TerrainLod::Shutdown() {
+	// Release the errors and bands of the cells.
+	if (m_cellErrors) {
+		delete[] m_cellErrors;
+		m_cellErrors = nullptr;
+	}
+
+	if (m_ranges) {
+		delete[] m_ranges;
+		m_ranges = nullptr;
+	}
+
+	if (m_morphStarts) {
+		delete[] m_morphStarts;
+		m_morphStarts = nullptr;
+	}
+}
+
+void TerrainLod::CalculateCellErrors(const HeightField* heightField, int nodeIndexX, int nodeIndexY, float* errors) const {
+	for (int level = 0; level < m_levelCount; level++) {
+		errors[level] = CalculateCellError(heightField, nodeIndexX, nodeIndexY, level);
+	}
+}
+
+void TerrainLod::SetCellErrors(const float* cellErrors) {
+	// Every cell keeps the errors measured on it.
+	memcpy(m_cellErrors, cellErrors, sizeof(float) * m_cellCount * m_levelCount);
+
+	CalculateRanges();
+}
+
+void TerrainLod::UpdateCellErrors(const HeightField* heightField, int startX, int startY, int endX, int endY) {
+	// Measure the edited block of cells again, the cells around it keep their errors.
+	for (int nodeIndexY = startY; nodeIndexY <= endY; nodeIndexY++) {
+		for (int nodeIndexX = startX; nodeIndexX <= endX; nodeIndexX++) {
+			CalculateCellErrors(heightField, nodeIndexX, nodeIndexY, m_cellErrors + (((nodeIndexY * m_cellCountX) + nodeIndexX) * m_levelCount));
+		}
+	}
+
+	// The bands of one cell can push out the bands of cells well away from it, so they are all worked out again.
+	CalculateRanges();
+}
+
+void TerrainLod::SetLevelErrors(const float* cellErrors, int cellCount) {
+	// Only some of the cells were measured, so every cell takes the worst of them for each level.
+	for (int level = 0; level < m_levelCount; level++) {
+		float levelError = 0.0f;
+
+		for (int index = 0; index < cellCount; index++) {
+			levelError = std::max(levelError, cellErrors[(index * m_levelCount) + level]);
+		}
+
+		for (int cellId = 0; cellId < m_cellCount; cellId++) {
+			m_cellErrors[(cellId * m_levelCount) + level] = levelError;
+		}
+	}
+
+	CalculateRanges();
+}
+
+void TerrainLod::SetErrorBudget(float pixelError, float projectionScale) {
+	m_pixelError = pixelError;
+	m_projectionScale = projectionScale;
+
+	CalculateRanges();
+}
+
+int TerrainLod::SelectLevel(int cellId, float distance) const {
+	const float* ranges = m_ranges + (cellId * m_levelCount);
+	int level = 0;
+
+	while ((level < m_levelCount - 1) && (distance >= ranges[level])) {
+		level++;
+	}
+
+	return level;
+}
+
+void TerrainLod::SelectLevels(float cameraX, float cameraZ, const int* cellIds, int cellCount, int* levels) const {
+	// Each cell uses the level for the closest point of its footprint to the camera.
+	for (int i = 0; i < cellCount; i++) {
+		levels[cellIds[i]] = SelectLevel(cellIds[i], GetCellDistance(cellIds[i], cameraX, cameraZ));
+	}
+}
+
+int TerrainLod::GetLevelCount() const {
+	return m_levelCount;
+}
+
+const float* TerrainLod::GetCellErrors(int cellId) const {
+	return m_cellErrors + (cellId * m_levelCount);
+}
+
+float TerrainLod::GetRange(int cellId, int level) const {
+	return m_ranges[(cellId * m_levelCount) + level];
+}
+
+float TerrainLod::GetMorphStart(int cellId, int level) const {
+	return m_morphStarts[(cellId * m_levelCount) + level];
+}
+
+float TerrainLod::GetMorphEnd(int cellId, int level) const {
+	return m_ranges[(cellId * m_levelCount) + level];
+}
+
+TerrainLod::MorphType TerrainLod::GetMorph(int cellId, int level) const {
+	int nodeIndexX = cellId % m_cellCountX;
+	int nodeIndexY = cellId / m_cellCountX;
+
+	MorphType morph;
+	morph.start = GetMorphStart(cellId, level);
+	morph.end = GetMorphEnd(cellId, level);
+
+	// The cells across the left, right, top and bottom edges, the edges of the terrain have nothing across them.
+	int neighbours[4];
+	neighbours[0] = (nodeIndexX > 0) ? cellId - 1 : -1;
+	neighbours[1] = (nodeIndexX < m_cellCountX - 1) ? cellId + 1 : -1;
+	neighbours[2] = (nodeIndexY > 0) ? cellId - m_cellCountX : -1;
+	neighbours[3] = (nodeIndexY < m_cellCountY - 1) ? cellId + m_cellCountX : -1;
+
+	// A shared edge finishes morphing by the time the nearer of the two bands does, so it is done whichever of the
+	// cells moves on to the next level first.  Both cells take the same band for the edge whenever they are at the
+	// same level, and the vertices the coarser cell drops are never moving when they're a level apart.
+	for (int edge = 0; edge < 4; edge++) {
+		if (neighbours[edge] < 0) {
+			morph.edgeStarts[edge] = morph.start;
+			morph.edgeEnds[edge] = morph.end;
+		}
+		else {
+			morph.edgeStarts[edge] = std::min(morph.start, GetMorphStart(neighbours[edge], level));
+			morph.edgeEnds[edge] = std::min(morph.end, GetMorphEnd(neighbours[edge], level));
+		}
+	}
+
+	return morph;
+}
+
+float TerrainLod::GetCellDistance(int cellId, float cameraX, float cameraZ) const {
+	int nodeIndexX = cellId % m_cellCountX;
+	int nodeIndexY = cellId / m_cellCountX;
+
+	// Get the footprint of the cell, rows run towards -Z from the back of the terrain and the cells on the far edges
+	// stop at the edge.
+	float minX = static_cast<float>(nodeIndexX * (m_cellWidth - 1));
+	float maxX = std::min(minX + static_cast<float>(m_cellWidth - 1), static_cast<float>(m_terrainWidth - 1));
+	float maxZ = static_cast<float>(m_terrainHeight - 1 - (nodeIndexY * (m_cellHeight - 1)));
+	float minZ = std::max(maxZ - static_cast<float>(m_cellHeight - 1), 0.0f);
+
+	float distanceX = std::max(std::max(minX - cameraX, cameraX - maxX), 0.0f);
+	float distanceZ = std::max(std::max(minZ - cameraZ, cameraZ - maxZ), 0.0f);
+
+	return sqrtf((distanceX * distanceX) + (distanceZ * distanceZ));
+}
+
+void TerrainLod::CalculateRanges() {
+	// Without a budget the full resolution level covers every distance.
+	if ((m_pixelError <= 0.0f) || (m_projectionScale <= 0.0f)) {
+		for (int i = 0; i < m_cellCount * m_levelCount; i++) {
+			m_ranges[i] = FLT_MAX;
+			m_morphStarts[i] = FLT_MAX;
+		}
+
+		return;
+	}
+
+	// Each level has to leave the part of its band before the morph at least two cells wide.  Together with neighbours
+	// whose bands are never more than a cell apart, a cell then never gets more than one level from its neighbours, and
+	// the vertices it drops along an edge have never started moving when its neighbour is a level finer.
+	float minimumWidth = (2.0f * m_cellDiagonal) / (1.0f - MORPH_FRACTION);
+
+	for (int level = 0; level < m_levelCount - 1; level++) {
+		for (int cellId = 0; cellId < m_cellCount; cellId++) {
+			int index = (cellId * m_levelCount) + level;
+			float previousRange = (level > 0) ? m_ranges[index - 1] : 0.0f;
+
+			// The next level can be shown once its error projects to less than the budget, which has to happen before
+			// this level starts morphing towards it.
+			float coarseDistance = (m_cellErrors[index + 1] * m_projectionScale) / m_pixelError;
+			float range = (coarseDistance - (MORPH_FRACTION * previousRange)) / (1.0f - MORPH_FRACTION);
+
+			m_ranges[index] = std::max(range, previousRange + minimumWidth);
+		}
+
+		// Push out the bands that are more than a cell nearer than a neighbour's.  Bands only ever grow so every cell
+		// still meets its budget.
+		SpreadRanges(level);
+
+		for (int cellId = 0; cellId < m_cellCount; cellId++) {
+			int index = (cellId * m_levelCount) + level;
+			float previousRange = (level > 0) ? m_ranges[index - 1] : 0.0f;
+
+			m_morphStarts[index] = m_ranges[index] - (MORPH_FRACTION * (m_ranges[index] - previousRange));
+		}
+	}
+
+	// The coarsest level covers everything beyond and has nothing to morph to.
+	for (int cellId = 0; cellId < m_cellCount; cellId++) {
+		int index = (cellId * m_levelCount) + m_levelCount - 1;
+
+		m_ranges[index] = FLT_MAX;
+		m_morphStarts[index] = FLT_MAX;
+	}
+}
+
+void TerrainLod::SpreadRanges(int level) {
+	// Raise each band to within a cell diagonal of the widest band of any cell around it.  One pass down the grid and
+	// one pass back up carry every band across the whole grid, losing a diagonal for each cell it crosses.
+	for (int nodeIndexY = 0; nodeIndexY < m_cellCountY; nodeIndexY++) {
+		for (int nodeIndexX = 0; nodeIndexX < m_cellCountX; nodeIndexX++) {
+			float& range = m_ranges[(((nodeIndexY * m_cellCountX) + nodeIndexX) * m_levelCount) + level];
+
+			for (int offsetX = -1; offsetX <= 1; offsetX++) {
+				int neighbourX = nodeIndexX + offsetX;
+				int neighbourY = nodeIndexY - 1;
+
+				if ((neighbourY >= 0) && (neighbourX >= 0) && (neighbourX < m_cellCountX)) {
+					range = std::max(range, m_ranges[(((neighbourY * m_cellCountX) + neighbourX) * m_levelCount) + level] - m_cellDiagonal);
+				}
+			}
+
+			if (nodeIndexX > 0) {
+				range = std::max(range, m_ranges[(((nodeIndexY * m_cellCountX) + nodeIndexX - 1) * m_levelCount) + level] - m_cellDiagonal);
+			}
+		}
+	}
+
+	for (int nodeIndexY = m_cellCountY - 1; nodeIndexY >= 0; nodeIndexY--) {
+		for (int nodeIndexX = m_cellCountX - 1; nodeIndexX >= 0; nodeIndexX--) {
+			float& range = m_ranges[(((nodeIndexY * m_cellCountX) + nodeIndexX) * m_levelCount) + level];
+
+			for (int offsetX = -1; offsetX <= 1; offsetX++) {
+				int neighbourX = nodeIndexX + offsetX;
+				int neighbourY = nodeIndexY + 1;
+
+				if ((neighbourY < m_cellCountY) && (neighbourX >= 0) && (neighbourX < m_cellCountX)) {
+					range = std::max(range, m_ranges[(((neighbourY * m_cellCountX) + neighbourX) * m_levelCount) + level] - m_cellDiagonal);
+				}
+			}
+
+			if (nodeIndexX < m_cellCountX - 1) {
+				range = std::max(range, m_ranges[(((nodeIndexY * m_cellCountX) + nodeIndexX + 1) * m_levelCount) + level] - m_cellDiagonal);
+			}
+		}
+	}
+}
+
+float TerrainLod::CalculateCellError(const HeightField* heightField, int nodeIndexX, int nodeIndexY, int level) const {
+	int stride = 1 << level;
+	float inverseStride = 1.0f / static_cast<float>(stride);
+	int startX = (nodeIndexX * (m_cellWidth - 1)) - heightField->GetOriginX();
+	int startY = (nodeIndexY * (m_cellHeight - 1)) - heightField->GetOriginY();
+	int quadCountX = (m_cellWidth - 1) / stride;
+	int quadCountY = (m_cellHeight - 1) / stride;
+	float error = 0.0f;
+
+	// Visit the quads of this level one at a time so each reads its corners once.  A quad takes the grid points from
+	// its upper left corner up to the next quad, the last quad along each side takes the points on the far edge too.
+	for (int quadY = 0; quadY < quadCountY; quadY++) {
+		int quadJ = quadY * stride;
+		int endJ = (quadY == quadCountY - 1) ? m_cellHeight : quadJ + stride;
+		const float* upperRow = heightField->GetHeightRow(startY + quadJ) + startX;
+		const float* bottomRow = heightField->GetHeightRow(startY + quadJ + stride) + startX;
+
+		for (int quadX = 0; quadX < quadCountX; quadX++) {
+			int quadI = quadX * stride;
+			int endI = (quadX == quadCountX - 1) ? m_cellWidth : quadI + stride;
+			float upperLeft = upperRow[quadI];
+			float upperRight = upperRow[quadI + stride];
+			float bottomLeft = bottomRow[quadI];
+			float bottomRight = bottomRow[quadI + stride];
+
+			for (int j = quadJ; j < endJ; j++) {
+				const float* heights = heightField->GetHeightRow(startY + j) + startX;
+				float v = static_cast<float>(j - quadJ) * inverseStride;
+
+				for (int i = quadI; i < endI; i++) {
+					float u = static_cast<float>(i - quadI) * inverseStride;
+
+					// Interpolate across whichever of the two triangles split along the upper right to bottom left
+					// diagonal it is in.
+					float surface;
+					if (u + v <= 1.0f) {
+						surface = upperLeft + (u * (upperRight - upperLeft)) + (v * (bottomLeft - upperLeft));
+					}
+					else {
+						surface = bottomRight + ((1.0f - u) * (bottomLeft - bottomRight)) + ((1.0f - v) * (upperRight - bottomRight));
+					}
+
+					error = std::max(error, fabsf(heights[i] - surface));
+				}
+			}
+		}
+	}
+
+	return error;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "HeightField.h"
+
+// Continuous distance based level of detail for the terrain cells.  Level L of a cell draws every 2^L'th grid point so
+// the levels form a quadtree inside the cell, and the vertices that level L + 1 drops are morphed onto the coarser
+// surface over the far end of level L's distance band so switching levels never pops.  Each cell gets its own bands
+// from its own errors and a screen space error budget, so flat cells coarsen sooner than rough ones.  Nothing in here
+// touches the device, so the selection can be run on its own.
+class TerrainLod {
+public:
+	// Distances the vertices of a cell's level morph over.  A vertex on an edge of the cell shared with another cell
+	// uses the band of that edge instead, which both cells agree on, so the shared vertices always end up in the same
+	// place.  The edges are in the order left, right, top and bottom, the top being the first row towards +Z.
+	struct MorphType {
+		float start;
+		float end;
+		float edgeStarts[4];
+		float edgeEnds[4];
+	};
+
+	TerrainLod();
+	~TerrainLod();
+
+	bool Initialize(const HeightField* heightField, int cellWidth, int cellHeight, int cellCountX, int cellCountY);
+	bool Initialize(int cellWidth, int cellHeight, int cellCountX, int cellCountY, int terrainWidth, int terrainHeight);
+	void Shutdown();
+	void CalculateCellErrors(const HeightField* heightField, int nodeIndexX, int nodeIndexY, float* errors) const;
+	void SetCellErrors(const float* cellErrors);
+	void UpdateCellErrors(const HeightField* heightField, int startX, int startY, int endX, int endY);
+	void SetLevelErrors(const float* cellErrors, int cellCount);
+	void SetErrorBudget(float pixelError, float projectionScale);
+	int SelectLevel(int cellId, float distance) const;
+	void SelectLevels(float cameraX, float cameraZ, const int* cellIds, int cellCount, int* levels) const;
+
+	int GetLevelCount() const;
+	const float* GetCellErrors(int cellId) const;
+	float GetRange(int cellId, int level) const;
+	float GetMorphStart(int cellId, int level) const;
+	float GetMorphEnd(int cellId, int level) const;
+	MorphType GetMorph(int cellId, int level) const;
+	float GetCellDistance(int cellId, float cameraX, float cameraZ) const;
+
+private:
+	TerrainLod(const TerrainLod&);
+
+	void CalculateRanges();
+	void SpreadRanges(int level);
+	float CalculateCellError(const HeightField* heightField, int nodeIndexX, int nodeIndexY, int level) const;
+
+	static const int MAX_LEVELS = 16;
+
+	// Fraction of each level's distance band spent morphing towards the next level.
+	static const float MORPH_FRACTION;
+
+	int m_cellWidth;
+	int m_cellHeight;
+	int m_cellCountX;
+	int m_cellCountY;
+	int m_cellCount;
+	int m_terrainWidth;
+	int m_terrainHeight;
+	int m_levelCount;
+	float m_cellDiagonal;
+	float m_pixelError;
+	float m_projectionScale;
+	float* m_cellErrors;
+	float* m_ranges;
+	float* m_morphStarts;
+};
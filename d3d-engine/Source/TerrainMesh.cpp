@@ -0,0 +1,296 @@
+#include "pch.h"
+#include "TerrainMesh.h"
+#include "TerrainKernels.h"
+
+int TerrainMesh::GetVertexCount(int cellWidth, int cellHeight) {
+	// Every grid point of the cell is stored once and shared by the quads around it.
+	return cellWidth * cellHeight;
+}
+
+int TerrainMesh::GetLevelCount(int cellWidth, int cellHeight) {
+	// Each level halves the quads along both sides of the cell so it can go on while both quad counts stay even.
+	int levelCount = 1;
+	int stride = 1;
+
+	while ((((cellWidth - 1) % (stride * 2)) == 0) && (((cellHeight - 1) % (stride * 2)) == 0)) {
+		stride *= 2;
+		levelCount++;
+	}
+
+	return levelCount;
+}
+
+int TerrainMesh::GetIndexCount(int cellWidth, int cellHeight, int level) {
+	int stride = 1 << level;
+
+	return ((cellWidth - 1) / stride) * ((cellHeight - 1) / stride) * 6;
+}
+
+int TerrainMesh::GetIndexStart(int cellWidth, int cellHeight, int level) {
+	// The index patterns of all the levels are stored one after another starting with the full resolution one.
+	int start = 0;
+
+	for (int i = 0; i < level; i++) {
+		start += GetIndexCount(cellWidth, cellHeight, i);
+	}
+
+	return start;
+}
+
+void TerrainMesh::BuildIndices(unsigned short* indices, int cellWidth, int cellHeight, int level) {
+	int stride = 1 << level;
+	int index = 0;
+
+	// Create two triangles for each quad of this level using the same corner order as the full resolution quads.
+	for (int j = 0; j < cellHeight - 1; j += stride) {
+		for (int i = 0; i < cellWidth - 1; i += stride) {
+			unsigned short upperLeft = static_cast<unsigned short>((j * cellWidth) + i);
+			unsigned short upperRight = static_cast<unsigned short>(upperLeft + stride);
+			unsigned short bottomLeft = static_cast<unsigned short>(upperLeft + (stride * cellWidth));
+			unsigned short bottomRight = static_cast<unsigned short>(bottomLeft + stride);
+
+			// Triangle 1 - Upper left, upper right, bottom left.
+			indices[index++] = upperLeft;
+			indices[index++] = upperRight;
+			indices[index++] = bottomLeft;
+
+			// Triangle 2 - Bottom left, upper right, bottom right.
+			indices[index++] = bottomLeft;
+			indices[index++] = upperRight;
+			indices[index++] = bottomRight;
+		}
+	}
+}
+
+void TerrainMesh::CalculateBounds(const HeightField* heightField, int nodeIndexX, int nodeIndexY, int cellWidth, int cellHeight, float* bounds) {
+	int startColumn = (nodeIndexX * (cellWidth - 1)) - heightField->GetOriginX();
+	int startRow = (nodeIndexY * (cellHeight - 1)) - heightField->GetOriginY();
+	float maxHeight = -FLT_MAX;
+	float minHeight = FLT_MAX;
+
+	for (int j = 0; j < cellHeight; j++) {
+		const float* heights = heightField->GetHeightRow(startRow + j) + startColumn;
+
+		for (int i = 0; i < cellWidth; i++) {
+			maxHeight = std::max(maxHeight, heights[i]);
+			minHeight = std::min(minHeight, heights[i]);
+		}
+	}
+
+	// The maximum corner comes first, rows run towards -Z so the first row is the deepest.
+	bounds[0] = heightField->GetPositionX(startColumn + cellWidth - 1);
+	bounds[1] = maxHeight;
+	bounds[2] = heightField->GetPositionZ(startRow);
+	bounds[3] = heightField->GetPositionX(startColumn);
+	bounds[4] = minHeight;
+	bounds[5] = heightField->GetPositionZ(startRow + cellHeight - 1);
+}
+
+TerrainMesh::DecodeType TerrainMesh::GetDecode(const float* bounds, int cellWidth, int cellHeight) {
+	DecodeType decode;
+
+	// The first grid point sits on the minimum X and maximum Z of the cell, and the points past the far edges of the
+	// terrain collapse onto the other corner.
+	decode.originX = bounds[3];
+	decode.originZ = bounds[2];
+	decode.limitX = bounds[0];
+	decode.limitZ = bounds[5];
+
+	// Spread the quantized heights across the cell's height range.
+	decode.minHeight = bounds[4];
+	decode.heightStep = (bounds[1] - bounds[4]) / static_cast<float>(HEIGHT_STEPS);
+
+	// The second texture spans the whole cell once.
+	decode.textureScaleX = 1.0f / static_cast<float>(cellWidth - 1);
+	decode.textureScaleY = 1.0f / static_cast<float>(cellHeight - 1);
+	decode.levelCount = GetLevelCount(cellWidth, cellHeight);
+
+	return decode;
+}
+
+void TerrainMesh::BuildVertices(VertexType* vertices, const DecodeType& decode, const HeightField* heightField, int nodeIndexX, int nodeIndexY, int cellWidth, int cellHeight) {
+	int startColumn = (nodeIndexX * (cellWidth - 1)) - heightField->GetOriginX();
+	int startRow = (nodeIndexY * (cellHeight - 1)) - heightField->GetOriginY();
+	int index = 0;
+
+	// Create the arrays that receive the tangent frames of one row of vertices at a time.
+	float* tangentX = new float[cellWidth * 4];
+	float* tangentY = tangentX + cellWidth;
+	float* binormalY = tangentY + cellWidth;
+	float* binormalZ = binormalY + cellWidth;
+
+	for (int j = 0; j < cellHeight; j++) {
+		int y = startRow + j;
+		const unsigned int* normals = heightField->GetNormalRow(y) + startColumn;
+		const unsigned int* colors = heightField->GetColorRow(y) + startColumn;
+
+		TerrainKernels::CalculateTangentFrames(heightField, y, startColumn, cellWidth, tangentX, tangentY, binormalY, binormalZ);
+
+		for (int i = 0; i < cellWidth; i++) {
+			int x = startColumn + i;
+
+			// Store where the vertex is in the cell rather than in the world, the shader puts it back with the cell's decode values.
+			float height = heightField->GetHeight(x, y);
+			vertices[index].position[0] = static_cast<unsigned short>(i);
+			vertices[index].position[1] = static_cast<unsigned short>(j);
+			vertices[index].position[2] = EncodeHeight(height, decode);
+
+			// Store the height this vertex morphs to on the way out of the finest level it is drawn in, the level itself
+			// follows from the column and row.  The coarsest level has nothing to morph to.
+			int level = GetVertexLevel(i, j, decode.levelCount);
+			float morphHeight = (level < decode.levelCount - 1) ? GetMorphHeight(heightField, x, y, i, j, level) : height;
+			vertices[index].position[3] = EncodeHeight(morphHeight, decode);
+
+			// The normal is already packed the way the vertex stores it.
+			vertices[index].normal = normals[i];
+			vertices[index].tangent = HeightField::PackNormal(tangentX[i], tangentY[i], 0.0f);
+
+			// The binormal is rebuilt from the cross product of the normal and tangent, so only which side of the normal
+			// it is on is kept, in the color's alpha.  The tangent has no Z and the binormal has no X.
+			float nx;
+			float ny;
+			float nz;
+			HeightField::UnpackNormal(vertices[index].normal, nx, ny, nz);
+
+			float side = (nz * tangentX[i] * binormalY[i]) + (((nx * tangentY[i]) - (ny * tangentX[i])) * binormalZ[i]);
+			vertices[index].color = (colors[i] & 0x00ffffff) | ((side < 0.0f) ? 0u : 0xff000000u);
+			index++;
+		}
+	}
+
+	delete[] tangentX;
+}
+
+Vector3 TerrainMesh::DecodePosition(const VertexType& vertex, const DecodeType& decode) {
+	// Positions past the far edges of the terrain collapse onto the edge.
+	float x = std::min(decode.originX + static_cast<float>(vertex.position[0]), decode.limitX);
+	float z = std::max(decode.originZ - static_cast<float>(vertex.position[1]), decode.limitZ);
+
+	return Vector3(x, decode.minHeight + (static_cast<float>(vertex.position[2]) * decode.heightStep), z);
+}
+
+float TerrainMesh::DecodeMorphHeight(const VertexType& vertex, const DecodeType& decode) {
+	return decode.minHeight + (static_cast<float>(vertex.position[3]) * decode.heightStep);
+}
+
+int TerrainMesh::DecodeVertexLevel(const VertexType& vertex, const DecodeType& decode) {
+	return GetVertexLevel(vertex.position[0], vertex.position[1], decode.levelCount);
+}
+
+Vector3 TerrainMesh::DecodeBinormal(const VertexType& vertex) {
+	float nx;
+	float ny;
+	float nz;
+	HeightField::UnpackNormal(vertex.normal, nx, ny, nz);
+
+	float tx;
+	float ty;
+	float tz;
+	HeightField::UnpackNormal(vertex.tangent, tx, ty, tz);
+
+	// The binormal is the cross product of the normal and tangent, flipped by the sign in the color's alpha.
+	float bx = (ny * tz) - (nz * ty);
+	float by = (nz * tx) - (nx * tz);
+	float bz = (nx * ty) - (ny * tx);
+	float scale = (((vertex.color >> 24) != 0) ? 1.0f : -1.0f) / sqrtf((bx * bx) + (by * by) + (bz * bz));
+
+	return Vector3(bx * scale, by * scale, bz * scale);
+}
+
+unsigned short TerrainMesh::EncodeHeight(float height, const DecodeType& decode) {
+	// A flat cell has no range to spread the heights over.
+	if (decode.heightStep <= 0.0f) {
+		return 0;
+	}
+
+	float step = floorf(((height - decode.minHeight) / decode.heightStep) + 0.5f);
+
+	return static_cast<unsigned short>(std::min(std::max(step, 0.0f), static_cast<float>(HEIGHT_STEPS)));
+}
+
+int TerrainMesh::GetVertexLevel(int i, int j, int levelCount) {
+	// A vertex is part of every level up to the one where its cell position stops being a multiple of the stride.
+	int level = 0;
+
+	while ((level < levelCount - 1) && ((i % (2 << level)) == 0) && ((j % (2 << level)) == 0)) {
+		level++;
+	}
+
+	return level;
+}
+
+float TerrainMesh::GetMorphHeight(const HeightField* heightField, int x, int y, int i, int j, int level) {
+	int stride = 1 << level;
+	bool oddColumn = ((i >> level) & 1) != 0;
+	bool oddRow = ((j >> level) & 1) != 0;
+
+	// The corners of the coarsest level never morph.
+	if (!oddColumn && !oddRow) {
+		return heightField->GetHeight(x, y);
+	}
+
+	// Past the far edges of the terrain the grid points collapse onto the edge, so the next level's quads are squashed
+	// and the vertex is no longer halfway along their edges.
+	if ((heightField->GetOriginX() + x + stride >= heightField->GetTerrainWidth()) || (heightField->GetOriginY() + y + stride >= heightField->GetTerrainHeight())) {
+		return GetSquashedMorphHeight(heightField, x, y, stride, oddColumn, oddRow);
+	}
+
+	// The vertex sits in the middle of a horizontal edge of the next level's quads.
+	if (oddColumn && !oddRow) {
+		return (heightField->GetHeight(x - stride, y) + heightField->GetHeight(x + stride, y)) * 0.5f;
+	}
+
+	// The vertex sits in the middle of a vertical edge.
+	if (!oddColumn && oddRow) {
+		return (heightField->GetHeight(x, y - stride) + heightField->GetHeight(x, y + stride)) * 0.5f;
+	}
+
+	// The vertex sits in the middle of the quad, on the diagonal from the upper right to the bottom left corner.
+	return (heightField->GetHeight(x + stride, y - stride) + heightField->GetHeight(x - stride, y + stride)) * 0.5f;
+}
+
+float TerrainMesh::GetSquashedMorphHeight(const HeightField* heightField, int x, int y, int stride, bool oddColumn, bool oddRow) {
+	// Find where the vertex lies across the next level's quad from the positions of the quad's sides.  A side that has
+	// collapsed completely only has repeated edge heights along it so any point on it will do.
+	float u = 0.0f;
+	float v = 0.0f;
+
+	if (oddColumn) {
+		float left = heightField->GetPositionX(x - stride);
+		float width = heightField->GetPositionX(x + stride) - left;
+		if (width > 0.0f) {
+			u = (heightField->GetPositionX(x) - left) / width;
+		}
+	}
+
+	if (oddRow) {
+		float top = heightField->GetPositionZ(y - stride);
+		float depth = top - heightField->GetPositionZ(y + stride);
+		if (depth > 0.0f) {
+			v = (top - heightField->GetPositionZ(y)) / depth;
+		}
+	}
+
+	// Interpolate along the edge the vertex is on.
+	if (!oddRow) {
+		float leftHeight = heightField->GetHeight(x - stride, y);
+		return leftHeight + (u * (heightField->GetHeight(x + stride, y) - leftHeight));
+	}
+
+	if (!oddColumn) {
+		float topHeight = heightField->GetHeight(x, y - stride);
+		return topHeight + (v * (heightField->GetHeight(x, y + stride) - topHeight));
+	}
+
+	// Otherwise interpolate across whichever of the quad's two triangles the vertex is in.
+	float upperLeft = heightField->GetHeight(x - stride, y - stride);
+	float upperRight = heightField->GetHeight(x + stride, y - stride);
+	float bottomLeft = heightField->GetHeight(x - stride, y + stride);
+	float bottomRight = heightField->GetHeight(x + stride, y + stride);
+
+	if (u + v <= 1.0f) {
+		return upperLeft + (u * (upperRight - upperLeft)) + (v * (bottomLeft - upperLeft));
+	}
+
+	return bottomRight + ((1.0f - u) * (bottomLeft - bottomRight)) + ((1.0f - v) * (upperRight - bottomRight));
+}
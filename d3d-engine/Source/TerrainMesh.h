@@ -0,0 +1,59 @@
+#pragma once
+
+#include "DXMath.h"
+#include "HeightField.h"
+
+// CPU side generation of the terrain cell meshes.  Nothing in here touches the device so the vertex and index data
+// can be built and checked on its own.
+class TerrainMesh {
+public:
+	// Compact vertex of 20 bytes.  The position is the grid point's column and row within the cell, which also give
+	// the texture coordinates and the level of detail the vertex drops out at, followed by its height and morph height
+	// quantized across the cell's height range.  The normal and tangent are 16 bit octahedral directions packed the
+	// same way as the height field normals, and the alpha of the RGBA8 color is the sign of the binormal.
+	struct VertexType {
+		unsigned short position[4];
+		unsigned int normal;
+		unsigned int tangent;
+		unsigned int color;
+	};
+
+	// Values each cell gives the vertex shader to turn its compact vertices back into the full vertex.
+	struct DecodeType {
+		float originX;
+		float originZ;
+		float limitX;
+		float limitZ;
+		float minHeight;
+		float heightStep;
+		float textureScaleX;
+		float textureScaleY;
+		int levelCount;
+	};
+
+	static int GetVertexCount(int cellWidth, int cellHeight);
+	static int GetLevelCount(int cellWidth, int cellHeight);
+	static int GetIndexCount(int cellWidth, int cellHeight, int level);
+	static int GetIndexStart(int cellWidth, int cellHeight, int level);
+	static void BuildIndices(unsigned short* indices, int cellWidth, int cellHeight, int level);
+	static void CalculateBounds(const HeightField* heightField, int nodeIndexX, int nodeIndexY, int cellWidth, int cellHeight, float* bounds);
+	static DecodeType GetDecode(const float* bounds, int cellWidth, int cellHeight);
+	static void BuildVertices(VertexType* vertices, const DecodeType& decode, const HeightField* heightField, int nodeIndexX, int nodeIndexY, int cellWidth, int cellHeight);
+
+	static Vector3 DecodePosition(const VertexType& vertex, const DecodeType& decode);
+	static float DecodeMorphHeight(const VertexType& vertex, const DecodeType& decode);
+	static int DecodeVertexLevel(const VertexType& vertex, const DecodeType& decode);
+	static Vector3 DecodeBinormal(const VertexType& vertex);
+
+	// Largest value of a quantized height.
+	static const int HEIGHT_STEPS = 65535;
+
+private:
+	TerrainMesh();
+	TerrainMesh(const TerrainMesh&);
+
+	static unsigned short EncodeHeight(float height, const DecodeType& decode);
+	static int GetVertexLevel(int i, int j, int levelCount);
+	static float GetMorphHeight(const HeightField* heightField, int x, int y, int i, int j, int level);
+	static float GetSquashedMorphHeight(const HeightField* heightField, int x, int y, int stride, bool oddColumn, bool oddRow);
+};
@@ -0,0 +1,375 @@
+#include "pch.h"
+#include "TerrainOcclusion.h"
+
+TerrainOcclusion::TerrainOcclusion() :
+	m_width(0),
+	m_height(0),
+	m_occluderSize(0),
+	m_maxOccluders(0),
+	m_levelCount(0),
+	m_levelWidths(),
+	m_levelHeights(),
+	m_levelOffsets(),
+	m_depths(nullptr),
+	m_screenVertices(nullptr),
+	m_viewProjection(),
+	m_cellsRejected(0),
+	m_cullTime(0) {}
+
+TerrainOcclusion::TerrainOcclusion(const TerrainOcclusion&) :
+	m_width(0),
+	m_height(0),
+	m_occluderSize(0),
+	m_maxOccluders(0),
+	m_levelCount(0),
+	m_levelWidths(),
+	m_levelHeights(),
+	m_levelOffsets(),
+	m_depths(nullptr),
+	m_screenVertices(nullptr),
+	m_viewProjection(),
+	m_cellsRejected(0),
+	m_cullTime(0) {}
+
+TerrainOcclusion::~TerrainOcclusion() {
+	Shutdown();
+}
+
+bool TerrainOcclusion::Initialize(int width, int height, int occluderSize, int maxOccluders) {
+	Shutdown();
+
+	if ((width <= 0) || (height <= 0) || (occluderSize <= 0) || (maxOccluders <= 0)) {
+		return false;
+	}
+
+	// Round the rows up to whole groups of four pixels so the rasterizer never steps past the end of a row.
+	m_width = (width + 3) & ~3;
+	m_height = height;
+	m_occluderSize = occluderSize;
+	m_maxOccluders = maxOccluders;
+
+	// The depth buffer is the first level and every level above halves it until a single block covers the buffer.
+	int levelWidth = m_width;
+	int levelHeight = m_height;
+	int blockCount = 0;
+
+	m_levelCount = 0;
+
+	for (;;) {
+		m_levelWidths[m_levelCount] = levelWidth;
+		m_levelHeights[m_levelCount] = levelHeight;
+		m_levelOffsets[m_levelCount] = blockCount;
+		blockCount += levelWidth * levelHeight;
+		m_levelCount++;
+
+		if (((levelWidth == 1) && (levelHeight == 1)) || (m_levelCount == MAX_LEVELS)) {
+			break;
+		}
+
+		levelWidth = (levelWidth + 1) / 2;
+		levelHeight = (levelHeight + 1) / 2;
+	}
+
+	m_depths = new float[blockCount];
+	m_screenVertices = new ScreenVertexType[maxOccluders * GetOccluderVertexCount()];
+
+	return true;
+}
+
+int TerrainOcclusion::Cull(const Matrix& viewProjection, const float* occluderVertices, int occluderCount, const float* bounds, int* cells, int count) {
+	INT64 startTime;
+	QueryPerformanceCounter(reinterpret_cast<LARGE_INTEGER*>(&startTime));
+
+	m_viewProjection = viewProjection;
+	occluderCount = std::min(occluderCount, m_maxOccluders);
+
+	// Project the occluders once, then fill each band of the depth buffer with every occluder that crosses it.
+	TransformOccluders(occluderVertices, occluderCount);
+
+	int bandCount = (m_height + BAND_ROWS - 1) / BAND_ROWS;
+	concurrency::parallel_for(0, bandCount, [&](int band) {
+		RasterizeBand(band, occluderCount);
+	});
+
+	UpdateLevels();
+
+	// Keep the cells whose boxes can still be seen, in the order they were given.  The boxes line up with the cells,
+	// six floats each, and a cell is always read before its place in the list is reused.
+	int visibleCount = 0;
+
+	for (int k = 0; k < count; k++) {
+		const float* box = bounds + (k * 6);
+
+		if (CheckRectangle(box[0], box[1], box[2], box[3], box[4], box[5])) {
+			cells[visibleCount++] = cells[k];
+		}
+	}
+
+	m_cellsRejected = count - visibleCount;
+
+	// Record how long the whole pass took in milliseconds.
+	INT64 endTime;
+	INT64 frequency;
+	QueryPerformanceCounter(reinterpret_cast<LARGE_INTEGER*>(&endTime));
+	QueryPerformanceFrequency(reinterpret_cast<LARGE_INTEGER*>(&frequency));
+
+	m_cullTime = static_cast<float>(endTime - startTime) / static_cast<float>(frequency) * 1000.0f;
+
+	return visibleCount;
+}
+
+int TerrainOcclusion::GetWidth() const {
+	return m_width;
+}
+
+int TerrainOcclusion::GetHeight() const {
+	return m_height;
+}
+
+int TerrainOcclusion::GetOccluderVertexCount() const {
+	return (m_occluderSize + 1) * (m_occluderSize + 1);
+}
+
+int TerrainOcclusion::GetCellsRejected() const {
+	return m_cellsRejected;
+}
+
+float TerrainOcclusion::GetCullTime() const {
+	return m_cullTime;
+}
+
+void TerrainOcclusion::TransformOccluders(const float* occluderVertices, int occluderCount) {
+	const DirectX::XMFLOAT4X4& m = m_viewProjection;
+	int vertexCount = GetOccluderVertexCount();
+
+	concurrency::parallel_for(0, occluderCount, [&](int occluder) {
+		for (int k = occluder * vertexCount; k < (occluder + 1) * vertexCount; k++) {
+			const float* vertex = occluderVertices + (k * 3);
+			ScreenVertexType& screenVertex = m_screenVertices[k];
+
+			float x = (vertex[0] * m._11) + (vertex[1] * m._21) + (vertex[2] * m._31) + m._41;
+			float y = (vertex[0] * m._12) + (vertex[1] * m._22) + (vertex[2] * m._32) + m._42;
+			float z = (vertex[0] * m._13) + (vertex[1] * m._23) + (vertex[2] * m._33) + m._43;
+			float w = (vertex[0] * m._14) + (vertex[1] * m._24) + (vertex[2] * m._34) + m._44;
+
+			// Vertices in front of the near plane aren't clipped against it, the triangles that use them are dropped.
+			screenVertex.clipped = (z < 0.0f) || (w <= 0.0f);
+			if (screenVertex.clipped) {
+				continue;
+			}
+
+			float inverseW = 1.0f / w;
+
+			screenVertex.x = ((x * inverseW * 0.5f) + 0.5f) * static_cast<float>(m_width);
+			screenVertex.y = (0.5f - (y * inverseW * 0.5f)) * static_cast<float>(m_height);
+			screenVertex.depth = z * inverseW;
+		}
+	});
+}
+
+void TerrainOcclusion::RasterizeBand(int band, int occluderCount) {
+	int startRow = band * BAND_ROWS;
+	int endRow = std::min(startRow + BAND_ROWS, m_height);
+
+	// Start the band at the far plane.
+	std::fill(m_depths + (startRow * m_width), m_depths + (endRow * m_width), 1.0f);
+
+	// The occluders come nearest first so the far ones mostly land behind what is already there.  Each quad of an
+	// occluder is two triangles.
+	int side = m_occluderSize + 1;
+	int vertexCount = GetOccluderVertexCount();
+
+	for (int occluder = 0; occluder < occluderCount; occluder++) {
+		const ScreenVertexType* vertices = m_screenVertices + (occluder * vertexCount);
+
+		for (int j = 0; j < m_occluderSize; j++) {
+			for (int i = 0; i < m_occluderSize; i++) {
+				const ScreenVertexType& topLeft = vertices[(j * side) + i];
+				const ScreenVertexType& topRight = vertices[(j * side) + i + 1];
+				const ScreenVertexType& bottomLeft = vertices[((j + 1) * side) + i];
+				const ScreenVertexType& bottomRight = vertices[((j + 1) * side) + i + 1];
+
+				RasterizeTriangle(topLeft, topRight, bottomLeft, startRow, endRow);
+				RasterizeTriangle(topRight, bottomRight, bottomLeft, startRow, endRow);
+			}
+		}
+	}
+}
+
+void TerrainOcclusion::RasterizeTriangle(const ScreenVertexType& v0, const ScreenVertexType& v1, const ScreenVertexType& v2, int startRow, int endRow) {
+	// Leaving a triangle out only lets more cells through.
+	if (v0.clipped || v1.clipped || v2.clipped) {
+		return;
+	}
+
+	// Find the pixels of the band the triangle can cover, starting on a group of four.
+	int startX = std::max(static_cast<int>(floorf(std::min(std::min(v0.x, v1.x), v2.x))), 0) & ~3;
+	int endX = std::min(static_cast<int>(ceilf(std::max(std::max(v0.x, v1.x), v2.x))), m_width);
+	int startY = std::max(static_cast<int>(floorf(std::min(std::min(v0.y, v1.y), v2.y))), startRow);
+	int endY = std::min(static_cast<int>(ceilf(std::max(std::max(v0.y, v1.y), v2.y))), endRow);
+
+	if ((startX >= endX) || (startY >= endY)) {
+		return;
+	}
+
+	float area = ((v1.x - v0.x) * (v2.y - v0.y)) - ((v1.y - v0.y) * (v2.x - v0.x));
+	if (area == 0.0f) {
+		return;
+	}
+
+	// Each edge is a * x + b * y + c, turned so it is positive inside whichever way the triangle winds.
+	float sign = (area > 0.0f) ? 1.0f : -1.0f;
+	const ScreenVertexType* edgeStarts[3] = { &v0, &v1, &v2 };
+	const ScreenVertexType* edgeEnds[3] = { &v1, &v2, &v0 };
+	float edgeA[3];
+	float edgeB[3];
+	float edgeC[3];
+
+	for (int k = 0; k < 3; k++) {
+		edgeA[k] = -(edgeEnds[k]->y - edgeStarts[k]->y) * sign;
+		edgeB[k] = (edgeEnds[k]->x - edgeStarts[k]->x) * sign;
+		edgeC[k] = -((edgeA[k] * edgeStarts[k]->x) + (edgeB[k] * edgeStarts[k]->y));
+	}
+
+	// The depth over screen space is a plane.
+	float depthX = (((v1.depth - v0.depth) * (v2.y - v0.y)) - ((v2.depth - v0.depth) * (v1.y - v0.y))) / area;
+	float depthY = (((v2.depth - v0.depth) * (v1.x - v0.x)) - ((v1.depth - v0.depth) * (v2.x - v0.x))) / area;
+	float depthC = v0.depth - (depthX * v0.x) - (depthY * v0.y);
+
+	// Test the pixel centers four at a time and keep the nearer depth where they are inside.
+	__m128 zero = _mm_setzero_ps();
+	__m128 centers = _mm_add_ps(_mm_set1_ps(static_cast<float>(startX)), _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+	__m128 edgeStep0 = _mm_set1_ps(edgeA[0] * 4.0f);
+	__m128 edgeStep1 = _mm_set1_ps(edgeA[1] * 4.0f);
+	__m128 edgeStep2 = _mm_set1_ps(edgeA[2] * 4.0f);
+	__m128 depthStep = _mm_set1_ps(depthX * 4.0f);
+
+	for (int y = startY; y < endY; y++) {
+		float centerY = static_cast<float>(y) + 0.5f;
+		__m128 edge0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[0]), centers), _mm_set1_ps((edgeB[0] * centerY) + edgeC[0]));
+		__m128 edge1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[1]), centers), _mm_set1_ps((edgeB[1] * centerY) + edgeC[1]));
+		__m128 edge2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[2]), centers), _mm_set1_ps((edgeB[2] * centerY) + edgeC[2]));
+		__m128 depth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depthX), centers), _mm_set1_ps((depthY * centerY) + depthC));
+		float* row = m_depths + (y * m_width);
+
+		for (int x = startX; x < endX; x += 4) {
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge0, zero), _mm_cmpge_ps(edge1, zero)), _mm_cmpge_ps(edge2, zero));
+
+			if (_mm_movemask_ps(inside) != 0) {
+				__m128 previous = _mm_loadu_ps(row + x);
+				__m128 nearer = _mm_min_ps(previous, depth);
+
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, previous)));
+			}
+
+			edge0 = _mm_add_ps(edge0, edgeStep0);
+			edge1 = _mm_add_ps(edge1, edgeStep1);
+			edge2 = _mm_add_ps(edge2, edgeStep2);
+			depth = _mm_add_ps(depth, depthStep);
+		}
+	}
+}
+
+void TerrainOcclusion::UpdateLevels() {
+	// Each block keeps the farthest depth of the 2x2 blocks under it.  The buffer is small enough to do this on the
+	// calling thread once the bands are done.
+	for (int level = 1; level < m_levelCount; level++) {
+		const float* below = m_depths + m_levelOffsets[level - 1];
+		float* blocks = m_depths + m_levelOffsets[level];
+		int belowWidth = m_levelWidths[level - 1];
+		int belowHeight = m_levelHeights[level - 1];
+
+		for (int y = 0; y < m_levelHeights[level]; y++) {
+			int y0 = y * 2;
+			int y1 = std::min(y0 + 1, belowHeight - 1);
+
+			for (int x = 0; x < m_levelWidths[level]; x++) {
+				int x0 = x * 2;
+				int x1 = std::min(x0 + 1, belowWidth - 1);
+
+				blocks[(y * m_levelWidths[level]) + x] = std::max(std::max(below[(y0 * belowWidth) + x0], below[(y0 * belowWidth) + x1]),
+					std::max(below[(y1 * belowWidth) + x0], below[(y1 * belowWidth) + x1]));
+			}
+		}
+	}
+}
+
+bool TerrainOcclusion::CheckRectangle(float maxWidth, float maxHeight, float maxDepth, float minWidth, float minHeight, float minDepth) const {
+	const DirectX::XMFLOAT4X4& m = m_viewProjection;
+	float minX = FLT_MAX;
+	float minY = FLT_MAX;
+	float maxX = -FLT_MAX;
+	float maxY = -FLT_MAX;
+	float nearestDepth = FLT_MAX;
+
+	// Project the corners for the outline of the box on screen and the depth of its nearest corner.
+	for (int corner = 0; corner < 8; corner++) {
+		float cornerX = (corner & 1) ? maxWidth : minWidth;
+		float cornerY = (corner & 2) ? maxHeight : minHeight;
+		float cornerZ = (corner & 4) ? maxDepth : minDepth;
+
+		float x = (cornerX * m._11) + (cornerY * m._21) + (cornerZ * m._31) + m._41;
+		float y = (cornerX * m._12) + (cornerY * m._22) + (cornerZ * m._32) + m._42;
+		float z = (cornerX * m._13) + (cornerY * m._23) + (cornerZ * m._33) + m._43;
+		float w = (cornerX * m._14) + (cornerY * m._24) + (cornerZ * m._34) + m._44;
+
+		// A box that reaches past the near plane is too close to hide.
+		if ((z < 0.0f) || (w <= 0.0f)) {
+			return true;
+		}
+
+		float inverseW = 1.0f / w;
+		float screenX = ((x * inverseW * 0.5f) + 0.5f) * static_cast<float>(m_width);
+		float screenY = (0.5f - (y * inverseW * 0.5f)) * static_cast<float>(m_height);
+
+		minX = std::min(minX, screenX);
+		minY = std::min(minY, screenY);
+		maxX = std::max(maxX, screenX);
+		maxY = std::max(maxY, screenY);
+		nearestDepth = std::min(nearestDepth, z * inverseW);
+	}
+
+	// Take every pixel the outline touches, a box that is off the buffer can't be tested.
+	int startX = std::max(static_cast<int>(floorf(minX)), 0);
+	int startY = std::max(static_cast<int>(floorf(minY)), 0);
+	int endX = std::min(static_cast<int>(ceilf(maxX)), m_width) - 1;
+	int endY = std::min(static_cast<int>(ceilf(maxY)), m_height) - 1;
+
+	if ((startX > endX) || (startY > endY)) {
+		return true;
+	}
+
+	// Go up to the first level where the outline covers at most two blocks each way.
+	int level = 0;
+	while ((level < m_levelCount - 1) && (((endX >> level) - (startX >> level) > 1) || ((endY >> level) - (startY >> level) > 1))) {
+		level++;
+	}
+
+	// The box can be seen if its nearest corner isn't behind the farthest depth of any of those blocks.
+	const float* blocks = m_depths + m_levelOffsets[level];
+
+	for (int y = startY >> level; y <= endY >> level; y++) {
+		for (int x = startX >> level; x <= endX >> level; x++) {
+			if (blocks[(y * m_levelWidths[level]) + x] >= nearestDepth) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void TerrainOcclusion::Shutdown() {
+	// Release the depth pyramid and the projected occluders.
+	if (m_depths) {
+		delete[] m_depths;
+		m_depths = nullptr;
+	}
+
+	if (m_screenVertices) {
+		delete[] m_screenVertices;
+		m_screenVertices = nullptr;
+	}
+
+	m_levelCount = 0;
+}
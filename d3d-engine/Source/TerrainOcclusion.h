@@ -0,0 +1,61 @@
+#pragma once
+
+#include "DXMath.h"
+
+// Software occlusion culling for the terrain cells.  Coarse occluder meshes that lie under the surface of the nearest
+// cells are rasterized in front to back order into a small depth buffer, which is split into bands of rows that are
+// filled in parallel four pixels at a time.  The farthest depth of each block of the buffer is kept in a pyramid, and
+// a candidate box is hidden when its nearest corner is behind every block its outline covers.  Nothing here touches
+// the device, so the culler runs the same without a window and reports what it rejected and how long it took.
+class TerrainOcclusion {
+public:
+	TerrainOcclusion();
+	~TerrainOcclusion();
+
+	bool Initialize(int width, int height, int occluderSize, int maxOccluders);
+	int Cull(const Matrix& viewProjection, const float* occluderVertices, int occluderCount, const float* bounds, int* cells, int count);
+
+	int GetWidth() const;
+	int GetHeight() const;
+	int GetOccluderVertexCount() const;
+	int GetCellsRejected() const;
+	float GetCullTime() const;
+
+private:
+	// A vertex of an occluder in the pixels of the depth buffer with the depth it has there.
+	struct ScreenVertexType {
+		float x;
+		float y;
+		float depth;
+		bool clipped;
+	};
+
+	TerrainOcclusion(const TerrainOcclusion&);
+
+	void TransformOccluders(const float* occluderVertices, int occluderCount);
+	void RasterizeBand(int band, int occluderCount);
+	void RasterizeTriangle(const ScreenVertexType& v0, const ScreenVertexType& v1, const ScreenVertexType& v2, int startRow, int endRow);
+	void UpdateLevels();
+	bool CheckRectangle(float maxWidth, float maxHeight, float maxDepth, float minWidth, float minHeight, float minDepth) const;
+	void Shutdown();
+
+	// Rows of the depth buffer each task fills.
+	static const int BAND_ROWS = 16;
+
+	// Enough levels to bring any buffer the culler is given down to a single block.
+	static const int MAX_LEVELS = 16;
+
+	int m_width;
+	int m_height;
+	int m_occluderSize;
+	int m_maxOccluders;
+	int m_levelCount;
+	int m_levelWidths[MAX_LEVELS];
+	int m_levelHeights[MAX_LEVELS];
+	int m_levelOffsets[MAX_LEVELS];
+	float* m_depths;
+	ScreenVertexType* m_screenVertices;
+	DirectX::XMFLOAT4X4 m_viewProjection;
+	int m_cellsRejected;
+	float m_cullTime;
+};
@@ -0,0 +1,208 @@
+#include "pch.h"
+#include "TerrainPyramid.h"
+
+TerrainPyramid::TerrainPyramid() :
+	m_quadCountX(0),
+	m_quadCountY(0),
+	m_leafShift(0),
+	m_levelCount(0),
+	m_levelWidths(),
+	m_levelHeights(),
+	m_levelOffsets(),
+	m_bounds(nullptr) {}
+
+TerrainPyramid::TerrainPyramid(const TerrainPyramid&) :
+	m_quadCountX(0),
+	m_quadCountY(0),
+	m_leafShift(0),
+	m_levelCount(0),
+	m_levelWidths(),
+	m_levelHeights(),
+	m_levelOffsets(),
+	m_bounds(nullptr) {}
+
+TerrainPyramid::~TerrainPyramid() {
+	Shutdown();
+}
+
+bool TerrainPyramid::Initialize(int quadCountX, int quadCountY) {
+	Shutdown();
+
+	if ((quadCountX <= 0) || (quadCountY <= 0)) {
+		return false;
+	}
+
+	m_quadCountX = quadCountX;
+	m_quadCountY = quadCountY;
+
+	// Put one quad in each leaf unless that would take too many leaves, then double the side of the leaves until it fits.
+	m_leafShift = 0;
+	while (static_cast<long long>(((quadCountX - 1) >> m_leafShift) + 1) * (((quadCountY - 1) >> m_leafShift) + 1) > MAX_LEAF_COUNT) {
+		m_leafShift++;
+	}
+
+	// Halve the levels until a single block covers the terrain, every level is stored after the one below it.
+	int width = ((quadCountX - 1) >> m_leafShift) + 1;
+	int height = ((quadCountY - 1) >> m_leafShift) + 1;
+	int blockCount = 0;
+
+	m_levelCount = 0;
+
+	for (;;) {
+		m_levelWidths[m_levelCount] = width;
+		m_levelHeights[m_levelCount] = height;
+		m_levelOffsets[m_levelCount] = blockCount;
+		blockCount += width * height;
+		m_levelCount++;
+
+		if ((width == 1) && (height == 1)) {
+			break;
+		}
+
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+
+	// Each block holds its lowest height followed by its highest.
+	m_bounds = new float[blockCount * 2];
+
+	for (int i = 0; i < blockCount; i++) {
+		m_bounds[i * 2] = FLT_MAX;
+		m_bounds[(i * 2) + 1] = -FLT_MAX;
+	}
+
+	return true;
+}
+
+void TerrainPyramid::SetLeafBounds(int leafX, int leafY, float minHeight, float maxHeight) {
+	float* bounds = m_bounds + (((leafY * m_levelWidths[0]) + leafX) * 2);
+
+	bounds[0] = minHeight;
+	bounds[1] = maxHeight;
+}
+
+void TerrainPyramid::UpdateLevels(int startLeafX, int startLeafY, int endLeafX, int endLeafY) {
+	// Refit the blocks over the changed leaves one level at a time, each level only reads the level below it.
+	for (int level = 1; level < m_levelCount; level++) {
+		startLeafX /= 2;
+		startLeafY /= 2;
+		endLeafX = (endLeafX + 1) / 2;
+		endLeafY = (endLeafY + 1) / 2;
+
+		int rowCount = endLeafY - startLeafY;
+		if ((endLeafX - startLeafX) * rowCount < MIN_PARALLEL_BLOCKS) {
+			UpdateLevel(level, startLeafX, startLeafY, endLeafX, endLeafY);
+			continue;
+		}
+
+		concurrency::parallel_for(0, rowCount, [&](int row) {
+			UpdateLevel(level, startLeafX, startLeafY + row, endLeafX, startLeafY + row + 1);
+		});
+	}
+}
+
+void TerrainPyramid::GetBounds(int startColumn, int startRow, int endColumn, int endRow, float& minHeight, float& maxHeight) const {
+	// Find the first and last leaf the rectangle of quads touches along each side.
+	int startX = startColumn >> m_leafShift;
+	int startY = startRow >> m_leafShift;
+	int endX = (endColumn - 1) >> m_leafShift;
+	int endY = (endRow - 1) >> m_leafShift;
+
+	// Go up to the first level where the blocks are at least as long as the rectangle, which then touches at most two
+	// blocks along each side.
+	unsigned long span = static_cast<unsigned long>(std::max(endX - startX, endY - startY));
+	unsigned long highestBit;
+	int level = 0;
+
+	if ((span > 1) && _BitScanReverse(&highestBit, span - 1)) {
+		level = std::min(static_cast<int>(highestBit) + 1, m_levelCount - 1);
+	}
+
+	startX >>= level;
+	startY >>= level;
+	endX >>= level;
+	endY >>= level;
+
+	minHeight = FLT_MAX;
+	maxHeight = -FLT_MAX;
+
+	for (int y = startY; y <= endY; y++) {
+		for (int x = startX; x <= endX; x++) {
+			const float* bounds = m_bounds + ((m_levelOffsets[level] + (y * m_levelWidths[level]) + x) * 2);
+
+			minHeight = std::min(minHeight, bounds[0]);
+			maxHeight = std::max(maxHeight, bounds[1]);
+		}
+	}
+}
+
+void TerrainPyramid::GetBlockBounds(int level, int blockX, int blockY, float& minHeight, float& maxHeight) const {
+	const float* bounds = m_bounds + ((m_levelOffsets[level] + (blockY * m_levelWidths[level]) + blockX) * 2);
+
+	minHeight = bounds[0];
+	maxHeight = bounds[1];
+}
+
+int TerrainPyramid::GetQuadCountX() const {
+	return m_quadCountX;
+}
+
+int TerrainPyramid::GetQuadCountY() const {
+	return m_quadCountY;
+}
+
+int TerrainPyramid::GetLeafShift() const {
+	return m_leafShift;
+}
+
+int TerrainPyramid::GetLevelCount() const {
+	return m_levelCount;
+}
+
+int TerrainPyramid::GetLevelWidth(int level) const {
+	return m_levelWidths[level];
+}
+
+int TerrainPyramid::GetLevelHeight(int level) const {
+	return m_levelHeights[level];
+}
+
+void TerrainPyramid::UpdateLevel(int level, int startX, int startY, int endX, int endY) {
+	int childWidth = m_levelWidths[level - 1];
+	int childHeight = m_levelHeights[level - 1];
+	const float* children = m_bounds + (m_levelOffsets[level - 1] * 2);
+	float* blocks = m_bounds + (m_levelOffsets[level] * 2);
+
+	for (int y = startY; y < endY; y++) {
+		for (int x = startX; x < endX; x++) {
+			float minHeight = FLT_MAX;
+			float maxHeight = -FLT_MAX;
+
+			// The blocks along the far edges can have only one child along that side.
+			for (int childY = y * 2; childY < std::min((y * 2) + 2, childHeight); childY++) {
+				for (int childX = x * 2; childX < std::min((x * 2) + 2, childWidth); childX++) {
+					const float* child = children + (((childY * childWidth) + childX) * 2);
+
+					minHeight = std::min(minHeight, child[0]);
+					maxHeight = std::max(maxHeight, child[1]);
+				}
+			}
+
+			float* block = blocks + (((y * m_levelWidths[level]) + x) * 2);
+			block[0] = minHeight;
+			block[1] = maxHeight;
+		}
+	}
+}
+
+void TerrainPyramid::Shutdown() {
+	if (m_bounds) {
+		delete[] m_bounds;
+		m_bounds = nullptr;
+	}
+
+	m_quadCountX = 0;
+	m_quadCountY = 0;
+	m_leafShift = 0;
+	m_levelCount = 0;
+}
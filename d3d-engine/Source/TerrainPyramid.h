@@ -0,0 +1,49 @@
+#pragma once
+
+// Min/max height pyramid over the quads of the terrain.  Each leaf holds the lowest and highest height of a square
+// block of quads and every level above merges 2x2 blocks of the one below, so the bounds of any rectangle of quads
+// come from at most four blocks of the first level where the rectangle spans no more than two blocks each way.  The
+// leaves are handed in by the owner, which knows where the heights of each part of the terrain live, and the levels
+// above are refitted over just the part that changed.
+class TerrainPyramid {
+public:
+	TerrainPyramid();
+	~TerrainPyramid();
+
+	bool Initialize(int quadCountX, int quadCountY);
+	void SetLeafBounds(int leafX, int leafY, float minHeight, float maxHeight);
+	void UpdateLevels(int startLeafX, int startLeafY, int endLeafX, int endLeafY);
+	void GetBounds(int startColumn, int startRow, int endColumn, int endRow, float& minHeight, float& maxHeight) const;
+	void GetBlockBounds(int level, int blockX, int blockY, float& minHeight, float& maxHeight) const;
+
+	int GetQuadCountX() const;
+	int GetQuadCountY() const;
+	int GetLeafShift() const;
+	int GetLevelCount() const;
+	int GetLevelWidth(int level) const;
+	int GetLevelHeight(int level) const;
+
+private:
+	TerrainPyramid(const TerrainPyramid&);
+
+	void UpdateLevel(int level, int startX, int startY, int endX, int endY);
+	void Shutdown();
+
+	// Most blocks the finest level can have, larger terrains put more quads in each leaf.
+	static const int MAX_LEAF_COUNT = 1 << 20;
+
+	// Enough levels to bring any terrain the 32 bit grid indices can address down to a single block.
+	static const int MAX_LEVELS = 32;
+
+	// Blocks below this many are refitted on the calling thread, the per edit updates are far smaller than this.
+	static const int MIN_PARALLEL_BLOCKS = 4096;
+
+	int m_quadCountX;
+	int m_quadCountY;
+	int m_leafShift;
+	int m_levelCount;
+	int m_levelWidths[MAX_LEVELS];
+	int m_levelHeights[MAX_LEVELS];
+	int m_levelOffsets[MAX_LEVELS];
+	float* m_bounds;
+};
@@ -0,0 +1,421 @@
+#include "pch.h"
+#include "TerrainQuadTree.h"
+
+TerrainQuadTree::TerrainQuadTree() :
+	m_nodes(nullptr),
+	m_cellOrder(nullptr),
+	m_cellNodes(nullptr),
+	m_lastPlanes(nullptr),
+	m_batchPlanes(nullptr),
+	m_childBoxes(nullptr),
+	m_maxWidths(nullptr),
+	m_maxHeights(nullptr),
+	m_maxDepths(nullptr),
+	m_minWidths(nullptr),
+	m_minHeights(nullptr),
+	m_minDepths(nullptr),
+	m_nodeCount(0),
+	m_cellCountX(0),
+	m_cellCountY(0),
+	m_placedCount(0) {}
+
+TerrainQuadTree::TerrainQuadTree(const TerrainQuadTree&) :
+	m_nodes(nullptr),
+	m_cellOrder(nullptr),
+	m_cellNodes(nullptr),
+	m_lastPlanes(nullptr),
+	m_batchPlanes(nullptr),
+	m_childBoxes(nullptr),
+	m_maxWidths(nullptr),
+	m_maxHeights(nullptr),
+	m_maxDepths(nullptr),
+	m_minWidths(nullptr),
+	m_minHeights(nullptr),
+	m_minDepths(nullptr),
+	m_nodeCount(0),
+	m_cellCountX(0),
+	m_cellCountY(0),
+	m_placedCount(0) {}
+
+TerrainQuadTree::~TerrainQuadTree() {
+	Shutdown();
+}
+
+bool TerrainQuadTree::Initialize(int cellCountX, int cellCountY) {
+	if ((cellCountX <= 0) || (cellCountY <= 0)) {
+		return false;
+	}
+
+	m_cellCountX = cellCountX;
+	m_cellCountY = cellCountY;
+
+	// Every node that is not a single cell has at least two children, so there are fewer than twice as many nodes as cells.
+	int cellCount = cellCountX * cellCountY;
+	m_nodes = new NodeType[cellCount * 2];
+	m_cellOrder = new int[cellCount];
+	m_cellNodes = new int[cellCount];
+	m_lastPlanes = new int[cellCount * 2 * MAX_VIEWS];
+	m_batchPlanes = new int[cellCount * 2 * MAX_VIEWS];
+	m_childBoxes = new float[cellCount * 2 * 6 * MAX_CHILDREN];
+	m_maxWidths = new float[cellCount];
+	m_maxHeights = new float[cellCount];
+	m_maxDepths = new float[cellCount];
+	m_minWidths = new float[cellCount];
+	m_minHeights = new float[cellCount];
+	m_minDepths = new float[cellCount];
+	m_nodeCount = 0;
+	m_placedCount = 0;
+
+	BuildNode(0, 0, cellCountX, cellCountY);
+
+	// Every node and batch starts by trying the near plane first in every view.  The planes of a node are the ones that
+	// rejected its children.
+	for (int i = 0; i < m_nodeCount * MAX_VIEWS; i++) {
+		m_lastPlanes[i] = 0;
+		m_batchPlanes[i] = 0;
+	}
+
+	return true;
+}
+
+void TerrainQuadTree::SetCellBounds(int cellId, float maxWidth, float maxHeight, float maxDepth, float minWidth, float minHeight, float minDepth) {
+	NodeType& node = m_nodes[m_cellNodes[cellId]];
+
+	node.maxWidth = maxWidth;
+	node.maxHeight = maxHeight;
+	node.maxDepth = maxDepth;
+	node.minWidth = minWidth;
+	node.minHeight = minHeight;
+	node.minDepth = minDepth;
+
+	// The leaf of the cell starts at its place in the cell order.
+	int index = node.firstCell;
+
+	m_maxWidths[index] = maxWidth;
+	m_maxHeights[index] = maxHeight;
+	m_maxDepths[index] = maxDepth;
+	m_minWidths[index] = minWidth;
+	m_minHeights[index] = minHeight;
+	m_minDepths[index] = minDepth;
+}
+
+void TerrainQuadTree::GetCellBounds(int cellId, float& maxWidth, float& maxHeight, float& maxDepth, float& minWidth, float& minHeight, float& minDepth) const {
+	const NodeType& node = m_nodes[m_cellNodes[cellId]];
+
+	maxWidth = node.maxWidth;
+	maxHeight = node.maxHeight;
+	maxDepth = node.maxDepth;
+	minWidth = node.minWidth;
+	minHeight = node.minHeight;
+	minDepth = node.minDepth;
+}
+
+void TerrainQuadTree::UpdateBounds() {
+	// The nodes were created depth first so every child comes after its parent, and walking backwards refits each
+	// node after all of its children.
+	for (int nodeId = m_nodeCount - 1; nodeId >= 0; nodeId--) {
+		NodeType& node = m_nodes[nodeId];
+		if (node.childCount == 0) {
+			continue;
+		}
+
+		node.maxWidth = -FLT_MAX;
+		node.maxHeight = -FLT_MAX;
+		node.maxDepth = -FLT_MAX;
+		node.minWidth = FLT_MAX;
+		node.minHeight = FLT_MAX;
+		node.minDepth = FLT_MAX;
+
+		for (int i = 0; i < node.childCount; i++) {
+			const NodeType& child = m_nodes[node.children[i]];
+
+			node.maxWidth = std::max(node.maxWidth, child.maxWidth);
+			node.maxHeight = std::max(node.maxHeight, child.maxHeight);
+			node.maxDepth = std::max(node.maxDepth, child.maxDepth);
+			node.minWidth = std::min(node.minWidth, child.minWidth);
+			node.minHeight = std::min(node.minHeight, child.minHeight);
+			node.minDepth = std::min(node.minDepth, child.minDepth);
+		}
+
+		// Copy the boxes of the children next to each other for the parent to classify them together.
+		float* boxes = m_childBoxes + (nodeId * 6 * MAX_CHILDREN);
+
+		for (int i = 0; i < node.childCount; i++) {
+			const NodeType& child = m_nodes[node.children[i]];
+
+			boxes[i] = child.maxWidth;
+			boxes[MAX_CHILDREN + i] = child.maxHeight;
+			boxes[(2 * MAX_CHILDREN) + i] = child.maxDepth;
+			boxes[(3 * MAX_CHILDREN) + i] = child.minWidth;
+			boxes[(4 * MAX_CHILDREN) + i] = child.minHeight;
+			boxes[(5 * MAX_CHILDREN) + i] = child.minDepth;
+		}
+	}
+}
+
+int TerrainQuadTree::Cull(const Frustum* frustum, int* visibleCells) {
+	int visibleCount = 0;
+
+	CullViews(&frustum, 1, &visibleCells, &visibleCount, nullptr);
+
+	return visibleCount;
+}
+
+bool TerrainQuadTree::CullViews(const Frustum* const* frustums, int viewCount, int* const* visibleCells, int* visibleCounts, unsigned int* cellMasks) {
+	// The planes each node rejected last are kept per view, so the views have to come in the same order every frame.
+	// More views than the masks have bits for are refused, with every list left empty.
+	if (viewCount > MAX_VIEWS) {
+		for (int view = 0; view < viewCount; view++) {
+			visibleCounts[view] = 0;
+		}
+
+		if (cellMasks) {
+			memset(cellMasks, 0, m_cellCountX * m_cellCountY * sizeof(unsigned int));
+		}
+
+		return false;
+	}
+
+	CullType cull;
+	cull.frustums = frustums;
+	cull.visibleCells = visibleCells;
+	cull.visibleCounts = visibleCounts;
+	cull.cellMasks = cellMasks;
+
+	int planeMasks[MAX_VIEWS];
+
+	for (int view = 0; view < viewCount; view++) {
+		visibleCounts[view] = 0;
+		planeMasks[view] = Frustum::ALL_PLANES;
+	}
+
+	// The mask of a cell gets the bit of every view that can see it, and is optional.
+	if (cellMasks) {
+		memset(cellMasks, 0, m_cellCountX * m_cellCountY * sizeof(unsigned int));
+	}
+
+	// The root is classified on its own, every other node is classified along with the rest of its parent's children.
+	const NodeType& root = m_nodes[0];
+	unsigned int insideMask = 0;
+	unsigned int straddleMask = 0;
+
+	for (int view = 0; view < viewCount; view++) {
+		int lastPlane = 0;
+		Frustum::Classification classification = frustums[view]->ClassifyRectangle(root.maxWidth, root.maxHeight, root.maxDepth, root.minWidth, root.minHeight, root.minDepth,
+			planeMasks[view], lastPlane);
+
+		if (classification == Frustum::OUTSIDE) {
+			continue;
+		}
+
+		if ((root.childCount == 0) || (classification == Frustum::INSIDE)) {
+			insideMask |= 1u << view;
+		}
+		else {
+			straddleMask |= 1u << view;
+		}
+	}
+
+	if (insideMask != 0) {
+		AcceptCells(root, insideMask, cull);
+	}
+
+	if (straddleMask != 0) {
+		CullNode(0, straddleMask, planeMasks, cull);
+	}
+
+	return true;
+}
+
+int TerrainQuadTree::GetNodeCount() const {
+	return m_nodeCount;
+}
+
+int TerrainQuadTree::BuildNode(int startX, int startY, int endX, int endY) {
+	int nodeId = m_nodeCount++;
+	NodeType& node = m_nodes[nodeId];
+
+	// Start with an empty box until the bounds of the cells are given.
+	node.maxWidth = -FLT_MAX;
+	node.maxHeight = -FLT_MAX;
+	node.maxDepth = -FLT_MAX;
+	node.minWidth = FLT_MAX;
+	node.minHeight = FLT_MAX;
+	node.minDepth = FLT_MAX;
+	node.childCount = 0;
+	node.firstCell = m_placedCount;
+
+	// A single cell is a leaf.
+	if ((endX - startX == 1) && (endY - startY == 1)) {
+		int cellId = (startY * m_cellCountX) + startX;
+
+		m_cellOrder[m_placedCount++] = cellId;
+		m_cellNodes[cellId] = nodeId;
+		node.cellCount = 1;
+
+		return nodeId;
+	}
+
+	// Split the block in half along each side that is more than one cell long.
+	int middleX = (endX - startX > 1) ? (startX + endX) / 2 : endX;
+	int middleY = (endY - startY > 1) ? (startY + endY) / 2 : endY;
+	int boundsX[3] = { startX, middleX, endX };
+	int boundsY[3] = { startY, middleY, endY };
+
+	for (int j = 0; j < 2; j++) {
+		for (int i = 0; i < 2; i++) {
+			if ((boundsX[i] == boundsX[i + 1]) || (boundsY[j] == boundsY[j + 1])) {
+				continue;
+			}
+
+			// The children are built depth first so each subtree's cells end up next to each other in the cell order.
+			node.children[node.childCount++] = BuildNode(boundsX[i], boundsY[j], boundsX[i + 1], boundsY[j + 1]);
+		}
+	}
+
+	node.cellCount = m_placedCount - node.firstCell;
+
+	return nodeId;
+}
+
+void TerrainQuadTree::CullNode(int nodeId, unsigned int viewMask, const int* planeMasks, const CullType& cull) {
+	// The node straddles every view in the mask, and each view only has the planes in its mask left to test.
+	const NodeType& node = m_nodes[nodeId];
+
+	// A small subtree tests all of its cells at once, each register of boxes against every view it straddles, which
+	// keeps the same cells in the same order since a cell is only inside when every box above it is.  The batch keeps
+	// its own rejecting plane per view, most of the cells of a straddling subtree are off the same side of the view as
+	// last frame.
+	if (node.cellCount <= CULL_BATCH_SIZE) {
+		int first = node.firstCell;
+
+		Frustum::CheckRectanglesInViews(cull.frustums, viewMask, m_maxWidths + first, m_maxHeights + first, m_maxDepths + first, m_minWidths + first, m_minHeights + first, m_minDepths + first,
+			m_cellOrder + first, node.cellCount, planeMasks, m_batchPlanes + (nodeId * MAX_VIEWS), cull.visibleCells, cull.visibleCounts, cull.cellMasks);
+
+		return;
+	}
+
+	// Larger ones classify all of their children at once for each view, starting with the plane that last rejected
+	// all of them.
+	const float* boxes = m_childBoxes + (nodeId * 6 * MAX_CHILDREN);
+	Frustum::Classification classifications[MAX_VIEWS][MAX_CHILDREN];
+	int childPlaneMasks[MAX_VIEWS][MAX_CHILDREN];
+
+	for (int view = 0; view < MAX_VIEWS; view++) {
+		if ((viewMask & (1u << view)) == 0) {
+			continue;
+		}
+
+		cull.frustums[view]->ClassifyRectangles(boxes, boxes + MAX_CHILDREN, boxes + (2 * MAX_CHILDREN), boxes + (3 * MAX_CHILDREN), boxes + (4 * MAX_CHILDREN), boxes + (5 * MAX_CHILDREN),
+			node.childCount, planeMasks[view], m_lastPlanes[(nodeId * MAX_VIEWS) + view], classifications[view], childPlaneMasks[view]);
+	}
+
+	// Then sort the views of each child into the ones it is outside of, which go no further, the ones it is completely
+	// inside of, which take every cell under it, and the ones it straddles, which go on down with the planes they still
+	// straddle.
+	for (int i = 0; i < node.childCount; i++) {
+		const NodeType& child = m_nodes[node.children[i]];
+		unsigned int insideMask = 0;
+		unsigned int straddleMask = 0;
+		int straddledPlanes[MAX_VIEWS];
+
+		for (int view = 0; view < MAX_VIEWS; view++) {
+			if ((viewMask & (1u << view)) == 0) {
+				continue;
+			}
+
+			Frustum::Classification classification = classifications[view][i];
+			if (classification == Frustum::OUTSIDE) {
+				continue;
+			}
+
+			if ((child.childCount == 0) || (classification == Frustum::INSIDE)) {
+				insideMask |= 1u << view;
+			}
+			else {
+				straddleMask |= 1u << view;
+				straddledPlanes[view] = childPlaneMasks[view][i];
+			}
+		}
+
+		if (insideMask != 0) {
+			AcceptCells(child, insideMask, cull);
+		}
+
+		if (straddleMask != 0) {
+			CullNode(node.children[i], straddleMask, straddledPlanes, cull);
+		}
+	}
+}
+
+void TerrainQuadTree::AcceptCells(const NodeType& node, unsigned int viewMask, const CullType& cull) const {
+	// Add every cell under the node to each of the views without any more plane tests.
+	for (int view = 0; view < MAX_VIEWS; view++) {
+		if ((viewMask & (1u << view)) == 0) {
+			continue;
+		}
+
+		int* visible = cull.visibleCells[view];
+		int& visibleCount = cull.visibleCounts[view];
+
+		for (int i = 0; i < node.cellCount; i++) {
+			visible[visibleCount++] = m_cellOrder[node.firstCell + i];
+		}
+	}
+
+	if (cull.cellMasks) {
+		for (int i = 0; i < node.cellCount; i++) {
+			cull.cellMasks[m_cellOrder[node.firstCell + i]] |= viewMask;
+		}
+	}
+}
+
+void TerrainQuadTree::Shutdown() {
+	// Release the nodes, the cell lookups, the cached planes and the boxes of the cells and children.
+	if (m_nodes) {
+		delete[] m_nodes;
+		m_nodes = nullptr;
+	}
+
+	if (m_cellOrder) {
+		delete[] m_cellOrder;
+		m_cellOrder = nullptr;
+	}
+
+	if (m_cellNodes) {
+		delete[] m_cellNodes;
+		m_cellNodes = nullptr;
+	}
+
+	if (m_lastPlanes) {
+		delete[] m_lastPlanes;
+		m_lastPlanes = nullptr;
+	}
+
+	if (m_batchPlanes) {
+		delete[] m_batchPlanes;
+		m_batchPlanes = nullptr;
+	}
+
+	if (m_childBoxes) {
+		delete[] m_childBoxes;
+		m_childBoxes = nullptr;
+	}
+
+	if (m_maxWidths) {
+		delete[] m_maxWidths;
+		delete[] m_maxHeights;
+		delete[] m_maxDepths;
+		delete[] m_minWidths;
+		delete[] m_minHeights;
+		delete[] m_minDepths;
+		m_maxWidths = nullptr;
+		m_maxHeights = nullptr;
+		m_maxDepths = nullptr;
+		m_minWidths = nullptr;
+		m_minHeights = nullptr;
+		m_minDepths = nullptr;
+	}
+
+	m_nodeCount = 0;
+}
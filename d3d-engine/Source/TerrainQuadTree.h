@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Frustum.h"
+
+// Bounding quadtree over the grid of terrain cells.  Each node splits its block of cells in half along both sides and
+// keeps the box around all of them, so a subtree that is off screen is rejected with a single test and a subtree that
+// is completely on screen is accepted without testing any of the cells under it.  The boxes of the cells are given one
+// at a time so the tree can be built before, or without, the cells themselves.  The boxes of the cells are also kept in
+// separate arrays in the order of the tree, so the cells under a small subtree that straddles the frustum are tested
+// together by the vector kernel of the frustum, and the boxes of the children of each node are kept together so a node
+// classifies all of its children at once.  Each node remembers the plane that last rejected all of its children, and
+// each batch of cells the plane that last rejected a register of them, so that plane is tried first the next frame.
+// The planes a node is completely in front of are not tested again for the nodes and cells under it.  Several views
+// are culled in the same walk, so each box is visited once a frame however many views there are, and a view drops out
+// of a subtree as soon as the subtree is outside or completely inside it.  A batch of cells loads each register of
+// boxes once and tests it against every view that still straddles the batch.
+class TerrainQuadTree {
+	struct NodeType {
+		float maxWidth;
+		float maxHeight;
+		float maxDepth;
+		float minWidth;
+		float minHeight;
+		float minDepth;
+		int children[4];
+		int childCount;
+		int firstCell;
+		int cellCount;
+	};
+
+	// The views of one walk and where their visible cells go.
+	struct CullType {
+		const Frustum* const* frustums;
+		int* const* visibleCells;
+		int* visibleCounts;
+		unsigned int* cellMasks;
+	};
+
+public:
+	// Most views one walk can cull, each view has a bit in the masks of the cells.
+	static const int MAX_VIEWS = 8;
+
+	TerrainQuadTree();
+	~TerrainQuadTree();
+
+	bool Initialize(int cellCountX, int cellCountY);
+	void SetCellBounds(int cellId, float maxWidth, float maxHeight, float maxDepth, float minWidth, float minHeight, float minDepth);
+	void GetCellBounds(int cellId, float& maxWidth, float& maxHeight, float& maxDepth, float& minWidth, float& minHeight, float& minDepth) const;
+	void UpdateBounds();
+	int Cull(const Frustum* frustum, int* visibleCells);
+	bool CullViews(const Frustum* const* frustums, int viewCount, int* const* visibleCells, int* visibleCounts, unsigned int* cellMasks);
+
+	int GetNodeCount() const;
+
+private:
+	TerrainQuadTree(const TerrainQuadTree&);
+
+	int BuildNode(int startX, int startY, int endX, int endY);
+	void CullNode(int nodeId, unsigned int viewMask, const int* planeMasks, const CullType& cull);
+	void AcceptCells(const NodeType& node, unsigned int viewMask, const CullType& cull) const;
+	void Shutdown();
+
+	// Subtrees with at most this many cells test their cells in one batch.
+	static const int CULL_BATCH_SIZE = 64;
+
+	// Most children a node can have, the boxes of the children of a node take six arrays of this many.
+	static const int MAX_CHILDREN = 4;
+
+	NodeType* m_nodes;
+	int* m_cellOrder;
+	int* m_cellNodes;
+	int* m_lastPlanes;
+	int* m_batchPlanes;
+	float* m_childBoxes;
+	float* m_maxWidths;
+	float* m_maxHeights;
+	float* m_maxDepths;
+	float* m_minWidths;
+	float* m_minHeights;
+	float* m_minDepths;
+	int m_nodeCount;
+	int m_cellCountX;
+	int m_cellCountY;
+	int m_placedCount;
+};
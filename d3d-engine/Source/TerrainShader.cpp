@@ -8,6 +8,7 @@ TerrainShader::TerrainShader() :
 	m_pixelShader(nullptr),
 	m_layout(nullptr),
 	m_matrixBuffer(nullptr),
+	m_lodBuffer(nullptr),
 	m_sampleState(nullptr),
 	m_lightBuffer(nullptr) {}
 
@@ -16,6 +17,7 @@ TerrainShader::TerrainShader(const TerrainShader&) :
 	m_pixelShader(nullptr),
 	m_layout(nullptr),
 	m_matrixBuffer(nullptr),
+	m_lodBuffer(nullptr),
 	m_sampleState(nullptr),
 	m_lightBuffer(nullptr) {}
 
@@ -25,9 +27,9 @@ bool TerrainShader::Initialize(ID3D11Device* device, HWND hwnd) {
 	return InitializeShader(device, hwnd, L"../d3d-engine/Source/Shaders/terrain.vs", L"../d3d-engine/Source/Shaders/terrain.ps");
 }
 
-bool TerrainShader::Render(ID3D11DeviceContext* deviceContext, int indexCount, Matrix worldMatrix, Matrix viewMatrix, Matrix projectionMatrix, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* normalMap, ID3D11ShaderResourceView* normalMap2, ID3D11ShaderResourceView* normalMap3, Vector3 lightDirection, Color diffuseColor) const {
+bool TerrainShader::Render(ID3D11DeviceContext* deviceContext, int indexCount, Matrix worldMatrix, Matrix viewMatrix, Matrix projectionMatrix, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* normalMap, ID3D11ShaderResourceView* normalMap2, ID3D11ShaderResourceView* normalMap3, Vector3 lightDirection, Color diffuseColor, Vector3 cameraPosition, int lodLevel, const TerrainLod::MorphType& morph, const TerrainMesh::DecodeType& decode) const {
 	// Set the shader parameters that it will use for rendering.
-	if (!SetShaderParameters(deviceContext, worldMatrix, viewMatrix, projectionMatrix, texture, normalMap, normalMap2, normalMap3, lightDirection, diffuseColor)) {
+	if (!SetShaderParameters(deviceContext, worldMatrix, viewMatrix, projectionMatrix, texture, normalMap, normalMap2, normalMap3, lightDirection, diffuseColor, cameraPosition, lodLevel, morph, decode)) {
 		return false;
 	}
 
@@ -94,64 +96,41 @@ bool TerrainShader::InitializeShader(ID3D11Device* device, HWND hwnd, WCHAR* vsF
 	if (FAILED(result)) {
 		return false;
 	}
-	// Create the vertex input layout description.
-	D3D11_INPUT_ELEMENT_DESC polygonLayout[7];
+	// Create the vertex input layout description.  The compact vertex is the cell position and quantized heights as
+	// integers, the octahedral normal and tangent as signed normalized pairs, and the color.
+	D3D11_INPUT_ELEMENT_DESC polygonLayout[4];
 	polygonLayout[0].SemanticName = "POSITION";
 	polygonLayout[0].SemanticIndex = 0;
-	polygonLayout[0].Format = DXGI_FORMAT_R32G32B32_FLOAT;
+	polygonLayout[0].Format = DXGI_FORMAT_R16G16B16A16_UINT;
 	polygonLayout[0].InputSlot = 0;
 	polygonLayout[0].AlignedByteOffset = 0;
 	polygonLayout[0].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
 	polygonLayout[0].InstanceDataStepRate = 0;
 
-	polygonLayout[1].SemanticName = "TEXCOORD";
+	polygonLayout[1].SemanticName = "NORMAL";
 	polygonLayout[1].SemanticIndex = 0;
-	polygonLayout[1].Format = DXGI_FORMAT_R32G32_FLOAT;
+	polygonLayout[1].Format = DXGI_FORMAT_R16G16_SNORM;
 	polygonLayout[1].InputSlot = 0;
 	polygonLayout[1].AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
 	polygonLayout[1].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
 	polygonLayout[1].InstanceDataStepRate = 0;
 
-	polygonLayout[2].SemanticName = "NORMAL";
+	polygonLayout[2].SemanticName = "TANGENT";
 	polygonLayout[2].SemanticIndex = 0;
-	polygonLayout[2].Format = DXGI_FORMAT_R32G32B32_FLOAT;
+	polygonLayout[2].Format = DXGI_FORMAT_R16G16_SNORM;
 	polygonLayout[2].InputSlot = 0;
 	polygonLayout[2].AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
 	polygonLayout[2].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
 	polygonLayout[2].InstanceDataStepRate = 0;
 
-	polygonLayout[3].SemanticName = "TANGENT";
+	polygonLayout[3].SemanticName = "COLOR";
 	polygonLayout[3].SemanticIndex = 0;
-	polygonLayout[3].Format = DXGI_FORMAT_R32G32B32_FLOAT;
+	polygonLayout[3].Format = DXGI_FORMAT_R8G8B8A8_UNORM;
 	polygonLayout[3].InputSlot = 0;
 	polygonLayout[3].AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
 	polygonLayout[3].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
 	polygonLayout[3].InstanceDataStepRate = 0;
 
-	polygonLayout[4].SemanticName = "BINORMAL";
-	polygonLayout[4].SemanticIndex = 0;
-	polygonLayout[4].Format = DXGI_FORMAT_R32G32B32_FLOAT;
-	polygonLayout[4].InputSlot = 0;
-	polygonLayout[4].AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
-	polygonLayout[4].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-	polygonLayout[4].InstanceDataStepRate = 0;
-
-	polygonLayout[5].SemanticName = "COLOR";
-	polygonLayout[5].SemanticIndex = 0;
-	polygonLayout[5].Format = DXGI_FORMAT_R32G32B32_FLOAT;
-	polygonLayout[5].InputSlot = 0;
-	polygonLayout[5].AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
-	polygonLayout[5].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-	polygonLayout[5].InstanceDataStepRate = 0;
-
-	polygonLayout[6].SemanticName = "TEXCOORD";
-	polygonLayout[6].SemanticIndex = 1;
-	polygonLayout[6].Format = DXGI_FORMAT_R32G32_FLOAT;
-	polygonLayout[6].InputSlot = 0;
-	polygonLayout[6].AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
-	polygonLayout[6].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-	polygonLayout[6].InstanceDataStepRate = 0;
-
 	// Get a count of the elements in the layout.
 	unsigned int numElements = sizeof(polygonLayout) / sizeof(polygonLayout[0]);
 
@@ -176,12 +155,27 @@ bool TerrainShader::InitializeShader(ID3D11Device* device, HWND hwnd, WCHAR* vsF
 		return false;
 	}
 
+	// Setup the description of the dynamic level of detail constant buffer that is in the vertex shader.
+	D3D11_BUFFER_DESC lodBufferDesc = {};
+	lodBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+	lodBufferDesc.ByteWidth = sizeof(LodBufferType);
+	lodBufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	lodBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	lodBufferDesc.MiscFlags = 0;
+	lodBufferDesc.StructureByteStride = 0;
+
+	// Create the constant buffer pointer so we can access the vertex shader level of detail buffer from within this class.
+	result = device->CreateBuffer(&lodBufferDesc, nullptr, m_lodBuffer.GetAddressOf());
+	if (FAILED(result)) {
+		return false;
+	}
+
 	// Create a texture sampler state description.
 	D3D11_SAMPLER_DESC samplerDesc = {};
 	samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
-	samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
-	samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
-	samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+	samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
+	samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
+	samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
 	samplerDesc.MipLODBias = 0.0f;
 	samplerDesc.MaxAnisotropy = 1;
 	samplerDesc.ComparisonFunc = D3D11_COMPARISON_ALWAYS;
@@ -216,7 +210,7 @@ bool TerrainShader::InitializeShader(ID3D11Device* device, HWND hwnd, WCHAR* vsF
 	return true;
 }
 
-bool TerrainShader::SetShaderParameters(ID3D11DeviceContext* deviceContext, Matrix worldMatrix, Matrix viewMatrix, Matrix projMatrix, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* normalMap, ID3D11ShaderResourceView* normalMap2, ID3D11ShaderResourceView* normalMap3, Vector3 lightDirection, Color diffuseColor) const {
+bool TerrainShader::SetShaderParameters(ID3D11DeviceContext* deviceContext, Matrix worldMatrix, Matrix viewMatrix, Matrix projMatrix, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* normalMap, ID3D11ShaderResourceView* normalMap2, ID3D11ShaderResourceView* normalMap3, Vector3 lightDirection, Color diffuseColor, Vector3 cameraPosition, int lodLevel, const TerrainLod::MorphType& morph, const TerrainMesh::DecodeType& decode) const {
 	// Transpose the matrices to prepare them for the shader.
 	/*worldMatrix.Transpose();
 	viewMatrix.Transpose();
@@ -249,6 +243,46 @@ bool TerrainShader::SetShaderParameters(ID3D11DeviceContext* deviceContext, Matr
 	// Finanly set the constant buffer in the vertex shader with the updated values.
 	deviceContext->VSSetConstantBuffers(bufferNumber, 1, m_matrixBuffer.GetAddressOf());
 
+	// Lock the level of detail constant buffer so it can be written to.
+	result = deviceContext->Map(m_lodBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+	if (FAILED(result)) {
+		return false;
+	}
+
+	// Copy the level of detail variables into the constant buffer.  The coarsest level has an empty morph range and
+	// gets a zero scale so nothing morphs, and the same goes for each edge.
+	LodBufferType* dataPtr3 = static_cast<LodBufferType*>(mappedResource.pData);
+	dataPtr3->cameraPosition = cameraPosition;
+	dataPtr3->lodLevel = static_cast<float>(lodLevel);
+	dataPtr3->morphStart = morph.start;
+	dataPtr3->morphScale = (morph.end > morph.start) ? (1.0f / (morph.end - morph.start)) : 0.0f;
+	dataPtr3->levelCount = static_cast<float>(decode.levelCount);
+
+	float edgeScales[4];
+	for (int edge = 0; edge < 4; edge++) {
+		edgeScales[edge] = (morph.edgeEnds[edge] > morph.edgeStarts[edge]) ? (1.0f / (morph.edgeEnds[edge] - morph.edgeStarts[edge])) : 0.0f;
+	}
+
+	dataPtr3->edgeMorphStarts = Vector4(morph.edgeStarts[0], morph.edgeStarts[1], morph.edgeStarts[2], morph.edgeStarts[3]);
+	dataPtr3->edgeMorphScales = Vector4(edgeScales[0], edgeScales[1], edgeScales[2], edgeScales[3]);
+
+	// Copy the values that decode the cell's compact vertices.
+	dataPtr3->minHeight = decode.minHeight;
+	dataPtr3->cellBounds = Vector4(decode.originX, decode.originZ, decode.limitX, decode.limitZ);
+	dataPtr3->textureScale = Vector2(decode.textureScaleX, decode.textureScaleY);
+	dataPtr3->heightStep = decode.heightStep;
+	dataPtr3->padding = 0.0f;
+
+	// The last column and row of the cell are where the second texture scale reaches one.
+	dataPtr3->cellQuads = Vector2(floorf((1.0f / decode.textureScaleX) + 0.5f), floorf((1.0f / decode.textureScaleY) + 0.5f));
+	dataPtr3->padding2 = Vector2(0.0f, 0.0f);
+
+	// Unlock the level of detail constant buffer.
+	deviceContext->Unmap(m_lodBuffer.Get(), 0);
+
+	// Set the level of detail constant buffer in the vertex shader after the matrix buffer.
+	deviceContext->VSSetConstantBuffers(1, 1, m_lodBuffer.GetAddressOf());
+
 	// Set shader texture resources in the pixel shader.
 	deviceContext->PSSetShaderResources(0, 1, &texture);
 	deviceContext->PSSetShaderResources(1, 1, &normalMap);
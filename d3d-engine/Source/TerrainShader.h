@@ -1,6 +1,8 @@
 #pragma once
 
 #include "DXMath.h"
+#include "TerrainLod.h"
+#include "TerrainMesh.h"
 
 class TerrainShader {
 	struct MatrixBufferType {
@@ -9,6 +11,23 @@ class TerrainShader {
 		Matrix projection;
 	};
 
+	struct LodBufferType {
+		Vector3 cameraPosition;
+		float lodLevel;
+		float morphStart;
+		float morphScale;
+		float levelCount;
+		float minHeight;
+		Vector4 cellBounds;
+		Vector2 textureScale;
+		float heightStep;
+		float padding;
+		Vector4 edgeMorphStarts;
+		Vector4 edgeMorphScales;
+		Vector2 cellQuads;
+		Vector2 padding2;
+	};
+
 	struct LightBufferType {
 		Color diffuseColor;
 		Vector3 lightDirection;
@@ -20,18 +39,19 @@ public:
 	~TerrainShader();
 
 	bool Initialize(ID3D11Device*, HWND);
-	bool Render(ID3D11DeviceContext*, int, Matrix, Matrix, Matrix, ID3D11ShaderResourceView*, ID3D11ShaderResourceView*, ID3D11ShaderResourceView*, ID3D11ShaderResourceView*, Vector3, Color) const;
+	bool Render(ID3D11DeviceContext*, int, Matrix, Matrix, Matrix, ID3D11ShaderResourceView*, ID3D11ShaderResourceView*, ID3D11ShaderResourceView*, ID3D11ShaderResourceView*, Vector3, Color, Vector3, int, const TerrainLod::MorphType&, const TerrainMesh::DecodeType&) const;
 
 private:
 	TerrainShader(const TerrainShader&);
 
 	bool InitializeShader(ID3D11Device*, HWND, WCHAR*, WCHAR*);
-	bool SetShaderParameters(ID3D11DeviceContext*, Matrix, Matrix, Matrix, ID3D11ShaderResourceView*, ID3D11ShaderResourceView*, ID3D11ShaderResourceView*, ID3D11ShaderResourceView*, Vector3, Color) const;
+	bool SetShaderParameters(ID3D11DeviceContext*, Matrix, Matrix, Matrix, ID3D11ShaderResourceView*, ID3D11ShaderResourceView*, ID3D11ShaderResourceView*, ID3D11ShaderResourceView*, Vector3, Color, Vector3, int, const TerrainLod::MorphType&, const TerrainMesh::DecodeType&) const;
 
 	Microsoft::WRL::ComPtr<ID3D11VertexShader> m_vertexShader;
 	Microsoft::WRL::ComPtr<ID3D11PixelShader> m_pixelShader;
 	Microsoft::WRL::ComPtr<ID3D11InputLayout> m_layout;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> m_matrixBuffer;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> m_lodBuffer;
 	Microsoft::WRL::ComPtr<ID3D11SamplerState> m_sampleState;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> m_lightBuffer;
 };
@@ -0,0 +1,546 @@
+#include "pch.h"
+#include "TerrainSurface.h"
+#include "TerrainKernels.h"
+
+// Every path finds the quad a position is in the same way and blends the corners of the triangle it is in with the
+// same weights in the same order, so the vector and scalar paths give identical results.  The quads are split from the
+// upper right corner to the bottom left one like the index pattern.  With the position at fraction x along the row
+// and y down the column from the upper left corner, the upper triangle weighs its corners 1 - x - y, x and y and the
+// lower triangle 1 - x, 1 - y and x + y - 1, which both come out of one set of weights once the weight of the bottom
+// right corner is clamped at zero.
+
+static __m128i MultiplySse2(__m128i a, __m128i b) {
+	// SSE2 only multiplies the even lanes so the odd lanes are shifted down, multiplied and put back in between.
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static __m128i MinSse2(__m128i a, __m128i b) {
+	return _mm_xor_si128(b, _mm_and_si128(_mm_xor_si128(a, b), _mm_cmplt_epi32(a, b)));
+}
+
+static __m128 SelectSse2(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static __m128i GatherSse2(const int* base, __m128i indices) {
+	// SSE2 has no gather so load each lane on its own.
+	alignas(16) int lanes[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes), indices);
+
+	return _mm_setr_epi32(base[lanes[0]], base[lanes[1]], base[lanes[2]], base[lanes[3]]);
+}
+
+static __m128 GatherHeightsSse2(const unsigned short* heights, __m128i indices, __m128 minHeight, __m128 heightStep) {
+	alignas(16) int lanes[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes), indices);
+
+	__m128i steps = _mm_setr_epi32(heights[lanes[0]], heights[lanes[1]], heights[lanes[2]], heights[lanes[3]]);
+
+	return _mm_add_ps(minHeight, _mm_mul_ps(_mm_cvtepi32_ps(steps), heightStep));
+}
+
+static void UnpackNormalsSse2(__m128i packed, __m128& x, __m128& y, __m128& z) {
+	// The same steps as HeightField::UnpackNormal, terrain normals always face up so none of them are folded.
+	__m128 signMask = _mm_set1_ps(-0.0f);
+	__m128 u = _mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(packed, 16), 16)), _mm_set1_ps(32767.0f));
+	__m128 v = _mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(packed, 16)), _mm_set1_ps(32767.0f));
+	__m128 w = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1.0f), _mm_andnot_ps(signMask, u)), _mm_andnot_ps(signMask, v));
+	__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(w, w)), _mm_mul_ps(v, v)));
+
+	x = _mm_div_ps(u, length);
+	y = _mm_div_ps(w, length);
+	z = _mm_div_ps(v, length);
+}
+
+static __m256 GatherHeightsAvx2(const unsigned short* heights, __m256i indices, __m256 minHeight, __m256 heightStep) {
+	// Gather 32 bits at each 16 bit height and keep the low half, the array has a spare height on the end for the last one.
+	__m256i steps = _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(heights), indices, 2), _mm256_set1_epi32(0xffff));
+
+	return _mm256_add_ps(minHeight, _mm256_mul_ps(_mm256_cvtepi32_ps(steps), heightStep));
+}
+
+static void UnpackNormalsAvx2(__m256i packed, __m256& x, __m256& y, __m256& z) {
+	__m256 signMask = _mm256_set1_ps(-0.0f);
+	__m256 u = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(packed, 16), 16)), _mm256_set1_ps(32767.0f));
+	__m256 v = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(packed, 16)), _mm256_set1_ps(32767.0f));
+	__m256 w = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_andnot_ps(signMask, u)), _mm256_andnot_ps(signMask, v));
+	__m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(u, u), _mm256_mul_ps(w, w)), _mm256_mul_ps(v, v)));
+
+	x = _mm256_div_ps(u, length);
+	y = _mm256_div_ps(w, length);
+	z = _mm256_div_ps(v, length);
+}
+
+TerrainSurface::TerrainSurface() :
+	m_terrainWidth(0),
+	m_terrainHeight(0),
+	m_cellWidth(0),
+	m_cellHeight(0),
+	m_cellCountX(0),
+	m_slotCount(0),
+	m_vertexCount(0),
+	m_cellSlots(nullptr),
+	m_heights(nullptr),
+	m_normals(nullptr),
+	m_minHeights(nullptr),
+	m_heightSteps(nullptr),
+	m_decodes(nullptr) {}
+
+TerrainSurface::TerrainSurface(const TerrainSurface&) :
+	m_terrainWidth(0),
+	m_terrainHeight(0),
+	m_cellWidth(0),
+	m_cellHeight(0),
+	m_cellCountX(0),
+	m_slotCount(0),
+	m_vertexCount(0),
+	m_cellSlots(nullptr),
+	m_heights(nullptr),
+	m_normals(nullptr),
+	m_minHeights(nullptr),
+	m_heightSteps(nullptr),
+	m_decodes(nullptr) {}
+
+TerrainSurface::~TerrainSurface() {
+	Shutdown();
+}
+
+bool TerrainSurface::Initialize(int terrainWidth, int terrainHeight, int cellWidth, int cellHeight, int cellCountX, int slotCount, const int* cellSlots) {
+	Shutdown();
+
+	if ((terrainWidth < 2) || (terrainHeight < 2) || (slotCount <= 0)) {
+		return false;
+	}
+
+	m_terrainWidth = terrainWidth;
+	m_terrainHeight = terrainHeight;
+	m_cellWidth = cellWidth;
+	m_cellHeight = cellHeight;
+	m_cellCountX = cellCountX;
+	m_slotCount = slotCount;
+	m_vertexCount = TerrainMesh::GetVertexCount(cellWidth, cellHeight);
+
+	// The slots are looked up through the cell to slot map of the owner, which changes as cells are paged.
+	m_cellSlots = cellSlots;
+
+	// The heights get one spare on the end for the 32 bit gathers.
+	size_t vertexCount = static_cast<size_t>(slotCount) * m_vertexCount;
+	m_heights = new unsigned short[vertexCount + 1];
+	m_normals = new unsigned int[vertexCount];
+	m_minHeights = new float[slotCount];
+	m_heightSteps = new float[slotCount];
+	m_decodes = new TerrainMesh::DecodeType[slotCount];
+
+	memset(m_heights, 0, (vertexCount + 1) * sizeof(unsigned short));
+	memset(m_normals, 0, vertexCount * sizeof(unsigned int));
+	memset(m_minHeights, 0, slotCount * sizeof(float));
+	memset(m_heightSteps, 0, slotCount * sizeof(float));
+	memset(m_decodes, 0, slotCount * sizeof(TerrainMesh::DecodeType));
+
+	return true;
+}
+
+void TerrainSurface::SetCell(int slot, const TerrainMesh::VertexType* vertices, const TerrainMesh::DecodeType& decode) {
+	unsigned short* heights = m_heights + (static_cast<size_t>(slot) * m_vertexCount);
+	unsigned int* normals = m_normals + (static_cast<size_t>(slot) * m_vertexCount);
+
+	// Keep the quantized heights and the normals just as the vertex buffer has them.
+	for (int i = 0; i < m_vertexCount; i++) {
+		heights[i] = vertices[i].position[2];
+		normals[i] = vertices[i].normal;
+	}
+
+	m_minHeights[slot] = decode.minHeight;
+	m_heightSteps[slot] = decode.heightStep;
+	m_decodes[slot] = decode;
+}
+
+void TerrainSurface::GetHeights(const float* positionX, const float* positionZ, int count, float* heights, bool* found) const {
+	TerrainKernels::InstructionSet instructionSet = TerrainKernels::GetInstructionSet();
+
+	int start = 0;
+	if (instructionSet == TerrainKernels::AVX2) {
+		start = SampleAvx2(positionX, positionZ, count, heights, nullptr, nullptr, nullptr, nullptr, found);
+	}
+	else if (instructionSet == TerrainKernels::SSE2) {
+		start = SampleSse2(positionX, positionZ, count, heights, nullptr, nullptr, nullptr, nullptr, found);
+	}
+
+	SampleScalar(positionX, positionZ, start, count, heights, nullptr, nullptr, nullptr, nullptr, found);
+}
+
+void TerrainSurface::GetNormals(const float* positionX, const float* positionZ, int count, float* normalX, float* normalY, float* normalZ, float* slopes, bool* found) const {
+	TerrainKernels::InstructionSet instructionSet = TerrainKernels::GetInstructionSet();
+
+	int start = 0;
+	if (instructionSet == TerrainKernels::AVX2) {
+		start = SampleAvx2(positionX, positionZ, count, nullptr, normalX, normalY, normalZ, slopes, found);
+	}
+	else if (instructionSet == TerrainKernels::SSE2) {
+		start = SampleSse2(positionX, positionZ, count, nullptr, normalX, normalY, normalZ, slopes, found);
+	}
+
+	SampleScalar(positionX, positionZ, start, count, nullptr, normalX, normalY, normalZ, slopes, found);
+}
+
+float TerrainSurface::GetHeight(int slot, int vertex) const {
+	return m_minHeights[slot] + (static_cast<float>(m_heights[(static_cast<size_t>(slot) * m_vertexCount) + vertex]) * m_heightSteps[slot]);
+}
+
+void TerrainSurface::GetHeightRange(int slot, int startColumn, int startRow, int endColumn, int endRow, float& minHeight, float& maxHeight) const {
+	const unsigned short* heights = m_heights + (static_cast<size_t>(slot) * m_vertexCount);
+	unsigned short lowest = 0xffff;
+	unsigned short highest = 0;
+
+	// The decode never reverses the order of the quantized heights, so only the lowest and highest of the grid points
+	// from the start to the end corner are decoded.
+	for (int j = startRow; j <= endRow; j++) {
+		for (int i = startColumn; i <= endColumn; i++) {
+			unsigned short height = heights[(j * m_cellWidth) + i];
+
+			lowest = std::min(lowest, height);
+			highest = std::max(highest, height);
+		}
+	}
+
+	minHeight = m_minHeights[slot] + (static_cast<float>(lowest) * m_heightSteps[slot]);
+	maxHeight = m_minHeights[slot] + (static_cast<float>(highest) * m_heightSteps[slot]);
+}
+
+void TerrainSurface::GetVertex(int slot, int vertex, float position[3]) const {
+	// The column and row of the vertex in the cell come from its index, past the far edges of the terrain they
+	// collapse onto the edge like TerrainMesh::DecodePosition does.
+	const TerrainMesh::DecodeType& decode = m_decodes[slot];
+
+	position[0] = std::min(decode.originX + static_cast<float>(vertex % m_cellWidth), decode.limitX);
+	position[1] = GetHeight(slot, vertex);
+	position[2] = std::max(decode.originZ - static_cast<float>(vertex / m_cellWidth), decode.limitZ);
+}
+
+void TerrainSurface::SampleScalar(const float* positionX, const float* positionZ, int start, int end, float* heights, float* normalX, float* normalY, float* normalZ, float* slopes, bool* found) const {
+	int backZ = m_terrainHeight - 1;
+
+	for (int k = start; k < end; k++) {
+		float x = positionX[k];
+		float z = positionZ[k];
+		int column = 0;
+		int row = 0;
+		int slot = -1;
+
+		// Find the quad the position is in, rows run towards -Z from the back of the terrain and a position on the far
+		// edges takes the last quad.  Only positions over a resident cell are found.
+		if ((x >= 0.0f) && (x <= static_cast<float>(m_terrainWidth - 1)) && (z >= 0.0f) && (z <= static_cast<float>(backZ))) {
+			column = std::min(static_cast<int>(x), m_terrainWidth - 2);
+			row = std::min(backZ - static_cast<int>(ceilf(z)), m_terrainHeight - 2);
+			slot = m_cellSlots[((row / (m_cellHeight - 1)) * m_cellCountX) + (column / (m_cellWidth - 1))];
+		}
+
+		found[k] = (slot >= 0);
+
+		if (slot < 0) {
+			if (heights) {
+				heights[k] = 0.0f;
+			}
+
+			if (normalX) {
+				normalX[k] = 0.0f;
+				normalY[k] = 1.0f;
+				normalZ[k] = 0.0f;
+				slopes[k] = 0.0f;
+			}
+
+			continue;
+		}
+
+		int vertex = (slot * m_vertexCount) + ((row % (m_cellHeight - 1)) * m_cellWidth) + (column % (m_cellWidth - 1));
+		int corners[4] = { vertex, vertex + 1, vertex + m_cellWidth, vertex + m_cellWidth + 1 };
+		float fractionX = x - static_cast<float>(column);
+		float fractionY = static_cast<float>(backZ - row) - z;
+
+		// Decode the corner heights like the vertex shader does.
+		float cornerHeights[4];
+		for (int i = 0; i < 4; i++) {
+			cornerHeights[i] = m_minHeights[slot] + (static_cast<float>(m_heights[corners[i]]) * m_heightSteps[slot]);
+		}
+
+		// Weigh the corners of the triangle the position is in, the other corner gets nothing.
+		float weights[4];
+		weights[3] = std::max((fractionX + fractionY) - 1.0f, 0.0f);
+		weights[1] = fractionX - weights[3];
+		weights[2] = fractionY - weights[3];
+		weights[0] = ((1.0f - fractionX) - fractionY) + weights[3];
+
+		if (heights) {
+			heights[k] = (((weights[0] * cornerHeights[0]) + (weights[1] * cornerHeights[1])) + (weights[2] * cornerHeights[2])) + (weights[3] * cornerHeights[3]);
+		}
+
+		if (normalX) {
+			// Blend the unit normals of the corners and bring the result back to unit length.
+			float sum[3] = { 0.0f, 0.0f, 0.0f };
+			for (int i = 0; i < 4; i++) {
+				float normal[3];
+				HeightField::UnpackNormal(m_normals[corners[i]], normal[0], normal[1], normal[2]);
+
+				for (int axis = 0; axis < 3; axis++) {
+					sum[axis] = (i == 0) ? (weights[i] * normal[axis]) : sum[axis] + (weights[i] * normal[axis]);
+				}
+			}
+
+			float length = sqrtf(((sum[0] * sum[0]) + (sum[1] * sum[1])) + (sum[2] * sum[2]));
+			normalX[k] = sum[0] / length;
+			normalY[k] = sum[1] / length;
+			normalZ[k] = sum[2] / length;
+
+			// The slope is the rise over the run of the triangle, rows running towards -Z doesn't change its size.
+			bool upper = (fractionX + fractionY) <= 1.0f;
+			float gradientX = upper ? cornerHeights[1] - cornerHeights[0] : cornerHeights[3] - cornerHeights[2];
+			float gradientY = upper ? cornerHeights[2] - cornerHeights[0] : cornerHeights[3] - cornerHeights[1];
+			slopes[k] = sqrtf((gradientX * gradientX) + (gradientY * gradientY));
+		}
+	}
+}
+
+int TerrainSurface::SampleSse2(const float* positionX, const float* positionZ, int count, float* heights, float* normalX, float* normalY, float* normalZ, float* slopes, bool* found) const {
+	int backZ = m_terrainHeight - 1;
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 limitX = _mm_set1_ps(static_cast<float>(m_terrainWidth - 1));
+	__m128 limitZ = _mm_set1_ps(static_cast<float>(backZ));
+	__m128i lastColumn = _mm_set1_epi32(m_terrainWidth - 2);
+	__m128i lastRow = _mm_set1_epi32(m_terrainHeight - 2);
+	__m128i backRow = _mm_set1_epi32(backZ);
+	__m128 cellSizeX = _mm_set1_ps(static_cast<float>(m_cellWidth - 1));
+	__m128 cellSizeY = _mm_set1_ps(static_cast<float>(m_cellHeight - 1));
+	__m128 inverseCellSizeX = _mm_set1_ps(1.0f / static_cast<float>(m_cellWidth - 1));
+	__m128 inverseCellSizeY = _mm_set1_ps(1.0f / static_cast<float>(m_cellHeight - 1));
+	int k = 0;
+
+	for (; k + 4 <= count; k += 4) {
+		__m128 x = _mm_loadu_ps(positionX + k);
+		__m128 z = _mm_loadu_ps(positionZ + k);
+
+		// Find the positions on the terrain, NaN fails every compare, and zero the rest so the index math stays in range.
+		__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(x, zero), _mm_cmple_ps(x, limitX)), _mm_and_ps(_mm_cmpge_ps(z, zero), _mm_cmple_ps(z, limitZ)));
+		x = _mm_and_ps(x, inside);
+		z = _mm_and_ps(z, inside);
+
+		// The positions aren't negative so truncating floors them, and SSE2 has no ceiling so the truncation is
+		// stepped up by one where it dropped a fraction.
+		__m128i columnFloor = _mm_cvttps_epi32(x);
+		__m128i rowCeiling = _mm_cvttps_epi32(z);
+		rowCeiling = _mm_sub_epi32(rowCeiling, _mm_castps_si128(_mm_cmplt_ps(_mm_cvtepi32_ps(rowCeiling), z)));
+		__m128i column = MinSse2(columnFloor, lastColumn);
+		__m128i row = MinSse2(_mm_sub_epi32(backRow, rowCeiling), lastRow);
+
+		// Split the column and row into the cell and the place in it.  The division is done on floats, which hold
+		// these whole numbers exactly, and the quotient corrected by one either way.
+		__m128 columnValue = _mm_cvtepi32_ps(column);
+		__m128 rowValue = _mm_cvtepi32_ps(row);
+		__m128 cellX = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(columnValue, inverseCellSizeX)));
+		__m128 cellY = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(rowValue, inverseCellSizeY)));
+		cellX = _mm_sub_ps(cellX, _mm_and_ps(_mm_cmpgt_ps(_mm_mul_ps(cellX, cellSizeX), columnValue), one));
+		cellY = _mm_sub_ps(cellY, _mm_and_ps(_mm_cmpgt_ps(_mm_mul_ps(cellY, cellSizeY), rowValue), one));
+		cellX = _mm_add_ps(cellX, _mm_and_ps(_mm_cmple_ps(_mm_add_ps(_mm_mul_ps(cellX, cellSizeX), cellSizeX), columnValue), one));
+		cellY = _mm_add_ps(cellY, _mm_and_ps(_mm_cmple_ps(_mm_add_ps(_mm_mul_ps(cellY, cellSizeY), cellSizeY), rowValue), one));
+
+		__m128i cellId = _mm_add_epi32(MultiplySse2(_mm_cvttps_epi32(cellY), _mm_set1_epi32(m_cellCountX)), _mm_cvttps_epi32(cellX));
+		__m128i slot = GatherSse2(m_cellSlots, cellId);
+		__m128i foundMask = _mm_and_si128(_mm_cmpgt_epi32(slot, _mm_set1_epi32(-1)), _mm_castps_si128(inside));
+		__m128 foundValues = _mm_castsi128_ps(foundMask);
+		slot = _mm_and_si128(slot, foundMask);
+
+		__m128 localX = _mm_sub_ps(columnValue, _mm_mul_ps(cellX, cellSizeX));
+		__m128 localY = _mm_sub_ps(rowValue, _mm_mul_ps(cellY, cellSizeY));
+		__m128i local = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(localY, _mm_set1_ps(static_cast<float>(m_cellWidth))), localX));
+		__m128i vertex = _mm_and_si128(_mm_add_epi32(MultiplySse2(slot, _mm_set1_epi32(m_vertexCount)), local), foundMask);
+		__m128i below = _mm_set1_epi32(m_cellWidth);
+		__m128i corners[4] = { vertex, _mm_add_epi32(vertex, _mm_set1_epi32(1)), _mm_add_epi32(vertex, below), _mm_add_epi32(vertex, _mm_add_epi32(below, _mm_set1_epi32(1))) };
+
+		__m128 fractionX = _mm_sub_ps(x, columnValue);
+		__m128 fractionY = _mm_sub_ps(_mm_cvtepi32_ps(_mm_sub_epi32(backRow, row)), z);
+
+		__m128 minHeight = _mm_castsi128_ps(GatherSse2(reinterpret_cast<const int*>(m_minHeights), slot));
+		__m128 heightStep = _mm_castsi128_ps(GatherSse2(reinterpret_cast<const int*>(m_heightSteps), slot));
+		__m128 cornerHeights[4];
+		for (int i = 0; i < 4; i++) {
+			cornerHeights[i] = GatherHeightsSse2(m_heights, corners[i], minHeight, heightStep);
+		}
+
+		__m128 weights[4];
+		weights[3] = _mm_max_ps(_mm_sub_ps(_mm_add_ps(fractionX, fractionY), one), zero);
+		weights[1] = _mm_sub_ps(fractionX, weights[3]);
+		weights[2] = _mm_sub_ps(fractionY, weights[3]);
+		weights[0] = _mm_add_ps(_mm_sub_ps(_mm_sub_ps(one, fractionX), fractionY), weights[3]);
+
+		if (heights) {
+			__m128 height = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(weights[0], cornerHeights[0]), _mm_mul_ps(weights[1], cornerHeights[1])), _mm_mul_ps(weights[2], cornerHeights[2])), _mm_mul_ps(weights[3], cornerHeights[3]));
+			_mm_storeu_ps(heights + k, _mm_and_ps(height, foundValues));
+		}
+
+		if (normalX) {
+			__m128 sum[3];
+			for (int i = 0; i < 4; i++) {
+				__m128 normal[3];
+				UnpackNormalsSse2(GatherSse2(reinterpret_cast<const int*>(m_normals), corners[i]), normal[0], normal[1], normal[2]);
+
+				for (int axis = 0; axis < 3; axis++) {
+					sum[axis] = (i == 0) ? _mm_mul_ps(weights[i], normal[axis]) : _mm_add_ps(sum[axis], _mm_mul_ps(weights[i], normal[axis]));
+				}
+			}
+
+			__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sum[0], sum[0]), _mm_mul_ps(sum[1], sum[1])), _mm_mul_ps(sum[2], sum[2])));
+			_mm_storeu_ps(normalX + k, _mm_and_ps(_mm_div_ps(sum[0], length), foundValues));
+			_mm_storeu_ps(normalY + k, SelectSse2(foundValues, _mm_div_ps(sum[1], length), one));
+			_mm_storeu_ps(normalZ + k, _mm_and_ps(_mm_div_ps(sum[2], length), foundValues));
+
+			__m128 upper = _mm_cmple_ps(_mm_add_ps(fractionX, fractionY), one);
+			__m128 gradientX = SelectSse2(upper, _mm_sub_ps(cornerHeights[1], cornerHeights[0]), _mm_sub_ps(cornerHeights[3], cornerHeights[2]));
+			__m128 gradientY = SelectSse2(upper, _mm_sub_ps(cornerHeights[2], cornerHeights[0]), _mm_sub_ps(cornerHeights[3], cornerHeights[1]));
+			__m128 slope = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(gradientX, gradientX), _mm_mul_ps(gradientY, gradientY)));
+			_mm_storeu_ps(slopes + k, _mm_and_ps(slope, foundValues));
+		}
+
+		int foundBits = _mm_movemask_ps(foundValues);
+		for (int i = 0; i < 4; i++) {
+			found[k + i] = ((foundBits >> i) & 1) != 0;
+		}
+	}
+
+	return k;
+}
+
+int TerrainSurface::SampleAvx2(const float* positionX, const float* positionZ, int count, float* heights, float* normalX, float* normalY, float* normalZ, float* slopes, bool* found) const {
+	int backZ = m_terrainHeight - 1;
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 limitX = _mm256_set1_ps(static_cast<float>(m_terrainWidth - 1));
+	__m256 limitZ = _mm256_set1_ps(static_cast<float>(backZ));
+	__m256i lastColumn = _mm256_set1_epi32(m_terrainWidth - 2);
+	__m256i lastRow = _mm256_set1_epi32(m_terrainHeight - 2);
+	__m256i backRow = _mm256_set1_epi32(backZ);
+	__m256 cellSizeX = _mm256_set1_ps(static_cast<float>(m_cellWidth - 1));
+	__m256 cellSizeY = _mm256_set1_ps(static_cast<float>(m_cellHeight - 1));
+	__m256 inverseCellSizeX = _mm256_set1_ps(1.0f / static_cast<float>(m_cellWidth - 1));
+	__m256 inverseCellSizeY = _mm256_set1_ps(1.0f / static_cast<float>(m_cellHeight - 1));
+	int k = 0;
+
+	for (; k + 8 <= count; k += 8) {
+		__m256 x = _mm256_loadu_ps(positionX + k);
+		__m256 z = _mm256_loadu_ps(positionZ + k);
+
+		__m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_GE_OQ), _mm256_cmp_ps(x, limitX, _CMP_LE_OQ)), _mm256_and_ps(_mm256_cmp_ps(z, zero, _CMP_GE_OQ), _mm256_cmp_ps(z, limitZ, _CMP_LE_OQ)));
+		x = _mm256_and_ps(x, inside);
+		z = _mm256_and_ps(z, inside);
+
+		__m256i column = _mm256_min_epi32(_mm256_cvttps_epi32(x), lastColumn);
+		__m256i row = _mm256_min_epi32(_mm256_sub_epi32(backRow, _mm256_cvttps_epi32(_mm256_ceil_ps(z))), lastRow);
+
+		__m256 columnValue = _mm256_cvtepi32_ps(column);
+		__m256 rowValue = _mm256_cvtepi32_ps(row);
+		__m256 cellX = _mm256_floor_ps(_mm256_mul_ps(columnValue, inverseCellSizeX));
+		__m256 cellY = _mm256_floor_ps(_mm256_mul_ps(rowValue, inverseCellSizeY));
+		cellX = _mm256_sub_ps(cellX, _mm256_and_ps(_mm256_cmp_ps(_mm256_mul_ps(cellX, cellSizeX), columnValue, _CMP_GT_OQ), one));
+		cellY = _mm256_sub_ps(cellY, _mm256_and_ps(_mm256_cmp_ps(_mm256_mul_ps(cellY, cellSizeY), rowValue, _CMP_GT_OQ), one));
+		cellX = _mm256_add_ps(cellX, _mm256_and_ps(_mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(cellX, cellSizeX), cellSizeX), columnValue, _CMP_LE_OQ), one));
+		cellY = _mm256_add_ps(cellY, _mm256_and_ps(_mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(cellY, cellSizeY), cellSizeY), rowValue, _CMP_LE_OQ), one));
+
+		__m256i cellId = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(cellY), _mm256_set1_epi32(m_cellCountX)), _mm256_cvttps_epi32(cellX));
+		__m256i slot = _mm256_mask_i32gather_epi32(_mm256_set1_epi32(-1), m_cellSlots, cellId, _mm256_castps_si256(inside), 4);
+		__m256i foundMask = _mm256_cmpgt_epi32(slot, _mm256_set1_epi32(-1));
+		__m256 foundValues = _mm256_castsi256_ps(foundMask);
+		slot = _mm256_and_si256(slot, foundMask);
+
+		__m256 localX = _mm256_sub_ps(columnValue, _mm256_mul_ps(cellX, cellSizeX));
+		__m256 localY = _mm256_sub_ps(rowValue, _mm256_mul_ps(cellY, cellSizeY));
+		__m256i local = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(localY, _mm256_set1_ps(static_cast<float>(m_cellWidth))), localX));
+		__m256i vertex = _mm256_and_si256(_mm256_add_epi32(_mm256_mullo_epi32(slot, _mm256_set1_epi32(m_vertexCount)), local), foundMask);
+		__m256i below = _mm256_set1_epi32(m_cellWidth);
+		__m256i corners[4] = { vertex, _mm256_add_epi32(vertex, _mm256_set1_epi32(1)), _mm256_add_epi32(vertex, below), _mm256_add_epi32(vertex, _mm256_add_epi32(below, _mm256_set1_epi32(1))) };
+
+		__m256 fractionX = _mm256_sub_ps(x, columnValue);
+		__m256 fractionY = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(backRow, row)), z);
+
+		__m256 minHeight = _mm256_i32gather_ps(m_minHeights, slot, 4);
+		__m256 heightStep = _mm256_i32gather_ps(m_heightSteps, slot, 4);
+		__m256 cornerHeights[4];
+		for (int i = 0; i < 4; i++) {
+			cornerHeights[i] = GatherHeightsAvx2(m_heights, corners[i], minHeight, heightStep);
+		}
+
+		__m256 weights[4];
+		weights[3] = _mm256_max_ps(_mm256_sub_ps(_mm256_add_ps(fractionX, fractionY), one), zero);
+		weights[1] = _mm256_sub_ps(fractionX, weights[3]);
+		weights[2] = _mm256_sub_ps(fractionY, weights[3]);
+		weights[0] = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(one, fractionX), fractionY), weights[3]);
+
+		if (heights) {
+			__m256 height = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(weights[0], cornerHeights[0]), _mm256_mul_ps(weights[1], cornerHeights[1])), _mm256_mul_ps(weights[2], cornerHeights[2])), _mm256_mul_ps(weights[3], cornerHeights[3]));
+			_mm256_storeu_ps(heights + k, _mm256_and_ps(height, foundValues));
+		}
+
+		if (normalX) {
+			__m256 sum[3];
+			for (int i = 0; i < 4; i++) {
+				__m256 normal[3];
+				UnpackNormalsAvx2(_mm256_i32gather_epi32(reinterpret_cast<const int*>(m_normals), corners[i], 4), normal[0], normal[1], normal[2]);
+
+				for (int axis = 0; axis < 3; axis++) {
+					sum[axis] = (i == 0) ? _mm256_mul_ps(weights[i], normal[axis]) : _mm256_add_ps(sum[axis], _mm256_mul_ps(weights[i], normal[axis]));
+				}
+			}
+
+			__m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sum[0], sum[0]), _mm256_mul_ps(sum[1], sum[1])), _mm256_mul_ps(sum[2], sum[2])));
+			_mm256_storeu_ps(normalX + k, _mm256_and_ps(_mm256_div_ps(sum[0], length), foundValues));
+			_mm256_storeu_ps(normalY + k, _mm256_blendv_ps(one, _mm256_div_ps(sum[1], length), foundValues));
+			_mm256_storeu_ps(normalZ + k, _mm256_and_ps(_mm256_div_ps(sum[2], length), foundValues));
+
+			__m256 upper = _mm256_cmp_ps(_mm256_add_ps(fractionX, fractionY), one, _CMP_LE_OQ);
+			__m256 gradientX = _mm256_blendv_ps(_mm256_sub_ps(cornerHeights[3], cornerHeights[2]), _mm256_sub_ps(cornerHeights[1], cornerHeights[0]), upper);
+			__m256 gradientY = _mm256_blendv_ps(_mm256_sub_ps(cornerHeights[3], cornerHeights[1]), _mm256_sub_ps(cornerHeights[2], cornerHeights[0]), upper);
+			__m256 slope = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(gradientX, gradientX), _mm256_mul_ps(gradientY, gradientY)));
+			_mm256_storeu_ps(slopes + k, _mm256_and_ps(slope, foundValues));
+		}
+
+		int foundBits = _mm256_movemask_ps(foundValues);
+		for (int i = 0; i < 8; i++) {
+			found[k + i] = ((foundBits >> i) & 1) != 0;
+		}
+	}
+
+	return k;
+}
+
+void TerrainSurface::Shutdown() {
+	// Release the per vertex and per slot arrays.
+	if (m_heights) {
+		delete[] m_heights;
+		m_heights = nullptr;
+	}
+
+	if (m_normals) {
+		delete[] m_normals;
+		m_normals = nullptr;
+	}
+
+	if (m_minHeights) {
+		delete[] m_minHeights;
+		m_minHeights = nullptr;
+	}
+
+	if (m_heightSteps) {
+		delete[] m_heightSteps;
+		m_heightSteps = nullptr;
+	}
+
+	if (m_decodes) {
+		delete[] m_decodes;
+		m_decodes = nullptr;
+	}
+
+	m_cellSlots = nullptr;
+	m_slotCount = 0;
+	m_vertexCount = 0;
+}
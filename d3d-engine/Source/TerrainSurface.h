@@ -0,0 +1,51 @@
+#pragma once
+
+#include "TerrainMesh.h"
+
+// Compact CPU copy of the surface of the resident cells for the batched queries.  Every cell slot keeps the quantized
+// heights and packed normals of its vertices, exactly as they went into its vertex buffer, in one shared array along
+// with the values that decode them.  A whole batch of positions can then gather its corners out of the same arrays
+// with nothing but index math, AVX2 gathers four or eight positions at a time and SSE2 loads them one by one.
+//
+// The single vertex accessors decode exactly like the vertex shader, so the scalar height and ray queries get the same
+// positions the cells are drawn with.
+//
+// The queries only read, so any number of threads can run them at once as long as no cell is being built or edited.
+class TerrainSurface {
+public:
+	TerrainSurface();
+	~TerrainSurface();
+
+	bool Initialize(int terrainWidth, int terrainHeight, int cellWidth, int cellHeight, int cellCountX, int slotCount, const int* cellSlots);
+	void SetCell(int slot, const TerrainMesh::VertexType* vertices, const TerrainMesh::DecodeType& decode);
+	void GetHeights(const float* positionX, const float* positionZ, int count, float* heights, bool* found) const;
+	void GetNormals(const float* positionX, const float* positionZ, int count, float* normalX, float* normalY, float* normalZ, float* slopes, bool* found) const;
+	float GetHeight(int slot, int vertex) const;
+	void GetHeightRange(int slot, int startColumn, int startRow, int endColumn, int endRow, float& minHeight, float& maxHeight) const;
+	void GetVertex(int slot, int vertex, float position[3]) const;
+
+	// Bytes each vertex of a resident cell takes in the surface.
+	static const int VERTEX_SIZE = sizeof(unsigned short) + sizeof(unsigned int);
+
+private:
+	TerrainSurface(const TerrainSurface&);
+
+	void Shutdown();
+	void SampleScalar(const float* positionX, const float* positionZ, int start, int end, float* heights, float* normalX, float* normalY, float* normalZ, float* slopes, bool* found) const;
+	int SampleSse2(const float* positionX, const float* positionZ, int count, float* heights, float* normalX, float* normalY, float* normalZ, float* slopes, bool* found) const;
+	int SampleAvx2(const float* positionX, const float* positionZ, int count, float* heights, float* normalX, float* normalY, float* normalZ, float* slopes, bool* found) const;
+
+	int m_terrainWidth;
+	int m_terrainHeight;
+	int m_cellWidth;
+	int m_cellHeight;
+	int m_cellCountX;
+	int m_slotCount;
+	int m_vertexCount;
+	const int* m_cellSlots;
+	unsigned short* m_heights;
+	unsigned int* m_normals;
+	float* m_minHeights;
+	float* m_heightSteps;
+	TerrainMesh::DecodeType* m_decodes;
+};
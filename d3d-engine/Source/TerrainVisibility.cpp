@@ -0,0 +1,215 @@
+#include "pch.h"
+#include "TerrainVisibility.h"
+
+TerrainVisibility::TerrainVisibility() :
+	m_File(nullptr),
+	m_header(),
+	m_offsets(nullptr),
+	m_data(nullptr) {}
+
+TerrainVisibility::TerrainVisibility(const TerrainVisibility&) :
+	m_File(nullptr),
+	m_header(),
+	m_offsets(nullptr),
+	m_data(nullptr) {}
+
+TerrainVisibility::~TerrainVisibility() {
+	Close();
+}
+
+bool TerrainVisibility::Open(const char* filename, const HeaderType& expected) {
+	Close();
+
+	// Map the visibility file.
+	m_File = new MappedFile;
+	if (!m_File->Open(filename) || (m_File->GetSize() < sizeof(HeaderType))) {
+		Close();
+		return false;
+	}
+
+	memcpy(&m_header, m_File->GetData(), sizeof(HeaderType));
+
+	// The sets are only any use if they were baked by this version from the same sources, cells and settings.
+	if ((m_header.magic != expected.magic) || (m_header.version != expected.version) || (m_header.contentHash != expected.contentHash) ||
+		(m_header.cellCountX != expected.cellCountX) || (m_header.cellCountY != expected.cellCountY) ||
+		(m_header.viewHeight != expected.viewHeight) || (m_header.splitDepth != expected.splitDepth)) {
+		Close();
+		return false;
+	}
+
+	// Make sure the offsets and all of the runs made it into the file.
+	unsigned long long cellCount = static_cast<unsigned long long>(m_header.cellCountX) * m_header.cellCountY;
+	unsigned long long offsetBytes = (cellCount + 1) * sizeof(unsigned int);
+	if (m_File->GetSize() < sizeof(HeaderType) + offsetBytes + m_header.dataSize) {
+		Close();
+		return false;
+	}
+
+	// The offsets follow the header and the runs follow the offsets.
+	m_offsets = reinterpret_cast<const unsigned int*>(m_File->GetData() + sizeof(HeaderType));
+	m_data = m_File->GetData() + sizeof(HeaderType) + offsetBytes;
+
+	// The sets have to follow each other in order and stay inside the runs, so a damaged table can't send
+	// GetVisibleSet outside the mapping.
+	for (unsigned long long cellId = 0; cellId < cellCount; cellId++) {
+		if ((m_offsets[cellId] > m_offsets[cellId + 1]) || (m_offsets[cellId + 1] > m_header.dataSize)) {
+			Close();
+			return false;
+		}
+	}
+
+	if (m_offsets[cellCount] != m_header.dataSize) {
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void TerrainVisibility::Close() {
+	// Release the mapping.
+	if (m_File) {
+		delete m_File;
+		m_File = nullptr;
+	}
+
+	m_offsets = nullptr;
+	m_data = nullptr;
+}
+
+const TerrainVisibility::HeaderType* TerrainVisibility::GetHeader() const {
+	return &m_header;
+}
+
+void TerrainVisibility::GetVisibleSet(int cellId, unsigned int* bits) const {
+	int cellCount = m_header.cellCountX * m_header.cellCountY;
+	memset(bits, 0, GetWordCount(cellCount) * sizeof(unsigned int));
+
+	// Walk the runs of the cell, which start with the hidden cells, and set the bits of the visible ones.
+	const unsigned char* data = m_data + m_offsets[cellId];
+	const unsigned char* end = m_data + m_offsets[cellId + 1];
+	int cell = 0;
+	bool visible = false;
+
+	while (data < end) {
+		unsigned int run = 0;
+		int shift = 0;
+		unsigned char byte;
+
+		do {
+			byte = *data++;
+			run |= static_cast<unsigned int>(byte & 0x7F) << shift;
+			shift += 7;
+		} while ((byte & 0x80) && (data < end));
+
+		int runEnd = std::min(cell + static_cast<int>(run), cellCount);
+		if (visible) {
+			for (int k = cell; k < runEnd; k++) {
+				bits[k >> 5] |= 1u << (k & 31);
+			}
+		}
+
+		cell = runEnd;
+		visible = !visible;
+	}
+}
+
+bool TerrainVisibility::Save(const char* filename, const HeaderType& header, const unsigned char* const* sets, const unsigned int* setSizes) {
+	FILE* output;
+
+	int error = fopen_s(&output, filename, "wb");
+	if (error != 0) {
+		return false;
+	}
+
+	// Hold the place of the header with one that won't validate until all of the sets are written.
+	int cellCount = header.cellCountX * header.cellCountY;
+	HeaderType placeholder = {};
+	bool result = (fwrite(&placeholder, sizeof(HeaderType), 1, output) == 1);
+
+	// Write where each set starts followed by the end of the last one.
+	unsigned int offset = 0;
+
+	for (int i = 0; (i <= cellCount) && result; i++) {
+		result = (fwrite(&offset, sizeof(unsigned int), 1, output) == 1);
+
+		if (i < cellCount) {
+			offset += setSizes[i];
+		}
+	}
+
+	for (int i = 0; (i < cellCount) && result; i++) {
+		result = (fwrite(sets[i], 1, setSizes[i], output) == setSizes[i]);
+	}
+
+	// Go back and write the real header now that the rest of the file is complete.
+	HeaderType finished = header;
+	finished.dataSize = offset;
+
+	result = result && (fseek(output, 0, SEEK_SET) == 0) && (fwrite(&finished, sizeof(HeaderType), 1, output) == 1);
+
+	if (fclose(output) != 0) {
+		result = false;
+	}
+
+	return result;
+}
+
+unsigned int TerrainVisibility::EncodeSet(const unsigned int* bits, int cellCount, unsigned char* output) {
+	unsigned int size = 0;
+	int cell = 0;
+	bool visible = false;
+
+	// Alternate between runs of hidden and visible cells, the first run is hidden and can be empty.
+	while (cell < cellCount) {
+		int start = cell;
+		while ((cell < cellCount) && (IsVisible(bits, cell) == visible)) {
+			cell++;
+		}
+
+		// Pack the length of the run seven bits at a time, the top bit marks that more follow.
+		unsigned int run = static_cast<unsigned int>(cell - start);
+
+		do {
+			unsigned char byte = static_cast<unsigned char>(run & 0x7F);
+			run >>= 7;
+
+			if (run != 0) {
+				byte |= 0x80;
+			}
+
+			output[size++] = byte;
+		} while (run != 0);
+
+		visible = !visible;
+	}
+
+	return size;
+}
+
+TerrainVisibility::HeaderType TerrainVisibility::MakeHeader(unsigned long long contentHash, int cellCountX, int cellCountY, float viewHeight, int splitDepth) {
+	HeaderType header = {};
+
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.contentHash = contentHash;
+	header.cellCountX = cellCountX;
+	header.cellCountY = cellCountY;
+	header.viewHeight = viewHeight;
+	header.splitDepth = splitDepth;
+
+	return header;
+}
+
+int TerrainVisibility::GetWordCount(int cellCount) {
+	return (cellCount + 31) / 32;
+}
+
+int TerrainVisibility::GetMaxEncodedSize(int cellCount) {
+	// Every cell can start a run, plus the empty first run, and a 32 bit length takes at most five bytes.
+	return (cellCount + 1) * 5;
+}
+
+bool TerrainVisibility::IsVisible(const unsigned int* bits, int cellId) {
+	return ((bits[cellId >> 5] >> (cellId & 31)) & 1) != 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "MappedFile.h"
+
+// Baked potentially visible sets between the cells of a static terrain.  The set of a cell holds every cell that can
+// be seen from an eye over it no higher than the view height above the top of its box, one bit per cell, and a cell
+// is only left out when the bake has proven that the ground hides it from every such eye.  Each set is stored as
+// alternating runs of hidden and visible cells, with the length of every run packed seven bits to a byte, and an
+// offset table in front of the runs finds the set of any cell in the mapped file.  The header carries the same hash of
+// the source files and setup values as the terrain cache, along with the bake settings.
+class TerrainVisibility {
+public:
+	struct HeaderType {
+		unsigned int magic;
+		unsigned int version;
+		unsigned long long contentHash;
+		int cellCountX;
+		int cellCountY;
+		float viewHeight;
+		int splitDepth;
+		unsigned int dataSize;
+	};
+
+	TerrainVisibility();
+	~TerrainVisibility();
+
+	bool Open(const char* filename, const HeaderType& expected);
+	void Close();
+
+	const HeaderType* GetHeader() const;
+	void GetVisibleSet(int cellId, unsigned int* bits) const;
+
+	static bool Save(const char* filename, const HeaderType& header, const unsigned char* const* sets, const unsigned int* setSizes);
+	static unsigned int EncodeSet(const unsigned int* bits, int cellCount, unsigned char* output);
+	static HeaderType MakeHeader(unsigned long long contentHash, int cellCountX, int cellCountY, float viewHeight, int splitDepth);
+	static int GetWordCount(int cellCount);
+	static int GetMaxEncodedSize(int cellCount);
+	static bool IsVisible(const unsigned int* bits, int cellId);
+
+private:
+	TerrainVisibility(const TerrainVisibility&);
+
+	static const unsigned int MAGIC = 0x53565054;
+	static const unsigned int VERSION = 2;
+
+	MappedFile* m_File;
+	HeaderType m_header;
+	const unsigned int* m_offsets;
+	const unsigned char* m_data;
+};
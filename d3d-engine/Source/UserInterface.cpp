@@ -139,7 +139,7 @@ bool UserInterface::Initialize(DXDeviceResources* Direct3D, int screenHeight, in
 	}
 
 	// Create the text objects for the render count strings.
-	m_RenderCountStrings = new Text[3];
+	m_RenderCountStrings = new Text[5];
 	if (!m_RenderCountStrings) {
 		return false;
 	}
@@ -157,6 +157,14 @@ bool UserInterface::Initialize(DXDeviceResources* Direct3D, int screenHeight, in
 		return false;
 	}
 
+	if (!m_RenderCountStrings[3].Initialize(Direct3D->GetDevice(), Direct3D->GetDeviceContext(), screenWidth, screenHeight, 32, false, m_Font1, "Cells Occluded: 0", 10, 320, 1.0f, 1.0f, 1.0f)) {
+		return false;
+	}
+
+	if (!m_RenderCountStrings[4].Initialize(Direct3D->GetDevice(), Direct3D->GetDeviceContext(), screenWidth, screenHeight, 32, false, m_Font1, "Occlusion us: 0", 10, 340, 1.0f, 1.0f, 1.0f)) {
+		return false;
+	}
+
 	// Create the mini-map object.
 	m_MiniMap = new Minimap;
 	if (!m_MiniMap) {
@@ -206,7 +214,7 @@ bool UserInterface::Render(DXDeviceResources* Direct3D, ShaderManager* ShaderMan
 	}
 
 	// Render the render count strings.
-	for (int i = 0; i < 3; i++) {
+	for (int i = 0; i < 5; i++) {
 		m_RenderCountStrings[i].Render(Direct3D->GetDeviceContext(), ShaderManager, worldMatrix, viewMatrix, orthoMatrix, m_Font1->GetTexture());
 	}
 
@@ -349,7 +357,7 @@ bool UserInterface::UpdatePositionStrings(ID3D11DeviceContext* deviceContext, fl
 	return true;
 }
 
-bool UserInterface::UpdateRenderCounts(ID3D11DeviceContext* deviceContext, int renderCount, int nodesDrawn, int nodesCulled) const {
+bool UserInterface::UpdateRenderCounts(ID3D11DeviceContext* deviceContext, int renderCount, int nodesDrawn, int nodesCulled, int nodesOccluded, float occlusionTime) const {
 	char tempString[32];
 	char finalString[32];
 
@@ -385,5 +393,29 @@ bool UserInterface::UpdateRenderCounts(ID3D11DeviceContext* deviceContext, int r
 	strcat_s(finalString, tempString);
 
 	// Update the sentence vertex buffer with the new string information.
-	return m_RenderCountStrings[2].UpdateSentence(deviceContext, m_Font1, finalString, 10, 300, 1.0f, 1.0f, 1.0f);
+	if (!m_RenderCountStrings[2].UpdateSentence(deviceContext, m_Font1, finalString, 10, 300, 1.0f, 1.0f, 1.0f)) {
+		return false;
+	}
+
+	// Convert the cells occluded integer to string format.
+	_itoa_s(nodesOccluded, tempString, 10);
+
+	// Setup the cells occluded string.
+	strcpy_s(finalString, "Cells Occluded: ");
+	strcat_s(finalString, tempString);
+
+	// Update the sentence vertex buffer with the new string information.
+	if (!m_RenderCountStrings[3].UpdateSentence(deviceContext, m_Font1, finalString, 10, 320, 1.0f, 1.0f, 1.0f)) {
+		return false;
+	}
+
+	// Convert the occlusion time to whole microseconds.
+	_itoa_s(static_cast<int>(occlusionTime * 1000.0f), tempString, 10);
+
+	// Setup the occlusion time string.
+	strcpy_s(finalString, "Occlusion us: ");
+	strcat_s(finalString, tempString);
+
+	// Update the sentence vertex buffer with the new string information.
+	return m_RenderCountStrings[4].UpdateSentence(deviceContext, m_Font1, finalString, 10, 340, 1.0f, 1.0f, 1.0f);
 }
@@ -13,7 +13,7 @@ public:
 	bool Initialize(DXDeviceResources*, int, int);
 	bool Frame(ID3D11DeviceContext*, int, float, float, float, float, float, float);
 	bool Render(DXDeviceResources*, ShaderManager*, Matrix, Matrix, Matrix) const;
-	bool UpdateRenderCounts(ID3D11DeviceContext*, int, int, int) const;
+	bool UpdateRenderCounts(ID3D11DeviceContext*, int, int, int, int, float) const;
 
 private:
 	UserInterface(const UserInterface&);
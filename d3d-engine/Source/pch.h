@@ -16,6 +16,7 @@
 #endif
 
 #include <windows.h>
+#include <intrin.h>
 #include <wrl.h>
 
 #include <d3d11_2.h>
@@ -26,16 +27,19 @@
 #include <dinput.h>
 
 #include <algorithm>
+#include <atomic>
 #include <exception>
 #include <memory>
 #include <stdexcept>
 #include <cstdint>
+#include <cfloat>
 #include <cstdio>
 #include <cstdarg>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
 #include <fstream>
+#include <ppl.h>
 #include <ppltasks.h>
 #include <timeapi.h>
 